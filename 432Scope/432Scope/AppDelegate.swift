@@ -8,14 +8,9 @@
 
 import Cocoa
 
-enum Error:ErrorType {
-    case AppFatal(String)
-    case ChannelFatal(String)
-}
-
 @NSApplicationMain
 class AppDelegate: NSObject, NSApplicationDelegate {
-
+    
     // use this object to pass channels along to the UI as they come online
     var mvc:MainViewController? = nil
     
@@ -24,19 +19,34 @@ class AppDelegate: NSObject, NSApplicationDelegate {
     
     // keep successfully init-ed channels here so we can shut them down on a terminate notification.
     var channels:[Channel] = []
-
+    
+    // other processes can listen in on the channels through this.  see StreamServer.swift.
+    var streamServer:StreamServer? = nil
+    
+    // virtual channels computed from the ones above.  see MathChannel.swift.
+    var mathChannels:[MathChannel] = []
+    
+    // trigger-aligned averages of the ones above.  see AveragedChannel.swift.
+    var averagedChannels:[AveragedChannel] = []
+    
     func applicationDidFinishLaunching(aNotification: NSNotification) {
         // Insert code here to initialize your application
         print("----applicationDidFinishLaunching" )
         
         // print constants for diag:
         print("--CONSTANTS:::")
-        print("\tdisplay frame rate: \(CONFIG_DISPLAY_REFRESH_RATE)")
+        print("\tmax display frame rate: \(CONFIG_DISPLAY_REFRESH_RATE)")
         print("\tincoming sample rate: \(CONFIG_SAMPLERATE) Hz")
         print("\tincoming data rate: \(CONFIG_INCOMING_BYTES_PER_SECOND) Bps")
-        print("\tbytes per display frame: \(CONFIG_INCOMING_BYTES_PER_DISPLAY_FRAME)")
+        print("\tdecoder packet rate: \(CONFIG_DECODER_PACKET_RATE)")
+        print("\tbytes per packet: \(CONFIG_INCOMING_BYTES_PER_PACKET)")
         print("\tdecoder packet size: \(CONFIG_DECODER_PACKET_SIZE)")
         print("\tposix read length: \(CONFIG_POSIX_READ_LENGTH)")
+        print("\tinstrumentation: \(Instrumentation.isEnabled ? "on" : "compiled out")")
+        
+        if let interval = CONFIG_INSTRUMENTATION_DUMP_INTERVAL {
+            Instrumentation.startPeriodicDump(interval, fileURL: CONFIG_INSTRUMENTATION_DUMP_FILE.map({ NSURL(fileURLWithPath: $0) }))
+        }
         
         // idiot check, make sure a main view controller exists.
         guard mvc != nil else {
@@ -44,17 +54,17 @@ class AppDelegate: NSObject, NSApplicationDelegate {
             omgKillTheApp()
             return
         }
-
+        
         // the channel creation try-catch of doom
         do {
             let devices = try scanner.initialDeviceScan()
             print("--DEVICES:::\n\(devices)")
-        
+            
             // open channels and pass them to the main view controller
             for i in 0..<devices.count {
                 // open a channel for each device.
                 do {
-                    let newChannel = try Channel(device: devices[i], sampleRateInHertz: CONFIG_SAMPLERATE, bufferLengthInSeconds: CONFIG_BUFFER_LENGTH)
+                    let newChannel = try Channel(device: devices[i], sampleRateInHertz: CONFIG_SAMPLERATE, bufferLengthInSeconds: CONFIG_ACTIVE_BUFFER_LENGTH)
                     try mvc?.loadChannel(newChannel)
                     channels.append(newChannel)
                 }
@@ -62,7 +72,21 @@ class AppDelegate: NSObject, NSApplicationDelegate {
                     print("!!! ChannelFatal: \(msg)")
                 }
             }
-
+            
+            // and share them, if there's somewhere to.  the scope works fine without this, so failing here isn't fatal.
+            if let path = CONFIG_STREAM_SERVER_SOCKET_PATH where CONFIG_STREAM_SERVER_ENABLED {
+                do {
+                    let server = try StreamServer(socketPath: path)
+                    for i in 0..<channels.count {
+                        channels[i].startPublishing(server, channelNumber: i)
+                    }
+                    streamServer = server
+                }
+                catch Error.ChannelFatal(let msg) {
+                    print("!!! ChannelFatal: \(msg)")
+                }
+            }
+            
         } catch Error.AppFatal( let msg ) {
             print( "!!! AppFatal: \(msg)")
             omgKillTheApp()
@@ -71,17 +95,274 @@ class AppDelegate: NSObject, NSApplicationDelegate {
         }
     }
     
+    //
+    // RECORDING - File menu actions.  every channel records to its own pair of files in the chosen folder.
+    //
+    
+    @IBAction func startRecording(sender: AnyObject) {
+        let panel = NSOpenPanel()
+        panel.title = "Choose a folder for the recordings"
+        panel.canChooseDirectories = true
+        panel.canChooseFiles = false
+        panel.canCreateDirectories = true
+        panel.prompt = "Record"
+        guard panel.runModal() == NSFileHandlingPanelOKButton else {
+            return
+        }
+        guard let directory = panel.URL else {
+            return
+        }
+        
+        let formatter = NSDateFormatter()
+        formatter.dateFormat = "yyyyMMdd-HHmmss"
+        let stamp = formatter.stringFromDate(NSDate())
+        for i in 0..<channels.count {
+            do {
+                try channels[i].startRecording(directory, baseName: "432scope-\(stamp)-ch\(i)", channelNumber: i)
+            } catch Error.ChannelFatal(let msg) {
+                print("!!! ChannelFatal: \(msg)")
+            } catch {
+                print("startRecording: something weird got thrown.")
+            }
+        }
+    }
+    
+    @IBAction func stopRecording(sender: AnyObject) {
+        for channel in channels {
+            channel.stopRecording()
+        }
+    }
+    
+    //
+    // EXPORT - File menu.  every channel into one file, side by side.  see Exporter.swift.
+    //
+    
+    private var exportPanel:ExportPanelController? = nil
+    
+    @IBAction func exportSamples(sender: AnyObject) {
+        let panel = NSSavePanel()
+        panel.title = "Export samples"
+        panel.prompt = "Export"
+        let formatter = NSDateFormatter()
+        formatter.dateFormat = "yyyyMMdd-HHmmss"
+        panel.nameFieldStringValue = "432scope-" + formatter.stringFromDate(NSDate())
+        
+        // which stretch, and what kind of file.  "visible" is the view's ages, so in trigger mode it's the newest
+        // stretch that wide, not the sweep on screen.
+        let selection = ScopeViewMath.getSelectionAgeRange()
+        let accessory = NSView(frame: NSRect(x: 0, y: 0, width: 360, height: 36))
+        let rangePopup = NSPopUpButton(frame: NSRect(x: 8, y: 6, width: 170, height: 24), pullsDown: false)
+        rangePopup.autoenablesItems = false
+        rangePopup.addItemsWithTitles(["Whole buffer", "Visible range", "Selection"])
+        if ( selection != nil ) {
+            rangePopup.selectItemAtIndex(2)
+        } else {
+            rangePopup.itemAtIndex(2)?.enabled = false
+        }
+        let formatPopup = NSPopUpButton(frame: NSRect(x: 182, y: 6, width: 170, height: 24), pullsDown: false)
+        formatPopup.addItemsWithTitles(["CSV", "WAV, 16-bit", "Raw binary, Int16"])
+        accessory.addSubview(rangePopup)
+        accessory.addSubview(formatPopup)
+        panel.accessoryView = accessory
+        guard panel.runModal() == NSFileHandlingPanelOKButton else {
+            return
+        }
+        guard let chosen = panel.URL else {
+            return
+        }
+        
+        let formats:[ExportFormat] = [.CSV, .WAV, .Binary]
+        let format = formats[max(0, formatPopup.indexOfSelectedItem)]
+        var ageRange:TimeRange? = nil
+        switch (rangePopup.indexOfSelectedItem) {
+        case 1:
+            ageRange = ScopeViewMath.tvRange
+        case 2:
+            ageRange = selection
+        default:
+            break
+        }
+        let fileURL = (chosen.pathExtension == format.fileExtension) ? chosen : chosen.URLByAppendingPathExtension(format.fileExtension)
+        let exporter = Exporter(buffers: channels.map({ $0.sampleBuffer }), names: channels.map({ $0.name }), ageRange: ageRange, format: format, fileURL: fileURL)
+        exportPanel = ExportPanelController(exporter: exporter)
+        exportPanel!.start(sender)
+    }
+    
+    //
+    // MATH CHANNELS - View menu.  the channels are A, B, C ... in the order they opened.
+    //
+    
+    @IBAction func addMathChannel(sender: AnyObject) {
+        let alert = NSAlert()
+        alert.messageText = "New math channel"
+        alert.informativeText = "Channels are A, B, C ... in order.  Use + - * and numbers, and abs(), int() and diff().  For example A-B, 2*A+0.5, abs(diff(A))."
+        let field = NSTextField(frame: NSRect(x: 0, y: 0, width: 280, height: 24))
+        field.stringValue = (channels.count > 1) ? "A-B" : "A"
+        alert.accessoryView = field
+        alert.addButtonWithTitle("Add")
+        alert.addButtonWithTitle("Cancel")
+        guard alert.runModal() == NSAlertFirstButtonReturn else {
+            return
+        }
+        
+        do {
+            let text = field.stringValue
+            let newChannel = MathChannel(expression: try MathExpression.parse(text, inputs: channels), text: text)
+            try mvc?.loadChannel(newChannel)
+            mathChannels.append(newChannel)
+        } catch Error.ChannelFatal(let msg) {
+            let failure = NSAlert()
+            failure.messageText = "Couldn't make that math channel."
+            failure.informativeText = msg
+            failure.runModal()
+        } catch {
+            print("addMathChannel: something weird got thrown.")
+        }
+    }
+    
+    //
+    // AVERAGED CHANNELS - View menu.  the input has to be triggering for there to be anything to average.
+    //
+    
+    @IBAction func addAveragedChannel(sender: AnyObject) {
+        let alert = NSAlert()
+        alert.messageText = "New averaged channel"
+        alert.informativeText = "Averages the window around every trigger event on the channel.  Sweeps is the mean of the last N; exponential weighs each new one 1/N."
+        let accessory = NSView(frame: NSRect(x: 0, y: 0, width: 280, height: 84))
+        let channelPopup = NSPopUpButton(frame: NSRect(x: 0, y: 56, width: 280, height: 26), pullsDown: false)
+        channelPopup.addItemsWithTitles(channels.map({ $0.name }))
+        let modePopup = NSPopUpButton(frame: NSRect(x: 0, y: 28, width: 280, height: 26), pullsDown: false)
+        modePopup.addItemsWithTitles(["Sweeps", "Exponential"])
+        let countField = NSTextField(frame: NSRect(x: 0, y: 0, width: 280, height: 24))
+        countField.stringValue = "\(CONFIG_AVERAGING_DEFAULT_COUNT)"
+        accessory.addSubview(channelPopup)
+        accessory.addSubview(modePopup)
+        accessory.addSubview(countField)
+        alert.accessoryView = accessory
+        alert.addButtonWithTitle("Add")
+        alert.addButtonWithTitle("Cancel")
+        guard alert.runModal() == NSAlertFirstButtonReturn else {
+            return
+        }
+        
+        let input = channels[max(0, channelPopup.indexOfSelectedItem)]
+        let count = max(1, countField.integerValue)
+        let mode:AveragingMode = (modePopup.indexOfSelectedItem == 1) ? .Exponential(count) : .Sweeps(count)
+        guard let averager = input.startAveraging(mode) else {
+            return
+        }
+        if ( !input.hasTrigger ) {
+            print("addAveragedChannel: \(input.name) has no trigger, so there won't be anything to average until it gets one.")
+        }
+        
+        let newChannel = AveragedChannel(input: input, averager: averager)
+        do {
+            try mvc?.loadChannel(newChannel)
+            averagedChannels.append(newChannel)
+        } catch {
+            newChannel.stop()
+            print("addAveragedChannel: couldn't load the channel.")
+        }
+    }
+    
+    //
+    // WINDOW MENU
+    //
+    
+    private var statsPanel:StatsPanelController? = nil
+    
+    @IBAction func showPipelineStats(sender: AnyObject) {
+        if ( statsPanel == nil ) {
+            statsPanel = StatsPanelController()
+        }
+        statsPanel!.showWindow(sender)
+    }
+    
+    private var segmentBrowser:SegmentBrowserController? = nil
+    
+    @IBAction func showSegmentBrowser(sender: AnyObject) {
+        if ( segmentBrowser == nil ) {
+            segmentBrowser = SegmentBrowserController(channels: channels)
+        }
+        segmentBrowser!.showWindow(sender)
+    }
+    
+    private var protocolDecoders:ProtocolDecoderPanelController? = nil
+    
+    @IBAction func showProtocolDecoders(sender: AnyObject) {
+        if ( protocolDecoders == nil ) {
+            protocolDecoders = ProtocolDecoderPanelController(channels: channels)
+        }
+        protocolDecoders!.showWindow(sender)
+    }
+    
+    private var waveformSearch:WaveformSearchPanelController? = nil
+    
+    @IBAction func showWaveformSearch(sender: AnyObject) {
+        if ( waveformSearch == nil ) {
+            waveformSearch = WaveformSearchPanelController(channels: channels, show: { channel, hit in
+                self.mvc?.scopeView.showSamples(channel, firstSampleIndex: hit.firstSampleIndex, lastSampleIndex: hit.lastSampleIndex)
+            })
+        }
+        waveformSearch!.showWindow(sender)
+    }
+    
+    //
+    // VIEW MENU
+    //
+    
+    @IBAction func toggleSpectrumAnalyzer(sender: AnyObject) {
+        mvc?.scopeView.toggleSpectrumAnalyzer()
+    }
+    
+    override func validateMenuItem(menuItem: NSMenuItem) -> Bool {
+        let anyRecording = channels.contains({ $0.isRecording })
+        switch (menuItem.action) {
+        case Selector("toggleSpectrumAnalyzer:"):
+            let showing = mvc?.scopeView.isSpectrumShowing ?? false
+            menuItem.state = showing ? NSOnState : NSOffState
+            return mvc != nil
+        case Selector("addMathChannel:"):
+            return mvc != nil && channels.count > 0
+        case Selector("addAveragedChannel:"):
+            return mvc != nil && channels.count > 0
+        case Selector("showSegmentBrowser:"):
+            return channels.count > 0
+        case Selector("showProtocolDecoders:"):
+            return channels.count > 0
+        case Selector("showWaveformSearch:"):
+            return channels.count > 0 && mvc != nil
+        case Selector("startRecording:"):
+            return channels.count > 0 && !anyRecording
+        case Selector("stopRecording:"):
+            return anyRecording
+        case Selector("exportSamples:"):
+            return channels.count > 0
+        default:
+            return true
+        }
+    }
+    
     func omgKillTheApp() {
         NSApplication.sharedApplication().terminate(nil)
     }
-
+    
     func applicationWillTerminate(aNotification: NSNotification) {
         // Insert code here to tear down your application
         print("----applicationWillTerminate")
+        for channel in channels {
+            channel.stopRecording()
+            channel.stopPublishing()
+            channel.stopSegmentCapture()
+        }
+        for channel in averagedChannels {
+            channel.stop()
+        }
+        streamServer?.close()
         do {
             for channel in channels {
                 try channel.channelOff()
-                try channel.transceiver!.closeTerminal()
+                try channel.source!.close()
             }
         } catch {
             print( "Something stupid happened.  Goodbye." )
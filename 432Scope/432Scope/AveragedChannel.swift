@@ -0,0 +1,171 @@
+//
+//  AveragedChannel.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/14/16.
+//
+//
+
+import Foundation
+
+/*
+ A channel that shows another channel's trigger-aligned average (see WaveformAverager.swift).
+ 
+ -it's a DerivedChannel (DerivedChannel.swift), so the scope view draws and measures it like any other channel.  its
+  samples are AveragedSamples, which puts the average where the newest sweep's window was in the input's buffer, so
+  with the scope triggered on the input, the average sits right on top of the live trace.
+ -outside the window there's nothing: minmax columns come back empty (no trace), and single samples hold the nearest
+  end of the average.
+ -the average gets picked up once a frame, when the scope view suspends writes, so it holds still while the view draws.
+  it's rounded to whole samples on the way out, so the display doesn't see anything finer than an LSB.
+ -measurements cover the window and nothing else.
+*/
+
+class AveragedChannel: DerivedChannel {
+    
+    let input:Channel
+    let averager:WaveformAverager
+    let averagedSamples:AveragedSamples
+    
+    init( input:Channel, averager:WaveformAverager ) {
+        self.input = input
+        self.averager = averager
+        averagedSamples = AveragedSamples(input: input.sampleBuffer, averager: averager)
+        super.init()
+    }
+    
+    override var name:String {
+        return "Average (\(averager.mode.description)): " + input.name
+    }
+    
+    override var samples:SampleHistory {
+        return averagedSamples
+    }
+    
+    // the scope view holds writes off while it draws a frame.  that's when to pick up the newest average.
+    override func suspendWrites( ) {
+        averagedSamples.refresh()
+    }
+    
+    override func getMeasurements( ) -> Measurements? {
+        averagedSamples.refresh()
+        guard let window = averagedSamples.waveform else {
+            return nil
+        }
+        return MeasurementEngine.measure(averagedSamples, firstSampleIndex: window.windowStart, count: window.values.count)
+    }
+    
+    // takes the averager out of the input's pipeline.  the average stays as it was.
+    func stop( ) {
+        input.stopAveraging(averager)
+    }
+}
+
+//
+// THE SAMPLES - the newest average, laid over the input's sample indices.  only use this on the main thread.
+//
+
+class AveragedSamples: SampleHistory {
+    
+    private let input:SampleHistory
+    private let averager:WaveformAverager
+    
+    // what refresh picked up last, and the same values rounded to samples.
+    private(set) var waveform:AveragedWaveform? = nil
+    private var values:[Sample] = []
+    
+    init( input:SampleHistory, averager:WaveformAverager ) {
+        self.input = input
+        self.averager = averager
+    }
+    
+    func refresh() {
+        guard let newest = averager.getAverage() else {
+            return
+        }
+        if ( newest.generation == waveform?.generation ) {
+            return
+        }
+        waveform = newest
+        values = newest.values.map({ Sample(round($0)) })
+    }
+    
+    //
+    // SampleHistory
+    //
+    
+    var capacity:Int {
+        return input.capacity
+    }
+    
+    var committedSampleCount:UInt {
+        return input.committedSampleCount
+    }
+    
+    // a new average changes everything we've handed out.
+    var clearCount:UInt {
+        return input.clearCount &+ (waveform?.generation ?? 0)
+    }
+    
+    var lastCommitTime:UInt64 {
+        return input.lastCommitTime
+    }
+    
+    func getSampleAtTime( time:Time ) -> Sample {
+        var value:Sample = 0
+        copySamples(UInt(max(0, Int(committedSampleCount) - 1 - time.asSampleIndex())), count: 1, destination: &value)
+        return value
+    }
+    
+    // newest first, like SampleBuffer's.
+    func getSampleRange( timeRange:TimeRange ) -> Array<Sample> {
+        let newestAge = timeRange.newest.asSampleIndex()
+        let count = timeRange.oldest.asSampleIndex() - newestAge
+        if ( count <= 0 ) {
+            return []
+        }
+        var rval = [Sample](count: count + 1, repeatedValue: 0)
+        copySamples(UInt(max(0, Int(committedSampleCount) - 1 - newestAge - count)), count: count + 1, destination: &rval)
+        return rval.reverse()
+    }
+    
+    func copySamples( firstSampleIndex:UInt, count:Int, destination:UnsafeMutablePointer<Sample> ) {
+        guard let window = waveform where values.count > 0 else {
+            let zero = Voltage(0.0).asSample()
+            for i in 0..<count {
+                destination[i] = zero
+            }
+            return
+        }
+        let first = Int(firstSampleIndex) - Int(window.windowStart)
+        let last = values.count - 1
+        for i in 0..<count {
+            destination[i] = values[Swift.max(0, Swift.min(last, first + i))]
+        }
+    }
+    
+    func getMinMax( firstSampleIndex:Int, count:Int ) -> (min:Sample, max:Sample) {
+        var minimum = Sample.max
+        var maximum = Sample.min
+        guard let window = waveform else {
+            return (min: minimum, max: maximum)
+        }
+        let first = Swift.max(0, firstSampleIndex - Int(window.windowStart))
+        let end = Swift.min(values.count, firstSampleIndex + count - Int(window.windowStart))
+        if ( first < end ) {
+            for i in first..<end {
+                minimum = Swift.min(minimum, values[i])
+                maximum = Swift.max(maximum, values[i])
+            }
+        }
+        return (min: minimum, max: maximum)
+    }
+    
+    func getColumnMinMaxes( newestSampleIndex:Int, samplesPerColumn:Double, columnCount:Int ) -> [(min:Sample, max:Sample)] {
+        return walkColumnMinMaxes(newestSampleIndex, samplesPerColumn: samplesPerColumn, columnCount: columnCount)
+    }
+    
+    func getSubRangeMinMaxes( timeRange:TimeRange, howManySubranges:Int ) -> [(min:Sample, max:Sample)] {
+        return walkSubRangeMinMaxes(timeRange, howManySubranges: howManySubranges)
+    }
+}
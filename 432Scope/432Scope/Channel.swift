@@ -22,23 +22,29 @@ class Channel : TriggerNotifications, DecoderNotifications {
     // DECODER NOTIFICATION
     //
     
-    var isDrawable:Bool = false
-    
     func decoderPacketFinished() {
         if let svc = notifications {
-            isDrawable = true
             svc.channelHasNewData(self)
         }
     }
-
+    
     
     //
     // TRIGGERING - once a trigger is installed, triggerEventDetected gets called when there's an event.
     //
     
+    // the trigger runs as its own pipeline stage, reading the sample buffer on its own queue.
+    private(set) var triggerStage:TriggerStage? = nil
+    
+    var trigger:Trigger? {
+        get {
+            return triggerStage?.trigger
+        }
+    }
+    
     var hasTrigger:Bool {
         get {
-            if sampleBuffer.trigger == nil {
+            if triggerStage == nil {
                 return false
             }
             return true
@@ -51,18 +57,25 @@ class Channel : TriggerNotifications, DecoderNotifications {
         // whatever the deal is, values stored in these are no longer relevant.
         newestTriggerEvent = nil
         
-        if newTrigger == nil {
-            // remove the trigger.
-            sampleBuffer.trigger = nil
-        } else {
-            // install the new one
-            sampleBuffer.trigger = newTrigger
+        // take the old stage out of the pipeline ...
+        if let oldStage = triggerStage {
+            sampleBuffer.removeReader(oldStage)
+            oldStage.detach()
+            triggerStage = nil
+        }
+        
+        // and put the new one in.
+        if let trig = newTrigger {
+            let stage = TriggerStage(trigger: trig, sampleBuffer: sampleBuffer)
+            sampleBuffer.addReader(stage)
+            triggerStage = stage
+            updateEventTap()
         }
         
         notifications?.channelTriggerChanged(self)
     }
     
-    // the basic notification handler
+    // the basic notification handler.  the trigger stage delivers these on the main queue.
     func triggerEventDetected( event:TriggerEvent ) {
         newestTriggerEvent = event
     }
@@ -72,22 +85,23 @@ class Channel : TriggerNotifications, DecoderNotifications {
     
     func getTriggeredCenterTime( visibleRangeHalfSpan:Time ) -> Time? {
         // if there's actually no trigger attached, this isn't gonna work ...
-        guard sampleBuffer.trigger != nil else {
+        guard let stage = triggerStage else {
             return nil
         }
         
         // if there's a trigger but no events yet, same deal ...
-        let events = sampleBuffer.trigger!.eventTimestamps
-        let currentTime = sampleBuffer.trigger!.currentTimestamp
+        let events = stage.getEventTimestamps()
         guard events.count > 0 else {
             return nil
         }
         
+        // event timestamps are sample indices, and the buffer's writes are suspended while we draw, so the newest committed sample pins down each event's age.
+        let newestSampleIndex = sampleBuffer.committedSampleCount &- 1
         let minimumSampleIndex = UInt(visibleRangeHalfSpan.asSampleIndex())
         for i in 1...events.count {
             // we have to do a little index-flipping math to count down, because the newest timestamps are at the end of the array.
             let index = events.count - i
-            let age = currentTime &- events[index]
+            let age = newestSampleIndex &- events[index]
             if ( age > minimumSampleIndex ) {
                 return SampleIndex(age).asTime()
             }
@@ -95,6 +109,220 @@ class Channel : TriggerNotifications, DecoderNotifications {
         return nil
     }
     
+    //
+    // MEASUREMENTS - a reader stage that's always there.  see MeasurementEngine.swift.
+    //
+    
+    private(set) var measurementEngine:MeasurementEngine? = nil
+    
+    // the newest live measurements, from every sample in the engine's last window.
+    func getMeasurements( ) -> Measurements? {
+        return measurementEngine?.getMeasurements()
+    }
+    
+    // measurements over a stretch of the buffer, given as ages (time before the newest sample).
+    func getMeasurements( ageRange:TimeRange ) -> Measurements {
+        // anything older than what's been committed, or than the ring can hold, isn't there.
+        let committed = Int(samples.committedSampleCount)
+        let available = min(committed, samples.capacity)
+        let newestAge = max(0, ageRange.min.asSampleIndex())
+        let oldestAge = min(available - 1, ageRange.max.asSampleIndex())
+        guard oldestAge >= newestAge else {
+            return Measurements()
+        }
+        // long stretches go a lot faster off the decimated copy, and lose nothing but the fastest edges.
+        if let decimated = decimatedSamples where ageRange.span > CONFIG_DECIMATED_MEASUREMENT_LENGTH {
+            return decimated.measure(UInt(committed - 1 - oldestAge), count: oldestAge - newestAge + 1)
+        }
+        return MeasurementEngine.measure(samples, firstSampleIndex: UInt(committed - 1 - oldestAge), count: oldestAge - newestAge + 1)
+    }
+    
+    //
+    // DECIMATION - a reader stage that keeps a low-passed, lower-rate copy of the buffer.  see Decimator.swift.
+    //
+    
+    private(set) var decimator:Decimator? = nil
+    private(set) var decimatedSamples:DecimatedSamples? = nil
+    
+    // what to draw columns this wide from: the decimated copy once a column covers enough of it, the raw samples otherwise.
+    func samplesForColumns( samplesPerColumn:Double ) -> SampleHistory {
+        if let decimated = decimatedSamples where samplesPerColumn >= Double(decimated.factor) * CONFIG_DECIMATED_MINIMUM_SAMPLES_PER_COLUMN {
+            return decimated
+        }
+        return samples
+    }
+    
+    //
+    // SPECTRUM - another reader stage.  see SpectrumAnalyzer.swift.
+    //
+    
+    private(set) var spectrumAnalyzer:SpectrumAnalyzer? = nil
+    
+    // nil settings takes the analyzer out.
+    func installSpectrumAnalyzer( settings:SpectrumAnalyzer.Settings? ) {
+        if let oldAnalyzer = spectrumAnalyzer {
+            sampleBuffer.removeReader(oldAnalyzer)
+            spectrumAnalyzer = nil
+        }
+        if let newSettings = settings {
+            let newAnalyzer = SpectrumAnalyzer(sampleBuffer: sampleBuffer, settings: newSettings)
+            sampleBuffer.addReader(newAnalyzer)
+            spectrumAnalyzer = newAnalyzer
+        }
+    }
+    
+    //
+    // PROTOCOL DECODING - a reader stage that decodes a serial bus off this channel, and maybe others.  see ProtocolDecoder.swift.
+    //
+    
+    private(set) var protocolDecoder:ProtocolDecoderStage? = nil
+    
+    // nil settings takes the decoder out.  the decoded items go with it.
+    func installProtocolDecoder( settings:ProtocolDecoderSettings? ) {
+        if let oldDecoder = protocolDecoder {
+            sampleBuffer.removeReader(oldDecoder)
+            protocolDecoder = nil
+        }
+        if let newSettings = settings {
+            let newDecoder = ProtocolDecoderStage(sampleBuffer: sampleBuffer, settings: newSettings, itemCapacity: CONFIG_PROTOCOL_ITEM_CAPACITY)
+            sampleBuffer.addReader(newDecoder)
+            protocolDecoder = newDecoder
+        }
+    }
+    
+    //
+    // SEARCH - a min/max summary of the ring, always there, that searches skip whole chunks with.  see WaveformSearch.swift.
+    //
+    
+    private(set) var minMaxSummary:MinMaxSummary? = nil
+    
+    // the whole history, parallel, and blocking until it's done.  so not on the main thread.
+    func search( criterion:SearchCriterion, maximumHits:Int ) -> SearchResult {
+        return WaveformSearch.search(sampleBuffer, summary: minMaxSummary, decoder: protocolDecoder, criterion: criterion, hysteresis: CONFIG_SEARCH_HYSTERESIS, maximumHits: maximumHits)
+    }
+    
+    //
+    // RECORDING - the recorder is another reader stage on the sample buffer.  see Recorder.swift.
+    //
+    
+    private(set) var recorder:Recorder? = nil
+    
+    var isRecording:Bool {
+        get {
+            return recorder != nil
+        }
+    }
+    
+    func startRecording( directory:NSURL, baseName:String, channelNumber:Int ) throws {
+        stopRecording()
+        let newRecorder = try Recorder(sampleBuffer: sampleBuffer, channelNumber: channelNumber, deviceName: name, directory: directory, baseName: baseName)
+        sampleBuffer.addReader(newRecorder)
+        recorder = newRecorder
+        print("----Channel.startRecording: \(name) -> \(newRecorder.dataFileURL.path!)")
+    }
+    
+    func stopRecording( ) {
+        if let oldRecorder = recorder {
+            sampleBuffer.removeReader(oldRecorder)
+            oldRecorder.finish()
+            recorder = nil
+        }
+    }
+    
+    //
+    // STREAMING - one more reader stage, which sends this channel's samples and trigger events to a StreamServer.  see StreamServer.swift.
+    //
+    
+    private(set) var streamPublisher:StreamPublisher? = nil
+    
+    func startPublishing( server:StreamServer, channelNumber:Int ) {
+        stopPublishing()
+        let publisher = StreamPublisher(server: server, sampleBuffer: sampleBuffer, channelNumber: channelNumber, channelName: name, measurementEngine: measurementEngine)
+        sampleBuffer.addReader(publisher)
+        server.addPublisher(publisher)
+        streamPublisher = publisher
+        updateEventTap()
+    }
+    
+    func stopPublishing( ) {
+        if let oldPublisher = streamPublisher {
+            sampleBuffer.removeReader(oldPublisher)
+            oldPublisher.server.removePublisher(oldPublisher)
+            streamPublisher = nil
+            updateEventTap()
+        }
+    }
+    
+    //
+    // SEGMENTED CAPTURE - another reader stage, which keeps a window around every trigger event.  see SegmentCapture.swift.
+    //
+    
+    // stopping keeps the segments around for browsing; starting again starts a new pool.
+    private(set) var segmentCapture:SegmentCapture? = nil
+    private(set) var isCapturingSegments:Bool = false
+    
+    func startSegmentCapture( ) {
+        stopSegmentCapture()
+        let capture = SegmentCapture(sampleBuffer: sampleBuffer, preTriggerSamples: CONFIG_SEGMENT_PRE_TRIGGER.asSampleIndex(),
+                                     postTriggerSamples: CONFIG_SEGMENT_POST_TRIGGER.asSampleIndex(), segmentCapacity: CONFIG_SEGMENT_COUNT)
+        sampleBuffer.addReader(capture)
+        segmentCapture = capture
+        isCapturingSegments = true
+        updateEventTap()
+    }
+    
+    func stopSegmentCapture( ) {
+        if let capture = segmentCapture where isCapturingSegments {
+            sampleBuffer.removeReader(capture)
+            isCapturingSegments = false
+            updateEventTap()
+        }
+    }
+    
+    //
+    // AVERAGING - one more reader stage per average, each averaging the windows around trigger events.  see WaveformAverager.swift.
+    //
+    
+    // every average anybody's showing (see AveragedChannel.swift).  they each have their own mode, and their own stage.
+    private(set) var waveformAveragers:[WaveformAverager] = []
+    
+    func startAveraging( mode:AveragingMode ) -> WaveformAverager? {
+        let averager = WaveformAverager(sampleBuffer: sampleBuffer, preTriggerSamples: CONFIG_AVERAGING_PRE_TRIGGER.asSampleIndex(),
+                                        postTriggerSamples: CONFIG_AVERAGING_POST_TRIGGER.asSampleIndex(), mode: mode,
+                                        alignmentRadius: CONFIG_AVERAGING_ALIGNMENT_RADIUS)
+        sampleBuffer.addReader(averager)
+        waveformAveragers.append(averager)
+        updateEventTap()
+        return averager
+    }
+    
+    func stopAveraging( averager:WaveformAverager ) {
+        if let index = waveformAveragers.indexOf({ $0 === averager }) {
+            sampleBuffer.removeReader(averager)
+            waveformAveragers.removeAtIndex(index)
+            updateEventTap()
+        }
+    }
+    
+    // the trigger stage has one event tap, so everybody who wants every event shares it.
+    private func updateEventTap( ) {
+        let publisher = streamPublisher
+        var windowReaders:[TriggeredWindowReader] = waveformAveragers
+        if let capture = segmentCapture where isCapturingSegments {
+            windowReaders.append(capture)
+        }
+        if ( publisher == nil && windowReaders.isEmpty ) {
+            triggerStage?.setEventTap(nil)
+            return
+        }
+        triggerStage?.setEventTap({ event in
+            publisher?.publishTriggerEvent(event)
+            for reader in windowReaders {
+                reader.receiveTriggerEvent(event)
+            }
+        })
+    }
+    
     //
     // DISPLAY PROPERTIES
     //
@@ -114,10 +342,26 @@ class Channel : TriggerNotifications, DecoderNotifications {
     var notifications:ChannelNotifications? = nil
     
     // the signal chain
-    private(set) var transceiver:Transceiver? = nil
+    private(set) var source:SampleSource? = nil
     private(set) var decoder:Decoder? = nil
     private(set) var sampleBuffer = SampleBuffer()
     
+    // what drawing and measuring read from.  for a channel with a device, that's just the sample buffer.
+    var samples:SampleHistory {
+        return sampleBuffer
+    }
+    
+    // the scope view holds writes off while it draws a frame.
+    func suspendWrites( ) {
+        sampleBuffer.suspendWrites()
+        decimator?.decimatedBuffer.suspendWrites()
+    }
+    
+    func resumeWrites( ) {
+        decimator?.decimatedBuffer.resumeWrites()
+        sampleBuffer.resumeWrites()
+    }
+    
     private(set) var isChannelOn:Bool = false
     
     private(set) var device:USBDevice? = nil;
@@ -130,16 +374,21 @@ class Channel : TriggerNotifications, DecoderNotifications {
     }
     
     func channelOn( ) throws {
-        transceiver!.flush()
+        source!.flush()
         sampleBuffer.clearAllSamples( Voltage(0.0).asSample() )
-        try transceiver!.send("Start")
+        decimator?.clear( Voltage(0.0).asSample() )
+        try source!.startStreaming()
         isChannelOn = true
     }
     
     func channelOff( ) throws {
         isChannelOn = false
-        try transceiver!.send("Stop")
-        transceiver!.flush()
+        try source!.stopStreaming()
+        source!.flush()
+    }
+    
+    // for channels without a device of their own (see MathChannel.swift): no buffer, no source, nothing streaming.
+    init( ) {
     }
     
     init( device:USBDevice, sampleRateInHertz:Int, bufferLengthInSeconds:Int ) throws {
@@ -147,15 +396,37 @@ class Channel : TriggerNotifications, DecoderNotifications {
         
         // create a sample buffer ...
         let bufferCapacity:Int = sampleRateInHertz * bufferLengthInSeconds
-        sampleBuffer = SampleBuffer(capacity: bufferCapacity, clearValue: Voltage(0.0).asSample() )
+        if let directory = CONFIG_DEEP_HISTORY_DIRECTORY {
+            // deep history lives in a memory-mapped file, one per device.
+            let fileURL = NSURL(fileURLWithPath: directory).URLByAppendingPathComponent("432scope-\((device.deviceFile as NSString).lastPathComponent).ring")
+            sampleBuffer = try SampleBuffer(capacity: bufferCapacity, clearValue: Voltage(0.0).asSample(), mappedFileURL: fileURL )
+        } else {
+            sampleBuffer = SampleBuffer(capacity: bufferCapacity, clearValue: Voltage(0.0).asSample() )
+        }
         print("----Channel.init() created \(bufferCapacity)-deep sample buffer")
         
+        // the measurement engine reads everything that goes in ...
+        measurementEngine = MeasurementEngine(sampleBuffer: sampleBuffer)
+        sampleBuffer.addReader(measurementEngine!)
+        
+        // and the summary searches use ...
+        minMaxSummary = MinMaxSummary(sampleBuffer: sampleBuffer, chunkSize: CONFIG_SEARCH_SUMMARY_CHUNK)
+        sampleBuffer.addReader(minMaxSummary!)
+        
+        // and the decimator, if there's any decimating to do ...
+        if ( CONFIG_DECIMATION_FACTOR > 1 ) {
+            let newDecimator = Decimator(sampleBuffer: sampleBuffer, factor: CONFIG_DECIMATION_FACTOR, tapsPerPhase: CONFIG_DECIMATION_TAPS_PER_PHASE, cutoff: CONFIG_DECIMATION_CUTOFF)
+            sampleBuffer.addReader(newDecimator)
+            decimator = newDecimator
+            decimatedSamples = DecimatedSamples(raw: sampleBuffer, decimator: newDecimator)
+        }
+        
         // and a decoder ...
         decoder = Decoder(sampleBuffer: sampleBuffer)
         decoder!.notifications = self
         
         // and a transceiver.
-        try transceiver = Transceiver(deviceFilePath: device.deviceFile, decoder: decoder!)
+        try source = Transceiver(deviceFilePath: device.deviceFile, decoder: decoder!)
         
         print( "Channel(): \(device.deviceFile) open." )
         
@@ -163,11 +434,11 @@ class Channel : TriggerNotifications, DecoderNotifications {
     
     deinit {
         print( "----Channel.deinit" )
-        if (transceiver != nil ) {
-            do { try transceiver!.closeTerminal()
+        if (source != nil ) {
+            do { try source!.close()
             } catch let msg {
                 print(msg)
-                print("Channel deinit: closeTerminal failed.")
+                print("Channel deinit: closing the source failed.")
             }
         }
     }
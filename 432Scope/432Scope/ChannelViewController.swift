@@ -16,7 +16,7 @@ class ChannelViewController: NSViewController {
     
     enum VoltmeterDisplayState {
         case Disabled
-        case Instantaneous
+        case Mean
         case PeakToPeak
     }
     var voltmeterDisplayState:VoltmeterDisplayState = .Disabled
@@ -25,6 +25,7 @@ class ChannelViewController: NSViewController {
     @IBOutlet weak var labelVoltmeter: NSTextField!
     @IBOutlet weak var labelReadingType: NSTextField!
     @IBOutlet weak var labelFrequencyMeter: NSTextField!
+    @IBOutlet weak var labelMeasurements: NSTextField!
     @IBOutlet weak var colorWell: NSColorWell!
 
     @IBAction func colorWellAction(sender: NSColorWell) {
@@ -74,6 +75,7 @@ class ChannelViewController: NSViewController {
     
     @IBOutlet weak var radioNoTrigger: NSButton!
     @IBOutlet weak var radioRisingEdge: NSButton!
+    @IBOutlet weak var radioHysteresisTrigger: NSButton!
     
     @IBAction func radioTriggerSelected(sender: NSButton) {
         switch sender {
@@ -83,12 +85,36 @@ class ChannelViewController: NSViewController {
         case radioRisingEdge:
             installRisingEdgeTrigger()
             break
+        case radioHysteresisTrigger:
+            installHysteresisTrigger()
+            break
         default:
             break
         }
         updateControlState()
     }
     
+    // the level controls are shared, so re-install whichever trigger is selected.
+    func reinstallSelectedTrigger() {
+        if ( radioRisingEdge.state == NSOnState ) {
+            installRisingEdgeTrigger()
+        }
+        if ( radioHysteresisTrigger.state == NSOnState ) {
+            installHysteresisTrigger()
+        }
+    }
+    
+    // initial level for auto-level triggers?  let's average the last second of samples.
+    func averageOfLatestSecond() -> Voltage {
+        let initialPeriodSamples = channel!.samples.getSampleRange(TimeRange(newest:0.0, oldest:1.0))
+        var initialPeriodTotal:Sample = 0
+        for sample in initialPeriodSamples {
+            initialPeriodTotal += sample
+        }
+        initialPeriodTotal /= initialPeriodSamples.count
+        return initialPeriodTotal.asVoltage()
+    }
+    
     //
     // RISING EDGE TRIGGER CONTROLS, INSTALLER
     //
@@ -98,14 +124,14 @@ class ChannelViewController: NSViewController {
     @IBOutlet weak var textfieldRisingEdgeLevel: NSTextField!
     @IBOutlet weak var stepperRisingEdgeLevel: NSStepper!
     @IBAction func risingEdgeLevelChanged(sender: AnyObject) {
-        installRisingEdgeTrigger()
+        reinstallSelectedTrigger()
         updateControlState()
     }
     
     // level auto controls
     @IBOutlet weak var checkboxRisingEdgeLevelAuto: NSButton!
     @IBAction func checkboxRisingEdgeLevelAutoClicked(sender: NSButton) {
-        installRisingEdgeTrigger()
+        reinstallSelectedTrigger()
         updateControlState()
     }
     
@@ -122,14 +148,7 @@ class ChannelViewController: NSViewController {
         var auto:Bool
         if (checkboxRisingEdgeLevelAuto.state == NSOnState) {
             auto = true
-            // initial level?  let's average the last second of samples.
-            let initialPeriodSamples = channel!.sampleBuffer.getSampleRange(TimeRange(newest:0.0, oldest:1.0))
-            var initialPeriodTotal:Sample = 0
-            for sample in initialPeriodSamples {
-                initialPeriodTotal += sample
-            }
-            initialPeriodTotal /= initialPeriodSamples.count
-            risingEdgeLevelValue = initialPeriodTotal.asVoltage()
+            risingEdgeLevelValue = averageOfLatestSecond()
         } else {
             auto = false
         }
@@ -140,6 +159,128 @@ class ChannelViewController: NSViewController {
 
     }
     
+    //
+    // HYSTERESIS TRIGGER CONTROLS, INSTALLER
+    //
+    // These share the level / auto controls with the rising edge trigger.  Window and runt triggers use Level as the low level, and Level 2 as the high one.
+    //
+    
+    enum HysteresisTriggerType {
+        case RisingEdge
+        case FallingEdge
+        case EitherEdge
+        case WindowExit
+        case WindowEnter
+        case PositivePulseNarrower
+        case PositivePulseWider
+        case NegativePulseNarrower
+        case NegativePulseWider
+        case PositiveRunt
+        case NegativeRunt
+    }
+    
+    // popup menu order
+    let hysteresisTriggerTypes:[(type:HysteresisTriggerType, title:String)] = [
+        (.RisingEdge, "Rising edge"),
+        (.FallingEdge, "Falling edge"),
+        (.EitherEdge, "Either edge"),
+        (.WindowExit, "Window exit"),
+        (.WindowEnter, "Window enter"),
+        (.PositivePulseNarrower, "+Pulse narrower"),
+        (.PositivePulseWider, "+Pulse wider"),
+        (.NegativePulseNarrower, "-Pulse narrower"),
+        (.NegativePulseWider, "-Pulse wider"),
+        (.PositiveRunt, "+Runt"),
+        (.NegativeRunt, "-Runt"),
+    ]
+    
+    var selectedHysteresisTriggerType:HysteresisTriggerType {
+        let index = popupHysteresisTriggerType.indexOfSelectedItem
+        if ( index < 0 ) {
+            return .RisingEdge
+        }
+        return hysteresisTriggerTypes[index].type
+    }
+    
+    @IBOutlet weak var popupHysteresisTriggerType: NSPopUpButton!
+    @IBAction func popupHysteresisTriggerTypeSelected(sender: NSPopUpButton) {
+        installHysteresisTrigger()
+        updateControlState()
+    }
+    
+    // parameters
+    var hysteresisValue:Voltage = 0.1
+    var secondLevelValue:Voltage = 1.0
+    var pulseWidthValue:Double = 100 // in microseconds
+    @IBOutlet weak var textfieldHysteresis: NSTextField!
+    @IBOutlet weak var textfieldSecondLevel: NSTextField!
+    @IBOutlet weak var textfieldPulseWidth: NSTextField!
+    @IBAction func hysteresisTriggerParameterChanged(sender: AnyObject) {
+        if ( radioHysteresisTrigger.state == NSOnState ) {
+            installHysteresisTrigger()
+        }
+        updateControlState()
+    }
+    
+    func installHysteresisTrigger() {
+        let type = selectedHysteresisTriggerType
+        let width = Time(pulseWidthValue / 1000000)
+        var newTrigger:Trigger
+        
+        // only the edge triggers can track their own level.
+        var auto:Bool = false
+        switch type {
+        case .RisingEdge, .FallingEdge, .EitherEdge:
+            if (checkboxRisingEdgeLevelAuto.state == NSOnState) {
+                auto = true
+                risingEdgeLevelValue = averageOfLatestSecond()
+            }
+            break
+        default:
+            break
+        }
+        
+        switch type {
+        case .RisingEdge:
+            newTrigger = EdgeTrigger(slope: .Rising, triggerLevel: risingEdgeLevelValue, hysteresis: hysteresisValue, autoLevel: auto, notifications: channel!)
+            break
+        case .FallingEdge:
+            newTrigger = EdgeTrigger(slope: .Falling, triggerLevel: risingEdgeLevelValue, hysteresis: hysteresisValue, autoLevel: auto, notifications: channel!)
+            break
+        case .EitherEdge:
+            newTrigger = EdgeTrigger(slope: .Either, triggerLevel: risingEdgeLevelValue, hysteresis: hysteresisValue, autoLevel: auto, notifications: channel!)
+            break
+        case .WindowExit:
+            newTrigger = WindowTrigger(condition: .Exits, lowLevel: risingEdgeLevelValue, highLevel: secondLevelValue, hysteresis: hysteresisValue, notifications: channel!)
+            break
+        case .WindowEnter:
+            newTrigger = WindowTrigger(condition: .Enters, lowLevel: risingEdgeLevelValue, highLevel: secondLevelValue, hysteresis: hysteresisValue, notifications: channel!)
+            break
+        case .PositivePulseNarrower:
+            newTrigger = PulseWidthTrigger(polarity: .Positive, condition: .NarrowerThan, triggerLevel: risingEdgeLevelValue, width: width, hysteresis: hysteresisValue, notifications: channel!)
+            break
+        case .PositivePulseWider:
+            newTrigger = PulseWidthTrigger(polarity: .Positive, condition: .WiderThan, triggerLevel: risingEdgeLevelValue, width: width, hysteresis: hysteresisValue, notifications: channel!)
+            break
+        case .NegativePulseNarrower:
+            newTrigger = PulseWidthTrigger(polarity: .Negative, condition: .NarrowerThan, triggerLevel: risingEdgeLevelValue, width: width, hysteresis: hysteresisValue, notifications: channel!)
+            break
+        case .NegativePulseWider:
+            newTrigger = PulseWidthTrigger(polarity: .Negative, condition: .WiderThan, triggerLevel: risingEdgeLevelValue, width: width, hysteresis: hysteresisValue, notifications: channel!)
+            break
+        case .PositiveRunt:
+            newTrigger = RuntTrigger(polarity: .Positive, lowLevel: risingEdgeLevelValue, highLevel: secondLevelValue, hysteresis: hysteresisValue, notifications: channel!)
+            break
+        case .NegativeRunt:
+            newTrigger = RuntTrigger(polarity: .Negative, lowLevel: risingEdgeLevelValue, highLevel: secondLevelValue, hysteresis: hysteresisValue, notifications: channel!)
+            break
+        }
+        
+        channel!.installTrigger(newTrigger)
+        
+        print("Hysteresis Trigger: \(type)\t\tlevel = \(risingEdgeLevelValue)\t\tlevel 2 = \(secondLevelValue)\t\thysteresis = \(hysteresisValue)\t\twidth = \(pulseWidthValue) uS\t\tauto = \(auto)")
+    }
+    
     //
     // UPDATE CONTROLS STATE
     //
@@ -165,29 +306,42 @@ class ChannelViewController: NSViewController {
         }
         
         // is there a trigger installed? make sure the radio buttons reflect that
-        if let trigger = channel!.sampleBuffer.trigger {
+        if let trigger = channel!.trigger {
             voltmeterDisplayState = .PeakToPeak
             // yes. what kind?
             switch "\(trigger.dynamicType)" {
             case "RisingEdgeTrigger":
                 radioRisingEdge.state = NSOnState
                 break
+            case "EdgeTrigger", "WindowTrigger", "PulseWidthTrigger", "RuntTrigger":
+                radioHysteresisTrigger.state = NSOnState
+                break
             default:
                 break
             }
         } else {
             // no trigger installed.
-            voltmeterDisplayState = .Instantaneous
+            voltmeterDisplayState = .Mean
             radioNoTrigger.state = NSOnState
         }
         
-        // RISING EDGE TRIGGER stuff
+        // LEVEL controls are shared by rising edge and the hysteresis triggers
+        
+        var levelIsAuto:Bool? = nil
+        if let trigger = channel!.trigger as? RisingEdgeTrigger {
+            levelIsAuto = trigger.autoLevel
+            risingEdgeLevelValue = trigger.triggerLevel.asVoltage()
+        }
+        if let trigger = channel!.trigger as? EdgeTrigger {
+            levelIsAuto = trigger.autoLevel
+            risingEdgeLevelValue = trigger.triggerLevel.asVoltage()
+        }
         
-        if let trigger = channel!.sampleBuffer.trigger as? RisingEdgeTrigger {
-            // it's a rising edge so the auto level checkbox should be enabled
+        if let auto = levelIsAuto {
+            // it's an edge trigger so the auto level checkbox should be enabled
             checkboxRisingEdgeLevelAuto.enabled = true
             // is autolevel actually selected?
-            if ( trigger.autoLevel == true ) {
+            if ( auto == true ) {
                 // yes, manual is auto.  the value is a Reading now.
                 checkboxRisingEdgeLevelAuto.state = NSOnState
                 textfieldRisingEdgeLevel.enabled = false
@@ -198,28 +352,54 @@ class ChannelViewController: NSViewController {
                 textfieldRisingEdgeLevel.enabled = true
                 stepperRisingEdgeLevel.enabled = true
                 // set the displayed level here.
-                risingEdgeLevelValue = trigger.triggerLevel.asVoltage()
                 textfieldRisingEdgeLevel.stringValue = "\(risingEdgeLevelValue)"
                 stepperRisingEdgeLevel.stringValue = "\(risingEdgeLevelValue)"
             }
-
-            // filter slider control
-            sliderRisingEdgeFilter.enabled = true
-
+        } else if ( channel!.trigger is HysteresisTrigger ) {
+            // window, pulse and runt triggers have a level but no auto.
+            checkboxRisingEdgeLevelAuto.enabled = false
+            textfieldRisingEdgeLevel.enabled = true
+            stepperRisingEdgeLevel.enabled = true
         } else {
-            // there's no rising edge trigger so disable this whole section
+            // there's no trigger with a level so disable this whole section
             checkboxRisingEdgeLevelAuto.enabled = false
             textfieldRisingEdgeLevel.enabled = false
             stepperRisingEdgeLevel.enabled = false
-            sliderRisingEdgeFilter.enabled = false
+        }
+        
+        // RISING EDGE TRIGGER stuff: the filter slider
+        sliderRisingEdgeFilter.enabled = (channel!.trigger is RisingEdgeTrigger)
+        
+        // HYSTERESIS TRIGGER stuff
+        
+        if ( channel!.trigger is HysteresisTrigger ) {
+            textfieldHysteresis.enabled = true
+            switch selectedHysteresisTriggerType {
+            case .WindowExit, .WindowEnter, .PositiveRunt, .NegativeRunt:
+                textfieldSecondLevel.enabled = true
+                textfieldPulseWidth.enabled = false
+                break
+            case .PositivePulseNarrower, .PositivePulseWider, .NegativePulseNarrower, .NegativePulseWider:
+                textfieldSecondLevel.enabled = false
+                textfieldPulseWidth.enabled = true
+                break
+            default:
+                textfieldSecondLevel.enabled = false
+                textfieldPulseWidth.enabled = false
+                break
+            }
+        } else {
+            textfieldHysteresis.enabled = false
+            textfieldSecondLevel.enabled = false
+            textfieldPulseWidth.enabled = false
         }
         
         // voltmeter
         switch (voltmeterDisplayState) {
         case .Disabled:
             break
-        case .Instantaneous:
-            labelReadingType.stringValue = "(Instant)"
+        case .Mean:
+            labelReadingType.stringValue = "(Mean)"
             break
         case .PeakToPeak:
             labelReadingType.stringValue = "(Peak-to-peak)"
@@ -231,35 +411,56 @@ class ChannelViewController: NSViewController {
     // UPDATE READINGS
     //
     
-    private var voltmeterReadingFilter = AveragingFilter<Voltage>(bufferSize: CONFIG_DISPLAY_CHANNELVIEW_FILTER_DEPTH, startingAverage: 0.0)
-    private var frequencyMeterReadingFilter = AveragingFilter<Frequency>(bufferSize: CONFIG_DISPLAY_CHANNELVIEW_FILTER_DEPTH, startingAverage: 100)
-    
     func updateReadings( ) {
         
-        // voltmeter: display instant or peak-to-peak ...
-        switch (voltmeterDisplayState) {
-        case .Instantaneous:
-            let newestInstantVoltage = voltmeterReadingFilter.filter(channel!.sampleBuffer.getNewestSample().asVoltage())
-            labelVoltmeter.stringValue = newestInstantVoltage.asString()
-            break
-        case .PeakToPeak:
-            if let event = channel!.newestTriggerEvent {
-                let newestPtPVoltage = event.periodVoltageRange.span
-                labelVoltmeter.stringValue = voltmeterReadingFilter.filter(newestPtPVoltage).asString()
-            }
-            break
-        default:
-            break
+        // measurements come from the channel's measurement engine, which sees every sample.  if there's a selection, measure just that instead.
+        var measurements:Measurements? = nil
+        var isSelection = false
+        if let ages = ScopeViewMath.getSelectionAgeRange() {
+            measurements = channel!.getMeasurements(ages)
+            isSelection = true
+        } else {
+            measurements = channel!.getMeasurements()
         }
         
-        // frequency meter
-        if let period = channel!.newestTriggerEvent?.samplesSinceLastEvent {
-            let newFrequency:Frequency = Frequency(CONFIG_SAMPLERATE) / Frequency(period)
-            labelFrequencyMeter.stringValue = frequencyMeterReadingFilter.filter(newFrequency).asString()
+        // voltmeter: display mean or peak-to-peak ...
+        if let m = measurements where m.sampleCount > 0 {
+            switch (voltmeterDisplayState) {
+            case .Mean:
+                labelVoltmeter.stringValue = m.mean.asString()
+                labelReadingType.stringValue = isSelection ? "(Sel. mean)" : "(Mean)"
+                break
+            case .PeakToPeak:
+                labelVoltmeter.stringValue = m.peakToPeak.asString()
+                labelReadingType.stringValue = isSelection ? "(Sel. p-p)" : "(Peak-to-peak)"
+                break
+            default:
+                break
+            }
+            
+            // frequency meter
+            if let f = m.frequency {
+                labelFrequencyMeter.stringValue = f.asString()
+            } else {
+                labelFrequencyMeter.stringValue = "-----"
+            }
+            
+            // and the rest
+            let duty = (m.dutyCycle != nil) ? String(format:"%.1f%%", m.dutyCycle! * 100) : "-----"
+            let rise = m.riseTime?.asString() ?? "-----"
+            let fall = m.fallTime?.asString() ?? "-----"
+            labelMeasurements.stringValue = "rms \(m.rms.asString())  duty \(duty)\nrise \(rise)  fall \(fall)"
         }
         
         // if there's an auto-level trigger, update that reading ...
-        if let trigger = channel!.sampleBuffer.trigger as? RisingEdgeTrigger {
+        if let trigger = channel!.trigger as? RisingEdgeTrigger {
+            if (trigger.autoLevel) {
+                risingEdgeLevelValue = trigger.triggerLevel.asVoltage()
+                textfieldRisingEdgeLevel.stringValue = "\(risingEdgeLevelValue)"
+                stepperRisingEdgeLevel.stringValue = "\(risingEdgeLevelValue)"
+            }
+        }
+        if let trigger = channel!.trigger as? EdgeTrigger {
             if (trigger.autoLevel) {
                 risingEdgeLevelValue = trigger.triggerLevel.asVoltage()
                 textfieldRisingEdgeLevel.stringValue = "\(risingEdgeLevelValue)"
@@ -332,9 +533,10 @@ class ChannelViewController: NSViewController {
         if let ch = channel {
             colorWell.color = ch.displayProperties.traceColor
         }
-        voltmeterDisplayState = .Instantaneous
-        labelReadingType.stringValue = "(Instant)"
+        voltmeterDisplayState = .Mean
+        labelReadingType.stringValue = "(Mean)"
         labelFrequencyMeter.stringValue = "-----"
+        labelMeasurements.stringValue = ""
         
         // done. start the timer.
         updateControlState()
@@ -351,6 +553,7 @@ class ChannelViewController: NSViewController {
         colorWell.enabled = false
         labelReadingType.stringValue = "-----"
         labelFrequencyMeter.stringValue = "-----"
+        labelMeasurements.stringValue = ""
     }
     
     //
@@ -362,6 +565,12 @@ class ChannelViewController: NSViewController {
         print("----ChannelViewController.channelDidLoad")
         // Do view setup here.
         
+        // fill in the hysteresis trigger types
+        popupHysteresisTriggerType.removeAllItems()
+        for entry in hysteresisTriggerTypes {
+            popupHysteresisTriggerType.addItemWithTitle(entry.title)
+        }
+        
         // we've loaded, but there's no channel attached yet, so disable controls
         disableUI()
     }
@@ -0,0 +1,103 @@
+//
+//  ColumnCache.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/3/16.
+//
+//
+
+import Foundation
+
+/*
+ Per-channel cache of the min/max columns for Timeline mode.
+ 
+ In Timeline mode the view is glued to the newest sample, so from one frame to the next most of the columns are the same
+ samples, just shifted over.  So columns are keyed on sample index (see SampleBuffer.committedSampleCount) instead of on
+ pixel position:  column k covers sample indices floor(k*samplesPerColumn) ..< floor((k+1)*samplesPerColumn).
+ 
+ Each frame we only compute the columns that weren't finished last frame.  A zoom, a resize or a cleared buffer throws
+ the whole thing out.  The values are raw samples, so the voltage range and the channel offset/scaling don't matter here.
+*/
+
+class ColumnCache {
+    
+    private var samplesPerColumn:Double = 0
+    private var columnCount:Int = 0
+    private var clearCount:UInt = 0
+    private var history:ObjectIdentifier? = nil
+    
+    // ring of columns, slot = key mod columnCount
+    private var columns:[(min:Sample, max:Sample)] = []
+    
+    // the newest sample index we've computed columns up to.  the column it's in was probably partial, so it gets redone
+    // next time, along with any columns the history says might still be settling (see SampleHistory.settlingSampleCount).
+    private var newestComputedSampleIndex:Int? = nil
+    
+    // columns start at the newest and go back in time, just like getSubRangeMinMaxes.
+    func getColumns( sampleBuffer:SampleHistory, samplesPerColumn:Double, columnCount:Int ) -> [(min:Sample, max:Sample)] {
+        
+        // did something happen that makes everything we have useless?
+        // (the channel might have switched between its raw and decimated samples, too.)
+        if ( samplesPerColumn != self.samplesPerColumn || columnCount != self.columnCount || sampleBuffer.clearCount != clearCount || ObjectIdentifier(sampleBuffer) != history ) {
+            self.samplesPerColumn = samplesPerColumn
+            self.columnCount = columnCount
+            clearCount = sampleBuffer.clearCount
+            history = ObjectIdentifier(sampleBuffer)
+            columns = [(min:Sample, max:Sample)](count: columnCount, repeatedValue: (min:0, max:0))
+            newestComputedSampleIndex = nil
+        }
+        
+        // the buffer is frozen while we draw, so this stays put.
+        let newestSampleIndex = Int(sampleBuffer.committedSampleCount) - 1
+        let currentNewestKey = keyOfSample(newestSampleIndex)
+        let oldestVisibleKey = currentNewestKey - columnCount + 1
+        
+        // figure out where to start computing.  from our last (partial) column, or from scratch.
+        var firstKeyToCompute = oldestVisibleKey
+        if let lastNewestSampleIndex = newestComputedSampleIndex {
+            let lastNewestKey = keyOfSample(lastNewestSampleIndex - sampleBuffer.settlingSampleCount)
+            if ( lastNewestKey <= currentNewestKey && lastNewestKey > oldestVisibleKey ) {
+                firstKeyToCompute = lastNewestKey
+            }
+        }
+        
+        for key in firstKeyToCompute...currentNewestKey {
+            let firstSampleIndex = firstSampleIndexOfKey(key)
+            var count = firstSampleIndexOfKey(key + 1) - firstSampleIndex
+            if ( key == currentNewestKey ) {
+                // the newest column is only as full as the data.
+                count = newestSampleIndex - firstSampleIndex + 1
+            }
+            columns[slotOfKey(key)] = sampleBuffer.getMinMax(firstSampleIndex, count: count)
+        }
+        newestComputedSampleIndex = newestSampleIndex
+        
+        // hand them back newest first
+        var rval:[(min:Sample, max:Sample)] = []
+        rval.reserveCapacity(columnCount)
+        for i in 0..<columnCount {
+            rval.append(columns[slotOfKey(currentNewestKey - i)])
+        }
+        return rval
+    }
+    
+    private func keyOfSample( sampleIndex:Int ) -> Int {
+        return Int(floor(Double(sampleIndex) / samplesPerColumn))
+    }
+    
+    private func firstSampleIndexOfKey( key:Int ) -> Int {
+        // make sure this agrees with keyOfSample at the edges, floating point notwithstanding.
+        var index = Int(floor(Double(key) * samplesPerColumn))
+        while ( keyOfSample(index) < key ) {
+            index += 1
+        }
+        while ( keyOfSample(index - 1) >= key ) {
+            index -= 1
+        }
+        return index
+    }
+    
+    private func slotOfKey( key:Int ) -> Int {
+        return ((key % columnCount) + columnCount) % columnCount
+    }
+}
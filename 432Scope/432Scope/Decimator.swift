@@ -0,0 +1,360 @@
+//
+//  Decimator.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/14/16.
+//
+//
+
+import Foundation
+
+/*
+ A second, lower-rate copy of a channel: FIR low-pass filtered, then decimated, into a SampleBuffer of its own.
+ 
+ BIG PICTURE:
+ 
+ -the Decimator is another reader stage on the raw buffer, so the filtering happens on its own queue and the Decoder's
+  write path doesn't get any longer.  every block gets filtered and the outputs go into the decimated buffer with one
+  storeNewSamples, which has room for the same number of seconds as the raw one.
+ -FIRFilter is a windowed-sinc (Blackman) low-pass with its cutoff a bit under the new Nyquist, so nothing aliases.
+  it's polyphase in the way that matters: only every factor'th output ever gets computed, and each one is a single
+  dot product of the reversed taps with a contiguous run of history, which the compiler vectorizes.  a factor of 1 is
+  just a low-pass.  outputs get saturated to the ADC's range, since the filter rings a little past a rail-to-rail step.
+ -DecimatedSamples makes the decimated buffer look like the raw one (SampleHistory, in raw sample indices, with the
+  filter's delay taken out), so the scope view and ColumnCache can draw long timebases from it without knowing.
+  see Channel.samplesForColumns.  long measurements use it too, through DecimatedSamples.measure.
+ -if the stage falls behind and the raw buffer skips it ahead, the missed outputs get filled with the last value, so
+  decimated sample k always lines up with the same raw samples.
+*/
+
+//
+// THE FILTER
+//
+
+final class FIRFilter {
+    
+    let factor:Int
+    let tapCount:Int
+    
+    // taps, reversed, so the dot product runs forward through the history.
+    private let reversedTaps:UnsafeMutablePointer<Float>
+    
+    // the last tapCount-1 inputs, then the block being filtered
+    private let history:UnsafeMutablePointer<Float>
+    private let historyCapacity:Int
+    private var isPrimed:Bool = false
+    
+    // how far the next output is into the next block.  outputs land on every factor'th input.
+    private var phase:Int
+    
+    // outputs stay in the ADC's range, 0...maximumOutput.
+    private let maximumOutput = Float(CONFIG_SAMPLE_MAX_VALUE)
+    
+    // the filter's delay, in input samples.  linear phase, so it's the same at every frequency.
+    var delay:Int {
+        return (tapCount - 1) / 2
+    }
+    
+    // tapsPerPhase taps for every output phase; more is sharper.  cutoff is a fraction of the output Nyquist rate.
+    init( factor:Int, tapsPerPhase:Int, cutoff:Double, maxBlockSize:Int ) {
+        let m = Swift.max(1, factor)
+        let n = Swift.max(1, m * tapsPerPhase) | 1 // odd, so the delay is a whole number of samples
+        self.factor = m
+        tapCount = n
+        phase = m - 1
+        
+        // windowed sinc.  fc is in cycles per input sample.
+        let fc = cutoff * 0.5 / Double(m)
+        let middle = Double(n - 1) / 2
+        var taps = [Double](count: n, repeatedValue: 0)
+        for t in 0..<n {
+            let x = Double(t) - middle
+            let sinc = (x == 0) ? 2 * fc : sin(2 * M_PI * fc * x) / (M_PI * x)
+            let blackman = (n == 1) ? 1.0 : 0.42 - 0.5 * cos(2 * M_PI * Double(t) / Double(n - 1)) + 0.08 * cos(4 * M_PI * Double(t) / Double(n - 1))
+            taps[t] = sinc * blackman
+        }
+        // unity gain at DC, so samples come out on the same scale they went in.
+        let dcGain = taps.reduce(0, combine: +)
+        reversedTaps = UnsafeMutablePointer<Float>.alloc(n)
+        for t in 0..<n {
+            reversedTaps[t] = Float(taps[n - 1 - t] / dcGain)
+        }
+        
+        historyCapacity = n - 1 + maxBlockSize
+        history = UnsafeMutablePointer<Float>.alloc(historyCapacity)
+    }
+    
+    deinit {
+        reversedTaps.dealloc(tapCount)
+        history.dealloc(historyCapacity)
+    }
+    
+    // filters a block, and writes an output for every factor'th input into output.  returns how many.
+    // output needs room for block.count / factor + 1.
+    func process( block:UnsafeBufferPointer<Sample>, output:UnsafeMutablePointer<Sample> ) -> Int {
+        let taps = tapCount - 1
+        
+        // start from the first sample held steady, rather than from a ramp up out of zero.
+        if ( !isPrimed && block.count > 0 ) {
+            let first = Float(block[0])
+            for i in 0..<taps {
+                history[i] = first
+            }
+            isPrimed = true
+        }
+        
+        let input = history + taps
+        for i in 0..<block.count {
+            input[i] = Float(block[i])
+        }
+        
+        var outputCount = 0
+        var position = phase
+        while ( position < block.count ) {
+            // the window ending at input[position] starts at history[position].
+            let window = history + position
+            var sum:Float = 0
+            for t in 0...taps {
+                sum += reversedTaps[t] * window[t]
+            }
+            // a low-pass rings past a step, so a step to the rail overshoots it.  nothing the ADC could have sent goes
+            // past the rails, and the ring can't hold what does (see SampleBuffer.narrow), so saturate.
+            sum = (sum < 0) ? 0 : ((sum > maximumOutput) ? maximumOutput : sum)
+            output[outputCount] = Sample(lroundf(sum))
+            outputCount += 1
+            position += factor
+        }
+        phase = position - block.count
+        
+        // keep the newest taps inputs for next time.
+        if ( taps > 0 ) {
+            memmove(history, history + block.count, taps * sizeof(Float))
+        }
+        return outputCount
+    }
+    
+    // forget the history.  the next block starts the filter over, on the given output phase.
+    func reset( nextOutputIn:Int ) {
+        isPrimed = false
+        phase = nextOutputIn
+    }
+}
+
+//
+// THE STAGE
+//
+
+class Decimator: SampleBufferReader {
+    
+    let factor:Int
+    let decimatedBuffer:SampleBuffer
+    private let filter:FIRFilter
+    
+    // decimated sample k is the filter output at raw sample index originSampleIndex + k*factor + factor-1.
+    let originSampleIndex:UInt
+    
+    // the raw sample index the next block should start at.  anything else means we got skipped ahead.
+    private var expectedSampleIndex:UInt
+    
+    private let output:UnsafeMutablePointer<Sample>
+    private let outputCapacity:Int
+    private var lastOutput:Sample
+    
+    init( sampleBuffer:SampleBuffer, factor:Int, tapsPerPhase:Int, cutoff:Double ) {
+        let blockCapacity = CONFIG_DECODER_PACKET_SIZE / CONFIG_INCOMING_SAMPLE_SIZE_IN_BYTES
+        let m = Swift.max(1, factor)
+        self.factor = m
+        filter = FIRFilter(factor: m, tapsPerPhase: tapsPerPhase, cutoff: cutoff, maxBlockSize: blockCapacity)
+        decimatedBuffer = SampleBuffer(capacity: Swift.max(1, sampleBuffer.capacity / m), clearValue: Voltage(0.0).asSample())
+        outputCapacity = blockCapacity / m + 1
+        output = UnsafeMutablePointer<Sample>.alloc(outputCapacity)
+        lastOutput = Voltage(0.0).asSample()
+        originSampleIndex = sampleBuffer.committedSampleCount
+        expectedSampleIndex = originSampleIndex
+        super.init(sampleBuffer: sampleBuffer, queueLabel: "decimatorQueue")
+    }
+    
+    deinit {
+        output.dealloc(outputCapacity)
+    }
+    
+    var filterDelay:Int {
+        return filter.delay
+    }
+    
+    override func processBlock( block:UnsafeBufferPointer<Sample>, firstSampleIndex:UInt ) {
+        let count = filter.process(block, output: output)
+        if ( count > 0 ) {
+            decimatedBuffer.storeNewSamples(UnsafeBufferPointer<Sample>(start: output, count: count))
+            lastOutput = output[count - 1]
+        }
+        expectedSampleIndex = firstSampleIndex &+ UInt(block.count)
+    }
+    
+    // hold the last value across the hole, so decimated indices keep lining up with raw ones.  then start the filter over.
+    override func readerDidSkipAhead( newCursor:UInt ) {
+        let outputsBefore = { (rawIndex:UInt) -> Int in
+            return Int((rawIndex &- self.originSampleIndex) / UInt(self.factor))
+        }
+        var missed = outputsBefore(newCursor) - outputsBefore(expectedSampleIndex)
+        let fill = [Sample](count: Swift.min(missed, outputCapacity), repeatedValue: lastOutput)
+        while ( missed > 0 ) {
+            let n = Swift.min(missed, fill.count)
+            fill.withUnsafeBufferPointer({
+                self.decimatedBuffer.storeNewSamples(UnsafeBufferPointer<Sample>(start: $0.baseAddress, count: n))
+            })
+            missed -= n
+        }
+        let intoPeriod = Int((newCursor &- originSampleIndex) % UInt(factor))
+        filter.reset(factor - 1 - intoPeriod)
+        expectedSampleIndex = newCursor
+    }
+    
+    // the raw buffer got cleared (see Channel.channelOn).  the old outputs are meaningless, and so is the filter history.
+    func clear( clearValue:Sample ) {
+        decimatedBuffer.clearAllSamples(clearValue)
+        dispatch_async( gcdReaderQueue, {
+            self.lastOutput = clearValue
+            let intoPeriod = Int((self.expectedSampleIndex &- self.originSampleIndex) % UInt(self.factor))
+            self.filter.reset(self.factor - 1 - intoPeriod)
+        })
+    }
+}
+
+//
+// THE VIEW FROM OUTSIDE - the decimated buffer, in raw sample indices.
+//
+
+class DecimatedSamples: SampleHistory {
+    
+    let raw:SampleBuffer
+    let decimator:Decimator
+    
+    init( raw:SampleBuffer, decimator:Decimator ) {
+        self.raw = raw
+        self.decimator = decimator
+    }
+    
+    var factor:Int {
+        return decimator.factor
+    }
+    
+    private var decimated:SampleBuffer {
+        return decimator.decimatedBuffer
+    }
+    
+    // the decimated sample nearest raw sample index rawIndex, after taking the filter's delay out.  not clamped.
+    func decimatedIndexOfSample( rawIndex:Int ) -> Int {
+        let position = rawIndex - Int(decimator.originSampleIndex) - (factor - 1) + decimator.filterDelay + factor / 2
+        return (position >= 0) ? position / factor : -((factor - 1 - position) / factor)
+    }
+    
+    // the decimated samples that are really there, oldest and newest.
+    private var validRange:(oldest:Int, newest:Int) {
+        let committed = Int(decimated.committedSampleCount)
+        return (oldest: Swift.max(0, committed - decimated.capacity), newest: committed - 1)
+    }
+    
+    private func clampedDecimatedIndex( rawIndex:Int ) -> Int {
+        let valid = validRange
+        return Swift.max(valid.oldest, Swift.min(valid.newest, decimatedIndexOfSample(rawIndex)))
+    }
+    
+    //
+    // SampleHistory
+    //
+    
+    // the raw buffer's count, so ages mean the same thing here as on the raw samples.  the newest few raw samples
+    // (the filter's delay, and the rest of the current decimation period) read as the newest decimated sample.
+    var committedSampleCount:UInt {
+        return raw.committedSampleCount
+    }
+    
+    var capacity:Int {
+        return decimated.capacity * factor
+    }
+    
+    var clearCount:UInt {
+        return raw.clearCount &+ decimated.clearCount
+    }
+    
+    var lastCommitTime:UInt64 {
+        return decimated.lastCommitTime
+    }
+    
+    // the filter's delay plus a decimation period: until then, those raw samples are still reading as the newest output.
+    var settlingSampleCount:Int {
+        return decimator.filterDelay + 2 * factor
+    }
+    
+    func getMinMax( firstSampleIndex:Int, count:Int ) -> (min:Sample, max:Sample) {
+        if ( count <= 0 || decimated.committedSampleCount == 0 ) {
+            return (min: Sample.max, max: Sample.min)
+        }
+        let first = clampedDecimatedIndex(firstSampleIndex)
+        let last = clampedDecimatedIndex(firstSampleIndex + count - 1)
+        return decimated.getMinMax(first, count: last - first + 1)
+    }
+    
+    func getColumnMinMaxes( newestSampleIndex:Int, samplesPerColumn:Double, columnCount:Int ) -> [(min:Sample, max:Sample)] {
+        return walkColumnMinMaxes(newestSampleIndex, samplesPerColumn: samplesPerColumn, columnCount: columnCount)
+    }
+    
+    func getSubRangeMinMaxes( timeRange:TimeRange, howManySubranges:Int ) -> [(min:Sample, max:Sample)] {
+        return walkSubRangeMinMaxes(timeRange, howManySubranges: howManySubranges)
+    }
+    
+    // every raw index gets its nearest decimated sample.
+    func copySamples( firstSampleIndex:UInt, count:Int, destination:UnsafeMutablePointer<Sample> ) {
+        if ( decimated.committedSampleCount == 0 ) {
+            for i in 0..<count {
+                destination[i] = Voltage(0.0).asSample()
+            }
+            return
+        }
+        var value:Sample = 0
+        var valueIndex:Int? = nil
+        for i in 0..<count {
+            let index = clampedDecimatedIndex(Int(firstSampleIndex) + i)
+            if ( index != valueIndex ) {
+                decimated.copySamples(UInt(index), count: 1, destination: &value)
+                valueIndex = index
+            }
+            destination[i] = value
+        }
+    }
+    
+    func getSampleAtTime( time:Time ) -> Sample {
+        var value:Sample = 0
+        copySamples(UInt(Swift.max(0, Int(raw.committedSampleCount) - 1 - time.asSampleIndex())), count: 1, destination: &value)
+        return value
+    }
+    
+    // newest first, like SampleBuffer's.
+    func getSampleRange( timeRange:TimeRange ) -> Array<Sample> {
+        let newestAge = timeRange.newest.asSampleIndex()
+        let count = timeRange.oldest.asSampleIndex() - newestAge
+        if ( count <= 0 ) {
+            return []
+        }
+        var rval = [Sample](count: count + 1, repeatedValue: 0)
+        copySamples(UInt(Swift.max(0, Int(raw.committedSampleCount) - 1 - newestAge - count)), count: count + 1, destination: &rval)
+        return rval.reverse()
+    }
+    
+    //
+    // MEASURING - straight off the decimated buffer, factor times fewer samples.
+    //
+    
+    // the accumulator thinks every sample is one raw sample period, so the times and frequency need scaling back.
+    // rise and fall times come out no faster than the filter lets through.
+    func measure( firstSampleIndex:UInt, count:Int ) -> Measurements {
+        let first = clampedDecimatedIndex(Int(firstSampleIndex))
+        let last = clampedDecimatedIndex(Int(firstSampleIndex) + count - 1)
+        var rval = MeasurementEngine.measure(decimated, firstSampleIndex: UInt(first), count: last - first + 1)
+        rval.frequency = rval.frequency.map({ $0 / Frequency(factor) })
+        rval.riseTime = rval.riseTime.map({ $0 * Time(factor) })
+        rval.fallTime = rval.fallTime.map({ $0 * Time(factor) })
+        return rval
+    }
+}
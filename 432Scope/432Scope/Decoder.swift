@@ -24,8 +24,18 @@ class Decoder {
     private var sampleBuffer:SampleBuffer? = nil
     var notifications:DecoderNotifications? = nil
     
+    // decoded samples collect here so the whole packet can be stored (and triggered on) in one go.
+    private var decodedBlock:UnsafeMutablePointer<Sample>
+    private var decodedBlockCapacity:Int
+    
     init( sampleBuffer sb:SampleBuffer) {
         self.sampleBuffer = sb
+        decodedBlockCapacity = CONFIG_DECODER_PACKET_SIZE / CONFIG_INCOMING_SAMPLE_SIZE_IN_BYTES
+        decodedBlock = UnsafeMutablePointer<Sample>.alloc(decodedBlockCapacity)
+    }
+    
+    deinit {
+        decodedBlock.dealloc(decodedBlockCapacity)
     }
     
     func newPacketArrived( packet:NSData ) {
@@ -34,14 +44,21 @@ class Decoder {
             // PACKET DECOMPRESSION CODE STARTS HERE!
             //
         
+        let decodeStart = Instrumentation.now()
+        
         // for now it's just raw 16 bit samples.
-        var aNewSample:Sample = 0
-        var i:Int = 0
-        while ( i < packet.length ) {
-            packet.getBytes(&aNewSample, range: NSRange(location: i, length: 2))
-            self.sampleBuffer!.storeNewSample(aNewSample)
-            i += 2
+        let sampleCount = packet.length / CONFIG_INCOMING_SAMPLE_SIZE_IN_BYTES
+        if ( sampleCount > decodedBlockCapacity ) {
+            decodedBlock.dealloc(decodedBlockCapacity)
+            decodedBlockCapacity = sampleCount
+            decodedBlock = UnsafeMutablePointer<Sample>.alloc(decodedBlockCapacity)
+        }
+        let rawSamples = UnsafePointer<UInt16>(packet.bytes)
+        for i in 0..<sampleCount {
+            decodedBlock[i] = Sample(rawSamples[i])
         }
+        Instrumentation.decode.recordElapsed(since: decodeStart)
+        self.sampleBuffer!.storeNewSamples(UnsafeBufferPointer<Sample>(start: decodedBlock, count: sampleCount))
         
         // let the boss know our work here is done.
         if let boss = notifications {
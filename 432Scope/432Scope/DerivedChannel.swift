@@ -0,0 +1,76 @@
+//
+//  DerivedChannel.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/14/16.
+//
+//
+
+import Foundation
+
+/*
+ Channels without a device of their own, whose samples get worked out from other channels': math channels
+ (MathChannel.swift) and averages (AveragedChannel.swift).
+ 
+ -there's no source, no decoder and nothing in the sample buffer.  subclasses override name and samples, and that's what
+  the scope view draws and measures.
+ -the channels they read do the streaming, and the scope view freezes those while it draws, so turning one of these on
+  or off, or suspending its writes, does nothing.
+ -they don't trigger, record, stream, capture segments, average, decode or get a spectrum.  the channels they read do
+  all that.
+*/
+
+class DerivedChannel: Channel {
+    
+    override init( ) {
+        super.init()
+    }
+    
+    // the live readings.  there's no engine watching every sample, so measure the newest window whenever asked.
+    override func getMeasurements( ) -> Measurements? {
+        let measurements = getMeasurements(TimeRange(newest: 0, span: CONFIG_MEASUREMENT_WINDOW_LENGTH))
+        return measurements.sampleCount > 0 ? measurements : nil
+    }
+    
+    override func channelOn( ) throws {
+    }
+    
+    override func channelOff( ) throws {
+    }
+    
+    override func suspendWrites( ) {
+    }
+    
+    override func resumeWrites( ) {
+    }
+    
+    //
+    // NOT FOR DERIVED CHANNELS
+    //
+    
+    override func installTrigger( newTrigger:Trigger? ) {
+        if ( newTrigger != nil ) {
+            print("----DerivedChannel.installTrigger: \(name) doesn't trigger.  trigger on what it reads instead.")
+        }
+    }
+    
+    override func installSpectrumAnalyzer( settings:SpectrumAnalyzer.Settings? ) {
+    }
+    
+    override func installProtocolDecoder( settings:ProtocolDecoderSettings? ) {
+    }
+    
+    override func startRecording( directory:NSURL, baseName:String, channelNumber:Int ) throws {
+        throw Error.ChannelFatal("DerivedChannel: \(name) can't record.  record what it reads.")
+    }
+    
+    override func startPublishing( server:StreamServer, channelNumber:Int ) {
+    }
+    
+    override func startSegmentCapture( ) {
+    }
+    
+    override func startAveraging( mode:AveragingMode ) -> WaveformAverager? {
+        return nil
+    }
+}
@@ -0,0 +1,69 @@
+//
+//  DisplayTypes.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/9/16.
+//
+//
+
+import Cocoa
+
+/*
+ The screen side of the basic types: translating samples, voltages and times to and from ScopeImageView coordinates.
+ These all lean on ScopeViewMath, so they live with the UI.  The rest of the type translations are in Types.swift.
+*/
+
+extension Sample {
+    
+    func asCoordinate( ) -> CGFloat {
+        return ScopeViewMath.sampleValueAsCoordinate(CGFloat(self))
+    }
+}
+
+extension Voltage {
+    
+    func asCoordinate( ) -> CGFloat {
+        var yVal = self - ScopeViewMath.vvRange.min
+        yVal *= ScopeViewMath.voltageScaleFactor
+        return CGFloat(yVal)
+    }
+    
+    // if something moves by (self) volts, how many pixels does it move by?  ask this function.
+    func asGraphicsDiff( ) -> CGFloat {
+        return CGFloat(self * ScopeViewMath.voltageScaleFactor)
+    }
+}
+
+extension Time {
+    
+    func asCoordinate( ) -> CGFloat {
+        var xVal = self - ScopeViewMath.tvRange.newest
+        xVal *= ScopeViewMath.timeScaleFactor
+        return CGFloat(ScopeViewMath.imageSize.width - xVal);
+    }
+    
+    func asGraphicsDiff( ) -> CGFloat {
+        return CGFloat(self * ScopeViewMath.timeScaleFactor)
+    }
+}
+
+extension CGFloat {
+    
+    // if self is a ScopeImageView coordinate, these translate it to Time (x) or Voltage (y).
+    func asTime( ) -> Time {
+        return (Time(ScopeViewMath.imageSize.width-self)*ScopeViewMath.inverseTimeScaleFactor)+ScopeViewMath.tvRange.newest
+    }
+    
+    func asVoltage( ) -> Voltage {
+        return (Voltage(self)*ScopeViewMath.inverseVoltageScaleFactor)+ScopeViewMath.vvRange.min
+    }
+    
+    // diff translates.  if self is a distance along x or y axes of ScopeImageView, these return the corresponding difference in time or voltage.
+    func asTimeDiff( ) -> Time {
+        return ScopeViewMath.inverseTimeScaleFactor * Time(self)
+    }
+    
+    func asVoltageDiff( ) -> Voltage {
+        return ScopeViewMath.inverseVoltageScaleFactor * Voltage(self)
+    }
+}
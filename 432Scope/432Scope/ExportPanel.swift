@@ -0,0 +1,98 @@
+//
+//  ExportPanel.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/14/16.
+//
+//
+
+import Cocoa
+
+/*
+ The little window an export (Exporter.swift) runs in: a progress bar, how it went, and a button that's Cancel until
+ it's done and Close after.
+ 
+ Built in code, like the stats panel.
+*/
+
+class ExportPanelController: NSWindowController, NSWindowDelegate {
+    
+    let exporter:Exporter
+    private let progressBar:NSProgressIndicator
+    private let statusLabel:NSTextField
+    private let button:NSButton
+    private var started:CFAbsoluteTime = 0
+    private var finished = false
+    
+    init( exporter:Exporter ) {
+        self.exporter = exporter
+        let panel = NSPanel(contentRect: NSRect(x: 0, y: 0, width: 420, height: 96),
+                            styleMask: NSTitledWindowMask | NSUtilityWindowMask,
+                            backing: .Buffered, defer: true)
+        panel.title = "Export"
+        panel.floatingPanel = true
+        panel.hidesOnDeactivate = false
+        let content = panel.contentView!
+        
+        statusLabel = NSTextField(frame: NSRect(x: 12, y: 66, width: 396, height: 18))
+        statusLabel.editable = false
+        statusLabel.bordered = false
+        statusLabel.drawsBackground = false
+        statusLabel.lineBreakMode = .ByTruncatingMiddle
+        statusLabel.stringValue = "exporting to " + (exporter.fileURL.lastPathComponent ?? "?")
+        content.addSubview(statusLabel)
+        
+        progressBar = NSProgressIndicator(frame: NSRect(x: 12, y: 40, width: 396, height: 20))
+        progressBar.indeterminate = false
+        progressBar.minValue = 0
+        progressBar.maxValue = 1
+        content.addSubview(progressBar)
+        
+        button = NSButton(frame: NSRect(x: 318, y: 6, width: 90, height: 28))
+        button.title = "Cancel"
+        button.bezelStyle = .RoundedBezelStyle
+        content.addSubview(button)
+        
+        super.init(window: panel)
+        panel.delegate = self
+        button.target = self
+        button.action = #selector(ExportPanelController.buttonPressed(_:))
+        panel.center()
+    }
+    
+    required init?(coder: NSCoder) {
+        fatalError("ExportPanelController is built in code.")
+    }
+    
+    // shows the window and starts the export.
+    func start( sender:AnyObject? ) {
+        showWindow(sender)
+        started = CFAbsoluteTimeGetCurrent()
+        exporter.start({ fraction in
+            self.progressBar.doubleValue = fraction
+        }, done: { failure in
+            self.finish(failure)
+        })
+    }
+    
+    private func finish( failure:String? ) {
+        finished = true
+        button.title = "Close"
+        if let message = failure {
+            statusLabel.stringValue = message
+            return
+        }
+        progressBar.doubleValue = 1
+        let seconds = CFAbsoluteTimeGetCurrent() - started
+        let megabytes = Double(exporter.bytesWritten) / 1048576.0
+        statusLabel.stringValue = "\(exporter.framesWritten) frames, " + String(format: "%.1f MB in %.2f s", megabytes, seconds)
+    }
+    
+    @IBAction func buttonPressed(sender: AnyObject) {
+        if ( finished ) {
+            close()
+        } else {
+            exporter.cancel()
+        }
+    }
+}
@@ -0,0 +1,350 @@
+//
+//  Exporter.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/14/16.
+//
+//
+
+import Foundation
+#if os(Linux)
+import Glibc
+#else
+import Darwin
+#endif
+
+/*
+ Exports samples to a file, as raw binary, 16-bit WAV, or CSV.  every channel goes in the same file, side by side,
+ lined up by age the way the scope view lines them up.
+ 
+ FORMATS (everything little-endian):
+    .bin    Int16 samples in ADC counts (0 to CONFIG_SAMPLE_MAX_VALUE), one per channel per frame, oldest frame first.
+            no header.
+    .wav    the usual 44-byte PCM header, then Int16 frames like .bin's, but with the ADC range centered on zero and
+            scaled up to the whole 16 bits.
+    .csv    a header row, then one line per frame: time (seconds since the first frame, to the microsecond), then every
+            channel in volts.
+ 
+ -it reads straight out of the rings (SampleBuffer.forEachSegment), CONFIG_EXPORT_BLOCK_FRAMES frames at a time,
+  converts each block into one big buffer and hands the whole thing to write().  nothing gets built per sample.
+ -CSV doesn't go near String(format:) once it's started.  the text of every possible sample value gets worked out once,
+  up front, into a table, and times are whole microseconds written out digit by digit.
+ -it runs on a queue of its own.  progress and how it went come back on the main queue.
+ -the writer keeps writing while we export, unless the scope's stopped.  like searches, a full ring's oldest
+  CONFIG_EXPORT_OLDEST_MARGIN is left alone (it's next to go), and the newest end is wherever it was at the start.
+*/
+
+enum ExportFormat {
+    case Binary
+    case WAV
+    case CSV
+    
+    var fileExtension:String {
+        switch (self) {
+        case .Binary:
+            return "bin"
+        case .WAV:
+            return "wav"
+        case .CSV:
+            return "csv"
+        }
+    }
+}
+
+class Exporter {
+    
+    static let wavHeaderSize:Int = 44
+    
+    let buffers:[SampleBuffer]
+    let names:[String]
+    let format:ExportFormat
+    let fileURL:NSURL
+    
+    // as ages, like the selection.  nil is everything the rings have.
+    let ageRange:TimeRange?
+    
+    private let gcdExportQueue = dispatch_queue_create("exportQueue", DISPATCH_QUEUE_SERIAL)
+    private var cancelled = false
+    
+    // how far it got.  only touched on the export queue until it's done.
+    private(set) var framesWritten:Int = 0
+    private(set) var bytesWritten:Int = 0
+    
+    init( buffers:[SampleBuffer], names:[String], ageRange:TimeRange?, format:ExportFormat, fileURL:NSURL ) {
+        self.buffers = buffers
+        self.names = names
+        self.ageRange = ageRange
+        self.format = format
+        self.fileURL = fileURL
+    }
+    
+    // progress gets how far along it is, 0 to 1.  done gets nil if it worked, or what went wrong.
+    func start( progress:(Double) -> (), done:(String?) -> () ) {
+        dispatch_async(gcdExportQueue, {
+            let failure = self.export(progress)
+            dispatch_async(dispatch_get_main_queue(), {
+                done(failure)
+            })
+        })
+    }
+    
+    // stops after the block it's on.  whatever's been written stays written.
+    func cancel() {
+        cancelled = true
+    }
+    
+    //
+    // EXPORTING - all on the export queue.
+    //
+    
+    private func export( progress:(Double) -> () ) -> String? {
+        let channelCount = buffers.count
+        if ( channelCount == 0 ) {
+            return "There aren't any channels to export."
+        }
+        
+        // which ages every channel has, and where that is in each ring.
+        // nothing from before a channel's last clear, either.
+        let committed = buffers.map({ $0.committedSampleCount })
+        let margin = CONFIG_EXPORT_OLDEST_MARGIN.asSampleIndex()
+        var oldestAge = Int.max
+        for i in 0..<channelCount {
+            let available = Int(min(committed[i] &- min(committed[i], buffers[i].validFromSampleIndex), UInt(buffers[i].capacity)))
+            let safe = (committed[i] >= UInt(buffers[i].capacity)) ? available - min(available, margin) : available
+            oldestAge = min(oldestAge, safe - 1)
+        }
+        var newestAge = 0
+        if let range = ageRange {
+            newestAge = max(0, range.newest.asSampleIndex())
+            oldestAge = min(oldestAge, range.oldest.asSampleIndex())
+        }
+        if ( oldestAge < newestAge ) {
+            return "There aren't any samples there."
+        }
+        let frames = oldestAge - newestAge + 1
+        let firstSampleIndices = committed.map({ $0 - 1 - UInt(oldestAge) })
+        
+        let fd = open(fileURL.path!, O_WRONLY | O_CREAT | O_TRUNC, 0o644)
+        if ( fd < 0 ) {
+            return "Couldn't open \(fileURL.path!) for writing."
+        }
+        defer {
+            close(fd)
+        }
+        
+        let csv:CSVFormatter? = (format == .CSV) ? CSVFormatter() : nil
+        let blockFrames = max(1, CONFIG_EXPORT_BLOCK_FRAMES)
+        let frameBlock = UnsafeMutablePointer<Sample>.alloc(blockFrames * channelCount)
+        let outputCapacity = max(blockFrames * (csv?.maximumLineLength(channelCount) ?? 2 * channelCount), Exporter.wavHeaderSize)
+        let output = UnsafeMutablePointer<UInt8>.alloc(outputCapacity)
+        defer {
+            frameBlock.dealloc(blockFrames * channelCount)
+            output.dealloc(outputCapacity)
+        }
+        
+        // the header, if there is one
+        switch (format) {
+        case .Binary:
+            break
+        case .WAV:
+            Exporter.fillWAVHeader(output, channelCount: channelCount, frameCount: frames)
+            if ( !writeAll(fd, bytes: output, count: Exporter.wavHeaderSize) ) {
+                return "Couldn't write to \(fileURL.path!)."
+            }
+        case .CSV:
+            let columns = ["time (s)"] + names.map({ $0 + " (V)" })
+            let row = columns.map({ "\"" + $0.stringByReplacingOccurrencesOfString("\"", withString: "\"\"") + "\"" }).joinWithSeparator(",") + "\n"
+            var bytes = Array(row.utf8)
+            if ( !writeAll(fd, bytes: &bytes, count: bytes.count) ) {
+                return "Couldn't write to \(fileURL.path!)."
+            }
+        }
+        
+        let wavScale = 32768 / ((Int(CONFIG_SAMPLE_MAX_VALUE) + 1) / 2)
+        let wavCenter = (Int(CONFIG_SAMPLE_MAX_VALUE) + 1) / 2
+        var lastProgress = CFAbsoluteTimeGetCurrent()
+        var done = 0
+        while ( done < frames ) {
+            if ( cancelled ) {
+                return "Cancelled."
+            }
+            let count = min(blockFrames, frames - done)
+            
+            // interleave the block, straight from the rings.  the array counts down, so every run goes in backwards.
+            for channel in 0..<channelCount {
+                let blockStart = firstSampleIndices[channel] + UInt(done)
+                buffers[channel].forEachSegment(blockStart, count: count, body: { segment, firstSampleIndex in
+                    var to = frameBlock + Int(firstSampleIndex - blockStart) * channelCount + channel
+                    for k in (0..<segment.count).reverse() {
+                        to.memory = Sample(segment[k])
+                        to += channelCount
+                    }
+                })
+            }
+            
+            // and convert it
+            var length = 0
+            switch (format) {
+            case .Binary:
+                let to = UnsafeMutablePointer<Int16>(output)
+                for i in 0..<(count * channelCount) {
+                    to[i] = Int16(truncatingBitPattern: frameBlock[i])
+                }
+                length = 2 * count * channelCount
+            case .WAV:
+                let to = UnsafeMutablePointer<Int16>(output)
+                for i in 0..<(count * channelCount) {
+                    to[i] = Int16(max(-32768, min(32767, (frameBlock[i] - wavCenter) * wavScale)))
+                }
+                length = 2 * count * channelCount
+            case .CSV:
+                length = csv!.format(frameBlock, frameCount: count, channelCount: channelCount, firstFrame: done, into: output)
+            }
+            if ( !writeAll(fd, bytes: output, count: length) ) {
+                return "Couldn't write to \(fileURL.path!)."
+            }
+            done += count
+            framesWritten = done
+            
+            let now = CFAbsoluteTimeGetCurrent()
+            if ( now - lastProgress > 0.1 ) {
+                lastProgress = now
+                let fraction = Double(done) / Double(frames)
+                dispatch_async(dispatch_get_main_queue(), {
+                    progress(fraction)
+                })
+            }
+        }
+        return nil
+    }
+    
+    // all of it, or false.
+    private func writeAll( fd:Int32, bytes:UnsafePointer<UInt8>, count:Int ) -> Bool {
+        var written = 0
+        while ( written < count ) {
+            let n = write(fd, bytes + written, count - written)
+            if ( n < 0 ) {
+                if ( errno == EINTR ) {
+                    continue
+                }
+                return false
+            }
+            written += n
+        }
+        bytesWritten += count
+        return true
+    }
+    
+    private class func fillWAVHeader( header:UnsafeMutablePointer<UInt8>, channelCount:Int, frameCount:Int ) {
+        let dataSize = UInt32(truncatingBitPattern: min(frameCount * channelCount * 2, Int(UInt32.max) - wavHeaderSize))
+        memset(header, 0, wavHeaderSize)
+        store(UInt32(0x46464952), at: 0, into: header) // "RIFF"
+        store(UInt32(36) &+ dataSize, at: 4, into: header)
+        store(UInt32(0x45564157), at: 8, into: header) // "WAVE"
+        store(UInt32(0x20746d66), at: 12, into: header) // "fmt "
+        store(UInt32(16), at: 16, into: header)
+        store(UInt16(1), at: 20, into: header) // PCM
+        store(UInt16(channelCount), at: 22, into: header)
+        store(UInt32(CONFIG_SAMPLERATE), at: 24, into: header)
+        store(UInt32(CONFIG_SAMPLERATE * channelCount * 2), at: 28, into: header)
+        store(UInt16(channelCount * 2), at: 32, into: header)
+        store(UInt16(16), at: 34, into: header)
+        store(UInt32(0x61746164), at: 36, into: header) // "data"
+        store(dataSize, at: 40, into: header)
+    }
+    
+    private class func store<T>( value:T, at offset:Int, into buffer:UnsafeMutablePointer<UInt8> ) {
+        UnsafeMutablePointer<T>(buffer + offset).memory = value
+    }
+}
+
+//
+// CSV TEXT - a table of every sample value's volts, and a digit loop for the times.
+//
+
+private final class CSVFormatter {
+    
+    // value v's text is text[offsets[v] ..< offsets[v+1]].
+    private let valueCount:Int
+    private let text:UnsafeMutablePointer<UInt8>
+    private let textLength:Int
+    private let offsets:UnsafeMutablePointer<Int>
+    private var longestValue:Int = 0
+    
+    init() {
+        valueCount = Int(CONFIG_SAMPLE_MAX_VALUE) + 1
+        var all:[UInt8] = []
+        offsets = UnsafeMutablePointer<Int>.alloc(valueCount + 1)
+        for v in 0..<valueCount {
+            offsets[v] = all.count
+            let bytes = Array(String(format: "%.4f", Sample(v).asVoltage()).utf8)
+            longestValue = max(longestValue, bytes.count)
+            all.appendContentsOf(bytes)
+        }
+        offsets[valueCount] = all.count
+        textLength = all.count
+        text = UnsafeMutablePointer<UInt8>.alloc(textLength)
+        for i in 0..<textLength {
+            text[i] = all[i]
+        }
+    }
+    
+    deinit {
+        text.dealloc(textLength)
+        offsets.dealloc(valueCount + 1)
+    }
+    
+    // the most one line can take: a time (20 digits, a point and 6 more), then a comma and a value per channel, then a newline.
+    func maximumLineLength( channelCount:Int ) -> Int {
+        return 27 + channelCount * (longestValue + 1) + 1
+    }
+    
+    // frames are interleaved, channelCount samples each.  returns how many bytes went into output.
+    func format( frames:UnsafePointer<Sample>, frameCount:Int, channelCount:Int, firstFrame:Int, into output:UnsafeMutablePointer<UInt8> ) -> Int {
+        let comma = UInt8(ascii: ",")
+        let point = UInt8(ascii: ".")
+        let newline = UInt8(ascii: "\n")
+        let zero = UInt8(ascii: "0")
+        let highest = valueCount - 1
+        var at = 0
+        for f in 0..<frameCount {
+            // the time: whole seconds, then exactly 6 digits of microseconds
+            let microseconds = (firstFrame + f) * 1000000 / CONFIG_SAMPLERATE
+            var seconds = microseconds / 1000000
+            var digits = 0
+            repeat {
+                digits += 1
+                seconds /= 10
+            } while ( seconds > 0 )
+            seconds = microseconds / 1000000
+            for d in (0..<digits).reverse() {
+                output[at + d] = zero + UInt8(seconds % 10)
+                seconds /= 10
+            }
+            at += digits
+            output[at] = point
+            var fraction = microseconds % 1000000
+            for d in (1...6).reverse() {
+                output[at + d] = zero + UInt8(fraction % 10)
+                fraction /= 10
+            }
+            at += 7
+            
+            // and the channels, out of the table
+            for channel in 0..<channelCount {
+                output[at] = comma
+                at += 1
+                let value = max(0, min(highest, frames[f * channelCount + channel]))
+                let start = offsets[value]
+                let length = offsets[value + 1] - start
+                for i in 0..<length {
+                    output[at + i] = text[start + i]
+                }
+                at += length
+            }
+            output[at] = newline
+            at += 1
+        }
+        return at
+    }
+}
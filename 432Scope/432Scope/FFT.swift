@@ -0,0 +1,224 @@
+//
+//  FFT.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/7/16.
+//
+//
+
+import Foundation
+
+/*
+ A plain-Swift real-input FFT.  No Accelerate, so it goes wherever the rest of the signal chain goes.
+ 
+ -an n-point real FFT is done as an n/2-point complex FFT on the even/odd samples packed into re/im, plus one
+  post-processing pass to pull the real spectrum back apart.  half the work of doing it the obvious way.
+ -the complex FFT is iterative radix-2 decimation-in-time.  everything is split real/imaginary arrays (not interleaved),
+  and the twiddles and bit-reversal permutation are all computed once in init, so the inner loops are straight
+  multiply-adds over contiguous memory that the compiler can vectorize.
+ -one FFT object per size, and it keeps its own scratch space, so don't share one between threads.
+*/
+
+class FFT {
+    
+    let size:Int
+    private let halfSize:Int
+    
+    // twiddles for the n/2-point complex FFT:  cos/sin(2*pi*k/(n/2)), k < n/4
+    private var twiddleCos:UnsafeMutablePointer<Float>
+    private var twiddleSin:UnsafeMutablePointer<Float>
+    
+    // twiddles for the real-spectrum post-processing:  cos/sin(2*pi*k/n), k <= n/2
+    private var realTwiddleCos:UnsafeMutablePointer<Float>
+    private var realTwiddleSin:UnsafeMutablePointer<Float>
+    
+    // where each of the n/2 complex inputs lands after the permutation
+    private var bitReversed:UnsafeMutablePointer<Int>
+    
+    // scratch
+    private var re:UnsafeMutablePointer<Float>
+    private var im:UnsafeMutablePointer<Float>
+    
+    class func isValidSize( size:Int ) -> Bool {
+        return size >= 4 && (size & (size - 1)) == 0
+    }
+    
+    init( size:Int ) {
+        precondition(FFT.isValidSize(size), "FFT size has to be a power of two, at least 4")
+        self.size = size
+        halfSize = size / 2
+        
+        twiddleCos = UnsafeMutablePointer<Float>.alloc(halfSize / 2)
+        twiddleSin = UnsafeMutablePointer<Float>.alloc(halfSize / 2)
+        for k in 0..<(halfSize / 2) {
+            let angle = 2.0 * M_PI * Double(k) / Double(halfSize)
+            twiddleCos[k] = Float(cos(angle))
+            twiddleSin[k] = Float(sin(angle))
+        }
+        
+        realTwiddleCos = UnsafeMutablePointer<Float>.alloc(halfSize + 1)
+        realTwiddleSin = UnsafeMutablePointer<Float>.alloc(halfSize + 1)
+        for k in 0...halfSize {
+            let angle = 2.0 * M_PI * Double(k) / Double(size)
+            realTwiddleCos[k] = Float(cos(angle))
+            realTwiddleSin[k] = Float(sin(angle))
+        }
+        
+        var bits = 0
+        while ( (1 << bits) < halfSize ) {
+            bits += 1
+        }
+        bitReversed = UnsafeMutablePointer<Int>.alloc(halfSize)
+        for i in 0..<halfSize {
+            var reversed = 0
+            var remaining = i
+            for _ in 0..<bits {
+                reversed = (reversed << 1) | (remaining & 1)
+                remaining >>= 1
+            }
+            bitReversed[i] = reversed
+        }
+        
+        re = UnsafeMutablePointer<Float>.alloc(halfSize)
+        im = UnsafeMutablePointer<Float>.alloc(halfSize)
+    }
+    
+    deinit {
+        twiddleCos.dealloc(halfSize / 2)
+        twiddleSin.dealloc(halfSize / 2)
+        realTwiddleCos.dealloc(halfSize + 1)
+        realTwiddleSin.dealloc(halfSize + 1)
+        bitReversed.dealloc(halfSize)
+        re.dealloc(halfSize)
+        im.dealloc(halfSize)
+    }
+    
+    //
+    // THE TRANSFORM
+    //
+    
+    // input: size real samples.  output: size/2+1 bins of |X[k]|^2, DC through Nyquist.
+    func powerSpectrum( input:UnsafePointer<Float>, output:UnsafeMutablePointer<Float> ) {
+        
+        // pack even samples into re, odd into im, in bit-reversed order.
+        for i in 0..<halfSize {
+            let j = bitReversed[i]
+            re[j] = input[2*i]
+            im[j] = input[2*i + 1]
+        }
+        
+        complexTransform()
+        
+        // pull the real spectrum out of the packed one.
+        //   Z = FFT(even + i*odd),  A = Z[k],  B = conj(Z[n/2-k])
+        //   X[k] = (A+B)/2 + W^k * (A-B)/(2i),  W = e^(-2*pi*i/n)
+        for k in 0...halfSize {
+            let a = (k == halfSize) ? 0 : k
+            let b = (k == 0) ? 0 : halfSize - k
+            let ar = re[a]
+            let ai = im[a]
+            let br = re[b]
+            let bi = -im[b]
+            
+            let er = 0.5 * (ar + br)
+            let ei = 0.5 * (ai + bi)
+            let or = 0.5 * (ai - bi)
+            let oi = -0.5 * (ar - br)
+            
+            let c = realTwiddleCos[k]
+            let s = realTwiddleSin[k]
+            let xr = er + c*or + s*oi
+            let xi = ei + c*oi - s*or
+            output[k] = xr*xr + xi*xi
+        }
+    }
+    
+    // in-place radix-2 DIT on re/im, which are already in bit-reversed order.
+    private func complexTransform() {
+        var span = 1
+        var twiddleStride = halfSize / 2
+        while ( span < halfSize ) {
+            // butterflies span apart.  the twiddle for butterfly j is W^(j*twiddleStride).
+            var groupStart = 0
+            while ( groupStart < halfSize ) {
+                let topRe = re + groupStart
+                let topIm = im + groupStart
+                let bottomRe = topRe + span
+                let bottomIm = topIm + span
+                for j in 0..<span {
+                    let wr = twiddleCos[j * twiddleStride]
+                    let wi = -twiddleSin[j * twiddleStride]
+                    let tr = wr*bottomRe[j] - wi*bottomIm[j]
+                    let ti = wr*bottomIm[j] + wi*bottomRe[j]
+                    bottomRe[j] = topRe[j] - tr
+                    bottomIm[j] = topIm[j] - ti
+                    topRe[j] = topRe[j] + tr
+                    topIm[j] = topIm[j] + ti
+                }
+                groupStart += 2 * span
+            }
+            span *= 2
+            twiddleStride /= 2
+        }
+    }
+}
+
+//
+// WINDOW FUNCTIONS
+//
+
+enum WindowFunction {
+    case Rectangular
+    case Hann
+    case Hamming
+    case Blackman
+    case BlackmanHarris
+    case FlatTop
+    
+    static let allValues:[WindowFunction] = [.Rectangular, .Hann, .Hamming, .Blackman, .BlackmanHarris, .FlatTop]
+    
+    var title:String {
+        get {
+            switch (self) {
+            case .Rectangular: return "Rectangular"
+            case .Hann: return "Hann"
+            case .Hamming: return "Hamming"
+            case .Blackman: return "Blackman"
+            case .BlackmanHarris: return "Blackman-Harris"
+            case .FlatTop: return "Flat Top"
+            }
+        }
+    }
+    
+    // they're all sums of cosines.  a0 - a1*cos(x) + a2*cos(2x) - a3*cos(3x) + a4*cos(4x)
+    private var cosineTerms:[Double] {
+        get {
+            switch (self) {
+            case .Rectangular: return [1.0]
+            case .Hann: return [0.5, 0.5]
+            case .Hamming: return [0.54, 0.46]
+            case .Blackman: return [0.42, 0.5, 0.08]
+            case .BlackmanHarris: return [0.35875, 0.48829, 0.14128, 0.01168]
+            case .FlatTop: return [0.21557895, 0.41663158, 0.277263158, 0.083578947, 0.006947368]
+            }
+        }
+    }
+    
+    // periodic form (divides by size, not size-1), which is what you want for spectral analysis.
+    func coefficients( size:Int ) -> [Float] {
+        let terms = cosineTerms
+        var rval:[Float] = []
+        rval.reserveCapacity(size)
+        for n in 0..<size {
+            let x = 2.0 * M_PI * Double(n) / Double(size)
+            var value:Double = 0
+            var sign:Double = 1
+            for t in 0..<terms.count {
+                value += sign * terms[t] * cos(Double(t) * x)
+                sign = -sign
+            }
+            rval.append(Float(value))
+        }
+        return rval
+    }
+}
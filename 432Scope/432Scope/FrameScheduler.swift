@@ -0,0 +1,149 @@
+//
+//  FrameScheduler.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/8/16.
+//
+//
+
+import Cocoa
+import CoreVideo
+
+/*
+ Drives the scope display off the screen's refresh, not off the data.
+ 
+ -a CVDisplayLink calls us on its own thread every vsync.  if the last frame is done, we hop onto the main queue and
+  render whatever's been committed to the channels' buffers by then.  no waiting on any particular channel.
+ -if the last frame ISN'T done, this vsync is skipped (and counted) rather than queueing up frames behind it.  that keeps
+  drawing from piling up behind mouse and keyboard events, so input latency stays around a frame.
+ -frames are capped at CONFIG_DISPLAY_REFRESH_RATE, so a 120 Hz display doesn't cost twice what a 60 Hz one does.
+ -once a second, the achieved frame rate and frame times get handed to frameStatsUpdated.
+*/
+
+protocol FrameSchedulerNotifications: class {
+    func renderFrame() // on the main queue.  draw now.
+    func frameStatsUpdated(stats:FrameStats)
+}
+
+struct FrameStats {
+    var framesPerSecond:Double = 0
+    var averageFrameTime:Double = 0 // seconds spent in renderFrame
+    var worstFrameTime:Double = 0
+    var skippedFrames:Int = 0 // vsyncs that came along while a frame was still going
+}
+
+class FrameScheduler {
+    
+    // weak: it's normally the view controller that owns the scheduler.
+    weak var notifications:FrameSchedulerNotifications? = nil
+    
+    private var displayLink:CVDisplayLink? = nil
+    
+    // set by the display link thread when it sends a frame over, cleared on the main queue when the frame's done.
+    private let frameInFlight = UnsafeMutablePointer<Int32>.alloc(1)
+    private let skippedFrameCounter = UnsafeMutablePointer<Int32>.alloc(1)
+    
+    private let minimumFrameInterval:CFTimeInterval = 1 / CONFIG_DISPLAY_REFRESH_RATE
+    private var lastFrameStart:CFTimeInterval = 0
+    
+    // stats, collected on the main queue
+    private var statsPeriodStart:CFTimeInterval = 0
+    private var statsFrameCount:Int = 0
+    private var statsFrameTimeSum:CFTimeInterval = 0
+    private var statsWorstFrameTime:CFTimeInterval = 0
+    private(set) var stats = FrameStats()
+    
+    init( ) {
+        frameInFlight.memory = 0
+        skippedFrameCounter.memory = 0
+        
+        if ( CVDisplayLinkCreateWithActiveCGDisplays(&displayLink) != kCVReturnSuccess ) {
+            print("----FrameScheduler.init: couldn't create a display link.  no frames for you.")
+            displayLink = nil
+            return
+        }
+        // weak, or the link would keep us around (and firing) forever, and deinit would never get to stop it.
+        CVDisplayLinkSetOutputHandler(displayLink!, { [weak self] (link, now, outputTime, flagsIn, flagsOut) -> CVReturn in
+            self?.vsync()
+            return kCVReturnSuccess
+        })
+    }
+    
+    deinit {
+        stop()
+        frameInFlight.dealloc(1)
+        skippedFrameCounter.dealloc(1)
+    }
+    
+    func start( ) {
+        if let link = displayLink {
+            statsPeriodStart = CACurrentMediaTime()
+            CVDisplayLinkStart(link)
+        }
+    }
+    
+    func stop( ) {
+        if let link = displayLink {
+            CVDisplayLinkStop(link)
+        }
+    }
+    
+    // when the window moves to another screen, follow that screen's refresh.
+    func followDisplay( displayID:CGDirectDisplayID ) {
+        if let link = displayLink {
+            CVDisplayLinkSetCurrentCGDisplay(link, displayID)
+        }
+    }
+    
+    //
+    // VSYNC - on the display link's thread.
+    //
+    
+    private func vsync( ) {
+        if ( OSAtomicCompareAndSwap32Barrier(0, 1, frameInFlight) ) {
+            dispatch_async( dispatch_get_main_queue(), {
+                self.frame()
+                OSAtomicCompareAndSwap32Barrier(1, 0, self.frameInFlight)
+            })
+        } else {
+            OSAtomicIncrement32Barrier(skippedFrameCounter)
+        }
+    }
+    
+    //
+    // FRAMES - on the main queue.
+    //
+    
+    private func frame( ) {
+        let start = CACurrentMediaTime()
+        
+        // a little slack, so vsync jitter doesn't knock a 60 Hz cap on a 60 Hz display down to 30.
+        if ( start - lastFrameStart < minimumFrameInterval * 0.9 ) {
+            return
+        }
+        lastFrameStart = start
+        
+        notifications?.renderFrame()
+        
+        let frameTime = CACurrentMediaTime() - start
+        statsFrameCount += 1
+        statsFrameTimeSum += frameTime
+        statsWorstFrameTime = max(statsWorstFrameTime, frameTime)
+        
+        // time to report?
+        let period = start - statsPeriodStart
+        if ( period >= 1.0 ) {
+            let skipped = Int(skippedFrameCounter.memory)
+            OSAtomicAdd32Barrier(Int32(-skipped), skippedFrameCounter)
+            stats = FrameStats(framesPerSecond: Double(statsFrameCount) / period,
+                               averageFrameTime: statsFrameTimeSum / Double(statsFrameCount),
+                               worstFrameTime: statsWorstFrameTime,
+                               skippedFrames: skipped)
+            statsPeriodStart = start
+            statsFrameCount = 0
+            statsFrameTimeSum = 0
+            statsWorstFrameTime = 0
+            notifications?.frameStatsUpdated(stats)
+        }
+    }
+}
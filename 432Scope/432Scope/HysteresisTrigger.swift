@@ -0,0 +1,523 @@
+//
+//  HysteresisTrigger.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/4/16.
+//
+//
+
+import Foundation
+
+/*
+ Block-oriented triggers.  TriggerStage hands these a whole block of committed samples at a time, and they walk it with tight scan loops instead of running a filter + FSM + base class call on every sample.
+ 
+ Noise immunity comes from hysteresis instead of a moving average: a crossing only counts once the signal has been all the way past the hysteresis band on the other side of the level.  Events land right on the level crossing, so there's no filter latency to compensate for.
+ 
+ HOW THEY WORK:
+ -the FSM state decides which threshold to look for next.
+ -a scan function (bottom of this file) runs over the block until that threshold is crossed.  that's one compare per sample, and whole chunks get skipped with a branch-free max/min.
+ -the period min/max is reduced over a stretch of samples only when an event closes it out, or when the block runs out.
+ 
+ To make a new one, derive from HysteresisTrigger and override scanBlock.  Call eventFound for every event.
+*/
+
+class HysteresisTrigger: Trigger {
+    
+    private(set) var hysteresis:Sample
+    
+    // where the still-open min/max period starts in the current block
+    private var periodStartOffset:Int = 0
+    
+    init( hysteresis:Voltage, notifications:TriggerNotifications ) {
+        self.hysteresis = max(hysteresis.asSampleDiff(), 0)
+        // like RisingEdgeTrigger, only watch the latest second of events.
+        super.init(capacity: CONFIG_SAMPLERATE, notifications: notifications)
+    }
+    
+    override func processBlock( block:UnsafeBufferPointer<Sample> ) {
+        super.blockWillBegin()
+        periodStartOffset = 0
+        
+        scanBlock(block)
+        
+        // whatever is left over belongs to the period that's still open.
+        foldPeriodMinMax(block, from: periodStartOffset, to: block.count)
+        super.blockDidFinish(block.count)
+    }
+    
+    override func processSample( sample:Sample ) {
+        // somebody's feeding us one at a time. that's just a really small block.
+        var theSample = sample
+        withUnsafePointer(&theSample) { samplePointer in
+            self.processBlock(UnsafeBufferPointer<Sample>(start: samplePointer, count: 1))
+        }
+    }
+    
+    // derived classes override this, walk the block, and call eventFound for each event.
+    func scanBlock( block:UnsafeBufferPointer<Sample> ) {
+        print("---HysteresisTrigger.scanBlock SHOULD NOT BE GETTING CALLED.")
+    }
+    
+    // returns the min/max of the period the event just closed.
+    func eventFound( block:UnsafeBufferPointer<Sample>, offset:Int ) -> (min:Sample, max:Sample) {
+        foldPeriodMinMax(block, from: periodStartOffset, to: offset+1)
+        periodStartOffset = offset+1
+        return super.blockEventHappened(offset)
+    }
+    
+    // the absolute timestamp of a sample in the current block, for triggers that measure time between crossings.
+    func timestampAtOffset( offset:Int ) -> UInt {
+        return super.blockStartTimestamp &+ UInt(offset)
+    }
+    
+    private func foldPeriodMinMax( block:UnsafeBufferPointer<Sample>, from:Int, to:Int ) {
+        if ( from >= to ) {
+            return
+        }
+        var lowest:Sample = Sample.max
+        var highest:Sample = Sample.min
+        for i in from..<to {
+            let sample = block[i]
+            lowest = min(lowest, sample)
+            highest = max(highest, sample)
+        }
+        super.mergePeriodMinMax(lowest, max: highest)
+    }
+}
+
+//
+// EDGES: rising, falling, or either.
+//
+
+class EdgeTrigger: HysteresisTrigger {
+    
+    enum Slope {
+        case Rising
+        case Falling
+        case Either
+    }
+    
+    private(set) var slope:Slope
+    private(set) var triggerLevel:Sample
+    private(set) var autoLevel:Bool
+    private var autoLevelFilter:AveragingFilter<Sample>
+    
+    private enum EdgeTriggerState {
+        case WaitingToArmRise
+        case ArmedForRise
+        case WaitingToArmFall
+        case ArmedForFall
+    }
+    private var triggerState:EdgeTriggerState
+    
+    init( slope:Slope, triggerLevel:Voltage, hysteresis:Voltage, autoLevel:Bool, notifications:TriggerNotifications ) {
+        self.slope = slope
+        self.triggerLevel = triggerLevel.asSample()
+        self.autoLevel = autoLevel
+        self.autoLevelFilter = AveragingFilter<Sample>(bufferSize: 16, startingAverage: triggerLevel.asSample())
+        self.triggerState = (slope == .Falling) ? .WaitingToArmFall : .WaitingToArmRise
+        super.init(hysteresis: hysteresis, notifications: notifications)
+    }
+    
+    override func scanBlock( block:UnsafeBufferPointer<Sample> ) {
+        let end = block.count
+        var i:Int = 0
+        while ( i < end ) {
+            switch triggerState {
+            case .WaitingToArmRise:
+                i = firstIndexAtOrBelow(block, from: i, threshold: triggerLevel - hysteresis - 1)
+                if ( i < end ) {
+                    triggerState = .ArmedForRise
+                    i += 1
+                }
+                break
+            case .ArmedForRise:
+                i = firstIndexAtOrAbove(block, from: i, threshold: triggerLevel)
+                if ( i < end ) {
+                    edgeHappened(block, offset: i)
+                    triggerState = (slope == .Either) ? .WaitingToArmFall : .WaitingToArmRise
+                    i += 1
+                }
+                break
+            case .WaitingToArmFall:
+                i = firstIndexAtOrAbove(block, from: i, threshold: triggerLevel + hysteresis + 1)
+                if ( i < end ) {
+                    triggerState = .ArmedForFall
+                    i += 1
+                }
+                break
+            case .ArmedForFall:
+                i = firstIndexAtOrBelow(block, from: i, threshold: triggerLevel)
+                if ( i < end ) {
+                    edgeHappened(block, offset: i)
+                    triggerState = (slope == .Either) ? .WaitingToArmRise : .WaitingToArmFall
+                    i += 1
+                }
+                break
+            }
+        }
+    }
+    
+    private func edgeHappened( block:UnsafeBufferPointer<Sample>, offset:Int ) {
+        let period = eventFound(block, offset: offset)
+        // auto-level adjustment for the next period ...
+        if ( autoLevel ) {
+            triggerLevel = autoLevelFilter.filter((period.max + period.min) / 2)
+        }
+    }
+}
+
+//
+// WINDOW: the signal leaves (or enters) the band between two levels.
+//
+
+class WindowTrigger: HysteresisTrigger {
+    
+    enum Condition {
+        case Exits
+        case Enters
+    }
+    
+    private(set) var condition:Condition
+    private(set) var lowLevel:Sample
+    private(set) var highLevel:Sample
+    
+    private var isArmed:Bool = false
+    
+    init( condition:Condition, lowLevel:Voltage, highLevel:Voltage, hysteresis:Voltage, notifications:TriggerNotifications ) {
+        self.condition = condition
+        self.lowLevel = min(lowLevel, highLevel).asSample()
+        self.highLevel = max(lowLevel, highLevel).asSample()
+        super.init(hysteresis: hysteresis, notifications: notifications)
+        // an exit trigger has to be able to arm somewhere inside the window.
+        if ( condition == .Exits ) {
+            self.hysteresis = min(self.hysteresis, (self.highLevel - self.lowLevel) / 2)
+        }
+    }
+    
+    override func scanBlock( block:UnsafeBufferPointer<Sample> ) {
+        let end = block.count
+        var i:Int = 0
+        while ( i < end ) {
+            switch condition {
+            case .Exits:
+                if ( isArmed ) {
+                    i = firstIndexOutside(block, from: i, low: lowLevel, high: highLevel)
+                } else {
+                    i = firstIndexInside(block, from: i, low: lowLevel + hysteresis, high: highLevel - hysteresis)
+                }
+                break
+            case .Enters:
+                if ( isArmed ) {
+                    i = firstIndexInside(block, from: i, low: lowLevel, high: highLevel)
+                } else {
+                    i = firstIndexOutside(block, from: i, low: lowLevel - hysteresis, high: highLevel + hysteresis)
+                }
+                break
+            }
+            if ( i < end ) {
+                if ( isArmed ) {
+                    eventFound(block, offset: i)
+                }
+                isArmed = !isArmed
+                i += 1
+            }
+        }
+    }
+}
+
+//
+// PULSE WIDTH: a pulse narrower or wider than a limit.  The event is the trailing edge.
+//
+
+class PulseWidthTrigger: HysteresisTrigger {
+    
+    enum Polarity {
+        case Positive
+        case Negative
+    }
+    
+    enum Condition {
+        case NarrowerThan
+        case WiderThan
+    }
+    
+    private(set) var polarity:Polarity
+    private(set) var condition:Condition
+    private(set) var triggerLevel:Sample
+    private(set) var widthLimit:UInt // in samples
+    
+    private enum PulseTriggerState {
+        case WaitingToArmLeadingEdge
+        case ArmedForLeadingEdge
+        case WaitingToArmTrailingEdge
+        case ArmedForTrailingEdge
+    }
+    private var triggerState:PulseTriggerState = .WaitingToArmLeadingEdge
+    private var leadingEdgeTimestamp:UInt = 0
+    
+    init( polarity:Polarity, condition:Condition, triggerLevel:Voltage, width:Time, hysteresis:Voltage, notifications:TriggerNotifications ) {
+        self.polarity = polarity
+        self.condition = condition
+        self.triggerLevel = triggerLevel.asSample()
+        self.widthLimit = UInt(max(width.asSampleIndex(), 1))
+        super.init(hysteresis: hysteresis, notifications: notifications)
+    }
+    
+    override func scanBlock( block:UnsafeBufferPointer<Sample> ) {
+        // positive pulses lead with a rising edge, negative ones with a falling edge.
+        let leadingEdgeRises = (polarity == .Positive)
+        let towardPulse:Sample = leadingEdgeRises ? 1 : -1
+        
+        let end = block.count
+        var i:Int = 0
+        while ( i < end ) {
+            switch triggerState {
+            case .WaitingToArmLeadingEdge:
+                i = firstIndexPast(block, from: i, threshold: triggerLevel - towardPulse*(hysteresis+1), rising: !leadingEdgeRises)
+                if ( i < end ) {
+                    triggerState = .ArmedForLeadingEdge
+                    i += 1
+                }
+                break
+            case .ArmedForLeadingEdge:
+                i = firstIndexPast(block, from: i, threshold: triggerLevel, rising: leadingEdgeRises)
+                if ( i < end ) {
+                    leadingEdgeTimestamp = timestampAtOffset(i)
+                    triggerState = .WaitingToArmTrailingEdge
+                    i += 1
+                }
+                break
+            case .WaitingToArmTrailingEdge:
+                i = firstIndexPast(block, from: i, threshold: triggerLevel + towardPulse*(hysteresis+1), rising: leadingEdgeRises)
+                if ( i < end ) {
+                    triggerState = .ArmedForTrailingEdge
+                    i += 1
+                }
+                break
+            case .ArmedForTrailingEdge:
+                i = firstIndexPast(block, from: i, threshold: triggerLevel, rising: !leadingEdgeRises)
+                if ( i < end ) {
+                    let width = timestampAtOffset(i) &- leadingEdgeTimestamp
+                    switch condition {
+                    case .NarrowerThan:
+                        if ( width < widthLimit ) {
+                            eventFound(block, offset: i)
+                        }
+                        break
+                    case .WiderThan:
+                        if ( width > widthLimit ) {
+                            eventFound(block, offset: i)
+                        }
+                        break
+                    }
+                    triggerState = .WaitingToArmLeadingEdge
+                    i += 1
+                }
+                break
+            }
+        }
+    }
+}
+
+//
+// RUNT: a pulse that crosses the first level but turns around before reaching the second.  The event is where it comes back.
+//
+
+class RuntTrigger: HysteresisTrigger {
+    
+    enum Polarity {
+        case Positive // starts low, doesn't make it up to highLevel
+        case Negative // starts high, doesn't make it down to lowLevel
+    }
+    
+    private(set) var polarity:Polarity
+    private(set) var lowLevel:Sample
+    private(set) var highLevel:Sample
+    
+    private enum RuntTriggerState {
+        case WaitingToArm
+        case Armed
+        case InPulse
+    }
+    private var triggerState:RuntTriggerState = .WaitingToArm
+    
+    init( polarity:Polarity, lowLevel:Voltage, highLevel:Voltage, hysteresis:Voltage, notifications:TriggerNotifications ) {
+        self.polarity = polarity
+        self.lowLevel = min(lowLevel, highLevel).asSample()
+        self.highLevel = max(lowLevel, highLevel).asSample()
+        super.init(hysteresis: hysteresis, notifications: notifications)
+    }
+    
+    override func scanBlock( block:UnsafeBufferPointer<Sample> ) {
+        let end = block.count
+        var i:Int = 0
+        while ( i < end ) {
+            switch polarity {
+            case .Positive:
+                i = scanPositive(block, from: i)
+                break
+            case .Negative:
+                i = scanNegative(block, from: i)
+                break
+            }
+        }
+    }
+    
+    // each of these takes one FSM step and returns where the next one should start.
+    
+    private func scanPositive( block:UnsafeBufferPointer<Sample>, from:Int ) -> Int {
+        let end = block.count
+        var i = from
+        switch triggerState {
+        case .WaitingToArm:
+            i = firstIndexAtOrBelow(block, from: i, threshold: lowLevel - hysteresis - 1)
+            if ( i < end ) {
+                triggerState = .Armed
+            }
+            break
+        case .Armed:
+            i = firstIndexAtOrAbove(block, from: i, threshold: lowLevel)
+            if ( i < end ) {
+                triggerState = .InPulse
+            }
+            break
+        case .InPulse:
+            // it either makes it to the high level (a real pulse) or drops back out of the band (a runt).
+            i = firstIndexOutside(block, from: i, low: lowLevel - hysteresis, high: highLevel - 1)
+            if ( i < end ) {
+                if ( block[i] >= highLevel ) {
+                    triggerState = .WaitingToArm
+                } else {
+                    eventFound(block, offset: i)
+                    triggerState = .Armed
+                }
+            }
+            break
+        }
+        return i + 1
+    }
+    
+    private func scanNegative( block:UnsafeBufferPointer<Sample>, from:Int ) -> Int {
+        let end = block.count
+        var i = from
+        switch triggerState {
+        case .WaitingToArm:
+            i = firstIndexAtOrAbove(block, from: i, threshold: highLevel + hysteresis + 1)
+            if ( i < end ) {
+                triggerState = .Armed
+            }
+            break
+        case .Armed:
+            i = firstIndexAtOrBelow(block, from: i, threshold: highLevel)
+            if ( i < end ) {
+                triggerState = .InPulse
+            }
+            break
+        case .InPulse:
+            i = firstIndexOutside(block, from: i, low: lowLevel + 1, high: highLevel + hysteresis)
+            if ( i < end ) {
+                if ( block[i] <= lowLevel ) {
+                    triggerState = .WaitingToArm
+                } else {
+                    eventFound(block, offset: i)
+                    triggerState = .Armed
+                }
+            }
+            break
+        }
+        return i + 1
+    }
+}
+
+//
+// SCAN FUNCTIONS
+//
+// Each returns the index of the first sample in block[from..<block.count] that meets its condition, or block.count if there isn't one.
+// The search goes a chunk at a time first: a chunk's max (or min) is computed without branches, and only a chunk that could hold the answer gets searched sample by sample.
+//
+
+private let scanChunkSize:Int = 8
+
+private func firstIndexAtOrAbove( block:UnsafeBufferPointer<Sample>, from:Int, threshold:Sample ) -> Int {
+    let p = block.baseAddress
+    let end = block.count
+    var i = from
+    while ( (i + scanChunkSize) <= end ) {
+        let chunkMax = max(max(max(p[i], p[i+1]), max(p[i+2], p[i+3])), max(max(p[i+4], p[i+5]), max(p[i+6], p[i+7])))
+        if ( chunkMax >= threshold ) {
+            break
+        }
+        i += scanChunkSize
+    }
+    while ( i < end ) {
+        if ( p[i] >= threshold ) {
+            return i
+        }
+        i += 1
+    }
+    return end
+}
+
+private func firstIndexAtOrBelow( block:UnsafeBufferPointer<Sample>, from:Int, threshold:Sample ) -> Int {
+    let p = block.baseAddress
+    let end = block.count
+    var i = from
+    while ( (i + scanChunkSize) <= end ) {
+        let chunkMin = min(min(min(p[i], p[i+1]), min(p[i+2], p[i+3])), min(min(p[i+4], p[i+5]), min(p[i+6], p[i+7])))
+        if ( chunkMin <= threshold ) {
+            break
+        }
+        i += scanChunkSize
+    }
+    while ( i < end ) {
+        if ( p[i] <= threshold ) {
+            return i
+        }
+        i += 1
+    }
+    return end
+}
+
+private func firstIndexPast( block:UnsafeBufferPointer<Sample>, from:Int, threshold:Sample, rising:Bool ) -> Int {
+    if ( rising ) {
+        return firstIndexAtOrAbove(block, from: from, threshold: threshold)
+    }
+    return firstIndexAtOrBelow(block, from: from, threshold: threshold)
+}
+
+// strictly below low or strictly above high
+private func firstIndexOutside( block:UnsafeBufferPointer<Sample>, from:Int, low:Sample, high:Sample ) -> Int {
+    let p = block.baseAddress
+    let end = block.count
+    var i = from
+    while ( (i + scanChunkSize) <= end ) {
+        let chunkMin = min(min(min(p[i], p[i+1]), min(p[i+2], p[i+3])), min(min(p[i+4], p[i+5]), min(p[i+6], p[i+7])))
+        let chunkMax = max(max(max(p[i], p[i+1]), max(p[i+2], p[i+3])), max(max(p[i+4], p[i+5]), max(p[i+6], p[i+7])))
+        if ( (chunkMin < low) || (chunkMax > high) ) {
+            break
+        }
+        i += scanChunkSize
+    }
+    while ( i < end ) {
+        if ( (p[i] < low) || (p[i] > high) ) {
+            return i
+        }
+        i += 1
+    }
+    return end
+}
+
+// low <= sample <= high.  a chunk can't be ruled out by its min/max alone here, so this one just goes sample by sample.
+private func firstIndexInside( block:UnsafeBufferPointer<Sample>, from:Int, low:Sample, high:Sample ) -> Int {
+    let p = block.baseAddress
+    let end = block.count
+    var i = from
+    while ( i < end ) {
+        if ( (p[i] >= low) && (p[i] <= high) ) {
+            return i
+        }
+        i += 1
+    }
+    return end
+}
@@ -0,0 +1,290 @@
+//
+//  Instrumentation.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/12/16.
+//
+//
+
+import Foundation
+#if os(Linux)
+import Glibc
+#else
+import Darwin
+#endif
+
+/*
+ Where the time goes, from a byte arriving on the serial port to a pixel changing.
+ 
+ -each stage of the pipeline has a PipelineStat: a count, a sum, a min and max, and a log2 histogram, so there are percentiles
+  without keeping every value.  most stats are nanoseconds; a few are sizes in bytes.
+ -stages time themselves with Instrumentation.now() and stat.recordElapsed(since:).  values go in from whatever queue the
+  stage runs on; each stat has its own lock, and nothing records more than once a packet or once a frame, so that's cheap.
+ -Instrumentation.snapshot() gets a consistent copy of everything, for the stats panel (StatsPanel.swift), the CLI, or
+  the periodic dump, which logs a summary and optionally writes JSON (see CONFIG_INSTRUMENTATION_*).
+ 
+ All of it compiles out unless INSTRUMENTATION is defined (Other Swift Flags: -DINSTRUMENTATION).  when it's off, now()
+ returns 0 and record does nothing, and both inline away, so the call sites can stay put.
+*/
+
+enum StatUnit: String {
+    case Nanoseconds = "ns"
+    case Bytes = "bytes"
+}
+
+struct PipelineStatSnapshot {
+    let name:String
+    let unit:StatUnit
+    let count:UInt64
+    let sum:UInt64
+    let min:UInt64
+    let max:UInt64
+    let histogram:[UInt64] // bucket b holds values in [2^(b-1), 2^b), bucket 0 holds 0
+    
+    var mean:Double {
+        return count > 0 ? Double(sum) / Double(count) : 0
+    }
+    
+    // the upper edge of the bucket the percentile falls in, clamped to the real max.  good to a factor of two, which is plenty to see where time goes.
+    func percentile( fraction:Double ) -> UInt64 {
+        if ( count == 0 ) {
+            return 0
+        }
+        let target = UInt64(ceil(Double(count) * fraction))
+        var seen:UInt64 = 0
+        for b in 0..<histogram.count {
+            seen += histogram[b]
+            if ( seen >= target ) {
+                let upperEdge:UInt64 = (b == 0) ? 0 : (b >= 64 ? UInt64.max : (UInt64(1) << UInt64(b)) - 1)
+                return Swift.min(upperEdge, max)
+            }
+        }
+        return max
+    }
+    
+    var asDictionary:[String:AnyObject] {
+        return [
+            "unit": unit.rawValue,
+            "count": NSNumber(unsignedLongLong: count),
+            "mean": mean,
+            "min": NSNumber(unsignedLongLong: min),
+            "max": NSNumber(unsignedLongLong: max),
+            "p50": NSNumber(unsignedLongLong: percentile(0.5)),
+            "p90": NSNumber(unsignedLongLong: percentile(0.9)),
+            "p99": NSNumber(unsignedLongLong: percentile(0.99)),
+            "histogram": histogram.map({ NSNumber(unsignedLongLong: $0) }),
+        ]
+    }
+    
+    // one line, for logs and the CLI.
+    var summary:String {
+        let paddedName = name.stringByPaddingToLength(24, withString: " ", startingAtIndex: 0)
+        if ( count == 0 ) {
+            return paddedName + " -"
+        }
+        if ( unit == .Nanoseconds ) {
+            return paddedName + String(format: " n=%-8llu mean %9.1fus  p50 %9.1fus  p99 %9.1fus  max %9.1fus", count,
+                          mean / 1000, Double(percentile(0.5)) / 1000, Double(percentile(0.99)) / 1000, Double(max) / 1000)
+        }
+        return paddedName + String(format: " n=%-8llu mean %9.0f  p50 %9llu  p99 %9llu  max %9llu %@", count, mean,
+                      percentile(0.5), percentile(0.99), max, unit.rawValue)
+    }
+}
+
+final class PipelineStat {
+    
+    static let bucketCount = 48
+    
+    let name:String
+    let unit:StatUnit
+    
+    // on the heap: a mutex has to stay put, and a stored property passed inout isn't promised to.
+    private let lock = UnsafeMutablePointer<pthread_mutex_t>.alloc(1)
+    private var count:UInt64 = 0
+    private var sum:UInt64 = 0
+    private var minimum:UInt64 = UInt64.max
+    private var maximum:UInt64 = 0
+    private var histogram = [UInt64](count: PipelineStat.bucketCount, repeatedValue: 0)
+    
+    init( name:String, unit:StatUnit ) {
+        self.name = name
+        self.unit = unit
+        pthread_mutex_init(lock, nil)
+    }
+    
+    deinit {
+        pthread_mutex_destroy(lock)
+        lock.dealloc(1)
+    }
+    
+    @inline(__always) func record( value:UInt64 ) {
+        #if INSTRUMENTATION
+        // which power of two: 64 minus the leading zeros.
+        var bucket = 0
+        var v = value
+        while ( v != 0 ) {
+            bucket += 1
+            v >>= 1
+        }
+        bucket = Swift.min(bucket, PipelineStat.bucketCount - 1)
+        
+        pthread_mutex_lock(lock)
+        count += 1
+        sum = sum &+ value
+        if ( value < minimum ) {
+            minimum = value
+        }
+        if ( value > maximum ) {
+            maximum = value
+        }
+        histogram[bucket] += 1
+        pthread_mutex_unlock(lock)
+        #endif
+    }
+    
+    @inline(__always) func recordElapsed( since start:UInt64 ) {
+        #if INSTRUMENTATION
+        record(Instrumentation.now() &- start)
+        #endif
+    }
+    
+    func snapshot() -> PipelineStatSnapshot {
+        pthread_mutex_lock(lock)
+        let rval = PipelineStatSnapshot(name: name, unit: unit, count: count, sum: sum, min: (count > 0) ? minimum : 0, max: maximum, histogram: histogram)
+        pthread_mutex_unlock(lock)
+        return rval
+    }
+    
+    func reset() {
+        pthread_mutex_lock(lock)
+        count = 0
+        sum = 0
+        minimum = UInt64.max
+        maximum = 0
+        histogram = [UInt64](count: PipelineStat.bucketCount, repeatedValue: 0)
+        pthread_mutex_unlock(lock)
+    }
+}
+
+class Instrumentation {
+    
+    static var isEnabled:Bool {
+        #if INSTRUMENTATION
+        return true
+        #else
+        return false
+        #endif
+    }
+    
+    //
+    // THE STAGES, in pipeline order.
+    //
+    
+    static let serialReadBytes = PipelineStat(name: "serial.readBytes", unit: .Bytes)                  // per dispatch source event
+    static let packetizerBacklogBytes = PipelineStat(name: "packetizer.backlogBytes", unit: .Bytes)     // left over after packetizing
+    static let decode = PipelineStat(name: "decoder.decode", unit: .Nanoseconds)                       // per packet, not counting the store
+    static let bufferWriteQueueWait = PipelineStat(name: "buffer.writeQueueWait", unit: .Nanoseconds)  // waiting on the write queue, i.e. on suspendWrites
+    static let bufferWrite = PipelineStat(name: "buffer.write", unit: .Nanoseconds)                    // per block, on the write queue
+    static let trigger = PipelineStat(name: "trigger.processBlock", unit: .Nanoseconds)                // per block, on the trigger stage's queue
+    static let minMax = PipelineStat(name: "display.minMax", unit: .Nanoseconds)                       // per channel per frame
+    static let drawRect = PipelineStat(name: "display.drawRect", unit: .Nanoseconds)                   // per frame, scope and spectrum views
+    static let commitToDraw = PipelineStat(name: "display.commitToDraw", unit: .Nanoseconds)           // newest commit to the start of the frame showing it
+    
+    static let allStats:[PipelineStat] = [serialReadBytes, packetizerBacklogBytes, decode, bufferWriteQueueWait, bufferWrite,
+                                          trigger, minMax, drawRect, commitToDraw]
+    
+    //
+    // THE CLOCK - monotonic nanoseconds.
+    //
+    
+    #if os(Linux)
+    @inline(__always) static func now() -> UInt64 {
+        #if INSTRUMENTATION
+        var ts = timespec()
+        clock_gettime(CLOCK_MONOTONIC, &ts)
+        return UInt64(ts.tv_sec) * 1_000_000_000 + UInt64(ts.tv_nsec)
+        #else
+        return 0
+        #endif
+    }
+    #else
+    private static let timebase:mach_timebase_info_data_t = {
+        var info = mach_timebase_info_data_t()
+        mach_timebase_info(&info)
+        return info
+    }()
+    
+    @inline(__always) static func now() -> UInt64 {
+        #if INSTRUMENTATION
+        return mach_absolute_time() * UInt64(timebase.numer) / UInt64(timebase.denom)
+        #else
+        return 0
+        #endif
+    }
+    #endif
+    
+    //
+    // SNAPSHOTS AND DUMPS
+    //
+    
+    class func snapshot() -> [PipelineStatSnapshot] {
+        return allStats.map({ $0.snapshot() })
+    }
+    
+    class func reset() {
+        for stat in allStats {
+            stat.reset()
+        }
+    }
+    
+    class func jsonData( snapshots:[PipelineStatSnapshot] ) -> NSData? {
+        var stages:[String:AnyObject] = [:]
+        for s in snapshots {
+            stages[s.name] = s.asDictionary
+        }
+        let file:[String:AnyObject] = [
+            "date": NSDate().description,
+            "enabled": isEnabled,
+            "stages": stages,
+        ]
+        return try? NSJSONSerialization.dataWithJSONObject(file, options: .PrettyPrinted)
+    }
+    
+    class func summary( snapshots:[PipelineStatSnapshot] ) -> String {
+        if ( !isEnabled ) {
+            return "instrumentation is compiled out.  build with -DINSTRUMENTATION to turn it on."
+        }
+        return snapshots.map({ $0.summary }).joinWithSeparator("\n")
+    }
+    
+    private static var gcdDumpTimer:dispatch_source_t? = nil
+    
+    // every interval seconds, log the summary, and write the JSON to fileURL if there is one (replacing it each time).
+    class func startPeriodicDump( interval:Double, fileURL:NSURL? ) {
+        stopPeriodicDump()
+        if ( !isEnabled ) {
+            return
+        }
+        let timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0))
+        let nanoseconds = UInt64(interval * Double(NSEC_PER_SEC))
+        dispatch_source_set_timer(timer, dispatch_time(DISPATCH_TIME_NOW, Int64(nanoseconds)), nanoseconds, nanoseconds / 10)
+        dispatch_source_set_event_handler(timer, {
+            let snapshots = snapshot()
+            print("----Instrumentation:\n" + summary(snapshots))
+            if let url = fileURL, data = jsonData(snapshots) {
+                if ( !data.writeToURL(url, atomically: true) ) {
+                    print("----Instrumentation: couldn't write \(url.path!)")
+                }
+            }
+        })
+        dispatch_resume(timer)
+        gcdDumpTimer = timer
+    }
+    
+    class func stopPeriodicDump() {
+        if let timer = gcdDumpTimer {
+            dispatch_source_cancel(timer)
+            gcdDumpTimer = nil
+        }
+    }
+}
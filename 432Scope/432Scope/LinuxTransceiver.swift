@@ -0,0 +1,259 @@
+//
+//  LinuxTransceiver.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/14/16.
+//
+//
+
+import Foundation
+#if os(Linux)
+import Glibc
+#else
+import Darwin
+#endif
+
+/*
+ The Transceiver for linux, so the headless core (432scope-cli) can run on the capture boxes at full rate.
+ 
+ BIG PICTURE:
+ 
+ -same job as Transceiver: open the terminal, set it to raw 3 Mbaud, cut what comes in into Decoder packets, send the
+  one-byte commands.  what's different is how it gets there.
+ -the baud rate goes in through termios2 with BOTHER (c_set_custom_baud_rate), so it isn't stuck with the Bxxx table.
+ -ASYNC_LOW_LATENCY goes on if the driver takes it.  for FTDI parts that also drops the chip's latency timer to 1 ms.
+  drivers that don't do TIOCSSERIAL are fine, it's just not as snappy.
+ -there's no knob for the tty layer's receive buffers from userspace, so instead it keeps them empty: reads come from a
+  dedicated thread (c_serial_reader_start) that sleeps in epoll and then read()s up to CONFIG_SERIAL_READ_SIZE at a time
+  until the descriptor is dry.  no dispatch source, no NSFileHandle.
+ -the packetizer fills one packet-sized buffer in place instead of slicing an NSMutableData every packet.
+ 
+ -the decoder gets called on the reader thread, one packet at a time, same as it gets called on Transceiver's queue.
+ -if the reader thread stops by itself (the device got unplugged, or epoll gave up), that's the channel gone:
+  failureHandler gets a ChannelFatal, and send (so startStreaming / stopStreaming) throws it until a flush gets a new
+  reader going.
+*/
+
+#if os(Linux)
+
+final class LinuxTransceiver: SampleSource {
+    
+    var decoder:Decoder
+    let deviceFilePath:String
+    let baudRate:UInt32
+    
+    private var fileDescriptor:Int32 = -1
+    private var originalTermios = termios()
+    private var reader:COpaquePointer = nil
+    
+    // the packet being filled.  only the reader thread touches it while the reader's running.
+    private let packetSize:Int = CONFIG_DECODER_PACKET_SIZE
+    private let packet:UnsafeMutablePointer<UInt8>
+    private var packetFill:Int = 0
+    
+    // called on the reader thread when it stops by itself.  nothing more comes in after that.
+    var failureHandler:((Error) -> ())? = nil
+    
+    // the reader thread sets it, and whoever's calling send reads it, so it's behind a lock.  the lock's on the heap
+    // so it doesn't move (see PipelineStat).
+    private var failureStorage:Error? = nil
+    private let failureLock = UnsafeMutablePointer<pthread_mutex_t>.alloc(1)
+    
+    private(set) var failure:Error? {
+        get {
+            pthread_mutex_lock(failureLock)
+            defer {
+                pthread_mutex_unlock(failureLock)
+            }
+            return failureStorage
+        }
+        set {
+            pthread_mutex_lock(failureLock)
+            failureStorage = newValue
+            pthread_mutex_unlock(failureLock)
+        }
+    }
+    
+    var sourceName:String {
+        return deviceFilePath
+    }
+    
+    var isOpen:Bool {
+        return fileDescriptor != -1
+    }
+    
+    init( deviceFilePath:String, decoder:Decoder, baudRate:UInt32 = UInt32(CONFIG_BAUDRATE) ) throws {
+        self.deviceFilePath = deviceFilePath
+        self.decoder = decoder
+        self.baudRate = baudRate
+        packet = UnsafeMutablePointer<UInt8>.alloc(packetSize)
+        pthread_mutex_init(failureLock, nil)
+        try openTerminal()
+    }
+    
+    deinit {
+        // the reader's context is an unretained self, so it can't outlive us.
+        stopReader()
+        if ( isOpen ) {
+            tcsetattr(fileDescriptor, TCSANOW, &originalTermios)
+            c_close_posix_file_descriptor(fileDescriptor)
+        }
+        packet.dealloc(packetSize)
+        pthread_mutex_destroy(failureLock)
+        failureLock.dealloc(1)
+    }
+    
+    //
+    // INTERNALS
+    //
+    
+    private func openTerminal( ) throws {
+        fileDescriptor = c_get_posix_file_descriptor(deviceFilePath)
+        if ( fileDescriptor == -1 ) {
+            throw Error.ChannelFatal("open() error \(errno): \(String.fromCString(strerror(errno)) ?? "")")
+        }
+        
+        // epoll wants a descriptor that says EAGAIN when it's dry, rather than one that blocks the reader thread.
+        if ( fcntl(fileDescriptor, F_SETFL, O_NONBLOCK) == -1 ) {
+            try failOpen("fcntl()")
+        }
+        
+        if ( tcgetattr(fileDescriptor, &originalTermios) == -1 ) {
+            try failOpen("tcgetattr()")
+        }
+        var newTermios = termios()
+        cfmakeraw(&newTermios)
+        newTermios.c_cflag = tcflag_t(CS8 | CREAD | CLOCAL)
+        if ( tcsetattr(fileDescriptor, TCSANOW, &newTermios) == -1 ) {
+            try failOpen("tcsetattr()")
+        }
+        
+        // the real speed, on top of what tcsetattr just did.
+        if ( c_set_custom_baud_rate(fileDescriptor, baudRate) == -1 ) {
+            try failOpen("setting \(baudRate) baud")
+        }
+        
+        if ( c_set_low_latency(fileDescriptor) == -1 ) {
+            print("\(deviceFilePath): no low latency mode (\(String.fromCString(strerror(errno)) ?? "")), carrying on without it.")
+        }
+        
+        tcflush(fileDescriptor, TCIOFLUSH)
+        try startReader()
+    }
+    
+    // puts the terminal back and gives up.
+    private func failOpen( what:String ) throws {
+        let message = "\(what) error \(errno): \(String.fromCString(strerror(errno)) ?? "")"
+        tcsetattr(fileDescriptor, TCSANOW, &originalTermios)
+        c_close_posix_file_descriptor(fileDescriptor)
+        fileDescriptor = -1
+        throw Error.ChannelFatal(message)
+    }
+    
+    // a new reader starts with a clean slate.  the old one's been joined (or never was), so it can't fail after this.
+    private func startReader( ) throws {
+        failure = nil
+        let context = UnsafeMutablePointer<Void>(Unmanaged.passUnretained(self).toOpaque())
+        reader = c_serial_reader_start(fileDescriptor, CONFIG_SERIAL_READ_SIZE, { context, bytes, count in
+            let transceiver = Unmanaged<LinuxTransceiver>.fromOpaque(COpaquePointer(context)).takeUnretainedValue()
+            transceiver.bytesArrived(bytes, count: count)
+        }, { context, error in
+            let transceiver = Unmanaged<LinuxTransceiver>.fromOpaque(COpaquePointer(context)).takeUnretainedValue()
+            transceiver.readerFailed(error)
+        }, context)
+        if ( reader == nil ) {
+            throw Error.ChannelFatal("couldn't start the serial reader thread: \(String.fromCString(strerror(errno)) ?? "")")
+        }
+    }
+    
+    private func stopReader( ) {
+        if ( reader != nil ) {
+            c_serial_reader_stop(reader)
+            reader = nil
+        }
+    }
+    
+    // reader thread.  the packetizer: top up the packet, ship it when it's full, repeat.
+    private func bytesArrived( bytes:UnsafePointer<UInt8>, count:Int ) {
+        Instrumentation.serialReadBytes.record(UInt64(count))
+        var used = 0
+        while ( used < count ) {
+            let take = min(count - used, packetSize - packetFill)
+            (packet + packetFill).assignFrom(UnsafeMutablePointer<UInt8>(bytes + used), count: take)
+            packetFill += take
+            used += take
+            if ( packetFill == packetSize ) {
+                decoder.newPacketArrived(NSData(bytes: packet, length: packetSize))
+                packetFill = 0
+            }
+        }
+        Instrumentation.packetizerBacklogBytes.record(UInt64(packetFill))
+    }
+    
+    // reader thread, its last act.  the reader stays allocated until stopReader joins it.
+    private func readerFailed( error:Int32 ) {
+        let fatal = Error.ChannelFatal("\(deviceFilePath): reading stopped, error \(error): \(String.fromCString(strerror(error)) ?? "")")
+        failure = fatal
+        failureHandler?(fatal)
+    }
+    
+    func send( nameOfCommandToSend:String ) throws {
+        if ( !isOpen ) {
+            throw Error.ChannelFatal("Terminal isn't open.")
+        }
+        if let fatal = failure {
+            throw fatal
+        }
+        guard var cmdByte = UART432Commands[nameOfCommandToSend] else {
+            throw Error.ChannelFatal("Unknown command.")
+        }
+        // one byte into an empty output queue.  non-blocking doesn't come into it.
+        let result = write(fileDescriptor, &cmdByte, 1)
+        if ( result != 1 ) {
+            throw Error.ChannelFatal("write() error \(errno): \(String.fromCString(strerror(errno)) ?? "")")
+        }
+    }
+    
+    //
+    // SampleSource
+    //
+    
+    func startStreaming( ) throws {
+        try send("Start")
+    }
+    
+    func stopStreaming( ) throws {
+        try send("Stop")
+    }
+    
+    // the reader owns the packet, so it stops while the slate gets wiped.
+    func flush( ) {
+        if ( !isOpen ) {
+            return
+        }
+        stopReader()
+        tcflush(fileDescriptor, TCIOFLUSH)
+        packetFill = 0
+        do {
+            try startReader()
+        } catch let msg {
+            print("\(deviceFilePath): \(msg)")
+        }
+    }
+    
+    func close( ) throws {
+        if ( !isOpen ) {
+            throw Error.ChannelFatal("This transceiver wasn't open.")
+        }
+        stopReader()
+        let restored = tcsetattr(fileDescriptor, TCSANOW, &originalTermios)
+        let closed = c_close_posix_file_descriptor(fileDescriptor)
+        fileDescriptor = -1
+        if ( restored == -1 || closed == -1 ) {
+            throw Error.ChannelFatal("couldn't close \(deviceFilePath) cleanly: \(String.fromCString(strerror(errno)) ?? "")")
+        }
+        print("Transceiver closed.")
+    }
+}
+
+#endif
@@ -0,0 +1,807 @@
+//
+//  MathChannel.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/13/16.
+//
+//
+
+import Foundation
+
+/*
+ Virtual channels: A-B, A+B, A*B, 2*A+0.5, int(A), diff(A), abs(A-B), and so on, over the real channels.
+ 
+ BIG PICTURE:
+ 
+ -a MathChannel is a Channel, so the scope view and a ChannelViewController draw and measure it like any other.  where a
+  real channel reads its SampleBuffer, a math channel reads MathSamples, which answers the same SampleHistory questions
+  (minmax columns, sample copies, the newest sample) by computing them from its inputs' buffers.
+ -nothing is ever materialized.  values get computed when somebody asks, a block at a time: the expression is a tree of
+  nodes, and each node fills its own block-sized array of volts from its children's, so A-B is two copies and a subtract.
+ -minmax columns get cached by sample index and count, so a stopped view, or the columns ColumnCache asks for again,
+  cost nothing.  only whole columns (every sample committed) go in, and the oldest entry goes out when it's full.  a
+  cleared input, an integral starting over, or the inputs sliding against each other (which changes what every index
+  means for all but the first) throws the cache out.
+ -sample indices are the first input's.  other inputs get lined up by age, the same way the scope view lines up
+  channels, so two 432s started at different times still subtract properly.
+ -values are volts on the way through, and get handed back as samples on the usual voltage scale, so A*B is in V^2,
+  diff(A) in V/s and int(A) in V*s, all drawn on the volts axis.  scale them (1000*diff(A)) to taste.
+ -int(A) starts at 0 when the channel gets made.  it keeps a running total every packet's worth of samples, so
+  looking at any part of it only costs the integral from the nearest checkpoint.  if nobody looks for so long that
+  the ring laps the newest checkpoint, it starts over from the oldest sample there is.
+ 
+ Math channels are DerivedChannels (DerivedChannel.swift): they don't trigger, record, stream or get a spectrum.  Their
+ inputs do all that.
+*/
+
+indirect enum MathExpression {
+    case Input(Channel)
+    case Sum(MathExpression, MathExpression)
+    case Difference(MathExpression, MathExpression)
+    case Product(MathExpression, MathExpression)
+    case Scaled(MathExpression, gain:Double, offset:Voltage)
+    case Integral(MathExpression)
+    case Derivative(MathExpression)
+    case AbsoluteValue(MathExpression)
+    
+    // every channel it reads, leftmost first.
+    var inputs:[Channel] {
+        switch (self) {
+        case .Input(let channel):
+            return [channel]
+        case .Sum(let a, let b):
+            return MathExpression.merge(a.inputs, b.inputs)
+        case .Difference(let a, let b):
+            return MathExpression.merge(a.inputs, b.inputs)
+        case .Product(let a, let b):
+            return MathExpression.merge(a.inputs, b.inputs)
+        case .Scaled(let a, _, _):
+            return a.inputs
+        case .Integral(let a):
+            return a.inputs
+        case .Derivative(let a):
+            return a.inputs
+        case .AbsoluteValue(let a):
+            return a.inputs
+        }
+    }
+    
+    private static func merge( a:[Channel], _ b:[Channel] ) -> [Channel] {
+        var rval = a
+        for channel in b where !rval.contains({ $0 === channel }) {
+            rval.append(channel)
+        }
+        return rval
+    }
+}
+
+//
+// THE CHANNEL
+//
+
+class MathChannel: DerivedChannel {
+    
+    let expression:MathExpression
+    let mathSamples:MathSamples
+    private let expressionText:String
+    
+    init( expression:MathExpression, text:String ) {
+        self.expression = expression
+        expressionText = text
+        mathSamples = MathSamples(expression: expression)
+        super.init()
+    }
+    
+    override var name:String {
+        return "Math: " + expressionText
+    }
+    
+    override var samples:SampleHistory {
+        return mathSamples
+    }
+    
+}
+
+//
+// THE SAMPLES - computed on demand.  like everything else the scope view reads, only use this on the main thread.
+//
+
+class MathSamples: SampleHistory {
+    
+    let expression:MathExpression
+    private let primary:SampleBuffer
+    private let inputBuffers:[SampleBuffer]
+    private let root:MathNode
+    
+    // one block of values at a time
+    private let blockCapacity:Int = CONFIG_DECODER_PACKET_SIZE / CONFIG_INCOMING_SAMPLE_SIZE_IN_BYTES
+    private let block:UnsafeMutablePointer<Double>
+    
+    // minmax columns we've already worked out, and what the world looked like when we did: the clear count, and where
+    // each input's committed count sat against the first one's.  columnCacheOrder is the keys in the order they went in,
+    // as a ring, so the oldest is the one to go.
+    private var columnCache:[MathColumnKey:(min:Sample, max:Sample)] = [:]
+    private var columnCacheGeneration:UInt = 0
+    private var columnCacheAlignment:[Int] = []
+    private var columnCacheOrder:[MathColumnKey] = []
+    private var columnCacheNext:Int = 0
+    
+    init( expression:MathExpression ) {
+        self.expression = expression
+        inputBuffers = expression.inputs.map({ $0.sampleBuffer })
+        primary = inputBuffers[0]
+        root = MathSamples.makeNode(expression, primary: primary, maxCount: blockCapacity)
+        block = UnsafeMutablePointer<Double>.alloc(blockCapacity)
+    }
+    
+    deinit {
+        block.dealloc(blockCapacity)
+    }
+    
+    private class func makeNode( expression:MathExpression, primary:SampleBuffer, maxCount:Int ) -> MathNode {
+        switch (expression) {
+        case .Input(let channel):
+            return InputNode(buffer: channel.sampleBuffer, primary: primary, maxCount: maxCount)
+        case .Sum(let a, let b):
+            return BinaryNode(operation: .Sum, left: makeNode(a, primary: primary, maxCount: maxCount), right: makeNode(b, primary: primary, maxCount: maxCount), maxCount: maxCount)
+        case .Difference(let a, let b):
+            return BinaryNode(operation: .Difference, left: makeNode(a, primary: primary, maxCount: maxCount), right: makeNode(b, primary: primary, maxCount: maxCount), maxCount: maxCount)
+        case .Product(let a, let b):
+            return BinaryNode(operation: .Product, left: makeNode(a, primary: primary, maxCount: maxCount), right: makeNode(b, primary: primary, maxCount: maxCount), maxCount: maxCount)
+        case .Scaled(let a, let gain, let offset):
+            return ScaleNode(inner: makeNode(a, primary: primary, maxCount: maxCount), gain: gain, offset: Double(offset), maxCount: maxCount)
+        case .Integral(let a):
+            return IntegralNode(inner: makeNode(a, primary: primary, maxCount: maxCount), primary: primary, maxCount: maxCount)
+        case .Derivative(let a):
+            // one sample of history in front of every block
+            return DerivativeNode(inner: makeNode(a, primary: primary, maxCount: maxCount + 1), maxCount: maxCount)
+        case .AbsoluteValue(let a):
+            return AbsoluteValueNode(inner: makeNode(a, primary: primary, maxCount: maxCount), maxCount: maxCount)
+        }
+    }
+    
+    //
+    // SampleHistory
+    //
+    
+    var capacity:Int {
+        return inputBuffers.map({ $0.capacity }).minElement()!
+    }
+    
+    var committedSampleCount:UInt {
+        return primary.committedSampleCount
+    }
+    
+    // changes whenever values we've already handed out might be different now.
+    var clearCount:UInt {
+        return inputBuffers.reduce(root.restartCount, combine: { $0 &+ $1.clearCount })
+    }
+    
+    var lastCommitTime:UInt64 {
+        return inputBuffers.map({ $0.lastCommitTime }).maxElement()!
+    }
+    
+    func getSampleAtTime( time:Time ) -> Sample {
+        var value:Sample = 0
+        copySamples(UInt(max(0, newestSampleIndex - time.asSampleIndex())), count: 1, destination: &value)
+        return value
+    }
+    
+    // newest first, like SampleBuffer's.
+    func getSampleRange( timeRange:TimeRange ) -> Array<Sample> {
+        let newestAge = timeRange.newest.asSampleIndex()
+        let count = timeRange.oldest.asSampleIndex() - newestAge
+        if ( count <= 0 ) {
+            return []
+        }
+        var rval = [Sample](count: count + 1, repeatedValue: 0)
+        copySamples(UInt(max(0, newestSampleIndex - newestAge - count)), count: count + 1, destination: &rval)
+        return rval.reverse()
+    }
+    
+    func copySamples( firstSampleIndex:UInt, count:Int, destination:UnsafeMutablePointer<Sample> ) {
+        evaluate(Int(firstSampleIndex), count: count, visit: { values, offset in
+            for i in 0..<values.count {
+                destination[offset + i] = MathSamples.sampleOfVoltage(values[i])
+            }
+        })
+    }
+    
+    func getMinMax( firstSampleIndex:Int, count:Int ) -> (min:Sample, max:Sample) {
+        if ( count <= 0 ) {
+            return (min: Sample.max, max: Sample.min)
+        }
+        checkColumnCache()
+        let key = MathColumnKey(firstSampleIndex: firstSampleIndex, count: count)
+        if let cached = columnCache[key] {
+            return cached
+        }
+        
+        var minimum = Double.infinity
+        var maximum = -Double.infinity
+        evaluate(firstSampleIndex, count: count, visit: { values, offset in
+            for v in values {
+                minimum = Swift.min(minimum, v)
+                maximum = Swift.max(maximum, v)
+            }
+        })
+        let rval = (min: MathSamples.sampleOfVoltage(minimum), max: MathSamples.sampleOfVoltage(maximum))
+        
+        // the newest column is still filling up, so it'd be wrong next time.  don't keep it.
+        if ( firstSampleIndex + count <= Int(primary.committedSampleCount) ) {
+            cacheColumn(key, minMax: rval)
+        }
+        return rval
+    }
+    
+    func getColumnMinMaxes( newestSampleIndex:Int, samplesPerColumn:Double, columnCount:Int ) -> [(min:Sample, max:Sample)] {
+        return walkColumnMinMaxes(newestSampleIndex, samplesPerColumn: samplesPerColumn, columnCount: columnCount)
+    }
+    
+    func getSubRangeMinMaxes( timeRange:TimeRange, howManySubranges:Int ) -> [(min:Sample, max:Sample)] {
+        return walkSubRangeMinMaxes(timeRange, howManySubranges: howManySubranges)
+    }
+    
+    //
+    // EVALUATION
+    //
+    
+    private var newestSampleIndex:Int {
+        return Int(primary.committedSampleCount) - 1
+    }
+    
+    // the values for count samples from firstSampleIndex on, a block at a time.  visit gets each block and where it starts in the run.
+    private func evaluate( firstSampleIndex:Int, count:Int, visit:(UnsafeBufferPointer<Double>, Int) -> () ) {
+        var offset = 0
+        while ( offset < count ) {
+            let blockCount = Swift.min(count - offset, blockCapacity)
+            root.evaluate(firstSampleIndex + offset, count: blockCount, destination: block)
+            visit(UnsafeBufferPointer<Double>(start: block, count: blockCount), offset)
+            offset += blockCount
+        }
+    }
+    
+    private func checkColumnCache() {
+        let generation = clearCount
+        let primaryCommitted = Int(primary.committedSampleCount)
+        let alignment = inputBuffers.map({ Int($0.committedSampleCount) - primaryCommitted })
+        if ( generation != columnCacheGeneration || alignment != columnCacheAlignment ) {
+            columnCache = [:]
+            columnCacheOrder = []
+            columnCacheNext = 0
+            columnCacheGeneration = generation
+            columnCacheAlignment = alignment
+        }
+    }
+    
+    private func cacheColumn( key:MathColumnKey, minMax:(min:Sample, max:Sample) ) {
+        if ( columnCacheOrder.count < CONFIG_MATH_COLUMN_CACHE_SIZE ) {
+            columnCacheOrder.append(key)
+        } else {
+            columnCache.removeValueForKey(columnCacheOrder[columnCacheNext])
+            columnCacheOrder[columnCacheNext] = key
+            columnCacheNext = (columnCacheNext + 1) % CONFIG_MATH_COLUMN_CACHE_SIZE
+        }
+        columnCache[key] = minMax
+    }
+    
+    // volts back to samples, on the same scale as Voltage.asSample, rounded.  clamped way out past anything real so a
+    // steep derivative can't overflow.
+    private class func sampleOfVoltage( volts:Double ) -> Sample {
+        let clamped = Swift.max(-1e9, Swift.min(1e9, volts))
+        return Sample(round((clamped - CONFIG_AFE_VOLTAGE_RANGE.min) * CONFIG_SAMPLES_PER_VOLT))
+    }
+}
+
+struct MathColumnKey: Hashable {
+    let firstSampleIndex:Int
+    let count:Int
+    
+    var hashValue:Int {
+        return firstSampleIndex.hashValue ^ (count.hashValue &* 31)
+    }
+}
+
+func ==( lhs:MathColumnKey, rhs:MathColumnKey ) -> Bool {
+    return lhs.firstSampleIndex == rhs.firstSampleIndex && lhs.count == rhs.count
+}
+
+//
+// THE OPERATORS - each one fills in up to maxCount values, in volts, for a run of sample indices (the first input's).
+//
+
+private class MathNode {
+    
+    let maxCount:Int
+    
+    init( maxCount:Int ) {
+        self.maxCount = maxCount
+    }
+    
+    func evaluate( firstSampleIndex:Int, count:Int, destination:UnsafeMutablePointer<Double> ) {
+        // this should be overridden
+        print("---MathNode.evaluate SHOULD NOT BE GETTING CALLED.")
+    }
+    
+    // bumps when values this node already gave out have changed.  only an integral starting over does that.
+    var restartCount:UInt {
+        return 0
+    }
+}
+
+private final class InputNode: MathNode {
+    
+    let buffer:SampleBuffer
+    let primary:SampleBuffer
+    private let scratch:UnsafeMutablePointer<Sample>
+    
+    init( buffer:SampleBuffer, primary:SampleBuffer, maxCount:Int ) {
+        self.buffer = buffer
+        self.primary = primary
+        scratch = UnsafeMutablePointer<Sample>.alloc(maxCount)
+        super.init(maxCount: maxCount)
+    }
+    
+    deinit {
+        scratch.dealloc(maxCount)
+    }
+    
+    override func evaluate( firstSampleIndex:Int, count:Int, destination:UnsafeMutablePointer<Double> ) {
+        // same age in this buffer.  the scope view has writes suspended while it draws, so this holds still.
+        let committed = Int(buffer.committedSampleCount)
+        let first = firstSampleIndex + committed - Int(primary.committedSampleCount)
+        
+        // anything not in the ring (not written yet, or long gone) is 0V.
+        let validFirst = Swift.max(first, Swift.max(0, committed - buffer.capacity))
+        let validEnd = Swift.min(first + count, committed)
+        for i in 0..<count {
+            destination[i] = 0
+        }
+        guard validEnd > validFirst else {
+            return
+        }
+        
+        let validCount = validEnd - validFirst
+        buffer.copySamples(UInt(validFirst), count: validCount, destination: scratch)
+        let out = destination + (validFirst - first)
+        let voltsAtZero = Double(CONFIG_AFE_VOLTAGE_RANGE.min)
+        let voltsPerSample = Double(CONFIG_VOLTS_PER_SAMPLE)
+        for i in 0..<validCount {
+            out[i] = voltsAtZero + Double(scratch[i]) * voltsPerSample
+        }
+    }
+}
+
+private final class BinaryNode: MathNode {
+    
+    enum Operation {
+        case Sum
+        case Difference
+        case Product
+    }
+    
+    let operation:Operation
+    let left:MathNode
+    let right:MathNode
+    private let scratch:UnsafeMutablePointer<Double>
+    
+    init( operation:Operation, left:MathNode, right:MathNode, maxCount:Int ) {
+        self.operation = operation
+        self.left = left
+        self.right = right
+        scratch = UnsafeMutablePointer<Double>.alloc(maxCount)
+        super.init(maxCount: maxCount)
+    }
+    
+    deinit {
+        scratch.dealloc(maxCount)
+    }
+    
+    override func evaluate( firstSampleIndex:Int, count:Int, destination:UnsafeMutablePointer<Double> ) {
+        left.evaluate(firstSampleIndex, count: count, destination: destination)
+        right.evaluate(firstSampleIndex, count: count, destination: scratch)
+        
+        // one loop per operation, so there's no switch in the middle of them.
+        switch (operation) {
+        case .Sum:
+            for i in 0..<count {
+                destination[i] += scratch[i]
+            }
+        case .Difference:
+            for i in 0..<count {
+                destination[i] -= scratch[i]
+            }
+        case .Product:
+            for i in 0..<count {
+                destination[i] *= scratch[i]
+            }
+        }
+    }
+    
+    override var restartCount:UInt {
+        return left.restartCount &+ right.restartCount
+    }
+}
+
+private final class ScaleNode: MathNode {
+    
+    let inner:MathNode
+    let gain:Double
+    let offset:Double
+    
+    init( inner:MathNode, gain:Double, offset:Double, maxCount:Int ) {
+        self.inner = inner
+        self.gain = gain
+        self.offset = offset
+        super.init(maxCount: maxCount)
+    }
+    
+    override func evaluate( firstSampleIndex:Int, count:Int, destination:UnsafeMutablePointer<Double> ) {
+        inner.evaluate(firstSampleIndex, count: count, destination: destination)
+        for i in 0..<count {
+            destination[i] = destination[i] * gain + offset
+        }
+    }
+    
+    override var restartCount:UInt {
+        return inner.restartCount
+    }
+}
+
+private final class AbsoluteValueNode: MathNode {
+    
+    let inner:MathNode
+    
+    init( inner:MathNode, maxCount:Int ) {
+        self.inner = inner
+        super.init(maxCount: maxCount)
+    }
+    
+    override func evaluate( firstSampleIndex:Int, count:Int, destination:UnsafeMutablePointer<Double> ) {
+        inner.evaluate(firstSampleIndex, count: count, destination: destination)
+        for i in 0..<count {
+            destination[i] = abs(destination[i])
+        }
+    }
+    
+    override var restartCount:UInt {
+        return inner.restartCount
+    }
+}
+
+// backward difference, in volts per second.
+private final class DerivativeNode: MathNode {
+    
+    let inner:MathNode
+    private let scratch:UnsafeMutablePointer<Double>
+    
+    init( inner:MathNode, maxCount:Int ) {
+        self.inner = inner
+        scratch = UnsafeMutablePointer<Double>.alloc(maxCount + 1)
+        super.init(maxCount: maxCount)
+    }
+    
+    deinit {
+        scratch.dealloc(maxCount + 1)
+    }
+    
+    override func evaluate( firstSampleIndex:Int, count:Int, destination:UnsafeMutablePointer<Double> ) {
+        inner.evaluate(firstSampleIndex - 1, count: count + 1, destination: scratch)
+        let sampleRate = Double(CONFIG_SAMPLERATE)
+        for i in 0..<count {
+            destination[i] = (scratch[i + 1] - scratch[i]) * sampleRate
+        }
+    }
+    
+    override var restartCount:UInt {
+        return inner.restartCount
+    }
+}
+
+// running integral in volt-seconds, 0 at the anchor and everywhere before it.
+private final class IntegralNode: MathNode {
+    
+    let inner:MathNode
+    let primary:SampleBuffer
+    private let scratch:UnsafeMutablePointer<Double>
+    private let samplePeriod = Double(CONFIG_SAMPLEPERIOD)
+    
+    private var anchor:Int
+    private var restarts:UInt = 0
+    
+    // checkpoints[k] is the integral up to (not including) anchor + (firstCheckpoint + k) * maxCount.
+    private var checkpoints:[Double] = [0]
+    private var firstCheckpoint:Int = 0
+    
+    // where the last evaluate left off, so consecutive runs don't go back to a checkpoint.
+    private var lastEnd:Int? = nil
+    private var lastValue:Double = 0
+    
+    init( inner:MathNode, primary:SampleBuffer, maxCount:Int ) {
+        self.inner = inner
+        self.primary = primary
+        anchor = Int(primary.committedSampleCount)
+        scratch = UnsafeMutablePointer<Double>.alloc(maxCount)
+        super.init(maxCount: maxCount)
+    }
+    
+    deinit {
+        scratch.dealloc(maxCount)
+    }
+    
+    override var restartCount:UInt {
+        return restarts &+ inner.restartCount
+    }
+    
+    override func evaluate( firstSampleIndex:Int, count:Int, destination:UnsafeMutablePointer<Double> ) {
+        var running = integralBefore(Swift.max(firstSampleIndex, anchor))
+        inner.evaluate(firstSampleIndex, count: count, destination: scratch)
+        
+        let lead = Swift.max(0, Swift.min(count, anchor - firstSampleIndex))
+        for i in 0..<lead {
+            destination[i] = 0
+        }
+        for i in lead..<count {
+            running += scratch[i] * samplePeriod
+            destination[i] = running
+        }
+        lastEnd = firstSampleIndex + count
+        lastValue = running
+    }
+    
+    // the integral over anchor ..< sampleIndex.
+    private func integralBefore( sampleIndex:Int ) -> Double {
+        if ( sampleIndex <= anchor ) {
+            return 0
+        }
+        // close to where the last run ended?  go from there.  columns that overlap by a sample or two land here.
+        if let end = lastEnd where end >= anchor && abs(sampleIndex - end) < maxCount {
+            if ( sampleIndex >= end ) {
+                return lastValue + integrate(end, count: sampleIndex - end)
+            }
+            return lastValue - integrate(sampleIndex, count: end - sampleIndex)
+        }
+        
+        // the checkpoints can only be brought up to date if the samples after the newest one are still in the ring.
+        let oldestAvailable = Int(primary.committedSampleCount) - primary.capacity
+        let k = (sampleIndex - anchor) / maxCount
+        let newestKey = firstCheckpoint + checkpoints.count - 1
+        if ( k > newestKey && anchor + newestKey * maxCount < oldestAvailable ) {
+            print("----IntegralNode: fell behind the ring, starting over at sample \(oldestAvailable)")
+            anchor = oldestAvailable
+            checkpoints = [0]
+            firstCheckpoint = 0
+            lastEnd = nil
+            restarts = restarts &+ 1
+            return integralBefore(sampleIndex)
+        }
+        
+        while ( firstCheckpoint + checkpoints.count - 1 < k ) {
+            let start = anchor + (firstCheckpoint + checkpoints.count - 1) * maxCount
+            checkpoints.append(checkpoints.last! + integrate(start, count: maxCount))
+        }
+        
+        // checkpoints for samples the ring has forgotten are no use to anybody.
+        let ringCheckpoints = primary.capacity / maxCount + 2
+        if ( checkpoints.count > 2 * ringCheckpoints ) {
+            let drop = checkpoints.count - ringCheckpoints
+            checkpoints.removeFirst(drop)
+            firstCheckpoint += drop
+        }
+        
+        // a sample older than every checkpoint we kept.  this integral's history doesn't go back that far any more.
+        if ( k < firstCheckpoint ) {
+            return checkpoints[0]
+        }
+        let base = anchor + k * maxCount
+        return checkpoints[k - firstCheckpoint] + integrate(base, count: sampleIndex - base)
+    }
+    
+    private func integrate( firstSampleIndex:Int, count:Int ) -> Double {
+        if ( count <= 0 ) {
+            return 0
+        }
+        inner.evaluate(firstSampleIndex, count: count, destination: scratch)
+        var sum:Double = 0
+        for i in 0..<count {
+            sum += scratch[i]
+        }
+        return sum * samplePeriod
+    }
+}
+
+//
+// PARSING - "A-B", "2*A + 0.5", "abs(int(A) - int(B))".  letters are the inputs, in order.  int(), diff() and abs()
+// are the functions.  numbers can scale and offset, but only a channel can multiply a channel.
+//
+
+extension MathExpression {
+    
+    private enum Term {
+        case Constant(Double)
+        case Signal(MathExpression)
+    }
+    
+    static func parse( text:String, inputs:[Channel] ) throws -> MathExpression {
+        var parser = MathParser(text: text, inputs: inputs)
+        let term = try parser.parseSum()
+        parser.skipSpaces()
+        if ( !parser.isAtEnd ) {
+            throw Error.ChannelFatal("MathExpression: don't know what to do with \"\(parser.rest)\".")
+        }
+        guard case .Signal(let expression) = term else {
+            throw Error.ChannelFatal("MathExpression: \(text) doesn't use any channels.")
+        }
+        return expression
+    }
+    
+    private struct MathParser {
+        let characters:[Character]
+        let inputs:[Channel]
+        var position:Int = 0
+        
+        init( text:String, inputs:[Channel] ) {
+            characters = Array(text.characters)
+            self.inputs = inputs
+        }
+        
+        var isAtEnd:Bool {
+            return position >= characters.count
+        }
+        
+        var rest:String {
+            return String(characters[position..<characters.count])
+        }
+        
+        mutating func skipSpaces() {
+            while ( !isAtEnd && characters[position] == " " ) {
+                position += 1
+            }
+        }
+        
+        mutating func take( c:Character ) -> Bool {
+            skipSpaces()
+            if ( !isAtEnd && characters[position] == c ) {
+                position += 1
+                return true
+            }
+            return false
+        }
+        
+        // sum := product (('+' | '-') product)*
+        mutating func parseSum() throws -> Term {
+            var lhs = try parseProduct()
+            while ( true ) {
+                if ( take("+") ) {
+                    lhs = try MathParser.combine(lhs, try parseProduct(), subtract: false)
+                } else if ( take("-") ) {
+                    lhs = try MathParser.combine(lhs, try parseProduct(), subtract: true)
+                } else {
+                    return lhs
+                }
+            }
+        }
+        
+        // product := unary ('*' unary)*
+        mutating func parseProduct() throws -> Term {
+            var lhs = try parseUnary()
+            while ( take("*") ) {
+                let rhs = try parseUnary()
+                switch (lhs, rhs) {
+                case (.Constant(let a), .Constant(let b)):
+                    lhs = .Constant(a * b)
+                case (.Constant(let gain), .Signal(let e)):
+                    lhs = .Signal(.Scaled(e, gain: gain, offset: 0))
+                case (.Signal(let e), .Constant(let gain)):
+                    lhs = .Signal(.Scaled(e, gain: gain, offset: 0))
+                case (.Signal(let a), .Signal(let b)):
+                    lhs = .Signal(.Product(a, b))
+                }
+            }
+            return lhs
+        }
+        
+        // unary := '-' unary | primary
+        mutating func parseUnary() throws -> Term {
+            if ( take("-") ) {
+                switch (try parseUnary()) {
+                case .Constant(let a):
+                    return .Constant(-a)
+                case .Signal(let e):
+                    return .Signal(.Scaled(e, gain: -1, offset: 0))
+                }
+            }
+            return try parsePrimary()
+        }
+        
+        // primary := number | letter | function '(' sum ')' | '(' sum ')'
+        mutating func parsePrimary() throws -> Term {
+            skipSpaces()
+            if ( isAtEnd ) {
+                throw Error.ChannelFatal("MathExpression: it ends too soon.")
+            }
+            if ( take("(") ) {
+                let inside = try parseSum()
+                try expect(")")
+                return inside
+            }
+            
+            // a word: a channel letter or a function name.
+            var word = ""
+            while ( !isAtEnd && MathParser.isLetter(characters[position]) ) {
+                word.append(characters[position])
+                position += 1
+            }
+            if ( !word.isEmpty ) {
+                return try parseWord(word.lowercaseString)
+            }
+            
+            // otherwise it had better be a number.  an exponent can have a sign (1e-3, 2.5E+6), right after the e.
+            var number = ""
+            while ( !isAtEnd ) {
+                let c = characters[position]
+                let exponentSign = (c == "+" || c == "-") && (number.hasSuffix("e") || number.hasSuffix("E"))
+                if ( !exponentSign && !"0123456789.eE".characters.contains(c) ) {
+                    break
+                }
+                number.append(c)
+                position += 1
+            }
+            guard let value = Double(number) else {
+                throw Error.ChannelFatal("MathExpression: don't know what to do with \"\(rest)\".")
+            }
+            return .Constant(value)
+        }
+        
+        mutating func parseWord( word:String ) throws -> Term {
+            if ( word.characters.count == 1 ) {
+                let index = Int(word.unicodeScalars.first!.value) - Int(("a" as UnicodeScalar).value)
+                guard index >= 0 && index < inputs.count else {
+                    throw Error.ChannelFatal("MathExpression: there's no channel \(word.uppercaseString).  there are \(inputs.count).")
+                }
+                return .Signal(.Input(inputs[index]))
+            }
+            
+            try expect("(")
+            let argument = try parseSum()
+            try expect(")")
+            guard case .Signal(let e) = argument else {
+                throw Error.ChannelFatal("MathExpression: \(word)() needs a channel in it.")
+            }
+            switch (word) {
+            case "abs":
+                return .Signal(.AbsoluteValue(e))
+            case "int", "integral":
+                return .Signal(.Integral(e))
+            case "diff", "derivative":
+                return .Signal(.Derivative(e))
+            default:
+                throw Error.ChannelFatal("MathExpression: there's no function \(word)().  there's abs(), int() and diff().")
+            }
+        }
+        
+        mutating func expect( c:Character ) throws {
+            if ( !take(c) ) {
+                throw Error.ChannelFatal("MathExpression: expected \"\(c)\" at \"\(rest)\".")
+            }
+        }
+        
+        static func isLetter( c:Character ) -> Bool {
+            return "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ".characters.contains(c)
+        }
+        
+        static func combine( lhs:Term, _ rhs:Term, subtract:Bool ) throws -> Term {
+            let sign:Double = subtract ? -1 : 1
+            switch (lhs, rhs) {
+            case (.Constant(let a), .Constant(let b)):
+                return .Constant(a + sign * b)
+            case (.Signal(let e), .Constant(let b)):
+                return .Signal(.Scaled(e, gain: 1, offset: Voltage(sign * b)))
+            case (.Constant(let a), .Signal(let e)):
+                return .Signal(.Scaled(e, gain: sign, offset: Voltage(a)))
+            case (.Signal(let a), .Signal(let b)):
+                return .Signal(subtract ? .Difference(a, b) : .Sum(a, b))
+            }
+        }
+    }
+}
@@ -0,0 +1,288 @@
+//
+//  MeasurementEngine.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/8/16.
+//
+//
+
+import Foundation
+
+/*
+ Running measurements over every sample a channel takes in, as a reader stage on its sample buffer.
+ 
+ -samples get folded into a MeasurementAccumulator one block at a time: sums for mean and RMS, min/max, and a little
+  edge-tracking state machine for duty cycle, rise/fall time and frequency.
+ -every CONFIG_MEASUREMENT_WINDOW_LENGTH of samples, the accumulator's result gets published and a fresh one starts.
+ -the 10/50/90% reference levels for the edge stuff come from the previous window's min and max, so the first window
+  only gets the amplitude measurements.
+ -the UI grabs the newest result with getMeasurements whenever it likes.  polling faster or slower doesn't change what gets measured.
+ 
+ MeasurementEngine.measure does the same measurements over any range of samples that's still in the buffer, e.g. a selection.
+*/
+
+struct Measurements {
+    var sampleCount:Int = 0
+    var mean:Voltage = 0
+    var rms:Voltage = 0
+    var min:Voltage = 0
+    var max:Voltage = 0
+    
+    // these need a signal with edges in it.  nil when there weren't enough of them.
+    var dutyCycle:Double? = nil     // fraction of each period spent above the 50% level
+    var riseTime:Time? = nil        // 10% to 90%, averaged over every rising edge
+    var fallTime:Time? = nil        // 90% to 10%, averaged over every falling edge
+    var frequency:Frequency? = nil  // from interpolated 50% crossings
+    
+    var peakToPeak:Voltage {
+        get {
+            return max - min
+        }
+    }
+}
+
+//
+// THE ACCUMULATOR - does the actual measuring.  feed it samples in time order with add().
+//
+
+struct MeasurementAccumulator {
+    
+    // reference levels, in sample units.  nil means don't bother with edges.
+    typealias ReferenceLevels = (low:Double, mid:Double, high:Double)
+    private let levels:ReferenceLevels?
+    
+    private(set) var count:Int = 0
+    private var sum:Int = 0
+    private var sumOfSquares:Int = 0
+    private var minimum:Sample = Sample.max
+    private var maximum:Sample = Sample.min
+    
+    // edge tracking.  positions are in samples since the first one added, interpolated between samples.
+    private var previousSample:Sample = 0
+    private var armedForRisingEdge:Bool = false // true once the signal's been below the low level since the last rising edge
+    private var risingEdgeCount:Int = 0
+    private var firstRisingEdge:Double = 0
+    private var lastRisingEdge:Double = 0
+    private var isHigh:Bool = false
+    private var highSamples:Int = 0 // above the mid level, since the first rising edge
+    private var highSamplesAtLastRisingEdge:Int = 0
+    private var riseStart:Double? = nil
+    private var fallStart:Double? = nil
+    private var riseTimeSum:Double = 0
+    private var riseTimeCount:Int = 0
+    private var fallTimeSum:Double = 0
+    private var fallTimeCount:Int = 0
+    
+    init( levels:ReferenceLevels? ) {
+        self.levels = levels
+    }
+    
+    // 10/50/90% levels between a min and a max, or nil if the swing is too small to have edges worth measuring.
+    static func referenceLevels( min:Sample, max:Sample ) -> ReferenceLevels? {
+        let swing = Double(max - min)
+        if ( swing < Double(CONFIG_MEASUREMENT_MINIMUM_SWING.asSampleDiff()) ) {
+            return nil
+        }
+        return (low: Double(min) + 0.1 * swing, mid: Double(min) + 0.5 * swing, high: Double(min) + 0.9 * swing)
+    }
+    
+    mutating func add( block:UnsafeBufferPointer<Sample> ) {
+        for sample in block {
+            sum += sample
+            sumOfSquares += sample * sample
+            if ( sample < minimum ) {
+                minimum = sample
+            }
+            if ( sample > maximum ) {
+                maximum = sample
+            }
+            if let lv = levels {
+                if ( count > 0 ) {
+                    trackEdges(sample, levels: lv)
+                } else {
+                    armedForRisingEdge = Double(sample) < lv.low
+                    isHigh = Double(sample) >= lv.mid
+                }
+            }
+            previousSample = sample
+            count += 1
+        }
+    }
+    
+    // where between the previous sample and this one the signal went through level
+    private func crossing( sample:Sample, level:Double ) -> Double {
+        let fraction = (level - Double(previousSample)) / Double(sample - previousSample)
+        return Double(count - 1) + fraction
+    }
+    
+    private mutating func trackEdges( sample:Sample, levels:ReferenceLevels ) {
+        let previous = Double(previousSample)
+        let current = Double(sample)
+        
+        // low level: arms the frequency counter, starts a rise, finishes a fall.
+        if ( current < levels.low ) {
+            armedForRisingEdge = true
+        }
+        if ( previous < levels.low && current >= levels.low ) {
+            riseStart = crossing(sample, level: levels.low)
+        }
+        if ( previous >= levels.low && current < levels.low ) {
+            if let start = fallStart {
+                fallTimeSum += crossing(sample, level: levels.low) - start
+                fallTimeCount += 1
+            }
+            fallStart = nil
+            riseStart = nil
+        }
+        
+        // high level: finishes a rise, starts a fall.
+        if ( previous < levels.high && current >= levels.high ) {
+            if let start = riseStart {
+                riseTimeSum += crossing(sample, level: levels.high) - start
+                riseTimeCount += 1
+            }
+            riseStart = nil
+            fallStart = nil
+        }
+        if ( previous >= levels.high && current < levels.high ) {
+            fallStart = crossing(sample, level: levels.high)
+        }
+        
+        // mid level: rising crossings count periods, and the time above it between them is the duty cycle.
+        if ( previous < levels.mid && current >= levels.mid && armedForRisingEdge ) {
+            let edge = crossing(sample, level: levels.mid)
+            if ( risingEdgeCount == 0 ) {
+                firstRisingEdge = edge
+                highSamples = 0
+            }
+            lastRisingEdge = edge
+            highSamplesAtLastRisingEdge = highSamples
+            risingEdgeCount += 1
+            armedForRisingEdge = false
+        }
+        isHigh = current >= levels.mid
+        if ( isHigh && risingEdgeCount > 0 ) {
+            highSamples += 1
+        }
+    }
+    
+    func result( ) -> Measurements {
+        var rval = Measurements()
+        guard count > 0 else {
+            return rval
+        }
+        
+        // mean and RMS in sample units first, then over to volts.  v = s*k + v0, so E[v^2] = k^2 E[s^2] + 2 k v0 E[s] + v0^2
+        let k = CONFIG_VOLTS_PER_SAMPLE
+        let v0 = CONFIG_AFE_VOLTAGE_RANGE.min
+        let meanSample = Double(sum) / Double(count)
+        let meanSquareSample = Double(sumOfSquares) / Double(count)
+        rval.sampleCount = count
+        rval.mean = meanSample * k + v0
+        rval.rms = sqrt(max(0, k * k * meanSquareSample + 2 * k * v0 * meanSample + v0 * v0))
+        rval.min = minimum.asVoltage()
+        rval.max = maximum.asVoltage()
+        
+        if ( risingEdgeCount >= 2 ) {
+            let samplesPerPeriod = (lastRisingEdge - firstRisingEdge) / Double(risingEdgeCount - 1)
+            rval.frequency = Frequency(Double(CONFIG_SAMPLERATE) / samplesPerPeriod)
+            rval.dutyCycle = Double(highSamplesAtLastRisingEdge) / (lastRisingEdge - firstRisingEdge)
+        }
+        if ( riseTimeCount > 0 ) {
+            rval.riseTime = Time(riseTimeSum / Double(riseTimeCount)) * CONFIG_SAMPLEPERIOD
+        }
+        if ( fallTimeCount > 0 ) {
+            rval.fallTime = Time(fallTimeSum / Double(fallTimeCount)) * CONFIG_SAMPLEPERIOD
+        }
+        return rval
+    }
+    
+    var range:(min:Sample, max:Sample) {
+        get {
+            return (min: minimum, max: maximum)
+        }
+    }
+}
+
+//
+// THE STAGE
+//
+
+class MeasurementEngine: SampleBufferReader {
+    
+    let windowLength:Int = max(1, CONFIG_MEASUREMENT_WINDOW_LENGTH.asSampleIndex())
+    
+    private var accumulator = MeasurementAccumulator(levels: nil)
+    private var newestMeasurements:Measurements? = nil
+    
+    init( sampleBuffer:SampleBuffer ) {
+        super.init(sampleBuffer: sampleBuffer, queueLabel: "measurementEngineQueue")
+    }
+    
+    //
+    // PROCESSING - on the engine's queue.
+    //
+    
+    override func processBlock( block:UnsafeBufferPointer<Sample>, firstSampleIndex:UInt ) {
+        var blockOffset = 0
+        while ( blockOffset < block.count ) {
+            // windows get cut exactly, so every one covers the same stretch of time.
+            let count = min(block.count - blockOffset, windowLength - accumulator.count)
+            accumulator.add(UnsafeBufferPointer<Sample>(start: block.baseAddress + blockOffset, count: count))
+            blockOffset += count
+            if ( accumulator.count == windowLength ) {
+                finishWindow()
+            }
+        }
+    }
+    
+    private func finishWindow() {
+        newestMeasurements = accumulator.result()
+        let range = accumulator.range
+        accumulator = MeasurementAccumulator(levels: MeasurementAccumulator.referenceLevels(range.min, max: range.max))
+    }
+    
+    // a window with a hole in it would have the wrong period, so start the window over.  the levels are still good.
+    override func readerDidSkipAhead( newCursor:UInt ) {
+        if let previous = newestMeasurements {
+            accumulator = MeasurementAccumulator(levels: MeasurementAccumulator.referenceLevels(previous.min.asSample(), max: previous.max.asSample()))
+        } else {
+            accumulator = MeasurementAccumulator(levels: nil)
+        }
+    }
+    
+    //
+    // RESULTS - from any thread.
+    //
+    
+    // the newest complete window's measurements.  nil until the first window is done.
+    func getMeasurements() -> Measurements? {
+        var rval:Measurements? = nil
+        syncWithReader({
+            rval = self.newestMeasurements
+        })
+        return rval
+    }
+    
+    // measures count samples, starting at firstSampleIndex, straight out of the buffer.  two passes: one for the
+    // reference levels, one for everything else.  like the buffer's other read functions, this doesn't stop writes.
+    class func measure( sampleBuffer:SampleHistory, firstSampleIndex:UInt, count:Int ) -> Measurements {
+        guard count > 0 else {
+            return Measurements()
+        }
+        let range = sampleBuffer.getMinMax(Int(firstSampleIndex), count: count)
+        var accumulator = MeasurementAccumulator(levels: MeasurementAccumulator.referenceLevels(range.min, max: range.max))
+        
+        let blockCapacity = CONFIG_DECODER_PACKET_SIZE / CONFIG_INCOMING_SAMPLE_SIZE_IN_BYTES
+        let block = UnsafeMutablePointer<Sample>.alloc(blockCapacity)
+        var offset = 0
+        while ( offset < count ) {
+            let blockCount = min(count - offset, blockCapacity)
+            sampleBuffer.copySamples(firstSampleIndex &+ UInt(offset), count: blockCount, destination: block)
+            accumulator.add(UnsafeBufferPointer<Sample>(start: block, count: blockCount))
+            offset += blockCount
+        }
+        block.dealloc(blockCapacity)
+        return accumulator.result()
+    }
+}
@@ -0,0 +1,135 @@
+//
+//  MinMaxSummary.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/14/16.
+//
+//
+
+import Foundation
+
+/*
+ The min and max of every chunkSize samples in the ring, kept up to date as samples come in, so anything scanning the
+ history (WaveformSearch.swift) can rule out a whole chunk from two numbers instead of looking at every sample in it.
+ 
+ -it's a reader stage, always there, like the measurement engine.  each block costs one pass that the compiler
+  vectorizes, and a chunk's entry gets written once, when its last sample is in.
+ -chunk n is sample indices n*chunkSize ..< (n+1)*chunkSize.  the entries are a ring with room for the whole sample ring
+  plus a couple, so every chunk that's still in the sample ring has one.
+ -chunks from before the stage started, from before the buffer was last cleared, and from a stretch the stage skipped
+  over aren't summarized.  the snapshot says which ones are; scan the rest.
+*/
+
+final class MinMaxSummary: SampleBufferReader {
+    
+    let chunkSize:Int
+    private let entryCapacity:Int
+    private let minimums:UnsafeMutablePointer<Sample>
+    private let maximums:UnsafeMutablePointer<Sample>
+    
+    // chunks validFromChunk ..< completeChunks have entries (the ones the ring hasn't dropped, anyway).
+    private var validFromChunk:UInt
+    private var completeChunks:UInt
+    private var seenClearCount:UInt
+    
+    // the chunk being filled
+    private var currentMinimum:Sample = Sample.max
+    private var currentMaximum:Sample = Sample.min
+    
+    init( sampleBuffer:SampleBuffer, chunkSize:Int ) {
+        let size = max(1, chunkSize)
+        self.chunkSize = size
+        entryCapacity = sampleBuffer.capacity / size + 2
+        minimums = UnsafeMutablePointer<Sample>.alloc(entryCapacity)
+        maximums = UnsafeMutablePointer<Sample>.alloc(entryCapacity)
+        let committed = sampleBuffer.committedSampleCount
+        validFromChunk = (committed + UInt(size) - 1) / UInt(size)
+        completeChunks = committed / UInt(size)
+        seenClearCount = sampleBuffer.clearCount
+        super.init(sampleBuffer: sampleBuffer, queueLabel: "minMaxSummaryQueue")
+    }
+    
+    deinit {
+        minimums.dealloc(entryCapacity)
+        maximums.dealloc(entryCapacity)
+    }
+    
+    //
+    // SUMMARIZING
+    //
+    
+    override func processBlock( block:UnsafeBufferPointer<Sample>, firstSampleIndex:UInt ) {
+        // cleared since last time?  everything summarized so far is wrong now.  start at the next whole chunk.
+        let clearCount = sampleBuffer.clearCount
+        if ( clearCount != seenClearCount ) {
+            seenClearCount = clearCount
+            restartAt(firstSampleIndex)
+        }
+        
+        let size = UInt(chunkSize)
+        var i = 0
+        while ( i < block.count ) {
+            let index = firstSampleIndex &+ UInt(i)
+            let offsetInChunk = Int(index % size)
+            let count = min(block.count - i, chunkSize - offsetInChunk)
+            var low = currentMinimum
+            var high = currentMaximum
+            for j in i..<(i + count) {
+                low = min(low, block[j])
+                high = max(high, block[j])
+            }
+            currentMinimum = low
+            currentMaximum = high
+            
+            if ( offsetInChunk + count == chunkSize ) {
+                let chunk = index / size
+                let slot = Int(chunk % UInt(entryCapacity))
+                minimums[slot] = low
+                maximums[slot] = high
+                completeChunks = chunk + 1
+                currentMinimum = Sample.max
+                currentMaximum = Sample.min
+            }
+            i += count
+        }
+    }
+    
+    override func readerDidSkipAhead( newCursor:UInt ) {
+        restartAt(newCursor)
+    }
+    
+    private func restartAt( sampleIndex:UInt ) {
+        let size = UInt(chunkSize)
+        // a partial chunk at the front gets an entry like any other, it just never counts.
+        validFromChunk = (sampleIndex + size - 1) / size
+        completeChunks = sampleIndex / size
+        currentMinimum = Sample.max
+        currentMaximum = Sample.min
+    }
+    
+    //
+    // READING - from any thread
+    //
+    
+    // the entries for chunks firstChunk ..< endChunk that are there, which are the ones from validFirst ..< validEnd.
+    func snapshot( firstChunk:UInt, endChunk:UInt ) -> (validFirst:UInt, validEnd:UInt, minimums:[Sample], maximums:[Sample]) {
+        var rval:(validFirst:UInt, validEnd:UInt, minimums:[Sample], maximums:[Sample]) = (0, 0, [], [])
+        syncWithReader({
+            let oldestKept = (self.completeChunks > UInt(self.entryCapacity)) ? self.completeChunks - UInt(self.entryCapacity) : 0
+            let first = max(firstChunk, max(self.validFromChunk, oldestKept))
+            let end = min(endChunk, self.completeChunks)
+            guard first < end else {
+                return
+            }
+            var mins = [Sample](count: Int(end - first), repeatedValue: 0)
+            var maxes = [Sample](count: Int(end - first), repeatedValue: 0)
+            for chunk in first..<end {
+                let slot = Int(chunk % UInt(self.entryCapacity))
+                mins[Int(chunk - first)] = self.minimums[slot]
+                maxes[Int(chunk - first)] = self.maximums[slot]
+            }
+            rval = (validFirst: first, validEnd: end, minimums: mins, maximums: maxes)
+        })
+        return rval
+    }
+}
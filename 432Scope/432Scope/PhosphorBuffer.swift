@@ -0,0 +1,150 @@
+//
+//  PhosphorBuffer.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/4/16.
+//
+//
+
+import Cocoa
+import Accelerate
+
+/*
+ Digital phosphor: a per-channel 2D hit-count buffer the size of the scope view.
+ 
+ -every waveform (each timeline frame, or each trigger event in trigger mode) gets rasterized into it as one vertical span per column.
+ -once per drawn frame everything decays by a constant factor.
+ -it gets drawn as an image, brighter where the trace has been more often, so rare glitches and jitter stick around long enough to see.
+ 
+ The counts are stored column-major, so a column span is one contiguous run of floats.  That's the whole trick: the kernel is
+ just "add 1 to a run", which vDSP does in wide vector ops.
+*/
+
+class PhosphorBuffer {
+    
+    private(set) var width:Int
+    private(set) var height:Int
+    
+    // fraction of the intensity that survives each drawn frame
+    var decay:Float = CONFIG_DISPLAY_PHOSPHOR_DEFAULT_DECAY
+    
+    // hit counts, column-major:  column x is hits[x*height ..< (x+1)*height], row 0 at the bottom.
+    private var hits:UnsafeMutablePointer<Float>
+    
+    // RGBA pixels for the rendered image, row-major, row 0 at the top.
+    private var pixels:UnsafeMutablePointer<UInt8>
+    
+    // scratch space for grading the counts into 0...1 intensities, in the same layout as hits.
+    private var intensities:UnsafeMutablePointer<Float>
+    
+    init( width:Int, height:Int ) {
+        self.width = width
+        self.height = height
+        hits = UnsafeMutablePointer<Float>.alloc(width * height)
+        pixels = UnsafeMutablePointer<UInt8>.alloc(width * height * 4)
+        intensities = UnsafeMutablePointer<Float>.alloc(width * height)
+        clear()
+    }
+    
+    deinit {
+        hits.dealloc(width * height)
+        pixels.dealloc(width * height * 4)
+        intensities.dealloc(width * height)
+    }
+    
+    func clear() {
+        var zero:Float = 0
+        vDSP_vfill(&zero, hits, 1, vDSP_Length(width * height))
+    }
+    
+    // once per drawn frame.
+    func decayFrame() {
+        vDSP_vsmul(hits, 1, &decay, hits, 1, vDSP_Length(width * height))
+    }
+    
+    //
+    // ACCUMULATION
+    //
+    
+    // the kernel.  bump every pixel in column x from row low to row high (inclusive).
+    func accumulateColumnSpan( x:Int, low:Int, high:Int ) {
+        let column = hits + (x * height + low)
+        let count = high - low + 1
+        if ( count < 16 ) {
+            // short spans (the usual case when zoomed out on a clean signal) aren't worth the call.
+            for i in 0..<count {
+                column[i] += 1
+            }
+        } else {
+            var one:Float = 1
+            vDSP_vsadd(column, 1, &one, column, 1, vDSP_Length(count))
+        }
+    }
+    
+    // fold in one waveform's worth of columns, newest first, the same way ScopeImageView lays them out (newest at the right edge).
+    // the sample display transform for the channel has to be set while this runs.
+    func accumulateColumns( columns:[(min:Sample, max:Sample)] ) {
+        var x = width - 1
+        for column in columns {
+            if ( x < 0 ) {
+                break
+            }
+            // an empty column (getMinMax with nothing there) has min > max.  no hits.
+            if ( column.min > column.max ) {
+                x -= 1
+                continue
+            }
+            var low = Int(column.min.asCoordinate())
+            var high = Int(column.max.asCoordinate())
+            // completely off the top or bottom?  nothing to see.
+            if ( high < 0 || low >= height ) {
+                x -= 1
+                continue
+            }
+            low = clampToRange(low, min: 0, max: height - 1)
+            high = clampToRange(high, min: 0, max: height - 1)
+            accumulateColumnSpan(x, low: low, high: high)
+            x -= 1
+        }
+    }
+    
+    //
+    // RENDERING
+    //
+    
+    func renderImage( color:NSColor ) -> CGImage? {
+        // what counts as "full brightness" is whatever the busiest pixel is right now.
+        var peak:Float = 0
+        vDSP_maxv(hits, 1, &peak, vDSP_Length(width * height))
+        if ( peak <= 0 ) {
+            return nil
+        }
+        
+        let rgbColor = color.colorUsingColorSpaceName(NSCalibratedRGBColorSpace) ?? NSColor.whiteColor()
+        let red = Float(rgbColor.redComponent) * 255
+        let green = Float(rgbColor.greenComponent) * 255
+        let blue = Float(rgbColor.blueComponent) * 255
+        
+        // log grading, so a single hit is still visible next to a spot that's been hit a thousand times.
+        var count = Int32(width * height)
+        vvlog1pf(intensities, hits, &count)
+        var scale:Float = 1 / log1p(peak)
+        vDSP_vsmul(intensities, 1, &scale, intensities, 1, vDSP_Length(width * height))
+        
+        for x in 0..<width {
+            let column = intensities + (x * height)
+            for y in 0..<height {
+                let intensity = column[y]
+                // premultiplied alpha
+                let pixel = pixels + (((height - 1 - y) * width + x) * 4)
+                pixel[0] = UInt8(red * intensity)
+                pixel[1] = UInt8(green * intensity)
+                pixel[2] = UInt8(blue * intensity)
+                pixel[3] = UInt8(255 * intensity)
+            }
+        }
+        
+        let context = CGBitmapContextCreate(pixels, width, height, 8, width * 4, CGColorSpaceCreateDeviceRGB(), CGImageAlphaInfo.PremultipliedLast.rawValue)
+        return CGBitmapContextCreateImage(context)
+    }
+}
@@ -0,0 +1,650 @@
+//
+//  ProtocolDecoder.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/14/16.
+//
+//
+
+import Foundation
+
+/*
+ Serial bus decoding: UART, SPI and I2C, straight off the samples.
+ 
+ BIG PICTURE:
+ 
+ -a ProtocolDecoderStage is a reader stage on the channel with the line (UART) or the clock (SPI, I2C) on it, so decoding
+  happens on its own queue as packets come in.  every sample gets looked at once: the bus state machines carry their
+  state from one block to the next, and nothing ever gets decoded again.
+ -every line gets thresholded with hysteresis (LogicThreshold) into a block of 0s and 1s first, so a slow or noisy edge
+  is one edge.  the state machines only ever see the bits.
+ -the other lines (SPI data and select, I2C data) are other channels' buffers, lined up by age once, when the stage
+  starts, the same way math channels line up their inputs.  the stage only decodes as far as every line has committed
+  samples, so it can run a packet behind.
+ -if one of the other lines stops (its channel isn't streaming, or fell way behind), the stage can't decode past it.
+  once its own channel is CONFIG_PROTOCOL_STALL_TIME ahead, it puts an error item in and getStatus says which line is
+  stuck, so the panel can show it.  it picks up again by itself if the line comes back.
+ -what comes out is DecodedItems: a byte, an address, a start or stop, or an error, with the samples it spans.  they go
+  in a ring, in sample order, so the scope view can pull out the ones in view with a binary search (getItems), and the
+  decoder panel can search them (getAllItems) without going near the samples.
+ -at 100kS/s a bit wants at least 4 samples, so that's UART up to about 25kbaud and SPI / I2C clocks up to about 25kHz.
+ 
+ To add a bus, derive from SerialStateMachine, override decode and reset, and add a case to SerialProtocol.
+*/
+
+enum UARTParity {
+    case None
+    case Even
+    case Odd
+}
+
+enum SerialProtocol {
+    // the stage's own channel is the line.
+    case UART(baud:Int, dataBits:Int, parity:UARTParity, stopBits:Int, inverted:Bool)
+    // the stage's own channel is the clock.  mode is the usual 0-3 (CPOL*2 + CPHA); select is active low.
+    case SPI(data:SampleBuffer, select:SampleBuffer?, mode:Int, bitsPerWord:Int, lsbFirst:Bool)
+    // the stage's own channel is SCL.
+    case I2C(data:SampleBuffer)
+    
+    var name:String {
+        switch (self) {
+        case .UART(let baud, _, _, _, _):
+            return "UART \(baud)"
+        case .SPI(_, _, let mode, _, _):
+            return "SPI mode \(mode)"
+        case .I2C(_):
+            return "I2C"
+        }
+    }
+    
+    // what each of the stage's lines is, in the stage's order.
+    var lineNames:[String] {
+        switch (self) {
+        case .UART(_, _, _, _, _):
+            return ["line"]
+        case .SPI(_, let select, _, _, _):
+            return (select == nil) ? ["clock", "data"] : ["clock", "data", "select"]
+        case .I2C(_):
+            return ["SCL", "SDA"]
+        }
+    }
+}
+
+struct ProtocolDecoderSettings {
+    var serialProtocol:SerialProtocol
+    var threshold:Voltage
+    var hysteresis:Voltage
+}
+
+enum DecodedItemKind {
+    case Data
+    case Address
+    case Start
+    case Stop
+    case Error
+}
+
+struct DecodedItem {
+    let firstSampleIndex:UInt
+    let lastSampleIndex:UInt
+    let kind:DecodedItemKind
+    let value:Int
+    let text:String // what gets drawn, and searched
+}
+
+//
+// THE STAGE
+//
+
+class ProtocolDecoderStage: SampleBufferReader {
+    
+    let settings:ProtocolDecoderSettings
+    private let machine:SerialStateMachine
+    
+    // line 0 is this stage's own buffer.
+    private let lines:[LogicLine]
+    private let chunkCapacity:Int
+    
+    // the next sample (this buffer's index) to decode.
+    private var decodedThrough:UInt
+    
+    // the results.  a ring, oldest first from itemsFirst.  only touched on the stage's queue.
+    private var items:[DecodedItem] = []
+    private var itemsFirst:Int = 0
+    private let itemCapacity:Int
+    private var decodedCount:Int = 0
+    private var errorCount:Int = 0
+    
+    // the line that's holding decoding up, if one is.  (see checkForStall.)
+    private var stalledLine:Int? = nil
+    private let stallSamples:Int = max(1, CONFIG_PROTOCOL_STALL_TIME.asSampleIndex())
+    
+    init( sampleBuffer:SampleBuffer, settings:ProtocolDecoderSettings, itemCapacity:Int ) {
+        self.settings = settings
+        self.itemCapacity = max(1, itemCapacity)
+        let committed = sampleBuffer.committedSampleCount
+        decodedThrough = committed
+        
+        let high = (settings.threshold + 0.5 * settings.hysteresis).asSample()
+        let low = (settings.threshold - 0.5 * settings.hysteresis).asSample()
+        var buffers:[SampleBuffer] = [sampleBuffer]
+        switch (settings.serialProtocol) {
+        case .UART(let baud, let dataBits, let parity, let stopBits, let inverted):
+            machine = UARTStateMachine(samplesPerBit: Double(CONFIG_SAMPLERATE) / Double(max(1, baud)), dataBits: dataBits, parity: parity, stopBits: stopBits, inverted: inverted)
+        case .SPI(let data, let select, let mode, let bitsPerWord, let lsbFirst):
+            buffers.append(data)
+            if let selectBuffer = select {
+                buffers.append(selectBuffer)
+            }
+            machine = SPIStateMachine(mode: mode, bitsPerWord: bitsPerWord, lsbFirst: lsbFirst, hasSelect: select != nil)
+        case .I2C(let data):
+            buffers.append(data)
+            machine = I2CStateMachine()
+        }
+        let capacity = CONFIG_DECODER_PACKET_SIZE / CONFIG_INCOMING_SAMPLE_SIZE_IN_BYTES
+        chunkCapacity = capacity
+        lines = buffers.map({ buffer in
+            // same age, in that buffer.  everything there is from here on is history, same as for the reader.
+            let offset = Int(buffer.committedSampleCount) - Int(committed)
+            return LogicLine(buffer: buffer, offset: offset, threshold: LogicThreshold(high: high, low: low), capacity: capacity)
+        })
+        super.init(sampleBuffer: sampleBuffer, queueLabel: "protocolDecoderQueue")
+    }
+    
+    //
+    // DECODING
+    //
+    
+    // the block itself doesn't matter: everything up to its end is committed, and the other lines may be behind.
+    override func processBlock( block:UnsafeBufferPointer<Sample>, firstSampleIndex:UInt ) {
+        let available = Int(firstSampleIndex) + block.count
+        var end = available
+        var slowest = 0
+        for (i, line) in lines.enumerate() {
+            let lineEnd = Int(line.buffer.committedSampleCount) - line.offset
+            if ( lineEnd < end ) {
+                end = lineEnd
+                slowest = i
+            }
+        }
+        checkForStall(slowest, behindBy: available - end)
+        
+        while ( Int(decodedThrough) < end ) {
+            let count = min(end - Int(decodedThrough), chunkCapacity)
+            for line in lines {
+                line.load(Int(decodedThrough) + line.offset, count: count)
+            }
+            machine.decode(decodedThrough, count: count, lines: lines.map({ UnsafePointer<UInt8>($0.levels) }))
+            for item in machine.output {
+                storeItem(item)
+            }
+            machine.output.removeAll(keepCapacity: true)
+            decodedThrough = decodedThrough &+ UInt(count)
+        }
+    }
+    
+    // a line that's been behind for CONFIG_PROTOCOL_STALL_TIME gets reported once, with an error item where decoding
+    // stopped.  it's cleared when the line catches back up.
+    private func checkForStall( line:Int, behindBy:Int ) {
+        if ( behindBy < stallSamples ) {
+            stalledLine = nil
+            return
+        }
+        if ( stalledLine != nil ) {
+            return
+        }
+        stalledLine = line
+        storeItem(DecodedItem(firstSampleIndex: decodedThrough, lastSampleIndex: decodedThrough, kind: .Error, value: line,
+                              text: "\(settings.serialProtocol.lineNames[line]) stopped"))
+    }
+    
+    // the samples before newCursor are gone, and so is whatever frame was open.
+    override func readerDidSkipAhead( newCursor:UInt ) {
+        if ( decodedThrough < newCursor ) {
+            machine.reset()
+            decodedThrough = newCursor
+        }
+    }
+    
+    private func storeItem( item:DecodedItem ) {
+        decodedCount += 1
+        if ( item.kind == .Error ) {
+            errorCount += 1
+        }
+        if ( items.count < itemCapacity ) {
+            items.append(item)
+        } else {
+            items[itemsFirst] = item
+            itemsFirst = (itemsFirst + 1) % itemCapacity
+        }
+    }
+    
+    private func itemAt( index:Int ) -> DecodedItem {
+        return items[(itemsFirst + index) % items.count]
+    }
+    
+    //
+    // READING - from any thread.
+    //
+    
+    // stalled is the name of the line decoding is waiting on, if it's been waiting longer than CONFIG_PROTOCOL_STALL_TIME.
+    func getStatus() -> (stored:Int, decoded:Int, errors:Int, stalled:String?) {
+        var rval:(stored:Int, decoded:Int, errors:Int, stalled:String?) = (stored: 0, decoded: 0, errors: 0, stalled: nil)
+        syncWithReader({
+            let stalled = self.stalledLine.map({ self.settings.serialProtocol.lineNames[$0] })
+            rval = (stored: self.items.count, decoded: self.decodedCount, errors: self.errorCount, stalled: stalled)
+        })
+        return rval
+    }
+    
+    // the items that overlap firstSampleIndex...lastSampleIndex, oldest first, no more than maximumCount of them (the newest ones).
+    func getItems( firstSampleIndex:UInt, lastSampleIndex:UInt, maximumCount:Int ) -> [DecodedItem] {
+        var rval:[DecodedItem] = []
+        syncWithReader({
+            // they're in order and don't overlap, so binary search for the first one that ends inside the range ...
+            var low = 0
+            var high = self.items.count
+            while ( low < high ) {
+                let middle = (low + high) / 2
+                if ( self.itemAt(middle).lastSampleIndex < firstSampleIndex ) {
+                    low = middle + 1
+                } else {
+                    high = middle
+                }
+            }
+            // ... and for the first one that starts past it.
+            var end = low
+            high = self.items.count
+            while ( end < high ) {
+                let middle = (end + high) / 2
+                if ( self.itemAt(middle).firstSampleIndex <= lastSampleIndex ) {
+                    end = middle + 1
+                } else {
+                    high = middle
+                }
+            }
+            for i in max(low, end - maximumCount)..<end {
+                rval.append(self.itemAt(i))
+            }
+        })
+        return rval
+    }
+    
+    // every stored item, oldest first.  copied out, so searching them doesn't hold the stage up.
+    func getAllItems() -> [DecodedItem] {
+        var rval:[DecodedItem] = []
+        syncWithReader({
+            rval.reserveCapacity(self.items.count)
+            for i in 0..<self.items.count {
+                rval.append(self.itemAt(i))
+            }
+        })
+        return rval
+    }
+}
+
+//
+// THRESHOLDING
+//
+
+struct LogicThreshold {
+    let high:Sample
+    let low:Sample
+    private var level:UInt8 = 0
+    
+    init( high:Sample, low:Sample ) {
+        self.high = high
+        self.low = low
+    }
+    
+    // 1 once a sample's above high, 0 once one's below low, and whatever it was in between.
+    mutating func convert( samples:UnsafePointer<Sample>, count:Int, destination:UnsafeMutablePointer<UInt8> ) {
+        var current = level
+        for i in 0..<count {
+            let s = samples[i]
+            if ( s > high ) {
+                current = 1
+            } else if ( s < low ) {
+                current = 0
+            }
+            destination[i] = current
+        }
+        level = current
+    }
+}
+
+private final class LogicLine {
+    
+    let buffer:SampleBuffer
+    let offset:Int
+    private var threshold:LogicThreshold
+    private let capacity:Int
+    private let samples:UnsafeMutablePointer<Sample>
+    let levels:UnsafeMutablePointer<UInt8>
+    
+    init( buffer:SampleBuffer, offset:Int, threshold:LogicThreshold, capacity:Int ) {
+        self.buffer = buffer
+        self.offset = offset
+        self.threshold = threshold
+        self.capacity = capacity
+        samples = UnsafeMutablePointer<Sample>.alloc(capacity)
+        levels = UnsafeMutablePointer<UInt8>.alloc(capacity)
+    }
+    
+    deinit {
+        samples.dealloc(capacity)
+        levels.dealloc(capacity)
+    }
+    
+    // count levels from sampleIndex (this buffer's) on.  anything that's already left the ring holds the level.
+    func load( sampleIndex:Int, count:Int ) {
+        let committed = Int(buffer.committedSampleCount)
+        let oldest = committed - min(committed, buffer.capacity)
+        let first = max(sampleIndex, oldest)
+        let skipped = min(count, first - sampleIndex)
+        if ( skipped < count ) {
+            buffer.copySamples(UInt(first), count: count - skipped, destination: samples + skipped)
+        }
+        for i in 0..<skipped {
+            samples[i] = threshold.low
+        }
+        threshold.convert(samples, count: count, destination: levels)
+    }
+}
+
+//
+// THE BUS STATE MACHINES - each one walks blocks of levels (one block per line, all the same length), and appends
+// whatever it finds to output.
+//
+
+class SerialStateMachine {
+    
+    var output:[DecodedItem] = []
+    
+    func decode( firstSampleIndex:UInt, count:Int, lines:[UnsafePointer<UInt8>] ) {
+        // this should be overridden
+        print("---SerialStateMachine.decode SHOULD NOT BE GETTING CALLED.")
+    }
+    
+    // forget any open frame.  the samples in between went missing.
+    func reset() {
+    }
+    
+    func emit( first:UInt, last:UInt, kind:DecodedItemKind, value:Int, text:String ) {
+        output.append(DecodedItem(firstSampleIndex: first, lastSampleIndex: max(first, last), kind: kind, value: value, text: text))
+    }
+    
+    class func hex( value:Int, bits:Int ) -> String {
+        return String(format: "0x%0\((bits + 3) / 4)X", value)
+    }
+}
+
+// idle high, a low start bit, dataBits LSB first, maybe a parity bit, stopBits high.  every bit gets sampled in the
+// middle, counting from the falling edge of the start bit.
+final class UARTStateMachine: SerialStateMachine {
+    
+    let samplesPerBit:Double
+    let dataBits:Int
+    let parity:UARTParity
+    let stopBits:Int
+    let inverted:UInt8
+    
+    private var previous:UInt8 = 1
+    private var inFrame:Bool = false
+    private var frameStart:UInt = 0
+    private var bit:Int = 0         // 0 is the start bit, then data, then parity, then stop
+    private var untilNextBit:Double = 0
+    private var value:Int = 0
+    private var ones:Int = 0
+    private var error:String? = nil
+    
+    init( samplesPerBit:Double, dataBits:Int, parity:UARTParity, stopBits:Int, inverted:Bool ) {
+        self.samplesPerBit = max(1, samplesPerBit)
+        self.dataBits = max(1, min(16, dataBits))
+        self.parity = parity
+        self.stopBits = max(1, stopBits)
+        self.inverted = inverted ? 1 : 0
+    }
+    
+    override func reset() {
+        inFrame = false
+        previous = 1
+    }
+    
+    override func decode( firstSampleIndex:UInt, count:Int, lines:[UnsafePointer<UInt8>] ) {
+        let line = lines[0]
+        let parityBits = (parity == .None) ? 0 : 1
+        let lastBit = dataBits + parityBits + stopBits
+        for i in 0..<count {
+            let level = line[i] ^ inverted
+            if ( !inFrame ) {
+                if ( previous == 1 && level == 0 ) {
+                    inFrame = true
+                    frameStart = firstSampleIndex &+ UInt(i)
+                    bit = 0
+                    untilNextBit = 0.5 * samplesPerBit
+                    value = 0
+                    ones = 0
+                    error = nil
+                }
+                previous = level
+                continue
+            }
+            previous = level
+            untilNextBit -= 1
+            if ( untilNextBit > 0 ) {
+                continue
+            }
+            untilNextBit += samplesPerBit
+            
+            if ( bit == 0 ) {
+                // back up already?  that was a glitch, not a start bit.
+                if ( level != 0 ) {
+                    inFrame = false
+                    continue
+                }
+            } else if ( bit <= dataBits ) {
+                value |= Int(level) << (bit - 1)
+                ones += Int(level)
+            } else if ( bit <= dataBits + parityBits ) {
+                ones += Int(level)
+                if ( (parity == .Even && ones % 2 != 0) || (parity == .Odd && ones % 2 != 1) ) {
+                    error = "parity error"
+                }
+            } else if ( level != 1 && error == nil ) {
+                error = "framing error"
+            }
+            
+            if ( bit == lastBit ) {
+                let last = firstSampleIndex &+ UInt(i) &+ UInt(0.5 * samplesPerBit)
+                var text = SerialStateMachine.hex(value, bits: dataBits)
+                if ( value >= 0x20 && value < 0x7f ) {
+                    text += " '\(Character(UnicodeScalar(value)))'"
+                }
+                if let message = error {
+                    emit(frameStart, last: last, kind: .Error, value: value, text: text + " " + message)
+                } else {
+                    emit(frameStart, last: last, kind: .Data, value: value, text: text)
+                }
+                inFrame = false
+            }
+            bit += 1
+        }
+    }
+}
+
+// lines are clock, data and (maybe) select.  a bit gets sampled on every sampling edge of the clock while select is low;
+// select going high, or the clock stopping for a good while, ends the word.
+final class SPIStateMachine: SerialStateMachine {
+    
+    let idleClock:UInt8
+    let sampleOnTrailingEdge:Bool
+    let bitsPerWord:Int
+    let lsbFirst:Bool
+    let hasSelect:Bool
+    
+    private var previousClock:UInt8
+    private var previousSelect:UInt8 = 1
+    private var word:Int = 0
+    private var bitCount:Int = 0
+    private var wordStart:UInt = 0
+    private var lastEdge:UInt = 0
+    private var bitPeriod:UInt = 0
+    
+    init( mode:Int, bitsPerWord:Int, lsbFirst:Bool, hasSelect:Bool ) {
+        idleClock = UInt8((mode >> 1) & 1)
+        sampleOnTrailingEdge = (mode & 1) == 1
+        self.bitsPerWord = max(1, min(32, bitsPerWord))
+        self.lsbFirst = lsbFirst
+        self.hasSelect = hasSelect
+        previousClock = idleClock
+    }
+    
+    override func reset() {
+        bitCount = 0
+        word = 0
+        bitPeriod = 0
+        previousClock = idleClock
+        previousSelect = 1
+    }
+    
+    private func endWord( at:UInt ) {
+        if ( bitCount > 0 ) {
+            emit(wordStart, last: at, kind: .Error, value: word, text: "partial word (\(bitCount) bits)")
+        }
+        bitCount = 0
+        word = 0
+    }
+    
+    override func decode( firstSampleIndex:UInt, count:Int, lines:[UnsafePointer<UInt8>] ) {
+        let clock = lines[0]
+        let data = lines[1]
+        for i in 0..<count {
+            let index = firstSampleIndex &+ UInt(i)
+            if ( hasSelect ) {
+                let select = lines[2][i]
+                if ( select == 1 ) {
+                    if ( previousSelect == 0 ) {
+                        endWord(index)
+                    }
+                    previousSelect = 1
+                    previousClock = clock[i]
+                    continue
+                }
+                previousSelect = 0
+            } else if ( bitCount > 0 && bitPeriod > 0 && index &- lastEdge > 8 * bitPeriod ) {
+                // no select line, so a long quiet clock is all there is to go on.
+                endWord(lastEdge)
+            }
+            
+            let level = clock[i]
+            if ( level == previousClock ) {
+                continue
+            }
+            let leading = (previousClock == idleClock)
+            previousClock = level
+            if ( leading == sampleOnTrailingEdge ) {
+                continue
+            }
+            
+            if ( lastEdge != 0 ) {
+                bitPeriod = index &- lastEdge
+            }
+            lastEdge = index
+            if ( bitCount == 0 ) {
+                wordStart = index
+            }
+            let bit = Int(data[i])
+            word = lsbFirst ? (word | (bit << bitCount)) : ((word << 1) | bit)
+            bitCount += 1
+            if ( bitCount == bitsPerWord ) {
+                emit(wordStart, last: index, kind: .Data, value: word, text: SerialStateMachine.hex(word, bits: bitsPerWord))
+                bitCount = 0
+                word = 0
+            }
+        }
+    }
+}
+
+// lines are SCL and SDA.  SDA falling while SCL is high is a start (or a repeated start), rising is a stop.  in between,
+// bits get sampled on SCL rising: 8 of them MSB first, then the ACK (SDA low) or NACK.  the first byte after a start is
+// the address and the R/W bit.
+final class I2CStateMachine: SerialStateMachine {
+    
+    private enum State {
+        case Idle
+        case Address
+        case Data
+    }
+    
+    private var state:State = .Idle
+    private var previousClock:UInt8 = 1
+    private var previousData:UInt8 = 1
+    private var byte:Int = 0
+    private var bitCount:Int = 0
+    private var byteStart:UInt = 0
+    
+    override func reset() {
+        state = .Idle
+        bitCount = 0
+        byte = 0
+        previousClock = 1
+        previousData = 1
+    }
+    
+    override func decode( firstSampleIndex:UInt, count:Int, lines:[UnsafePointer<UInt8>] ) {
+        let scl = lines[0]
+        let sda = lines[1]
+        for i in 0..<count {
+            let index = firstSampleIndex &+ UInt(i)
+            let clock = scl[i]
+            let data = sda[i]
+            defer {
+                previousClock = clock
+                previousData = data
+            }
+            
+            // start and stop: SDA moving while SCL stays high.  SCL went up for it after the last byte, and that got
+            // taken as a bit, so one bit is just the stop (or repeated start) setting up, not a byte cut short.
+            if ( clock == 1 && previousClock == 1 && data != previousData ) {
+                if ( state != .Idle && bitCount > 1 ) {
+                    emit(byteStart, last: index, kind: .Error, value: byte, text: "cut short (\(bitCount) bits)")
+                }
+                if ( data == 0 ) {
+                    emit(index, last: index, kind: .Start, value: 0, text: "S")
+                    state = .Address
+                } else {
+                    emit(index, last: index, kind: .Stop, value: 0, text: "P")
+                    state = .Idle
+                }
+                bitCount = 0
+                byte = 0
+                continue
+            }
+            
+            if ( state == .Idle || !(clock == 1 && previousClock == 0) ) {
+                continue
+            }
+            if ( bitCount < 8 ) {
+                if ( bitCount == 0 ) {
+                    byteStart = index
+                }
+                byte = (byte << 1) | Int(data)
+                bitCount += 1
+                continue
+            }
+            
+            // the ninth bit.
+            let ack = (data == 0) ? "" : " NACK"
+            if ( state == .Address ) {
+                let direction = ((byte & 1) == 1) ? "R" : "W"
+                emit(byteStart, last: index, kind: .Address, value: byte >> 1, text: direction + " " + SerialStateMachine.hex(byte >> 1, bits: 7) + ack)
+                state = .Data
+            } else {
+                emit(byteStart, last: index, kind: .Data, value: byte, text: SerialStateMachine.hex(byte, bits: 8) + ack)
+            }
+            bitCount = 0
+            byte = 0
+        }
+    }
+}
@@ -0,0 +1,320 @@
+//
+//  ProtocolDecoderPanel.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/14/16.
+//
+//
+
+import Cocoa
+
+/*
+ Window > Protocol Decoders.  Sets up a UART, SPI or I2C decoder (ProtocolDecoder.swift) on a channel, and lists what it
+ decoded, newest at the bottom, filtered by whatever's in the search field.  the scope view draws the same items along
+ its bottom edge.
+ 
+ -the channel is the UART line, the SPI clock or SCL.  data (and the SPI select, if there is one) come off other channels.
+ -options is the parity for UART and the mode for SPI.  rate is the baud rate, and is only for UART.  bits is data bits
+  for UART and bits per word for SPI.
+ -search matches the decoded text and the item type, case doesn't matter: "0x4", "nack", "error".
+ 
+ Built in code, like the stats panel.
+*/
+
+class ProtocolDecoderPanelController: NSWindowController, NSWindowDelegate, NSTableViewDataSource, NSTableViewDelegate {
+    
+    private let channels:[Channel]
+    private let channelPopup:NSPopUpButton
+    private let protocolPopup:NSPopUpButton
+    private let dataPopup:NSPopUpButton
+    private let selectPopup:NSPopUpButton
+    private let optionsPopup:NSPopUpButton
+    private let rateField:NSTextField
+    private let bitsField:NSTextField
+    private let thresholdField:NSTextField
+    private let searchField:NSSearchField
+    private let tableView:NSTableView
+    private let statusLabel:NSTextField
+    private var refreshTimer:NSTimer? = nil
+    
+    // what the table shows, and what it was filtered from.
+    private var shownItems:[DecodedItem] = []
+    private var shownDecodedCount:Int = -1
+    private var shownSearch:String = ""
+    private var shownDecoder:ProtocolDecoderStage? = nil
+    
+    init( channels:[Channel] ) {
+        self.channels = channels
+        let panel = NSPanel(contentRect: NSRect(x: 0, y: 0, width: 760, height: 420),
+                            styleMask: NSTitledWindowMask | NSClosableWindowMask | NSResizableWindowMask | NSUtilityWindowMask,
+                            backing: .Buffered, defer: true)
+        panel.title = "Protocol Decoders"
+        panel.floatingPanel = true
+        panel.hidesOnDeactivate = false
+        
+        let rowHeight:CGFloat = 30
+        let content = panel.contentView!
+        let top = content.bounds.height
+        let names = channels.map({ $0.name })
+        
+        // first row: which channels, and which bus
+        channelPopup = NSPopUpButton(frame: NSRect(x: 8, y: top - rowHeight + 2, width: 200, height: 24), pullsDown: false)
+        channelPopup.addItemsWithTitles(names)
+        protocolPopup = NSPopUpButton(frame: NSRect(x: 212, y: top - rowHeight + 2, width: 90, height: 24), pullsDown: false)
+        protocolPopup.addItemsWithTitles(["UART", "SPI", "I2C"])
+        dataPopup = NSPopUpButton(frame: NSRect(x: 306, y: top - rowHeight + 2, width: 200, height: 24), pullsDown: false)
+        dataPopup.addItemsWithTitles(names.map({ "data: " + $0 }))
+        selectPopup = NSPopUpButton(frame: NSRect(x: 510, y: top - rowHeight + 2, width: 200, height: 24), pullsDown: false)
+        selectPopup.addItemsWithTitles(["no select"] + names.map({ "select: " + $0 }))
+        
+        // second row: how it's set up
+        optionsPopup = NSPopUpButton(frame: NSRect(x: 8, y: top - 2 * rowHeight + 2, width: 110, height: 24), pullsDown: false)
+        rateField = NSTextField(frame: NSRect(x: 122, y: top - 2 * rowHeight + 4, width: 70, height: 22))
+        rateField.stringValue = "9600"
+        rateField.toolTip = "baud rate"
+        bitsField = NSTextField(frame: NSRect(x: 196, y: top - 2 * rowHeight + 4, width: 40, height: 22))
+        bitsField.stringValue = "8"
+        bitsField.toolTip = "data bits / bits per word"
+        thresholdField = NSTextField(frame: NSRect(x: 240, y: top - 2 * rowHeight + 4, width: 60, height: 22))
+        thresholdField.stringValue = "\(CONFIG_PROTOCOL_DEFAULT_THRESHOLD)"
+        thresholdField.toolTip = "logic threshold, volts"
+        searchField = NSSearchField(frame: NSRect(x: 500, y: top - 2 * rowHeight + 4, width: content.bounds.width - 508, height: 22))
+        searchField.autoresizingMask = [.ViewWidthSizable]
+        
+        for view in [channelPopup, protocolPopup, dataPopup, selectPopup, optionsPopup, rateField, bitsField, thresholdField, searchField] as [NSView] {
+            view.autoresizingMask.insert(.ViewMinYMargin)
+            content.addSubview(view)
+        }
+        
+        // the list
+        tableView = NSTableView(frame: NSRect(x: 0, y: 0, width: content.bounds.width, height: 100))
+        let columns:[(identifier:String, title:String, width:CGFloat)] = [("time", "time (s)", 120), ("kind", "kind", 80), ("text", "decoded", 500)]
+        for c in columns {
+            let column = NSTableColumn(identifier: c.identifier)
+            column.title = c.title
+            column.width = c.width
+            tableView.addTableColumn(column)
+        }
+        tableView.usesAlternatingRowBackgroundColors = true
+        let scrollView = NSScrollView(frame: NSRect(x: 0, y: rowHeight, width: content.bounds.width, height: top - 3 * rowHeight - 4))
+        scrollView.documentView = tableView
+        scrollView.hasVerticalScroller = true
+        scrollView.autoresizingMask = [.ViewWidthSizable, .ViewHeightSizable]
+        content.addSubview(scrollView)
+        
+        statusLabel = NSTextField(frame: NSRect(x: 176, y: 8, width: content.bounds.width - 184, height: 18))
+        statusLabel.editable = false
+        statusLabel.bordered = false
+        statusLabel.drawsBackground = false
+        statusLabel.font = NSFont(name: "Menlo", size: 10.0)
+        statusLabel.autoresizingMask = [.ViewWidthSizable]
+        content.addSubview(statusLabel)
+        
+        super.init(window: panel)
+        panel.delegate = self
+        tableView.setDataSource(self)
+        tableView.setDelegate(self)
+        
+        channelPopup.target = self
+        channelPopup.action = #selector(ProtocolDecoderPanelController.channelChanged(_:))
+        protocolPopup.target = self
+        protocolPopup.action = #selector(ProtocolDecoderPanelController.protocolChanged(_:))
+        searchField.target = self
+        searchField.action = #selector(ProtocolDecoderPanelController.searchChanged(_:))
+        
+        let buttons:[(title:String, width:CGFloat, action:Selector)] = [
+            ("Decode", 80, #selector(ProtocolDecoderPanelController.startDecoding(_:))),
+            ("Stop", 80, #selector(ProtocolDecoderPanelController.stopDecoding(_:))),
+        ]
+        var x:CGFloat = 8
+        for b in buttons {
+            let button = NSButton(frame: NSRect(x: x, y: 2, width: b.width, height: 24))
+            button.title = b.title
+            button.bezelStyle = .RoundedBezelStyle
+            button.target = self
+            button.action = b.action
+            content.addSubview(button)
+            x += b.width + 4
+        }
+        
+        updateOptions()
+        panel.center()
+    }
+    
+    required init?(coder: NSCoder) {
+        fatalError("ProtocolDecoderPanelController is built in code.")
+    }
+    
+    private func channelAt( index:Int ) -> Channel? {
+        return (index >= 0 && index < channels.count) ? channels[index] : nil
+    }
+    
+    private var channel:Channel? {
+        return channelAt(channelPopup.indexOfSelectedItem)
+    }
+    
+    override func showWindow(sender: AnyObject?) {
+        super.showWindow(sender)
+        refresh()
+        if ( refreshTimer == nil ) {
+            refreshTimer = NSTimer.scheduledTimerWithTimeInterval(0.5, target: self, selector: #selector(ProtocolDecoderPanelController.refreshTimerFired(_:)), userInfo: nil, repeats: true)
+        }
+    }
+    
+    func windowWillClose(notification: NSNotification) {
+        refreshTimer?.invalidate()
+        refreshTimer = nil
+    }
+    
+    func refreshTimerFired(timer: NSTimer) {
+        refresh()
+    }
+    
+    // the options popup means something different for every bus.
+    private func updateOptions() {
+        optionsPopup.removeAllItems()
+        switch (protocolPopup.indexOfSelectedItem) {
+        case 0:
+            optionsPopup.addItemsWithTitles(["no parity", "even parity", "odd parity"])
+        case 1:
+            optionsPopup.addItemsWithTitles(["mode 0", "mode 1", "mode 2", "mode 3"])
+        default:
+            optionsPopup.addItemWithTitle("-")
+        }
+        optionsPopup.enabled = (protocolPopup.indexOfSelectedItem != 2)
+        rateField.enabled = (protocolPopup.indexOfSelectedItem == 0)
+        bitsField.enabled = (protocolPopup.indexOfSelectedItem != 2)
+        dataPopup.enabled = (protocolPopup.indexOfSelectedItem != 0)
+        selectPopup.enabled = (protocolPopup.indexOfSelectedItem == 1)
+    }
+    
+    private func refresh() {
+        guard let decoder = channel?.protocolDecoder else {
+            statusLabel.stringValue = "not decoding."
+            if ( !shownItems.isEmpty ) {
+                shownItems = []
+                tableView.reloadData()
+            }
+            shownDecoder = nil
+            return
+        }
+        
+        let status = decoder.getStatus()
+        statusLabel.stringValue = "\(decoder.settings.serialProtocol.name): \(status.decoded) decoded, \(status.errors) errors, \(status.stored) stored, \(shownItems.count) shown."
+        if let line = status.stalled {
+            statusLabel.stringValue += "  Waiting on \(line): it stopped."
+        }
+        
+        // nothing new, and the same search?  leave the table be, so it doesn't jump around.
+        let search = searchField.stringValue
+        if ( decoder === shownDecoder && status.decoded == shownDecodedCount && search == shownSearch ) {
+            return
+        }
+        let following = tableView.numberOfRows == 0 || NSMaxRange(tableView.rowsInRect(tableView.visibleRect)) >= tableView.numberOfRows
+        shownDecoder = decoder
+        shownDecodedCount = status.decoded
+        shownSearch = search
+        shownItems = ProtocolDecoderPanelController.filter(decoder.getAllItems(), search: search)
+        tableView.reloadData()
+        if ( following && shownItems.count > 0 ) {
+            tableView.scrollRowToVisible(shownItems.count - 1)
+        }
+    }
+    
+    private class func kindName( kind:DecodedItemKind ) -> String {
+        switch (kind) {
+        case .Data:
+            return "data"
+        case .Address:
+            return "address"
+        case .Start:
+            return "start"
+        case .Stop:
+            return "stop"
+        case .Error:
+            return "error"
+        }
+    }
+    
+    private class func filter( items:[DecodedItem], search:String ) -> [DecodedItem] {
+        let needle = search.stringByTrimmingCharactersInSet(NSCharacterSet.whitespaceCharacterSet()).lowercaseString
+        if ( needle.isEmpty ) {
+            return items
+        }
+        return items.filter({ item in
+            return item.text.lowercaseString.containsString(needle) || ProtocolDecoderPanelController.kindName(item.kind).containsString(needle)
+        })
+    }
+    
+    //
+    // THE TABLE
+    //
+    
+    func numberOfRowsInTableView(tableView: NSTableView) -> Int {
+        return shownItems.count
+    }
+    
+    func tableView(tableView: NSTableView, objectValueForTableColumn tableColumn: NSTableColumn?, row: Int) -> AnyObject? {
+        guard row >= 0 && row < shownItems.count, let identifier = tableColumn?.identifier else {
+            return nil
+        }
+        let item = shownItems[row]
+        switch (identifier) {
+        case "time":
+            return String(format: "%.6f", Double(item.firstSampleIndex) * Double(CONFIG_SAMPLEPERIOD))
+        case "kind":
+            return ProtocolDecoderPanelController.kindName(item.kind)
+        default:
+            return item.text
+        }
+    }
+    
+    //
+    // ACTIONS
+    //
+    
+    @IBAction func channelChanged(sender: AnyObject) {
+        refresh()
+    }
+    
+    @IBAction func protocolChanged(sender: AnyObject) {
+        updateOptions()
+    }
+    
+    @IBAction func searchChanged(sender: AnyObject) {
+        refresh()
+    }
+    
+    @IBAction func startDecoding(sender: AnyObject) {
+        guard let ch = channel else {
+            return
+        }
+        let bits = max(1, bitsField.integerValue)
+        let option = max(0, optionsPopup.indexOfSelectedItem)
+        var serialProtocol:SerialProtocol
+        switch (protocolPopup.indexOfSelectedItem) {
+        case 0:
+            let parities:[UARTParity] = [.None, .Even, .Odd]
+            serialProtocol = .UART(baud: max(1, rateField.integerValue), dataBits: bits, parity: parities[min(option, 2)], stopBits: 1, inverted: false)
+        case 1:
+            guard let data = channelAt(dataPopup.indexOfSelectedItem) else {
+                return
+            }
+            let select = channelAt(selectPopup.indexOfSelectedItem - 1)
+            serialProtocol = .SPI(data: data.sampleBuffer, select: select?.sampleBuffer, mode: option, bitsPerWord: bits, lsbFirst: false)
+        default:
+            guard let data = channelAt(dataPopup.indexOfSelectedItem) else {
+                return
+            }
+            serialProtocol = .I2C(data: data.sampleBuffer)
+        }
+        let threshold = Voltage(thresholdField.doubleValue)
+        ch.installProtocolDecoder(ProtocolDecoderSettings(serialProtocol: serialProtocol, threshold: threshold, hysteresis: CONFIG_PROTOCOL_DEFAULT_HYSTERESIS))
+        refresh()
+    }
+    
+    @IBAction func stopDecoding(sender: AnyObject) {
+        channel?.installProtocolDecoder(nil)
+        refresh()
+    }
+}
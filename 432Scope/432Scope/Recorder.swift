@@ -0,0 +1,294 @@
+//
+//  Recorder.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/5/16.
+//
+//
+
+import Foundation
+#if os(Linux)
+import Glibc
+#else
+import Darwin
+#endif
+
+/*
+ Streams a channel's decoded samples to disk, for as long as you like.
+ 
+ It's a SampleBufferReader, so it sits after the Decoder and never touches the buffer's write queue.  Samples get packed into
+ fixed-size chunks in page-aligned memory, and each full chunk is handed to a GCD dispatch_io channel which writes it
+ asynchronously.  If the disk falls behind by more than CONFIG_RECORDER_MAX_CHUNKS_IN_FLIGHT chunks, chunks get dropped
+ (and counted) instead of eating memory.
+ 
+ FILES (everything little-endian):
+ 
+ <name>.432rec - the data.  Back-to-back chunks, each exactly CONFIG_RECORDER_CHUNK_SIZE bytes:
+    0   UInt32  magic "432C"
+    4   UInt16  format version
+    6   UInt16  header size (64)
+    8   UInt32  sample rate in Hz
+    12  UInt32  valid sample count in this chunk
+    16  UInt64  sample index of the first sample (see SampleBuffer.committedSampleCount)
+    24  UInt32  channel number
+    28  Int32   lowest sample in the chunk
+    32  Int32   highest sample in the chunk
+    36  ...     reserved, zero
+    64  Int16 x sample count, oldest first.  the rest of the chunk is zero padding.
+ The samples in one chunk are contiguous.  a gap (the recorder couldn't keep up, or a chunk got dropped) shows up as a jump in the start index.
+ 
+ <name>.432idx - the seek index.  a 64-byte header:
+    0   UInt32  magic "432I"
+    4   UInt16  format version
+    6   UInt16  header size (64)
+    8   UInt32  sample rate in Hz
+    12  UInt32  chunk size in bytes
+    16  UInt32  channel number
+    20  ...     device name, UTF-8, zero padded to 64
+ then one 32-byte entry per chunk, in file order:
+    0   UInt64  sample index of the first sample
+    8   UInt64  byte offset of the chunk in the .432rec file
+    16  UInt32  valid sample count
+    20  Int32   lowest sample
+    24  Int32   highest sample
+    28  UInt32  reserved
+*/
+
+class Recorder: SampleBufferReader {
+    
+    static let formatVersion:UInt16 = 1
+    static let headerSize:Int = 64
+    static let indexEntrySize:Int = 32
+    static let chunkMagic:UInt32 = 0x43323334 // "432C"
+    static let indexMagic:UInt32 = 0x49323334 // "432I"
+    
+    let channelNumber:Int
+    let dataFileURL:NSURL
+    let indexFileURL:NSURL
+    
+    // counters, for the curious.  only touched on the reader queue.
+    private(set) var chunksWritten:Int = 0
+    private(set) var chunksDropped:Int = 0
+    private(set) var bytesWritten:Int = 0
+    
+    private var dataChannel:dispatch_io_t? = nil
+    private var indexChannel:dispatch_io_t? = nil
+    private var dataFileOffset:Int = 0
+    private var indexFileOffset:Int = 0
+    
+    // the chunk being filled
+    private let samplesPerChunk:Int = (CONFIG_RECORDER_CHUNK_SIZE - Recorder.headerSize) / sizeof(Int16)
+    private var chunk:UnsafeMutablePointer<Void> = nil
+    private var chunkSampleCount:Int = 0
+    private var chunkStartSampleIndex:UInt = 0
+    private var chunkMin:Sample = Sample.max
+    private var chunkMax:Sample = Sample.min
+    
+    // chunks handed to dispatch_io that haven't finished writing yet
+    private var chunksInFlight:Int = 0
+    
+    // one member per open file.  each leaves once its channel is closed and its writes are all through.
+    private let gcdFilesOpenGroup = dispatch_group_create()
+    
+    init( sampleBuffer:SampleBuffer, channelNumber:Int, deviceName:String, directory:NSURL, baseName:String ) throws {
+        self.channelNumber = channelNumber
+        dataFileURL = directory.URLByAppendingPathComponent(baseName + ".432rec")
+        indexFileURL = directory.URLByAppendingPathComponent(baseName + ".432idx")
+        super.init(sampleBuffer: sampleBuffer, queueLabel: "recorderQueue")
+        
+        dataChannel = try openChannel(dataFileURL)
+        indexChannel = try openChannel(indexFileURL)
+        
+        // the index file starts with its header
+        let header = UnsafeMutablePointer<UInt8>.alloc(Recorder.headerSize)
+        memset(header, 0, Recorder.headerSize)
+        Recorder.store(Recorder.indexMagic, at: 0, into: header)
+        Recorder.store(Recorder.formatVersion, at: 4, into: header)
+        Recorder.store(UInt16(Recorder.headerSize), at: 6, into: header)
+        Recorder.store(UInt32(CONFIG_SAMPLERATE), at: 8, into: header)
+        Recorder.store(UInt32(CONFIG_RECORDER_CHUNK_SIZE), at: 12, into: header)
+        Recorder.store(UInt32(channelNumber), at: 16, into: header)
+        let nameBytes = Array(deviceName.utf8)
+        for i in 0..<min(nameBytes.count, Recorder.headerSize - 21) {
+            header[20 + i] = nameBytes[i]
+        }
+        writeIndexBytes(header, count: Recorder.headerSize)
+        
+        startNewChunk(readCursor)
+    }
+    
+    private func openChannel( url:NSURL ) throws -> dispatch_io_t {
+        let fd = open(url.path!, O_WRONLY | O_CREAT | O_TRUNC, 0o644)
+        if ( fd < 0 ) {
+            throw Error.ChannelFatal("Recorder: couldn't open \(url.path!) for writing.")
+        }
+        dispatch_group_enter(gcdFilesOpenGroup)
+        return dispatch_io_create(DISPATCH_IO_STREAM, fd, gcdReaderQueue, { error in
+            close(fd)
+            dispatch_group_leave(self.gcdFilesOpenGroup)
+        })
+    }
+    
+    //
+    // CHUNK BUILDING - all on the reader queue.
+    //
+    
+    override func processBlock( block:UnsafeBufferPointer<Sample>, firstSampleIndex:UInt ) {
+        guard dataChannel != nil else {
+            return
+        }
+        var blockOffset = 0
+        while ( blockOffset < block.count ) {
+            if ( chunk == nil ) {
+                startNewChunk(firstSampleIndex &+ UInt(blockOffset))
+                if ( chunk == nil ) {
+                    // out of memory.  nothing sensible to do but skip this block.
+                    chunksDropped += 1
+                    return
+                }
+            }
+            let count = min(block.count - blockOffset, samplesPerChunk - chunkSampleCount)
+            let payload = UnsafeMutablePointer<Int16>(UnsafeMutablePointer<UInt8>(chunk) + Recorder.headerSize) + chunkSampleCount
+            for i in 0..<count {
+                let sample = block[blockOffset + i]
+                payload[i] = Int16(truncatingBitPattern: sample)
+                if ( sample < chunkMin ) {
+                    chunkMin = sample
+                }
+                if ( sample > chunkMax ) {
+                    chunkMax = sample
+                }
+            }
+            chunkSampleCount += count
+            blockOffset += count
+            if ( chunkSampleCount == samplesPerChunk ) {
+                finishChunk()
+            }
+        }
+    }
+    
+    // a chunk has to be contiguous, so a skip closes out the current one.
+    override func readerDidSkipAhead( newCursor:UInt ) {
+        finishChunk()
+        if ( chunk != nil ) {
+            // there was nothing in it yet.  just move it.
+            chunkStartSampleIndex = newCursor
+        }
+    }
+    
+    private func startNewChunk( startSampleIndex:UInt ) {
+        // page-aligned, so the kernel can move it without copying.
+        if ( posix_memalign(&chunk, Int(getpagesize()), CONFIG_RECORDER_CHUNK_SIZE) != 0 ) {
+            chunk = nil
+            return
+        }
+        memset(chunk, 0, CONFIG_RECORDER_CHUNK_SIZE)
+        chunkSampleCount = 0
+        chunkStartSampleIndex = startSampleIndex
+        chunkMin = Sample.max
+        chunkMax = Sample.min
+    }
+    
+    private func finishChunk() {
+        guard chunk != nil && chunkSampleCount > 0 else {
+            return
+        }
+        let finishedChunk = chunk
+        chunk = nil
+        
+        // too far behind?  let this one go rather than pile up memory.
+        if ( chunksInFlight >= CONFIG_RECORDER_MAX_CHUNKS_IN_FLIGHT ) {
+            chunksDropped += 1
+            free(finishedChunk)
+            print("----Recorder.finishChunk: disk can't keep up, dropped a chunk on channel \(channelNumber)")
+            return
+        }
+        
+        // fill in the header
+        let header = UnsafeMutablePointer<UInt8>(finishedChunk)
+        Recorder.store(Recorder.chunkMagic, at: 0, into: header)
+        Recorder.store(Recorder.formatVersion, at: 4, into: header)
+        Recorder.store(UInt16(Recorder.headerSize), at: 6, into: header)
+        Recorder.store(UInt32(CONFIG_SAMPLERATE), at: 8, into: header)
+        Recorder.store(UInt32(chunkSampleCount), at: 12, into: header)
+        Recorder.store(UInt64(chunkStartSampleIndex), at: 16, into: header)
+        Recorder.store(UInt32(channelNumber), at: 24, into: header)
+        Recorder.store(Int32(truncatingBitPattern: chunkMin), at: 28, into: header)
+        Recorder.store(Int32(truncatingBitPattern: chunkMax), at: 32, into: header)
+        
+        // and the index entry to go with it
+        let entry = UnsafeMutablePointer<UInt8>.alloc(Recorder.indexEntrySize)
+        memset(entry, 0, Recorder.indexEntrySize)
+        Recorder.store(UInt64(chunkStartSampleIndex), at: 0, into: entry)
+        Recorder.store(UInt64(dataFileOffset), at: 8, into: entry)
+        Recorder.store(UInt32(chunkSampleCount), at: 16, into: entry)
+        Recorder.store(Int32(truncatingBitPattern: chunkMin), at: 20, into: entry)
+        Recorder.store(Int32(truncatingBitPattern: chunkMax), at: 24, into: entry)
+        
+        // off it goes.  dispatch_data frees the chunk once the write is done with it.
+        let data = dispatch_data_create(finishedChunk, CONFIG_RECORDER_CHUNK_SIZE, gcdReaderQueue, {
+            free(finishedChunk)
+        })
+        chunksInFlight += 1
+        dispatch_io_write(dataChannel!, off_t(dataFileOffset), data, gcdReaderQueue, { done, remaining, error in
+            if ( error != 0 ) {
+                print("----Recorder: write error \(error) on \(self.dataFileURL.path!)")
+            }
+            if ( done ) {
+                self.chunksInFlight -= 1
+                self.chunksWritten += 1
+                self.bytesWritten += CONFIG_RECORDER_CHUNK_SIZE
+            }
+        })
+        dataFileOffset += CONFIG_RECORDER_CHUNK_SIZE
+        writeIndexBytes(entry, count: Recorder.indexEntrySize)
+    }
+    
+    private func writeIndexBytes( bytes:UnsafeMutablePointer<UInt8>, count:Int ) {
+        let data = dispatch_data_create(bytes, count, gcdReaderQueue, {
+            bytes.dealloc(count)
+        })
+        dispatch_io_write(indexChannel!, off_t(indexFileOffset), data, gcdReaderQueue, { done, remaining, error in
+            if ( error != 0 ) {
+                print("----Recorder: write error \(error) on \(self.indexFileURL.path!)")
+            }
+        })
+        indexFileOffset += count
+    }
+    
+    private class func store<T>( value:T, at offset:Int, into buffer:UnsafeMutablePointer<UInt8> ) {
+        UnsafeMutablePointer<T>(buffer + offset).memory = value
+    }
+    
+    //
+    // STOPPING
+    //
+    
+    // flushes the partial chunk and closes the files once the writes are through.  call after removing this from the sample buffer.
+    func finish() {
+        dispatch_async( gcdReaderQueue, {
+            self.finishChunk()
+            if let channel = self.dataChannel {
+                dispatch_io_close(channel, 0)
+            }
+            if let channel = self.indexChannel {
+                dispatch_io_close(channel, 0)
+            }
+            self.dataChannel = nil
+            self.indexChannel = nil
+            print("----Recorder.finish: channel \(self.channelNumber) wrote \(self.chunksWritten + self.chunksInFlight) chunks, dropped \(self.chunksDropped)")
+        })
+    }
+    
+    // blocks until finish has closed both files and everything's on disk.  for when the process is about to exit.
+    // don't call it on the reader queue.  false if it timed out.
+    func waitUntilFinished( timeout:Time ) -> Bool {
+        return dispatch_group_wait(gcdFilesOpenGroup, dispatch_time(DISPATCH_TIME_NOW, Int64(Double(timeout) * Double(NSEC_PER_SEC)))) == 0
+    }
+    
+    deinit {
+        if ( chunk != nil ) {
+            free(chunk)
+        }
+    }
+}
@@ -8,26 +8,119 @@
 
 
 /* 
- stores samples, connects to a trigger detector ...
+ stores samples, and tells any attached readers (trigger stages etc.) when there are new ones ...
  Concurrency: array writes are done in a serial queue and reads pause the queue.
+ Readers do their work on their own queues (see SampleBufferReader.swift), so the write path stays short.
  */
 
 
 import Foundation
 
 
-class SampleBuffer {
+// the read side of a sample buffer: everything drawing and measuring use.  SampleBuffer is the real thing; a math
+// channel's samples (MathChannel.swift) compute the same answers on demand from other channels' buffers, and a decimated
+// copy (Decimator.swift) answers them from a lower-rate buffer.
+protocol SampleHistory: class {
+    var capacity:Int { get }
+    var committedSampleCount:UInt { get }
+    var clearCount:UInt { get }
+    var lastCommitTime:UInt64 { get }
+    
+    // how many of the newest samples can still read differently next time, even without a clear.  0 for real buffers.
+    var settlingSampleCount:Int { get }
+    
+    func getSampleAtTime( time:Time ) -> Sample
+    func getSampleRange( timeRange:TimeRange ) -> Array<Sample>
+    func copySamples( firstSampleIndex:UInt, count:Int, destination:UnsafeMutablePointer<Sample> )
+    func getMinMax( firstSampleIndex:Int, count:Int ) -> (min:Sample, max:Sample)
+    func getColumnMinMaxes( newestSampleIndex:Int, samplesPerColumn:Double, columnCount:Int ) -> [(min:Sample, max:Sample)]
+    func getSubRangeMinMaxes( timeRange:TimeRange, howManySubranges:Int ) -> [(min:Sample, max:Sample)]
+}
+
+// for histories where getMinMax is the only real read there is (MathChannel.swift, Decimator.swift): the same columns
+// SampleBuffer's getColumnMinMaxes and getSubRangeMinMaxes give, one getMinMax each.  they get asked for oldest column
+// first, so anything that carries state from one run of samples to the next (an integral, say) only goes forward.
+extension SampleHistory {
+    
+    var settlingSampleCount:Int {
+        return 0
+    }
+    
+    func walkColumnMinMaxes( newestSampleIndex:Int, samplesPerColumn:Double, columnCount:Int ) -> [(min:Sample, max:Sample)] {
+        var minmaxes = [(min:Sample, max:Sample)](count: columnCount, repeatedValue: (min: 0, max: 0))
+        for i in (0..<columnCount).reverse() {
+            let columnNewest = newestSampleIndex - Int(floor(Double(i) * samplesPerColumn))
+            let columnOldest = newestSampleIndex - Int(floor(Double(i+1) * samplesPerColumn)) + 1
+            let count = Swift.max(columnNewest - columnOldest + 1, 1)
+            minmaxes[i] = getMinMax(columnNewest - count + 1, count: count)
+        }
+        return minmaxes
+    }
+    
+    func walkSubRangeMinMaxes( timeRange:TimeRange, howManySubranges:Int ) -> [(min:Sample, max:Sample)] {
+        let newestAge = timeRange.newest.asSampleIndex()
+        let visibleSampleCount = timeRange.oldest.asSampleIndex() - newestAge + 1
+        let subrangeWidthInSamples = Double(visibleSampleCount) / Double(howManySubranges)
+        let subrangeSampleCount = Swift.max(1, Int(ceil(subrangeWidthInSamples)))
+        let newestSampleIndex = Int(committedSampleCount) - 1
+        
+        var minmaxes = [(min:Sample, max:Sample)](count: howManySubranges, repeatedValue: (min: 0, max: 0))
+        for j in (0..<howManySubranges).reverse() {
+            let oldestAge = newestAge + Int(floor(Double(j) * subrangeWidthInSamples)) + subrangeSampleCount - 1
+            minmaxes[j] = getMinMax(newestSampleIndex - oldestAge, count: subrangeSampleCount)
+        }
+        return minmaxes
+    }
+}
+
+
+class SampleBuffer: SampleHistory {
     
     // use this to sync / lock the memory buffer
     private var gcdSampleBufferQueue:dispatch_queue_t? = nil
     
-    // the memory buffer itself
-    private var samples:ContiguousArray<Sample> = []
-    private var capacity:Int = 0
+    // the memory buffer itself.  storage owns it (RAM or a mapped file, see SampleStorage.swift); samples is just its pointer.
+    private var storage:SampleStorage? = nil
+    // 16 bits a sample (StoredSample), widened to Sample by everything that reads it.
+    private var samples:UnsafeMutablePointer<StoredSample> = nil
+    private(set) var capacity:Int = 0
     private var writeIndex:Int = 0
     
-    // if there's a trigger object attached, samples will be passed through to it as well.
-    var trigger:Trigger? = nil
+    // how many samples have ever been written.  this never goes backwards (not even on clear), so "sample index N" means the same sample to everybody for as long as it's in the ring.
+    private(set) var committedSampleCount:UInt = 0
+    
+    // when the newest block went in, on the Instrumentation clock.  0 if instrumentation is compiled out.
+    private(set) var lastCommitTime:UInt64 = 0
+    
+    // bumps every time the contents get wiped, so anybody caching what's in here knows to start over.
+    private(set) var clearCount:UInt = 0
+    
+    // the clear is a watermark, not a wipe: samples older than validFromSampleIndex read as clearValue, whatever the
+    // array still has in it.  so clearing costs the same at any depth, and the array never gets touched until it's
+    // written (the storage hands out zero pages lazily, see SampleStorage.swift).  reads outside the write queue see
+    // the watermark move between one sample and the next, same as they see the writer.
+    private(set) var validFromSampleIndex:UInt = 0
+    private(set) var clearValue:Sample = 0
+    
+    // how many of the newest samples are real: written since the last clear, and still in the ring.
+    var validSampleCount:Int {
+        return Int(Swift.min(committedSampleCount &- validFromSampleIndex, UInt(capacity)))
+    }
+    
+    // pipeline stages reading the committed samples.  only touched on the write queue.
+    private var readers:[SampleBufferReader] = []
+    
+    func addReader( reader:SampleBufferReader ) {
+        dispatch_sync( gcdSampleBufferQueue!, {
+            self.readers.append(reader)
+        })
+    }
+    
+    func removeReader( reader:SampleBufferReader ) {
+        dispatch_sync( gcdSampleBufferQueue!, {
+            self.readers = self.readers.filter({ $0 !== reader })
+        })
+    }
     
     func suspendWrites() {
         dispatch_sync(gcdSampleBufferQueue!, {
@@ -38,15 +131,24 @@ class SampleBuffer {
     func resumeWrites() {
         dispatch_resume(gcdSampleBufferQueue!)
     }
-
+    
     init() {
     }
     
-    init( capacity:Int, clearValue:Sample ) {
-        samples = ContiguousArray<Sample>(count: capacity, repeatedValue: clearValue)
-        samples.reserveCapacity(capacity)
-        
-        self.capacity = capacity
+    convenience init( capacity:Int, clearValue:Sample ) {
+        self.init( storage:MemorySampleStorage(capacity: capacity), clearValue:clearValue )
+    }
+    
+    // deep history: the ring lives in a memory-mapped file.
+    convenience init( capacity:Int, clearValue:Sample, mappedFileURL:NSURL ) throws {
+        try self.init( storage:MappedSampleStorage(capacity: capacity, fileURL: mappedFileURL), clearValue:clearValue )
+    }
+    
+    init( storage:SampleStorage, clearValue:Sample ) {
+        self.storage = storage
+        samples = storage.samples
+        capacity = storage.capacity
+        self.clearValue = clearValue
         writeIndex = capacity - 1
         
         gcdSampleBufferQueue = dispatch_queue_create( "sampleBufferWriteQueue", DISPATCH_QUEUE_SERIAL )
@@ -62,13 +164,16 @@ class SampleBuffer {
         }
         return rval
     }
-
+    
     //
     // READ FUNCTIONS.  These do NOT suspend writes so just be aware the array could be running around under you.
     
     func getNewestSample() -> Sample {
+        if ( validSampleCount == 0 ) {
+            return clearValue
+        }
         let newestSampleIndex = self.wrapIndex(self.writeIndex + 1)
-        return self.samples[newestSampleIndex]
+        return Sample(self.samples[newestSampleIndex])
     }
     
     func getSampleRange( timeRange:TimeRange ) -> Array<Sample> {
@@ -86,30 +191,80 @@ class SampleBuffer {
         let safeOldest = self.wrapIndex(indexRange.oldest + lockedWriteIndex + 1)
         if ( safeNewest < safeOldest ) {
             // contiguous
-            rval = Array<Sample>(self.samples[safeNewest...safeOldest])
+            rval = UnsafeBufferPointer<StoredSample>(start: self.samples + safeNewest, count: safeOldest - safeNewest + 1).map({ Sample($0) })
         } else {
             // the range wraps around the end of the array
-            rval = Array<Sample>(self.samples[safeNewest...(self.capacity-1)])
-            rval += Array<Sample>(self.samples[0...safeOldest])
+            rval = UnsafeBufferPointer<StoredSample>(start: self.samples + safeNewest, count: self.capacity - safeNewest).map({ Sample($0) })
+            rval += UnsafeBufferPointer<StoredSample>(start: self.samples, count: safeOldest + 1).map({ Sample($0) })
+        }
+        
+        // anything older than the watermark was cleared.  rval[k] is age newest+k.
+        let firstCleared = Swift.min(rval.count, Swift.max(0, self.validSampleCount - indexRange.newest))
+        for k in firstCleared..<rval.count {
+            rval[k] = clearValue
         }
         return rval
         
     }
     
+    // where sample index N lives in the array.  the first sample ever written went to capacity-1, and it counts down from there.
+    func arrayIndexOfSample( sampleIndex:UInt ) -> Int {
+        return capacity - 1 - Int(sampleIndex % UInt(capacity))
+    }
+    
+    // copies committed samples out in time order (oldest first), starting at sample index firstSampleIndex.  readers use this from their own queues.
+    func copySamples( firstSampleIndex:UInt, count:Int, destination:UnsafeMutablePointer<Sample> ) {
+        // the cleared part first
+        let validFrom = validFromSampleIndex
+        let clearedCount = (firstSampleIndex < validFrom) ? Int(Swift.min(validFrom - firstSampleIndex, UInt(Swift.max(0, count)))) : 0
+        for i in 0..<clearedCount {
+            destination[i] = clearValue
+        }
+        var arrayIndex = arrayIndexOfSample(firstSampleIndex &+ UInt(clearedCount))
+        for i in clearedCount..<Swift.max(clearedCount, count) {
+            destination[i] = Sample(samples[arrayIndex])
+            arrayIndex -= 1
+            if ( arrayIndex < 0 ) {
+                arrayIndex = capacity - 1
+            }
+        }
+    }
+    
+    // the same samples as copySamples, without the copy: the runs of the array they're in, oldest run first.  the array
+    // counts down, so inside a run the newest sample comes first.  there are never more than two (one if it doesn't wrap).
+    // the array doesn't know about the clear watermark, so keep to the newest validSampleCount samples.  the runs are the
+    // array's own StoredSamples, so widen them as they go.
+    func forEachSegment( firstSampleIndex:UInt, count:Int, body:(segment:UnsafeBufferPointer<StoredSample>, firstSampleIndex:UInt) -> () ) {
+        let n = Swift.min(count, capacity)
+        if ( n <= 0 ) {
+            return
+        }
+        let arrayIndex = arrayIndexOfSample(firstSampleIndex)
+        let firstRun = Swift.min(n, arrayIndex + 1)
+        body(segment: UnsafeBufferPointer<StoredSample>(start: samples + arrayIndex - firstRun + 1, count: firstRun), firstSampleIndex: firstSampleIndex)
+        if ( firstRun < n ) {
+            body(segment: UnsafeBufferPointer<StoredSample>(start: samples + capacity - (n - firstRun), count: n - firstRun), firstSampleIndex: firstSampleIndex + UInt(firstRun))
+        }
+    }
+    
     //
     // READ-WITHOUT-COPY, and MINMAX stuff, for the new drawing trick.
     //
     // set a subrange depth, and then query indices on that timeframe ...
     //
     
-    // returns the first sample in the subrange
+    // the sample time seconds before the newest one.
     func getSampleAtTime( time:Time ) -> Sample {
-        return samples[wrapIndex(time.asSampleIndex())]
+        let age = time.asSampleIndex()
+        if ( age < 0 || age >= validSampleCount ) {
+            return clearValue
+        }
+        return Sample(samples[wrapIndex(age + writeIndex + 1)])
     }
     
     // let's try doing this all locally in sampleBuffer, maybe the call / deref overhead is significant ...
     func getSubRangeMinMaxes(timeRange:TimeRange, howManySubranges:Int) -> [(min:Sample, max:Sample)] {
-
+        
         // figure out how many samples to minmax per pixel
         
         // TODO: parallel-process this??
@@ -126,8 +281,13 @@ class SampleBuffer {
         var subrangeStartIndexAsFloat = CGFloat(wrapIndex(timeRange.newest.asSampleIndex()+(1+writeIndex)))
         var subrangeStartIndex = Int(floor(subrangeStartIndexAsFloat))
         
+        // and the age of the same sample, because anything older than validCount was cleared.
+        let validCount = validSampleCount
+        var subrangeStartAgeAsFloat = CGFloat(timeRange.newest.asSampleIndex())
+        var subrangeStartAge = Int(floor(subrangeStartAgeAsFloat))
+
 //        print("samples in time range: \(visibleSampleCount)\t\tframe width in samples: \(subrangeWidthInSamples)")
-        
+
         // this subfunction will do the actual computing. just set subrangeStartIndex and subrangeSampleCount (which is already set as it was declared) ...
         var min:Sample = Sample.max
         var max:Sample = Sample.min
@@ -137,7 +297,7 @@ class SampleBuffer {
         func getLocalMinMax() -> (min:Sample, max:Sample) {
             // eliminate the obvious stuff ...
             if subrangeSampleCount <= 1 {
-                let theLonelySample = samples[subrangeStartIndex]
+                let theLonelySample = (subrangeStartAge < validCount) ? Sample(samples[subrangeStartIndex]) : clearValue
                 return (min:theLonelySample, max:theLonelySample)
             }
             
@@ -146,11 +306,16 @@ class SampleBuffer {
             max = Sample.min
             realIndex = 0
             currentSample = 0
-            subrangeEndIndex = subrangeStartIndex + subrangeSampleCount
+            let validSamples = Swift.max(0, Swift.min(subrangeSampleCount, validCount - subrangeStartAge))
+            if ( validSamples < subrangeSampleCount ) {
+                min = clearValue
+                max = clearValue
+            }
+            subrangeEndIndex = subrangeStartIndex + validSamples
             
             for i in subrangeStartIndex..<subrangeEndIndex {
                 realIndex = wrapIndex(i)
-                currentSample = samples[realIndex]
+                currentSample = Sample(samples[realIndex])
                 if ( currentSample < min ) {
                     min = currentSample
                 }
@@ -160,7 +325,7 @@ class SampleBuffer {
             }
             return (min:min, max:max)
         }
-
+        
         // create the return object ...
         var minmaxes:[(min:Sample, max:Sample)] = []
         minmaxes.reserveCapacity(howManySubranges)
@@ -170,36 +335,117 @@ class SampleBuffer {
             minmaxes.append(getLocalMinMax())
             subrangeStartIndexAsFloat += subrangeWidthInSamples
             subrangeStartIndex = Int(floor(subrangeStartIndexAsFloat))
+            subrangeStartAgeAsFloat += subrangeWidthInSamples
+            subrangeStartAge = Int(floor(subrangeStartAgeAsFloat))
         }
         
         return minmaxes
     }
     
+    // minmax over a run of sample indices, oldest first.  indices before the watermark (which includes everything before
+    // the first sample ever written) are clearValue.
+    func getMinMax( firstSampleIndex:Int, count:Int ) -> (min:Sample, max:Sample) {
+        var min:Sample = Sample.max
+        var max:Sample = Sample.min
+        let clearedCount = Swift.max(0, Swift.min(count, Int(validFromSampleIndex) - firstSampleIndex))
+        if ( clearedCount > 0 ) {
+            min = clearValue
+            max = clearValue
+        }
+        var arrayIndex = wrapIndex(capacity - 1 - ((firstSampleIndex + clearedCount) % capacity))
+        for _ in clearedCount..<Swift.max(clearedCount, count) {
+            let currentSample = Sample(samples[arrayIndex])
+            if ( currentSample < min ) {
+                min = currentSample
+            }
+            if ( currentSample > max ) {
+                max = currentSample
+            }
+            arrayIndex -= 1
+            if ( arrayIndex < 0 ) {
+                arrayIndex = capacity - 1
+            }
+        }
+        return (min:min, max:max)
+    }
+    
+    // columns of minmaxes for a window ending at newestSampleIndex, newest column first.  column i covers the samples
+    // between i*samplesPerColumn and (i+1)*samplesPerColumn back from the newest, and always at least one.
+    func getColumnMinMaxes( newestSampleIndex:Int, samplesPerColumn:Double, columnCount:Int ) -> [(min:Sample, max:Sample)] {
+        var minmaxes:[(min:Sample, max:Sample)] = []
+        minmaxes.reserveCapacity(columnCount)
+        for i in 0..<columnCount {
+            let columnNewest = newestSampleIndex - Int(floor(Double(i) * samplesPerColumn))
+            let columnOldest = newestSampleIndex - Int(floor(Double(i+1) * samplesPerColumn)) + 1
+            let count = Swift.max(columnNewest - columnOldest + 1, 1)
+            minmaxes.append(getMinMax(columnNewest - count + 1, count: count))
+        }
+        return minmaxes
+    }
+    
     private func getSubRangeSampleCount(timeRange:TimeRange) -> Int {
         let oldest = timeRange.oldest.asSampleIndex()
         let newest = timeRange.newest.asSampleIndex()
         return (oldest - newest) + 1
     }
-
+    
     //
     // WRITE FUNCTIONS which should ALL queue their writes.
     //
     
+    // the ring only keeps 16 bits, so anything outside the ADC's range (a filter's overshoot, say) gets pinned to the
+    // rail on the way in.  truncating it would wrap -3 round to 65533, a full-scale spike.
+    @inline(__always) private class func narrow( sample:Sample ) -> StoredSample {
+        return StoredSample(truncatingBitPattern: (sample < 0) ? 0 : ((sample > CONFIG_SAMPLE_MAX_VALUE) ? CONFIG_SAMPLE_MAX_VALUE : sample))
+    }
+    
     func storeNewSample( newSample:Sample ) {
         dispatch_sync( gcdSampleBufferQueue!, {
-            self.samples[self.writeIndex] = newSample
+            self.samples[self.writeIndex] = SampleBuffer.narrow(newSample)
             self.writeIndex = self.wrapIndex(self.writeIndex-1)
-            if let trig = self.trigger {
-                trig.processSample(newSample)
+            self.committedSampleCount = self.committedSampleCount &+ 1
+            self.notifyReaders()
+        })
+    }
+    
+    // the decoder stores a whole packet at once.  one trip through the queue, and one wakeup for the readers.
+    func storeNewSamples( block:UnsafeBufferPointer<Sample> ) {
+        let callTime = Instrumentation.now()
+        dispatch_sync( gcdSampleBufferQueue!, {
+            // anything past a few microseconds here is a reader or the UI holding writes off with suspendWrites.
+            let writeStart = Instrumentation.now()
+            Instrumentation.bufferWriteQueueWait.record(writeStart &- callTime)
+            
+            var localWriteIndex = self.writeIndex
+            for sample in block {
+                self.samples[localWriteIndex] = SampleBuffer.narrow(sample)
+                localWriteIndex -= 1
+                if ( localWriteIndex < 0 ) {
+                    localWriteIndex = self.capacity - 1
+                }
             }
+            self.writeIndex = localWriteIndex
+            self.committedSampleCount = self.committedSampleCount &+ UInt(block.count)
+            self.notifyReaders()
+            
+            self.lastCommitTime = Instrumentation.now()
+            Instrumentation.bufferWrite.record(self.lastCommitTime &- writeStart)
         })
     }
     
+    // called on the write queue.  readers just get poked here; they do the actual work on their own queues.
+    private func notifyReaders() {
+        for reader in readers {
+            reader.samplesCommitted()
+        }
+    }
+    
+    // just moves the watermark up to the newest sample.  the array keeps whatever it had until it's written over.
     func clearAllSamples( clearValue:Sample ) {
         dispatch_sync( gcdSampleBufferQueue!, {
-            for i in 0..<self.capacity {
-                self.samples[i] = clearValue
-            }
+            self.clearValue = clearValue
+            self.validFromSampleIndex = self.committedSampleCount
+            self.clearCount = self.clearCount &+ 1
         })
     }
 }
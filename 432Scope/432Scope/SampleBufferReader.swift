@@ -0,0 +1,97 @@
+//
+//  SampleBufferReader.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/2/16.
+//
+//
+
+import Foundation
+
+/*
+ A pipeline stage that consumes a SampleBuffer's committed samples on its own queue.
+ 
+ -SampleBuffer pokes each attached reader from its write queue when new samples are committed.  that's all the write path pays.
+ -the reader hops onto its own serial queue, copies everything between its read cursor and the newest committed sample out of the ring (oldest first), and hands it to processBlock.
+ -if a reader falls so far behind that the ring is about to lap it, it skips ahead and counts the dropped samples instead of holding up ingestion.
+ 
+ Every reader has its own queue, so several of them on one buffer run in parallel.
+ To make a new stage, derive from this and override processBlock (and readerDidSkipAhead if you keep timestamps).
+*/
+
+class SampleBufferReader {
+    
+    let sampleBuffer:SampleBuffer
+    let gcdReaderQueue:dispatch_queue_t
+    
+    // the sample index (see SampleBuffer.committedSampleCount) of the next sample this reader will look at.
+    private(set) var readCursor:UInt
+    
+    // how many samples got skipped because this reader couldn't keep up.
+    private(set) var droppedSampleCount:UInt = 0
+    
+    // time-ordered scratch space for the blocks we hand to processBlock
+    private var block:UnsafeMutablePointer<Sample>
+    private let blockCapacity:Int
+    
+    init( sampleBuffer:SampleBuffer, queueLabel:String ) {
+        self.sampleBuffer = sampleBuffer
+        gcdReaderQueue = dispatch_queue_create( queueLabel, DISPATCH_QUEUE_SERIAL )
+        blockCapacity = CONFIG_DECODER_PACKET_SIZE / CONFIG_INCOMING_SAMPLE_SIZE_IN_BYTES
+        block = UnsafeMutablePointer<Sample>.alloc(blockCapacity)
+        
+        // start from "now".  whatever is already in the buffer is history.
+        readCursor = sampleBuffer.committedSampleCount
+    }
+    
+    deinit {
+        block.dealloc(blockCapacity)
+    }
+    
+    // SampleBuffer calls this on its write queue.  keep it quick.
+    func samplesCommitted() {
+        dispatch_async( gcdReaderQueue, {
+            self.catchUp()
+        })
+    }
+    
+    // run something on this reader's queue, so it sees the stage's state between blocks.
+    func syncWithReader( work:() -> () ) {
+        dispatch_sync( gcdReaderQueue, work )
+    }
+    
+    private func catchUp() {
+        let committed = sampleBuffer.committedSampleCount
+        
+        // the writer keeps going no matter what, so stay at least a packet clear of the oldest sample in the ring.
+        let maximumLag = UInt(max(sampleBuffer.capacity - blockCapacity, blockCapacity))
+        if ( committed &- readCursor > maximumLag ) {
+            let newCursor = committed &- maximumLag
+            droppedSampleCount = droppedSampleCount &+ (newCursor &- readCursor)
+            print("----SampleBufferReader.catchUp: fell behind, skipping \(newCursor &- readCursor) samples")
+            readCursor = newCursor
+            readerDidSkipAhead(newCursor)
+        }
+        
+        while ( readCursor < committed ) {
+            let count = Int(min(committed - readCursor, UInt(blockCapacity)))
+            sampleBuffer.copySamples(readCursor, count: count, destination: block)
+            processBlock(UnsafeBufferPointer<Sample>(start: block, count: count), firstSampleIndex: readCursor)
+            readCursor = readCursor &+ UInt(count)
+        }
+    }
+    
+    //
+    // OVERRIDE THESE
+    //
+    
+    // gets called on the reader queue with the next run of samples in time order.  firstSampleIndex is the sample index of block[0].
+    func processBlock( block:UnsafeBufferPointer<Sample>, firstSampleIndex:UInt ) {
+        // this should be overridden
+        print("---SampleBufferReader.processBlock SHOULD NOT BE GETTING CALLED.")
+    }
+    
+    // the samples before newCursor are gone for good.  stages that keep timestamps should resync here.
+    func readerDidSkipAhead( newCursor:UInt ) {
+    }
+}
@@ -0,0 +1,205 @@
+//
+//  SampleSource.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/10/16.
+//
+//
+
+import Foundation
+
+/*
+ Where a channel's bytes come from.  Anything that can hand a Decoder packets of raw wire-format bytes.
+ 
+ -Transceiver: a 432 on a serial port.
+ -LinuxTransceiver: the same on linux, with its own reader thread instead of dispatch sources.
+ -FileSampleSource: a file.  either raw wire-format bytes (what the 432 sends, 16 bits a sample) or a .432rec recording
+  from Recorder.  for replaying captures, and for working on the signal chain without the hardware plugged in.
+ 
+ Nothing in here knows about the UI, so the whole chain from source to readers runs headless (see 432scope-cli).
+*/
+
+protocol SampleSource: class {
+    var sourceName:String { get }
+    func startStreaming() throws
+    func stopStreaming() throws
+    func flush()                // throw away anything read but not yet decoded
+    func close() throws
+}
+
+class FileSampleSource: SampleSource {
+    
+    let fileURL:NSURL
+    let isRecording:Bool // .432rec, as opposed to raw wire-format bytes
+    
+    // real time paces packets at the sample rate, like a device would.  otherwise it goes as fast as the file can be read,
+    // and readers that can't keep up skip ahead, same as they would with a device.
+    let realTime:Bool
+    
+    // called on the source's queue when the file runs out.
+    var endOfFileHandler:(() -> ())? = nil
+    
+    private(set) var bytesShipped:Int = 0
+    
+    private var decoder:Decoder
+    private var fileHandle:NSFileHandle? = nil
+    private var buffer = NSMutableData()
+    private var atEndOfFile:Bool = false
+    private var isStreaming:Bool = false
+    
+    private let gcdSourceQueue:dispatch_queue_t
+    private var gcdTimer:dispatch_source_t? = nil
+    
+    var sourceName:String {
+        return fileURL.path!
+    }
+    
+    init( fileURL:NSURL, decoder:Decoder, realTime:Bool = true ) throws {
+        self.fileURL = fileURL
+        self.decoder = decoder
+        self.realTime = realTime
+        isRecording = (fileURL.pathExtension == "432rec")
+        gcdSourceQueue = dispatch_queue_create("fileSampleSourceQueue", DISPATCH_QUEUE_SERIAL)
+        
+        fileHandle = NSFileHandle(forReadingAtPath: fileURL.path!)
+        if ( fileHandle == nil ) {
+            throw Error.ChannelFatal("FileSampleSource: couldn't open \(fileURL.path!) for reading.")
+        }
+    }
+    
+    //
+    // STREAMING
+    //
+    
+    func startStreaming() throws {
+        if ( fileHandle == nil ) {
+            throw Error.ChannelFatal("FileSampleSource: file isn't open.")
+        }
+        if ( isStreaming ) {
+            return
+        }
+        isStreaming = true
+        
+        if ( realTime ) {
+            // one packet per tick, at the rate a device would send them.
+            let packetSamples = CONFIG_DECODER_PACKET_SIZE / CONFIG_INCOMING_SAMPLE_SIZE_IN_BYTES
+            let interval = UInt64(Double(NSEC_PER_SEC) * Double(packetSamples) / Double(CONFIG_SAMPLERATE))
+            gcdTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, gcdSourceQueue)
+            dispatch_source_set_timer(gcdTimer!, dispatch_time(DISPATCH_TIME_NOW, 0), interval, interval / 10)
+            dispatch_source_set_event_handler(gcdTimer!, {
+                self.shipPacket()
+            })
+            dispatch_resume(gcdTimer!)
+        } else {
+            dispatch_async( gcdSourceQueue, {
+                self.shipBatch()
+            })
+        }
+    }
+    
+    // flat out, a few packets at a time so stopStreaming and flush can get a word in between batches.
+    private func shipBatch() {
+        for _ in 0..<16 {
+            if ( !isStreaming || !shipPacket() ) {
+                return
+            }
+        }
+        dispatch_async( gcdSourceQueue, {
+            self.shipBatch()
+        })
+    }
+    
+    func stopStreaming() throws {
+        dispatch_sync( gcdSourceQueue, {
+            self.stopOnQueue()
+        })
+    }
+    
+    func flush() {
+        dispatch_sync( gcdSourceQueue, {
+            self.buffer = NSMutableData()
+        })
+    }
+    
+    func close() throws {
+        try stopStreaming()
+        dispatch_sync( gcdSourceQueue, {
+            self.fileHandle?.closeFile()
+            self.fileHandle = nil
+        })
+    }
+    
+    private func stopOnQueue() {
+        isStreaming = false
+        if let timer = gcdTimer {
+            dispatch_source_cancel(timer)
+            gcdTimer = nil
+        }
+    }
+    
+    //
+    // READING - on the source's queue.
+    //
+    
+    // sends one packet to the decoder.  false once the file's used up.
+    private func shipPacket() -> Bool {
+        let packetSize = CONFIG_DECODER_PACKET_SIZE
+        while ( buffer.length < packetSize && !atEndOfFile ) {
+            readMore()
+        }
+        
+        // the last packet in the file can come up short.  that's fine, the decoder takes whatever it gets.
+        let length = min(packetSize, buffer.length - buffer.length % CONFIG_INCOMING_SAMPLE_SIZE_IN_BYTES)
+        if ( length == 0 ) {
+            stopOnQueue()
+            if let handler = endOfFileHandler {
+                handler()
+            }
+            return false
+        }
+        decoder.newPacketArrived(buffer.subdataWithRange(NSRange(location: 0, length: length)))
+        buffer.replaceBytesInRange(NSRange(location: 0, length: length), withBytes: nil, length: 0)
+        bytesShipped += length
+        return true
+    }
+    
+    private func readMore() {
+        guard let handle = fileHandle else {
+            atEndOfFile = true
+            return
+        }
+        if ( !isRecording ) {
+            let data = handle.readDataOfLength(CONFIG_DECODER_PACKET_SIZE * 16)
+            if ( data.length == 0 ) {
+                atEndOfFile = true
+            }
+            buffer.appendData(data)
+            return
+        }
+        
+        // a recording: a chunk at a time.  the samples are stored the way they came off the wire, so the payload
+        // goes to the decoder as is.  see Recorder.swift for the layout.
+        let chunk = handle.readDataOfLength(CONFIG_RECORDER_CHUNK_SIZE)
+        if ( chunk.length < Recorder.headerSize ) {
+            atEndOfFile = true
+            return
+        }
+        let header = UnsafePointer<UInt8>(chunk.bytes)
+        let magic = UnsafePointer<UInt32>(header).memory
+        if ( magic != Recorder.chunkMagic ) {
+            print("----FileSampleSource.readMore: bad chunk magic in \(sourceName), stopping there.")
+            atEndOfFile = true
+            return
+        }
+        let headerSize = Int(UnsafePointer<UInt16>(header + 6).memory)
+        let sampleCount = Int(UnsafePointer<UInt32>(header + 12).memory)
+        let payloadLength = min(sampleCount * sizeof(Int16), chunk.length - headerSize)
+        if ( payloadLength > 0 ) {
+            buffer.appendBytes(header + headerSize, length: payloadLength)
+        }
+    }
+    
+    deinit {
+        fileHandle?.closeFile()
+    }
+}
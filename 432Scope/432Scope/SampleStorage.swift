@@ -0,0 +1,112 @@
+//
+//  SampleStorage.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/6/16.
+//
+//
+
+import Foundation
+#if os(Linux)
+import Glibc
+#else
+import Darwin
+#endif
+
+/*
+ The memory behind a SampleBuffer's ring.  SampleBuffer only ever sees a pointer and a capacity, so where the memory
+ comes from is up to the subclass:
+ 
+ -MemorySampleStorage: plain RAM, mapped anonymously, so it's zero pages the OS doesn't actually hand over until
+  they're written.  a deep buffer costs next to nothing until it fills, and making one doesn't touch it at all.
+ -MappedSampleStorage: a memory-mapped file.  can be gigabytes deep; the OS pages it in and out, so resident memory
+  stays around what's actually being written and looked at.
+ 
+ Either way it's StoredSample, 16 bits a sample, not Sample.  SampleBuffer narrows on the way in (clamping to
+ 0...CONFIG_SAMPLE_MAX_VALUE) and widens on the way out.
+*/
+
+class SampleStorage {
+    let capacity:Int
+    let samples:UnsafeMutablePointer<StoredSample>
+    
+    init( capacity:Int, samples:UnsafeMutablePointer<StoredSample> ) {
+        self.capacity = capacity
+        self.samples = samples
+    }
+    
+    var sizeInBytes:Int {
+        get {
+            return capacity * sizeof(StoredSample)
+        }
+    }
+}
+
+class MemorySampleStorage: SampleStorage {
+    
+    // if the map didn't work out, it's a plain allocation instead.
+    private let isMapped:Bool
+    
+    init( capacity:Int ) {
+        let mapped = mmap(nil, capacity * sizeof(StoredSample), PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0)
+        if ( mapped == UnsafeMutablePointer<Void>(bitPattern: -1) ) {
+            print("----MemorySampleStorage: couldn't map \(capacity) samples, allocating them instead")
+            isMapped = false
+            super.init(capacity: capacity, samples: UnsafeMutablePointer<StoredSample>.alloc(capacity))
+        } else {
+            isMapped = true
+            super.init(capacity: capacity, samples: UnsafeMutablePointer<StoredSample>(mapped))
+        }
+    }
+    
+    deinit {
+        if ( isMapped ) {
+            munmap(samples, sizeInBytes)
+        } else {
+            samples.dealloc(capacity)
+        }
+    }
+}
+
+// the file is scratch space, not a recording (that's Recorder.swift): it's made over from nothing every time, so
+// whatever the last session left in it is gone as soon as the next one opens it.
+class MappedSampleStorage: SampleStorage {
+    
+    let fileURL:NSURL
+    private let fileDescriptor:Int32
+    
+    init( capacity:Int, fileURL:NSURL ) throws {
+        self.fileURL = fileURL
+        let size = capacity * sizeof(StoredSample)
+        
+        if ( access(fileURL.path!, F_OK) == 0 ) {
+            print("----MappedSampleStorage: starting \(fileURL.path!) over.  the last session's history in it is gone.")
+        }
+        
+        // make the file (sparse, so it doesn't cost anything until it's written) ...
+        let fd = open(fileURL.path!, O_RDWR | O_CREAT | O_TRUNC, 0o644)
+        if ( fd < 0 ) {
+            throw Error.ChannelFatal("MappedSampleStorage: couldn't open \(fileURL.path!)")
+        }
+        if ( ftruncate(fd, off_t(size)) != 0 ) {
+            close(fd)
+            throw Error.ChannelFatal("MappedSampleStorage: couldn't make \(fileURL.path!) \(size) bytes long")
+        }
+        
+        // ... and map it.
+        let mapped = mmap(nil, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+        if ( mapped == UnsafeMutablePointer<Void>(bitPattern: -1) ) {
+            close(fd)
+            throw Error.ChannelFatal("MappedSampleStorage: couldn't map \(fileURL.path!)")
+        }
+        fileDescriptor = fd
+        
+        super.init(capacity: capacity, samples: UnsafeMutablePointer<StoredSample>(mapped))
+        print("----MappedSampleStorage: \(size / 1048576) MB ring in \(fileURL.path!)")
+    }
+    
+    deinit {
+        munmap(samples, sizeInBytes)
+        close(fileDescriptor)
+    }
+}
@@ -20,7 +20,7 @@ class ScopeImageView: NSImageView {
     override var opaque:Bool {
         return true
     }
-
+    
     var notifications:ScopeImageViewNotifications? = nil
     var channels:[Channel] = []
     
@@ -44,45 +44,312 @@ class ScopeImageView: NSImageView {
         CGContextStrokeRect(currentContext, ScopeViewMath.selectionRect!)
         selectionBoxPhase += selectionBoxPhaseDelta
     }
-
+    
     //
     // SAMPLE PLOTTING
     //
     
+    // Timeline mode keeps a column cache per channel, so each frame only minmaxes the newly arrived samples.
+    private var columnCaches:[ObjectIdentifier:ColumnCache] = [:]
+    
+    // columnCount is however many columns the caller draws into: the phosphor's, or the rasterizer's backing pixels.
+    private func getMinMaxes(ch:Channel, columnCount:Int) -> [(min:Sample, max:Sample)] {
+        let minMaxStart = Instrumentation.now()
+        defer {
+            Instrumentation.minMax.recordElapsed(since: minMaxStart)
+        }
+        
+        let tvIndexRange = ScopeViewMath.tvRange.asSampleIndexRange()
+        let samplesPerColumn = Double(tvIndexRange.oldest - tvIndexRange.newest + 1) / Double(columnCount)
+        
+        // zoomed in past a sample per column, the columns come off the interpolated trace instead.
+        if ( isDeepZoom ) {
+            let newestAge = Double(ScopeViewMath.tvRange.newest) * Double(CONFIG_SAMPLERATE)
+            return columnsOfPoints(getInterpolatedPoints(ch.samples, newestSampleIndex: Int(ch.samples.committedSampleCount) - 1, newestAge: newestAge, columnCount: columnCount))
+        }
+        
+        // the cache only makes sense when the view is glued to the newest sample, and there's at least a sample per column.
+        var useCache = false
+        if case .Timeline = ScopeViewMath.scopeImageViewDisplayState {
+            useCache = ( tvIndexRange.newest == 0 && samplesPerColumn >= 1 && columnCount > 0 )
+        }
+        // long timebases draw from the channel's decimated copy, if it has one.
+        let samples = ch.samplesForColumns(samplesPerColumn)
+        if ( !useCache ) {
+            columnCaches[ObjectIdentifier(ch)] = nil
+            return samples.getSubRangeMinMaxes(ScopeViewMath.tvRange, howManySubranges: columnCount)
+        }
+        
+        var cache = columnCaches[ObjectIdentifier(ch)]
+        if ( cache == nil ) {
+            cache = ColumnCache()
+            columnCaches[ObjectIdentifier(ch)] = cache
+        }
+        return cache!.getColumns(samples, samplesPerColumn: samplesPerColumn, columnCount: columnCount)
+    }
+    
+    // the minmax columns go straight into pixels, one vertical span each, and the pixels go on screen in one blit.
+    // see SpanRasterizer.swift.
+    private var rasterizers:[ObjectIdentifier:SpanRasterizer] = [:]
+    
+    // sized in backing pixels, with the same scale getLayer gives the trace layer, so a retina screen gets a column per
+    // pixel instead of a point-sized image stretched over it.
+    private func getRasterizer(ch:Channel) -> SpanRasterizer {
+        let scale = window?.backingScaleFactor ?? 1
+        let width = Int(frame.width * scale)
+        let height = Int(frame.height * scale)
+        if let existing = rasterizers[ObjectIdentifier(ch)] {
+            if ( existing.width == width && existing.height == height && existing.scale == scale ) {
+                return existing
+            }
+        }
+        let rasterizer = SpanRasterizer(width: width, height: height, scale: scale)
+        rasterizers[ObjectIdentifier(ch)] = rasterizer
+        return rasterizer
+    }
+    
+    // the channel's sample display transform has to be set while this runs.
     func drawSamples_minmax_inplace(chIndex:Int) {
         let ch = channels[chIndex]
         
-        // get all the local minmaxes
-        let minmaxes = ch.sampleBuffer.getSubRangeMinMaxes(ScopeViewMath.tvRange, howManySubranges: Int(frame.width))
+        let rasterizer = getRasterizer(ch)
         
-        // we can start our path now at the first sample ...
+        // get all the local minmaxes, one per pixel column
+        let minmaxes = getMinMaxes(ch, columnCount: rasterizer.width)
+        
+        rasterizer.updateRows([Double(ScopeViewMath.generation), ch.displayProperties.offset, ch.displayProperties.scaling])
+        rasterizer.clear()
+        rasterizer.fillColumns(minmaxes, color: ch.displayProperties.traceColor)
+        // the layer's CTM already scales points to pixels, so the view's bounds in points is one image pixel per backing pixel.
+        rasterizer.blit(CGRect(x: 0, y: 0, width: frame.width, height: frame.height))
+    }
+    
+    
+    //
+    // DEEP ZOOM - fewer samples than columns, so draw what's between them.  see SincInterpolator.swift.
+    //
+    
+    private let sincInterpolator = SincInterpolator(halfWidth: CONFIG_DISPLAY_SINC_HALF_WIDTH, phaseCount: CONFIG_DISPLAY_SINC_PHASES)
+    
+    private var isDeepZoom:Bool {
+        return CONFIG_DISPLAY_SINC_INTERPOLATION && Double(ScopeViewMath.tvRange.span) * Double(CONFIG_SAMPLERATE) < Double(frame.width)
+    }
+    
+    // the trace at every column edge, newest (the right edge of the view) first, so columnCount+1 of them.  newestAge is
+    // how many sample periods before newestSampleIndex the right edge is, and it doesn't have to be whole.
+    private func getInterpolatedPoints(history:SampleHistory, newestSampleIndex:Int, newestAge:Double, columnCount:Int) -> [Float] {
+        let samplesPerColumn = Double(ScopeViewMath.tvRange.span) * Double(CONFIG_SAMPLERATE) / Double(columnCount)
+        return sincInterpolator.interpolate(history, newestPosition: Double(newestSampleIndex) - newestAge, step: samplesPerColumn, count: columnCount + 1)
+    }
+    
+    // for persistence, which wants columns: each one covers the trace from its right edge to its left.
+    private func columnsOfPoints(points:[Float]) -> [(min:Sample, max:Sample)] {
+        var rval:[(min:Sample, max:Sample)] = []
+        rval.reserveCapacity(points.count - 1)
+        for c in 0..<(points.count - 1) {
+            rval.append((min: Sample(floor(min(points[c], points[c + 1]))), max: Sample(ceil(max(points[c], points[c + 1])))))
+        }
+        return rval
+    }
+    
+    func drawSamples_interpolated(chIndex:Int) {
+        let ch = channels[chIndex]
+        
+        let minMaxStart = Instrumentation.now()
+        let newestAge = Double(ScopeViewMath.tvRange.newest) * Double(CONFIG_SAMPLERATE)
+        let points = getInterpolatedPoints(ch.samples, newestSampleIndex: Int(ch.samples.committedSampleCount) - 1, newestAge: newestAge, columnCount: Int(frame.width))
+        Instrumentation.minMax.recordElapsed(since: minMaxStart)
+        
+        // one line, right to left.  no fill: at this zoom there's nothing between the min and the max.
         let cgPath = CGPathCreateMutable()
-        CGPathMoveToPoint(cgPath, nil, frame.width, CGFloat(ch.sampleBuffer.getSampleAtTime(ScopeViewMath.tvRange.newest)))
-        // trace the maxes ...
         var currentXPixel = frame.width
-        for local in minmaxes {
-            CGPathAddLineToPoint(cgPath, nil, currentXPixel, local.max.asCoordinate())
+        CGPathMoveToPoint(cgPath, nil, currentXPixel, ScopeViewMath.sampleValueAsCoordinate(CGFloat(points[0])))
+        for point in points.dropFirst() {
             currentXPixel -= 1
-        }
-        // .. now trace the mins
-        for local in minmaxes.reverse() {
-            currentXPixel += 1
-            CGPathAddLineToPoint(cgPath, nil, currentXPixel, local.min.asCoordinate())
+            CGPathAddLineToPoint(cgPath, nil, currentXPixel, ScopeViewMath.sampleValueAsCoordinate(CGFloat(point)))
         }
         
-        // set the color
-        let color = ch.displayProperties.traceColor
-        color.setStroke()
-        let fillColor = color.colorWithAlphaComponent(0.5)
-        fillColor.setFill()
-        
-        // draw them
+        ch.displayProperties.traceColor.setStroke()
         let currentContext = NSGraphicsContext.currentContext()?.CGContext
         CGContextAddPath(currentContext, cgPath)
-        CGContextDrawPath(currentContext,.FillStroke)
+        CGContextStrokePath(currentContext)
     }
-
-
+    
+    //
+    // PERSISTENCE (digital phosphor).  see PhosphorBuffer.swift.
+    //
+    
+    var persistenceEnabled:Bool = false {
+        didSet {
+            phosphors = [:]
+        }
+    }
+    var persistenceDecay:Float = CONFIG_DISPLAY_PHOSPHOR_DEFAULT_DECAY {
+        didSet {
+            for phosphor in phosphors.values {
+                phosphor.buffer.decay = persistenceDecay
+            }
+        }
+    }
+    
+    // per channel: the buffer, the view geometry it was drawn with, and the newest trigger event already folded in.
+    private class ChannelPhosphor {
+        let buffer:PhosphorBuffer
+        var geometry:[Double] = []
+        var lastEventTimestamp:UInt? = nil
+        var triggerChannel:ObjectIdentifier? = nil
+        init( buffer:PhosphorBuffer ) {
+            self.buffer = buffer
+        }
+    }
+    private var phosphors:[ObjectIdentifier:ChannelPhosphor] = [:]
+    
+    private func getPhosphor(ch:Channel) -> ChannelPhosphor {
+        let width = Int(frame.width)
+        let height = Int(frame.height)
+        if let existing = phosphors[ObjectIdentifier(ch)] {
+            if ( existing.buffer.width == width && existing.buffer.height == height ) {
+                return existing
+            }
+        }
+        let phosphor = ChannelPhosphor(buffer: PhosphorBuffer(width: width, height: height))
+        phosphor.buffer.decay = persistenceDecay
+        phosphors[ObjectIdentifier(ch)] = phosphor
+        return phosphor
+    }
+    
+    func drawSamples_phosphor(chIndex:Int) {
+        let ch = channels[chIndex]
+        let phosphor = getPhosphor(ch)
+        
+        // anything that moves the trace around on screen makes the old hits meaningless.
+        let geometry:[Double] = [Double(ScopeViewMath.tvRange.span), ScopeViewMath.vvRange.min, ScopeViewMath.vvRange.max,
+                                 ch.displayProperties.offset, ch.displayProperties.scaling]
+        if ( geometry != phosphor.geometry ) {
+            phosphor.buffer.clear()
+            phosphor.geometry = geometry
+        }
+        
+        switch (ScopeViewMath.scopeImageViewDisplayState) {
+        case .Stop:
+            // frozen.  just show what we've got.
+            break
+        case .Timeline:
+            phosphor.buffer.decayFrame()
+            phosphor.buffer.accumulateColumns(getMinMaxes(ch, columnCount: phosphor.buffer.width))
+            break
+        case .Trigger(let triggerChannel):
+            phosphor.buffer.decayFrame()
+            accumulateTriggerEvents(ch, triggerChannel: triggerChannel, phosphor: phosphor)
+            break
+        }
+        
+        if let image = phosphor.buffer.renderImage(ch.displayProperties.traceColor) {
+            let currentContext = NSGraphicsContext.currentContext()?.CGContext
+            CGContextDrawImage(currentContext, CGRect(x: 0, y: 0, width: phosphor.buffer.width, height: phosphor.buffer.height), image)
+        }
+    }
+    
+    // fold in every trigger event since last frame, not just the one we're centered on.  oldest first: if there are more
+    // than a frame's worth, the rest stay behind lastEventTimestamp and the next frames catch up on them.
+    private func accumulateTriggerEvents(ch:Channel, triggerChannel:Channel, phosphor:ChannelPhosphor) {
+        guard let stage = triggerChannel.triggerStage else {
+            return
+        }
+        
+        // different trigger channel than last time?  start counting from now.
+        if ( phosphor.triggerChannel != ObjectIdentifier(triggerChannel) ) {
+            phosphor.triggerChannel = ObjectIdentifier(triggerChannel)
+            phosphor.lastEventTimestamp = nil
+        }
+        
+        let events = stage.getEventTimestamps()
+        let tvIndexRange = ScopeViewMath.tvRange.asSampleIndexRange()
+        let visibleSampleCount = tvIndexRange.oldest - tvIndexRange.newest + 1
+        let halfSpanSamples = visibleSampleCount / 2
+        let samplesPerColumn = Double(visibleSampleCount) / Double(phosphor.buffer.width)
+        
+        // the buffers are frozen while we draw.  ages work across channels, sample indices don't.
+        let triggerNewestSampleIndex = Int(triggerChannel.samples.committedSampleCount) - 1
+        let channelNewestSampleIndex = Int(ch.samples.committedSampleCount) - 1
+        
+        // the first event not done yet.  nothing done yet starts with the newest frame's worth.
+        var first = events.count
+        if let last = phosphor.lastEventTimestamp {
+            while ( first > 0 && events[first - 1] > last ) {
+                first -= 1
+            }
+        } else {
+            first = max(0, events.count - CONFIG_DISPLAY_PHOSPHOR_MAX_EVENTS_PER_FRAME)
+        }
+        
+        // events without enough samples after them yet are the newest ones, so the first of those ends it until next frame.
+        var eventsFolded = 0
+        for event in events[first..<events.count] {
+            let windowNewestAge = (triggerNewestSampleIndex - Int(event)) - halfSpanSamples
+            if ( windowNewestAge < 0 || eventsFolded >= CONFIG_DISPLAY_PHOSPHOR_MAX_EVENTS_PER_FRAME ) {
+                break
+            }
+            let minMaxStart = Instrumentation.now()
+            var columns:[(min:Sample, max:Sample)]
+            if ( isDeepZoom ) {
+                columns = columnsOfPoints(getInterpolatedPoints(ch.samples, newestSampleIndex: channelNewestSampleIndex, newestAge: Double(windowNewestAge), columnCount: phosphor.buffer.width))
+            } else {
+                columns = ch.samplesForColumns(samplesPerColumn).getColumnMinMaxes(channelNewestSampleIndex - windowNewestAge, samplesPerColumn: samplesPerColumn, columnCount: phosphor.buffer.width)
+            }
+            Instrumentation.minMax.recordElapsed(since: minMaxStart)
+            phosphor.buffer.accumulateColumns(columns)
+            phosphor.lastEventTimestamp = event
+            eventsFolded += 1
+        }
+    }
+    
+    //
+    // PROTOCOL ANNOTATIONS - what the channels' protocol decoders found, as labeled boxes along the bottom of the view, one
+    // row per decoding channel.  the decoders keep them sorted, so this only ever sees the ones in view.  see ProtocolDecoder.swift.
+    //
+    
+    let annotationLabelAttributes:[String:AnyObject] = [ NSForegroundColorAttributeName: NSColor(calibratedWhite:0.9, alpha:1.0),NSFontAttributeName: NSFont(name:"Menlo", size:9.0)! ]
+    
+    func drawProtocolAnnotations( ) {
+        let context = NSGraphicsContext.currentContext()?.CGContext
+        let tvIndexRange = ScopeViewMath.tvRange.asSampleIndexRange()
+        var row:CGFloat = 0
+        for ch in channels {
+            guard let decoder = ch.protocolDecoder where ch.displayProperties.visible else {
+                continue
+            }
+            let y = 2 + row * CONFIG_DISPLAY_PROTOCOL_ROW_HEIGHT
+            row += 1
+            
+            // the buffers are frozen while we draw, so the newest committed sample pins down every item's age.
+            let newestSampleIndex = Int(ch.samples.committedSampleCount) - 1
+            let last = newestSampleIndex - tvIndexRange.newest
+            let first = max(0, newestSampleIndex - tvIndexRange.oldest)
+            if ( last < first ) {
+                continue
+            }
+            let items = decoder.getItems(UInt(first), lastSampleIndex: UInt(last), maximumCount: CONFIG_DISPLAY_PROTOCOL_MAX_ANNOTATIONS)
+            
+            for item in items {
+                let x0 = (newestSampleIndex - Int(item.firstSampleIndex)).asTime().asCoordinate()
+                let x1 = (newestSampleIndex - Int(item.lastSampleIndex)).asTime().asCoordinate()
+                let box = CGRect(x: x0, y: y, width: max(2, x1 - x0), height: CONFIG_DISPLAY_PROTOCOL_ROW_HEIGHT - 2)
+                let color = (item.kind == .Error) ? NSColor.redColor() : ch.displayProperties.traceColor
+                CGContextSetFillColorWithColor(context, color.colorWithAlphaComponent(0.3).CGColor)
+                CGContextFillRect(context, box)
+                CGContextSetStrokeColorWithColor(context, color.CGColor)
+                CGContextStrokeRect(context, box)
+                
+                // only label the ones it fits in.
+                let size = item.text.sizeWithAttributes(annotationLabelAttributes)
+                if ( size.width + 4 <= box.width ) {
+                    item.text.drawAtPoint(NSPoint(x: box.origin.x + 2, y: box.origin.y + (box.height - size.height) / 2), withAttributes: annotationLabelAttributes)
+                }
+            }
+        }
+    }
+    
     //
     // GRID LINES
     //
@@ -128,36 +395,163 @@ class ScopeImageView: NSImageView {
         }
     }
     
+    //
+    // CACHED LAYERS - the background and grid only change when ScopeViewMath.update does something (see
+    // ScopeViewMath.generation), and a trace only changes when its samples or its display properties do.  each gets
+    // drawn into an offscreen CGLayer and composited every frame, and only gets redrawn when it's stale.
+    //
+    
+    private class CachedLayer {
+        let layer:CGLayer
+        let pixelSize:CGSize
+        var key:[Double] = []
+        var color:NSColor? = nil
+        init( layer:CGLayer, pixelSize:CGSize ) {
+            self.layer = layer
+            self.pixelSize = pixelSize
+        }
+    }
+    private var gridLayer:CachedLayer? = nil
+    private var traceLayers:[ObjectIdentifier:CachedLayer] = [:]
+    
+    // a layer the size of the view in pixels, not points, so it stays sharp on a retina screen.
+    private func getLayer( existing:CachedLayer?, context:CGContext ) -> CachedLayer? {
+        let scale = window?.backingScaleFactor ?? 1
+        let pixelSize = CGSize(width: frame.width * scale, height: frame.height * scale)
+        if let layer = existing {
+            if ( layer.pixelSize == pixelSize ) {
+                return layer
+            }
+        }
+        guard let newLayer = CGLayerCreateWithContext(context, pixelSize, nil) else {
+            return nil
+        }
+        CGContextScaleCTM(CGLayerGetContext(newLayer), scale, scale)
+        return CachedLayer(layer: newLayer, pixelSize: pixelSize)
+    }
+    
+    // runs drawing with the layer as the current context, starting from transparent.
+    private func drawIntoLayer( layer:CachedLayer, drawing:() -> () ) {
+        let layerContext = CGLayerGetContext(layer.layer)
+        CGContextClearRect(layerContext, CGRect(x: 0, y: 0, width: frame.width, height: frame.height))
+        NSGraphicsContext.saveGraphicsState()
+        NSGraphicsContext.setCurrentContext(NSGraphicsContext(CGContext: layerContext!, flipped: false))
+        drawing()
+        NSGraphicsContext.restoreGraphicsState()
+    }
+    
+    private func compositeLayer( layer:CachedLayer, context:CGContext ) {
+        CGContextDrawLayerInRect(context, CGRect(x: 0, y: 0, width: frame.width, height: frame.height), layer.layer)
+    }
+    
+    // background and grid, redrawn when the view moves, zooms or resizes.
+    private func drawStaticLayer( context:CGContext ) {
+        guard let layer = getLayer(gridLayer, context: context) else {
+            return
+        }
+        let key = [Double(ScopeViewMath.generation)]
+        if ( layer !== gridLayer || layer.key != key ) {
+            drawIntoLayer(layer, drawing: {
+                CONFIG_DISPLAY_SCOPEVIEW_BACKGROUND_COLOR.setFill()
+                NSRectFill(NSRect(x: 0, y: 0, width: self.frame.width, height: self.frame.height))
+                self.drawGridLines()
+            })
+            layer.key = key
+            gridLayer = layer
+        }
+        compositeLayer(layer, context: context)
+    }
+    
+    // one channel's trace, redrawn when new samples came in, the buffer got cleared, the view changed, or the channel's
+    // color, offset or scaling did.  in Stop mode that's usually never.
+    private func drawTraceLayer( chIndex:Int, context:CGContext ) {
+        let ch = channels[chIndex]
+        guard let layer = getLayer(traceLayers[ObjectIdentifier(ch)], context: context) else {
+            return
+        }
+        let key = [Double(ScopeViewMath.generation), Double(ch.samples.committedSampleCount), Double(ch.samples.clearCount),
+                   ch.displayProperties.offset, ch.displayProperties.scaling]
+        if ( layer !== traceLayers[ObjectIdentifier(ch)] || layer.key != key || layer.color != ch.displayProperties.traceColor ) {
+            drawIntoLayer(layer, drawing: {
+                ScopeViewMath.setSampleDisplayTransform(ch.displayProperties.offset, scaling: ch.displayProperties.scaling)
+                if ( self.isDeepZoom ) {
+                    self.drawSamples_interpolated(chIndex)
+                } else {
+                    self.drawSamples_minmax_inplace(chIndex)
+                }
+                ScopeViewMath.clearSampleDisplayTransform()
+            })
+            layer.key = key
+            layer.color = ch.displayProperties.traceColor
+            traceLayers[ObjectIdentifier(ch)] = layer
+        }
+        compositeLayer(layer, context: context)
+    }
+    
     //
     // DRAWING MAIN
     //
-
+    
     override func drawRect(dirtyRect: NSRect) {
         super.drawRect(dirtyRect)
-  
-        // Black background
-        CONFIG_DISPLAY_SCOPEVIEW_BACKGROUND_COLOR.setFill()
-        NSRectFill(NSRect(x: 0, y: 0, width: frame.width, height: frame.height))
+        let drawStart = Instrumentation.now()
+        defer {
+            Instrumentation.drawRect.recordElapsed(since: drawStart)
+        }
         
-        // let the boss know we're drawing...
+        // how stale the newest samples are by the time they get drawn.  (lastCommitTime gets written on the buffer's
+        // queue; a torn read here just makes for one odd number in a histogram.)
+        for ch in channels {
+            let committed = ch.samples.lastCommitTime
+            if ( committed != 0 && drawStart > committed ) {
+                Instrumentation.commitToDraw.record(drawStart - committed)
+            }
+        }
+        
+        guard let context = NSGraphicsContext.currentContext()?.CGContext else {
+            return
+        }
+        
+        // let the boss know we're drawing...  (this can move the view, so it goes before anything gets drawn.)
         if let del = notifications {
             del.drawingWillBegin()
         }
         
-        // grid lines
-        drawGridLines()
+        // background and grid lines
+        drawStaticLayer(context)
         
-        // curves
+        // curves.  (forget the caches of any channels that went away.)
+        let liveChannels = Set(channels.map({ ObjectIdentifier($0) }))
+        for key in columnCaches.keys where !liveChannels.contains(key) {
+            columnCaches[key] = nil
+        }
+        for key in phosphors.keys where !liveChannels.contains(key) {
+            phosphors[key] = nil
+        }
+        for key in traceLayers.keys where !liveChannels.contains(key) {
+            traceLayers[key] = nil
+        }
+        for key in rasterizers.keys where !liveChannels.contains(key) {
+            rasterizers[key] = nil
+        }
         for ch in 0..<channels.count {
             if ( channels[ch].displayProperties.visible == true ) {
-                ScopeViewMath.setSampleDisplayTransform(channels[ch].displayProperties.offset,
-                                                        scaling: channels[ch].displayProperties.scaling)
-                drawSamples_minmax_inplace(ch)
-                ScopeViewMath.clearSampleDisplayTransform()
+                if ( persistenceEnabled ) {
+                    // the phosphor decays every frame, so there's nothing to cache.
+                    ScopeViewMath.setSampleDisplayTransform(channels[ch].displayProperties.offset,
+                                                            scaling: channels[ch].displayProperties.scaling)
+                    drawSamples_phosphor(ch)
+                    ScopeViewMath.clearSampleDisplayTransform()
+                } else {
+                    drawTraceLayer(ch, context: context)
+                }
             }
         }
         
-        // selection rectangle
+        // decoded bytes and such, on top of the traces.
+        drawProtocolAnnotations()
+        
+        // selection rectangle.  its dashes march every frame, so it's always drawn fresh; it's one rectangle.
         drawSelection()
         
         // let the boss know our work here is done.
@@ -8,7 +8,7 @@
 
 import Cocoa
 
-class ScopeViewController: NSViewController, ChannelNotifications, ScopeImageViewNotifications {
+class ScopeViewController: NSViewController, ChannelNotifications, ScopeImageViewNotifications, FrameSchedulerNotifications {
     
     //
     // SELECTION DISPLAY
@@ -193,16 +193,10 @@ class ScopeViewController: NSViewController, ChannelNotifications, ScopeImageVie
             catch { print("ERROR: couldn't switch off \(ch.name)") }
         }
         
-        // start the drawing timer
-        startDrawingTimer()
-        
         ScopeViewMath.scopeImageViewDisplayState = .Stop
     }
     
     func enterTimelineMode() {
-        // make sure drawing timer is off
-        stopDrawingTimer()
-        
         // make sure channels are on
         for ch in channels {
             if ( ch.isChannelOn == true ) {
@@ -225,9 +219,6 @@ class ScopeViewController: NSViewController, ChannelNotifications, ScopeImageVie
             catch { print("ERROR: couldn't switch on \(ch.name)" ) }
         }
         
-        // make sure drawing timer is off
-        stopDrawingTimer()
-        
         // get the channel we're gonna trigger on
         popupTriggerSelector.enabled = true
         let selectedName = popupTriggerSelector.titleOfSelectedItem!
@@ -248,6 +239,94 @@ class ScopeViewController: NSViewController, ChannelNotifications, ScopeImageVie
         ScopeViewMath.scopeImageViewDisplayState = .Trigger(selectedChannel!)
     }
     
+    // puts a stretch of one channel's history (a search hit, say) in the middle of the view, zoomed out enough to see
+    // it with some room on both sides.  ages only hold still in stop mode, so that's where we go first.
+    func showSamples( channel:Channel, firstSampleIndex:UInt, lastSampleIndex:UInt ) {
+        switch (ScopeViewMath.scopeImageViewDisplayState) {
+        case .Stop:
+            break
+        default:
+            enterStopMode()
+            updateViewModeControls()
+        }
+        let newest = Int(channel.samples.committedSampleCount) - 1
+        let newestAge = newest - Int(lastSampleIndex)
+        let oldestAge = newest - Int(firstSampleIndex)
+        let center = (newestAge + oldestAge).asTime() / 2
+        let span = max(ScopeViewMath.tvRange.span, 4 * (oldestAge - newestAge + 1).asTime())
+        ScopeViewMath.update(nil, vvRange: nil, tvRange: TimeRange(center: center, span: span))
+        scopeImage.needsDisplay = true
+    }
+    
+    //
+    // PERSISTENCE CONTROLS - the phosphor buffers themselves live in ScopeImageView.
+    //
+    
+    @IBOutlet weak var checkboxPersistence: NSButton!
+    @IBOutlet weak var sliderPersistenceDecay: NSSlider!
+    
+    @IBAction func persistenceChanged(sender: AnyObject) {
+        scopeImage.persistenceEnabled = (checkboxPersistence.state == NSOnState)
+        scopeImage.persistenceDecay = sliderPersistenceDecay.floatValue
+        sliderPersistenceDecay.enabled = scopeImage.persistenceEnabled
+        scopeImage.needsDisplay = true
+    }
+    
+    //
+    // SPECTRUM ANALYZER - the view slides out to the right of the scope image.
+    //
+    
+    @IBOutlet weak var spectrumView: SpectrumView!
+    @IBOutlet weak var spectrumWidthConstraint: NSLayoutConstraint!
+    @IBOutlet weak var spectrumGapConstraint: NSLayoutConstraint!
+    @IBOutlet weak var stackSpectrumControls: NSStackView!
+    @IBOutlet weak var popupSpectrumSize: NSPopUpButton!
+    @IBOutlet weak var popupSpectrumWindow: NSPopUpButton!
+    @IBOutlet weak var popupSpectrumMode: NSPopUpButton!
+    
+    private(set) var isSpectrumShowing:Bool = false
+    
+    func toggleSpectrumAnalyzer() {
+        isSpectrumShowing = !isSpectrumShowing
+        spectrumWidthConstraint.constant = isSpectrumShowing ? CONFIG_DISPLAY_SPECTRUM_WIDTH : 0
+        spectrumGapConstraint.constant = isSpectrumShowing ? 10 : 0
+        stackSpectrumControls.hidden = !isSpectrumShowing
+        installSpectrumAnalyzers()
+    }
+    
+    @IBAction func spectrumSettingsChanged(sender: AnyObject) {
+        installSpectrumAnalyzers()
+    }
+    
+    private func spectrumSettings() -> SpectrumAnalyzer.Settings {
+        var settings = SpectrumAnalyzer.Settings()
+        settings.size = CONFIG_SPECTRUM_SIZES[max(0, popupSpectrumSize.indexOfSelectedItem)]
+        settings.window = WindowFunction.allValues[max(0, popupSpectrumWindow.indexOfSelectedItem)]
+        settings.mode = SpectrumAnalyzer.Mode.allValues[max(0, popupSpectrumMode.indexOfSelectedItem)]
+        return settings
+    }
+    
+    // (re)install an analyzer on every channel with the current settings, or take them all out.
+    private func installSpectrumAnalyzers() {
+        let settings:SpectrumAnalyzer.Settings? = isSpectrumShowing ? spectrumSettings() : nil
+        for ch in channels {
+            ch.installSpectrumAnalyzer(settings)
+        }
+        spectrumView.needsDisplay = true
+    }
+    
+    private func populateSpectrumControls() {
+        popupSpectrumSize.removeAllItems()
+        popupSpectrumSize.addItemsWithTitles(CONFIG_SPECTRUM_SIZES.map({ "\($0) pt" }))
+        popupSpectrumSize.selectItemAtIndex(CONFIG_SPECTRUM_SIZES.indexOf(SpectrumAnalyzer.Settings().size) ?? 0)
+        popupSpectrumWindow.removeAllItems()
+        popupSpectrumWindow.addItemsWithTitles(WindowFunction.allValues.map({ $0.title }))
+        popupSpectrumWindow.selectItemAtIndex(WindowFunction.allValues.indexOf(SpectrumAnalyzer.Settings().window) ?? 0)
+        popupSpectrumMode.removeAllItems()
+        popupSpectrumMode.addItemsWithTitles(SpectrumAnalyzer.Mode.allValues.map({ $0.title }))
+        popupSpectrumMode.selectItemAtIndex(0)
+    }
+    
     //
     // ZOOM BUTTONS
     //
@@ -340,21 +419,14 @@ class ScopeViewController: NSViewController, ChannelNotifications, ScopeImageVie
         newChannel.notifications = self
         channels += [newChannel]
         scopeImage.channels = self.channels
+        spectrumView.channels = self.channels
+        if ( isSpectrumShowing ) {
+            newChannel.installSpectrumAnalyzer(spectrumSettings())
+        }
     }
     
-    // this is the notification from channel that it has completed a new packet.
+    // this is the notification from channel that it has completed a new packet.  frames come from the frame scheduler, so nothing to do here.
     func channelHasNewData(sender:Channel) {
-        // look through all the channels, and if they're all drawable, trigger a frame
-        for ch in channels {
-            if (!ch.isDrawable) {
-                return
-            }
-        }
-        // we got here, so everything's drawable. draw, then reset.
-        drawFrame()
-        for ch in channels {
-            ch.isDrawable = false
-        }
     }
     
     func channelTriggerChanged(sender: Channel) {
@@ -368,7 +440,7 @@ class ScopeViewController: NSViewController, ChannelNotifications, ScopeImageVie
     func drawingWillBegin() {
         // freeze the channels
         for ch in channels {
-            ch.sampleBuffer.suspendWrites()
+            ch.suspendWrites()
         }
         
         switch (ScopeViewMath.scopeImageViewDisplayState) {
@@ -394,29 +466,64 @@ class ScopeViewController: NSViewController, ChannelNotifications, ScopeImageVie
     }
     
     func drawFrame( ) {
-        scopeImage.needsDisplay = true
+        // draw right now, rather than whenever the run loop gets around to it, so the frame scheduler can time it.
+        scopeImage.display()
+        if ( isSpectrumShowing ) {
+            spectrumView.display()
+        }
     }
     
     func drawingHasFinished() {
         // unfreeze the channels
         for ch in channels {
-            ch.sampleBuffer.resumeWrites()
+            ch.resumeWrites()
         }
     }
     
     //
-    // A FRAME RATE GENERATOR for when the data stream is stopped
+    // FRAME SCHEDULER - frames go out on vsync, with whatever data has made it into the buffers.  see FrameScheduler.swift.
     //
     
-    private var drawingTimer = NSTimer()
+    private let frameScheduler = FrameScheduler()
+    private var screenObserver:NSObjectProtocol? = nil
+    
+    @IBOutlet weak var labelFrameStats: NSTextField!
     
-    func startDrawingTimer( ) {
-        drawingTimer.invalidate()
-        drawingTimer = NSTimer.scheduledTimerWithTimeInterval((1/CONFIG_DISPLAY_REFRESH_RATE), target: self, selector: #selector(drawFrame), userInfo: nil, repeats: true)
+    func renderFrame() {
+        drawFrame()
+    }
+    
+    func frameStatsUpdated(stats: FrameStats) {
+        labelFrameStats.stringValue = String(format: "%.0f fps, %.1f ms/frame (worst %.1f), %d skipped", stats.framesPerSecond, stats.averageFrameTime * 1000, stats.worstFrameTime * 1000, stats.skippedFrames)
+    }
+    
+    // this view's window only, and only while it's up.  the window isn't there yet in viewDidLoad.
+    override func viewDidAppear() {
+        super.viewDidAppear()
+        stopFollowingScreen()
+        screenObserver = NSNotificationCenter.defaultCenter().addObserverForName(NSWindowDidChangeScreenNotification, object: view.window, queue: nil, usingBlock: { [weak self] n in
+            self?.windowScreenChanged()
+        })
+        windowScreenChanged()
     }
     
-    func stopDrawingTimer( ) {
-        drawingTimer.invalidate()
+    override func viewWillDisappear() {
+        super.viewWillDisappear()
+        stopFollowingScreen()
+    }
+    
+    private func stopFollowingScreen( ) {
+        if let observer = screenObserver {
+            NSNotificationCenter.defaultCenter().removeObserver(observer)
+            screenObserver = nil
+        }
+    }
+    
+    // follow the refresh of whichever screen the window is on.
+    func windowScreenChanged( ) {
+        if let screenNumber = view.window?.screen?.deviceDescription["NSScreenNumber"] as? NSNumber {
+            frameScheduler.followDisplay(screenNumber.unsignedIntValue)
+        }
     }
     
     //
@@ -451,11 +558,29 @@ class ScopeViewController: NSViewController, ChannelNotifications, ScopeImageVie
         radioViewModeTrigger.enabled = false
         popupTriggerSelector.enabled = false
         
+        // persistence starts off
+        checkboxPersistence.state = NSOffState
+        sliderPersistenceDecay.floatValue = CONFIG_DISPLAY_PHOSPHOR_DEFAULT_DECAY
+        sliderPersistenceDecay.enabled = false
+        
+        // spectrum starts hidden
+        populateSpectrumControls()
+        spectrumWidthConstraint.constant = 0
+        spectrumGapConstraint.constant = 0
+        stackSpectrumControls.hidden = true
+        
         // initial selection info
         updateSelectionLabels()
+        
+        // and start drawing.
+        labelFrameStats.stringValue = ""
+        frameScheduler.notifications = self
+        frameScheduler.start()
     }
     
     deinit {
         print( "----ScopeViewController.deinit" )
+        stopFollowingScreen()
+        frameScheduler.stop()
     }
 }
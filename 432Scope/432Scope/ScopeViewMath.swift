@@ -27,6 +27,9 @@ class ScopeViewMath {
     static private(set) var voltageGridLines:[GridLine] = []
     static private(set) var timeGridLines:[GridLine] = []
     
+    // bumps every time update() changes anything above, so the view knows when its cached layers are stale.
+    static private(set) var generation:UInt = 0
+    
     // PRIVATE: the viewable spans, used to detect whether a view has changed size or just position.
     static private(set) var vvRangeSpan:Voltage = 10
     static private(set) var tvRangeSpan:Time = 0.05
@@ -38,8 +41,8 @@ class ScopeViewMath {
     static private(set) var inverseTimeScaleFactor:CGFloat = 0
     static private(set) var sampleToCoordinateScaleFactor:CGFloat = 0.001
     // These scaling factors are constant but I really want all the scale factors kept in one place.
-    static let sampleToVoltageScaleFactor:Voltage = (CONFIG_AFE_VOLTAGE_RANGE.span) / Voltage(CONFIG_SAMPLE_MAX_VALUE)
-    static let voltageToSampleScaleFactor:Voltage = Voltage(CONFIG_SAMPLE_MAX_VALUE)/(CONFIG_AFE_VOLTAGE_RANGE.span)
+    static let sampleToVoltageScaleFactor:Voltage = CONFIG_VOLTS_PER_SAMPLE
+    static let voltageToSampleScaleFactor:Voltage = CONFIG_SAMPLES_PER_VOLT
     
     // PRIVATE: the grid spacing, also subject to recalculation.
     static private var voltageGridSpacing:Voltage = 2
@@ -48,14 +51,14 @@ class ScopeViewMath {
     class func initializeViewMath( ) {
         initializeGridSpacingCalculator()
     }
-
+    
     //
     // UPDATE()
     //
     // the view controller calls this when something has changed due to pan, zoom, whatever.
     // this function assumes the new ranges have been sanity-checked already.
     //
-
+    
     class func update( imageSize:CGSize?, vvRange:VoltageRange?, tvRange:TimeRange? ) {
         
         // something about the view has changed, and it's being passed to us here.  if a parameter is nil, that means it hasn't changed so we can ignore it.
@@ -135,6 +138,9 @@ class ScopeViewMath {
         if ( needTGridLines ) {
             recalculateTimeGridLines()
         }
+        if ( needScalingFactors || needVGridLines || needTGridLines ) {
+            generation = generation &+ 1
+        }
     }
     
     //
@@ -148,7 +154,7 @@ class ScopeViewMath {
         timeScaleFactor = imageSize.width / tvRangeSpan
         inverseTimeScaleFactor = tvRangeSpan / Time(imageSize.width)
         
-
+        
         sampleToCoordinateScaleFactor = imageSize.height / CGFloat(svRange.span)
     }
     
@@ -175,6 +181,24 @@ class ScopeViewMath {
         sampleDisplayTransform = nil
     }
     
+    // Sample.asCoordinate, for sample values in between counts (interpolated ones, see SincInterpolator.swift).
+    class func sampleValueAsCoordinate( value:CGFloat ) -> CGFloat {
+        if (sampleDisplayTransform == nil) {
+            return sampleToCoordinateScaleFactor * (value - CGFloat(svRange.min))
+        }
+        var floatValue = value
+        // the scale-about-zero...
+        floatValue -= sampleDisplayTransform!.zeroVolts
+        floatValue *= sampleDisplayTransform!.scaling
+        floatValue += sampleDisplayTransform!.zeroVolts
+        // the display offset
+        floatValue += sampleDisplayTransform!.offset
+        // the normal transform ...
+        floatValue -= CGFloat(svRange.min)
+        floatValue *= sampleToCoordinateScaleFactor
+        return floatValue
+    }
+    
     //
     // GRID SPACING
     //
@@ -254,7 +278,7 @@ class ScopeViewMath {
     private class func recalculateTimeGridLines( ) {
         // this changes depending on the view mode...
         switch scopeImageViewDisplayState {
-            
+        
         case .Stop, .Timeline:
             let firstGridMultiplier = ceil(tvRange.newest / timeGridSpacing)
             var aGridTime:Time = firstGridMultiplier * timeGridSpacing
@@ -267,7 +291,7 @@ class ScopeViewMath {
             }
             timeGridLines = gridCoords
             break
-            
+        
         case .Trigger:
             var gridCoords:[GridLine] = []
             
@@ -377,7 +401,7 @@ class ScopeViewMath {
                 size.width = (-selectionEndPoint!.t).asCoordinate() - origin.x
                 size.height = selectionEndPoint!.v.asCoordinate() - origin.y
                 break
-                
+            
             case .Trigger:
                 let tCorr = imageSize.width / 2
                 origin.x = selectionStartPoint!.t.asGraphicsDiff() + tCorr
@@ -401,6 +425,23 @@ class ScopeViewMath {
         let vRange = VoltageRange(min: selectionStartPoint!.v, max: selectionEndPoint!.v)
         return (tRange, vRange)
     }
+    
+    // the selection's x extent as ages (seconds before the newest sample), which is what the sample buffers want.
+    class func getSelectionAgeRange() -> TimeRange? {
+        guard let sel = getSelectionRanges() else {
+            return nil
+        }
+        // the drag could have gone either way.
+        let earlier = Swift.min(sel.tRange.min, sel.tRange.max)
+        let later = Swift.max(sel.tRange.min, sel.tRange.max)
+        switch scopeImageViewDisplayState {
+        case .Stop, .Timeline:
+            return TimeRange(min: -later, max: -earlier)
+        case .Trigger:
+            // selection times are relative to the trigger, which is at the center of the view.
+            return TimeRange(min: tvRange.center - later, max: tvRange.center - earlier)
+        }
+    }
 }
 
 struct GridLine {
@@ -0,0 +1,327 @@
+//
+//  SegmentBrowser.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/14/16.
+//
+//
+
+import Cocoa
+
+/*
+ Window > Segment Browser.  Turns segmented capture (SegmentCapture.swift) on and off for a channel, and shows what it
+ caught:  one segment at a time, stepped through with the arrows, or every segment in the pool overlaid as a phosphor
+ image, so the odd burst out of thousands stands out.  Export writes the whole pool to a CSV.
+ 
+ The channel needs a trigger installed for there to be anything to capture.  the vertical scale is whatever the scope
+ view is showing, and the trigger is the dashed line.  Built in code, like the stats panel.
+*/
+
+class SegmentBrowserController: NSWindowController, NSWindowDelegate {
+    
+    private let channels:[Channel]
+    private let channelPopup:NSPopUpButton
+    private let captureCheckbox:NSButton
+    private let overlayCheckbox:NSButton
+    private let statusLabel:NSTextField
+    private let segmentView:SegmentView
+    private var refreshTimer:NSTimer? = nil
+    
+    // which segment is showing.  nil follows the newest.
+    private var segmentIndex:Int? = nil
+    
+    init( channels:[Channel] ) {
+        self.channels = channels
+        let panel = NSPanel(contentRect: NSRect(x: 0, y: 0, width: 760, height: 360),
+                            styleMask: NSTitledWindowMask | NSClosableWindowMask | NSResizableWindowMask | NSUtilityWindowMask,
+                            backing: .Buffered, defer: true)
+        panel.title = "Segment Browser"
+        panel.floatingPanel = true
+        panel.hidesOnDeactivate = false
+        
+        let rowHeight:CGFloat = 32
+        let content = panel.contentView!
+        
+        channelPopup = NSPopUpButton(frame: NSRect(x: 8, y: content.bounds.height - rowHeight + 4, width: 220, height: 24), pullsDown: false)
+        channelPopup.autoresizingMask = [.ViewMinYMargin]
+        channelPopup.addItemsWithTitles(channels.map({ $0.name }))
+        content.addSubview(channelPopup)
+        
+        captureCheckbox = NSButton(frame: NSRect(x: 236, y: content.bounds.height - rowHeight + 4, width: 90, height: 24))
+        captureCheckbox.setButtonType(.SwitchButton)
+        captureCheckbox.title = "Capture"
+        captureCheckbox.autoresizingMask = [.ViewMinYMargin]
+        content.addSubview(captureCheckbox)
+        
+        overlayCheckbox = NSButton(frame: NSRect(x: 332, y: content.bounds.height - rowHeight + 4, width: 110, height: 24))
+        overlayCheckbox.setButtonType(.SwitchButton)
+        overlayCheckbox.title = "Overlay All"
+        overlayCheckbox.autoresizingMask = [.ViewMinYMargin]
+        content.addSubview(overlayCheckbox)
+        
+        segmentView = SegmentView(frame: NSRect(x: 0, y: rowHeight, width: content.bounds.width, height: content.bounds.height - 2 * rowHeight))
+        segmentView.autoresizingMask = [.ViewWidthSizable, .ViewHeightSizable]
+        content.addSubview(segmentView)
+        
+        statusLabel = NSTextField(frame: NSRect(x: 304, y: 8, width: content.bounds.width - 312, height: 18))
+        statusLabel.editable = false
+        statusLabel.bordered = false
+        statusLabel.drawsBackground = false
+        statusLabel.font = NSFont(name: "Menlo", size: 10.0)
+        statusLabel.autoresizingMask = [.ViewWidthSizable]
+        content.addSubview(statusLabel)
+        
+        super.init(window: panel)
+        panel.delegate = self
+        
+        channelPopup.target = self
+        channelPopup.action = #selector(SegmentBrowserController.channelChanged(_:))
+        captureCheckbox.target = self
+        captureCheckbox.action = #selector(SegmentBrowserController.toggleCapture(_:))
+        overlayCheckbox.target = self
+        overlayCheckbox.action = #selector(SegmentBrowserController.toggleOverlay(_:))
+        
+        let buttons:[(title:String, width:CGFloat, action:Selector)] = [
+            ("<", 40, #selector(SegmentBrowserController.previousSegment(_:))),
+            (">", 40, #selector(SegmentBrowserController.nextSegment(_:))),
+            ("Newest", 80, #selector(SegmentBrowserController.newestSegment(_:))),
+            ("Export CSV…", 120, #selector(SegmentBrowserController.exportCSV(_:))),
+        ]
+        var x:CGFloat = 8
+        for b in buttons {
+            let button = NSButton(frame: NSRect(x: x, y: 4, width: b.width, height: 24))
+            button.title = b.title
+            button.bezelStyle = .RoundedBezelStyle
+            button.target = self
+            button.action = b.action
+            content.addSubview(button)
+            x += b.width + 4
+        }
+        
+        panel.center()
+    }
+    
+    required init?(coder: NSCoder) {
+        fatalError("SegmentBrowserController is built in code.")
+    }
+    
+    private var channel:Channel? {
+        let i = channelPopup.indexOfSelectedItem
+        return (i >= 0 && i < channels.count) ? channels[i] : nil
+    }
+    
+    override func showWindow(sender: AnyObject?) {
+        super.showWindow(sender)
+        refresh()
+        if ( refreshTimer == nil ) {
+            refreshTimer = NSTimer.scheduledTimerWithTimeInterval(0.5, target: self, selector: #selector(SegmentBrowserController.refreshTimerFired(_:)), userInfo: nil, repeats: true)
+        }
+    }
+    
+    func windowWillClose(notification: NSNotification) {
+        refreshTimer?.invalidate()
+        refreshTimer = nil
+    }
+    
+    func refreshTimerFired(timer: NSTimer) {
+        refresh()
+    }
+    
+    private func refresh() {
+        captureCheckbox.state = (channel?.isCapturingSegments ?? false) ? NSOnState : NSOffState
+        guard let ch = channel, capture = ch.segmentCapture else {
+            statusLabel.stringValue = (channel?.hasTrigger ?? false) ? "not capturing." : "not capturing.  (install a trigger on this channel first.)"
+            segmentView.clearSegments()
+            return
+        }
+        
+        let status = capture.getStatus()
+        if let index = segmentIndex {
+            segmentIndex = clampToRange(index, min: 0, max: max(0, status.stored - 1))
+        }
+        let showing = segmentIndex ?? (status.stored - 1)
+        var text = "\(status.stored) stored, \(status.captured) captured, \(status.missed) missed.  "
+        
+        if ( overlayCheckbox.state == NSOnState ) {
+            text += "showing all of them."
+            segmentView.overlay(capture, color: ch.displayProperties.traceColor)
+        } else if let segment = capture.getSegment(showing) {
+            let date = NSDate(timeIntervalSince1970: segment.info.captureDate)
+            text += "#\(segment.info.sequenceNumber) at sample \(segment.info.triggerSampleIndex), \(date)"
+            segmentView.show(segment.samples, preTriggerSamples: capture.preTriggerSamples, color: ch.displayProperties.traceColor)
+        } else {
+            segmentView.clearSegments()
+        }
+        statusLabel.stringValue = text
+    }
+    
+    //
+    // ACTIONS
+    //
+    
+    @IBAction func channelChanged(sender: AnyObject) {
+        segmentIndex = nil
+        refresh()
+    }
+    
+    @IBAction func toggleCapture(sender: AnyObject) {
+        if ( captureCheckbox.state == NSOnState ) {
+            channel?.startSegmentCapture()
+            segmentIndex = nil
+        } else {
+            channel?.stopSegmentCapture()
+        }
+        refresh()
+    }
+    
+    @IBAction func toggleOverlay(sender: AnyObject) {
+        refresh()
+    }
+    
+    @IBAction func previousSegment(sender: AnyObject) {
+        let stored = channel?.segmentCapture?.getStatus().stored ?? 0
+        segmentIndex = max(0, (segmentIndex ?? stored - 1) - 1)
+        refresh()
+    }
+    
+    @IBAction func nextSegment(sender: AnyObject) {
+        if let index = segmentIndex {
+            segmentIndex = index + 1
+        }
+        refresh()
+    }
+    
+    @IBAction func newestSegment(sender: AnyObject) {
+        segmentIndex = nil
+        refresh()
+    }
+    
+    @IBAction func exportCSV(sender: AnyObject) {
+        guard let capture = channel?.segmentCapture else {
+            return
+        }
+        let panel = NSSavePanel()
+        panel.title = "Export segments"
+        panel.allowedFileTypes = ["csv"]
+        panel.nameFieldStringValue = "432scope-segments.csv"
+        guard panel.runModal() == NSFileHandlingPanelOKButton, let url = panel.URL else {
+            return
+        }
+        do {
+            try capture.writeCSV(url)
+        } catch Error.ChannelFatal(let msg) {
+            let failure = NSAlert()
+            failure.messageText = "Couldn't export the segments."
+            failure.informativeText = msg
+            failure.runModal()
+        } catch {
+            print("exportCSV: something weird got thrown.")
+        }
+    }
+}
+
+//
+// THE VIEW - one segment as a line, or all of them as a phosphor image (see PhosphorBuffer.swift).
+//
+
+class SegmentView: NSView {
+    
+    private var samples:[Sample] = []
+    private var preTriggerSamples:Int = 0
+    private var segmentLength:Int = 0
+    private var color:NSColor = NSColor.whiteColor()
+    private var overlayImage:CGImage? = nil
+    private var phosphor:PhosphorBuffer? = nil
+    
+    override var opaque:Bool {
+        return true
+    }
+    
+    // row of a sample, on the scope view's voltage scale.
+    private func yOfSample( sample:Sample ) -> CGFloat {
+        let vvRange = ScopeViewMath.vvRange
+        return CGFloat((sample.asVoltage() - vvRange.min) / vvRange.span) * bounds.height
+    }
+    
+    func clearSegments() {
+        samples = []
+        segmentLength = 0
+        overlayImage = nil
+        needsDisplay = true
+    }
+    
+    func show( segment:[Sample], preTriggerSamples:Int, color:NSColor ) {
+        samples = segment
+        segmentLength = segment.count
+        self.preTriggerSamples = preTriggerSamples
+        self.color = color
+        overlayImage = nil
+        needsDisplay = true
+    }
+    
+    // every stored segment, folded into a phosphor buffer one column span at a time.
+    func overlay( capture:SegmentCapture, color:NSColor ) {
+        let width = Int(bounds.width)
+        let height = Int(bounds.height)
+        guard width > 0 && height > 0 else {
+            return
+        }
+        if ( phosphor == nil || phosphor!.width != width || phosphor!.height != height ) {
+            phosphor = PhosphorBuffer(width: width, height: height)
+        }
+        let buffer = phosphor!
+        buffer.clear()
+        preTriggerSamples = capture.preTriggerSamples
+        segmentLength = capture.segmentLength
+        let samplesPerColumn = Double(capture.segmentLength) / Double(width)
+        capture.forEachSegment({ (info, segment) in
+            for x in 0..<width {
+                let first = Int(Double(x) * samplesPerColumn)
+                let last = max(first, min(segment.count - 1, Int(Double(x + 1) * samplesPerColumn) - 1))
+                var low = segment[first]
+                var high = low
+                for i in first...last {
+                    low = min(low, segment[i])
+                    high = max(high, segment[i])
+                }
+                let lowRow = clampToRange(Int(self.yOfSample(low)), min: 0, max: height - 1)
+                let highRow = clampToRange(Int(self.yOfSample(high)), min: 0, max: height - 1)
+                buffer.accumulateColumnSpan(x, low: lowRow, high: highRow)
+            }
+        })
+        samples = []
+        overlayImage = buffer.renderImage(color)
+        needsDisplay = true
+    }
+    
+    override func drawRect(dirtyRect: NSRect) {
+        CONFIG_DISPLAY_SCOPEVIEW_BACKGROUND_COLOR.setFill()
+        NSRectFill(bounds)
+        let context = NSGraphicsContext.currentContext()?.CGContext
+        
+        if let image = overlayImage {
+            CGContextDrawImage(context, CGRect(x: 0, y: 0, width: CGImageGetWidth(image), height: CGImageGetHeight(image)), image)
+        } else if ( samples.count > 1 ) {
+            let path = CGPathCreateMutable()
+            let xScale = bounds.width / CGFloat(samples.count - 1)
+            CGPathMoveToPoint(path, nil, 0, yOfSample(samples[0]))
+            for i in 1..<samples.count {
+                CGPathAddLineToPoint(path, nil, CGFloat(i) * xScale, yOfSample(samples[i]))
+            }
+            color.setStroke()
+            CGContextAddPath(context, path)
+            CGContextStrokePath(context)
+        }
+        
+        // the trigger
+        guard segmentLength > 1 else {
+            return
+        }
+        let triggerX = bounds.width * CGFloat(preTriggerSamples) / CGFloat(segmentLength - 1)
+        CONFIG_DISPLAY_SCOPEVIEW_GROUNDLINE_COLOR.setStroke()
+        CGContextSetLineDash(context, 0, [4, 4], 2)
+        CGContextMoveToPoint(context, triggerX, 0)
+        CGContextAddLineToPoint(context, triggerX, bounds.height)
+        CGContextStrokePath(context)
+    }
+}
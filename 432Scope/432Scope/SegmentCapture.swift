@@ -0,0 +1,130 @@
+//
+//  SegmentCapture.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/14/16.
+//
+//
+
+import Foundation
+
+/*
+ Segmented memory: a window around every trigger event, kept after the ring has moved on.
+ 
+ -TriggeredWindowReader (TriggeredWindowReader.swift) does the waiting: every event whose window made it gets one
+  copySamples into the next slot of a pool that was allocated up front: segmentCapacity slots of
+  preTriggerSamples+postTriggerSamples samples each.  when the pool is full the oldest segment gets reused.
+ -reading (SegmentBrowser.swift, writeCSV) happens on the stage's queue, between blocks, through syncWithReader.
+*/
+
+struct CapturedSegmentInfo {
+    let sequenceNumber:Int      // counts up from 0 since the capture started, missed events not included
+    let triggerSampleIndex:UInt // see SampleBuffer.committedSampleCount
+    let captureDate:NSTimeInterval
+}
+
+class SegmentCapture: TriggeredWindowReader {
+    
+    let segmentCapacity:Int
+    
+    var segmentLength:Int {
+        return windowLength
+    }
+    
+    // the pool, segmentCapacity slots of segmentLength samples.  slot n is pool[n*segmentLength ..< (n+1)*segmentLength].
+    private let pool:UnsafeMutablePointer<Sample>
+    private var infos:[CapturedSegmentInfo]
+    
+    // since the capture started.  only touched on the stage's queue.
+    private var capturedCount:Int = 0
+    
+    init( sampleBuffer:SampleBuffer, preTriggerSamples:Int, postTriggerSamples:Int, segmentCapacity:Int ) {
+        let capacity = max(1, segmentCapacity)
+        self.segmentCapacity = capacity
+        pool = UnsafeMutablePointer<Sample>.alloc(capacity * (max(0, preTriggerSamples) + max(1, postTriggerSamples)))
+        infos = [CapturedSegmentInfo](count: capacity, repeatedValue: CapturedSegmentInfo(sequenceNumber: 0, triggerSampleIndex: 0, captureDate: 0))
+        super.init(sampleBuffer: sampleBuffer, preTriggerSamples: preTriggerSamples, postTriggerSamples: postTriggerSamples, queueLabel: "segmentCaptureQueue")
+    }
+    
+    deinit {
+        pool.dealloc(segmentCapacity * segmentLength)
+    }
+    
+    //
+    // CAPTURING
+    //
+    
+    override func processWindow( event:TriggerEvent, windowStart:UInt ) {
+        let slot = capturedCount % segmentCapacity
+        sampleBuffer.copySamples(windowStart, count: segmentLength, destination: pool + slot * segmentLength)
+        infos[slot] = CapturedSegmentInfo(sequenceNumber: capturedCount, triggerSampleIndex: event.timestamp, captureDate: NSDate().timeIntervalSince1970)
+        capturedCount += 1
+    }
+    
+    //
+    // READING - from any thread.  segment 0 is the oldest one still in the pool.
+    //
+    
+    func getStatus() -> (stored:Int, captured:Int, missed:Int) {
+        var rval = (stored: 0, captured: 0, missed: 0)
+        syncWithReader({
+            rval = (stored: min(self.capturedCount, self.segmentCapacity), captured: self.capturedCount, missed: self.missedCount)
+        })
+        return rval
+    }
+    
+    private func slotOfSegment( index:Int ) -> Int {
+        let oldest = max(0, capturedCount - segmentCapacity)
+        return (oldest + index) % segmentCapacity
+    }
+    
+    func getSegment( index:Int ) -> (info:CapturedSegmentInfo, samples:[Sample])? {
+        var rval:(info:CapturedSegmentInfo, samples:[Sample])? = nil
+        syncWithReader({
+            guard index >= 0 && index < min(self.capturedCount, self.segmentCapacity) else {
+                return
+            }
+            let slot = self.slotOfSegment(index)
+            let samples = Array(UnsafeBufferPointer<Sample>(start: self.pool + slot * self.segmentLength, count: self.segmentLength))
+            rval = (info: self.infos[slot], samples: samples)
+        })
+        return rval
+    }
+    
+    // every stored segment, oldest first, without copying.  this holds the stage up while it runs (new events just wait
+    // in the pending ring), so don't dawdle.
+    func forEachSegment( body:(info:CapturedSegmentInfo, samples:UnsafeBufferPointer<Sample>) -> () ) {
+        syncWithReader({
+            for index in 0..<min(self.capturedCount, self.segmentCapacity) {
+                let slot = self.slotOfSegment(index)
+                body(info: self.infos[slot], samples: UnsafeBufferPointer<Sample>(start: self.pool + slot * self.segmentLength, count: self.segmentLength))
+            }
+        })
+    }
+    
+    //
+    // EXPORT
+    //
+    
+    // one row per segment: its sequence number, trigger sample index and capture time, then its samples in volts.  the
+    // header row has each sample's time relative to the trigger.
+    func writeCSV( url:NSURL ) throws {
+        var header = "segment,trigger_sample_index,capture_time"
+        for i in 0..<segmentLength {
+            header += String(format: ",%.9f", Double(i - preTriggerSamples) * Double(CONFIG_SAMPLEPERIOD))
+        }
+        var lines:[String] = [header]
+        forEachSegment({ (info, samples) in
+            var line = "\(info.sequenceNumber),\(info.triggerSampleIndex)," + String(format: "%.6f", info.captureDate)
+            for s in samples {
+                line += String(format: ",%.6f", s.asVoltage())
+            }
+            lines.append(line)
+        })
+        do {
+            try (lines.joinWithSeparator("\n") + "\n").writeToURL(url, atomically: true, encoding: NSUTF8StringEncoding)
+        } catch {
+            throw Error.ChannelFatal("SegmentCapture.writeCSV: couldn't write \(url.path ?? "")")
+        }
+    }
+}
@@ -0,0 +1,118 @@
+//
+//  SincInterpolator.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/14/16.
+//
+//
+
+import Foundation
+
+/*
+ sin(x)/x reconstruction, for drawing between samples when the view is zoomed in past one sample per column.
+ 
+ -the samples are band-limited (the front end filters them), so the signal between two of them isn't a step, it's the sum
+  of a sinc centered on every sample.  we use the nearest 2*halfWidth of them, windowed, which is plenty for a screen.
+ -the kernel gets tabulated once: phaseCount+1 rows, one per fraction of a sample period, each row 2*halfWidth weights
+  normalized to sum to 1.  a point is then a row lookup and one contiguous dot product, which the compiler vectorizes.
+ -interpolate() only copies out the samples under the view (plus halfWidth either side), so the cost goes with the width
+  of the view, not the depth of the buffer.  copySamples takes care of the ring wrapping.  past either end of the history,
+  the end sample gets repeated.
+*/
+
+final class SincInterpolator {
+    
+    let halfWidth:Int
+    let phaseCount:Int
+    
+    // row p is for a point p/phaseCount of a period after sample i.  tap t weights sample i - halfWidth + 1 + t.
+    private let table:UnsafeMutablePointer<Float>
+    private let tableSize:Int
+    
+    init( halfWidth:Int, phaseCount:Int ) {
+        let h = Swift.max(1, halfWidth)
+        let phases = Swift.max(1, phaseCount)
+        self.halfWidth = h
+        self.phaseCount = phases
+        tableSize = (phases + 1) * 2 * h
+        table = UnsafeMutablePointer<Float>.alloc(tableSize)
+        
+        for p in 0...phases {
+            let fraction = Double(p) / Double(phases)
+            let row = table + p * 2 * h
+            var sum:Double = 0
+            var weights = [Double](count: 2 * h, repeatedValue: 0)
+            for t in 0..<(2 * h) {
+                // how far this tap's sample is from the point, in sample periods
+                let x = Double(t - h + 1) - fraction
+                let sinc = (x == 0) ? 1.0 : sin(M_PI * x) / (M_PI * x)
+                // Blackman, stretched over the kernel's halfWidth either side
+                let window = (abs(x) >= Double(h)) ? 0.0 : 0.42 + 0.5 * cos(M_PI * x / Double(h)) + 0.08 * cos(2 * M_PI * x / Double(h))
+                weights[t] = sinc * window
+                sum += weights[t]
+            }
+            for t in 0..<(2 * h) {
+                row[t] = Float(weights[t] / sum)
+            }
+        }
+    }
+    
+    deinit {
+        table.dealloc(tableSize)
+    }
+    
+    // count values at fractional sample indices, starting at newestPosition and going back step samples each time.
+    // newest first, like the minmax columns.
+    func interpolate( history:SampleHistory, newestPosition:Double, step:Double, count:Int ) -> [Float] {
+        var rval = [Float](count: Swift.max(0, count), repeatedValue: 0)
+        let committed = Int(history.committedSampleCount)
+        if ( count <= 0 || committed == 0 ) {
+            return rval
+        }
+        let oldestPosition = newestPosition - step * Double(count - 1)
+        
+        // the samples under the view, and halfWidth more either side.
+        let firstIndex = Int(floor(oldestPosition)) - halfWidth + 1
+        let lastIndex = Int(floor(newestPosition)) + halfWidth
+        let scratchCount = lastIndex - firstIndex + 1
+        
+        // what's really in there.  everything outside gets the nearest end sample.
+        let oldestAvailable = committed - Swift.min(committed, history.capacity)
+        let newestAvailable = committed - 1
+        let copyFirst = Swift.max(firstIndex, oldestAvailable)
+        let copyLast = Swift.min(lastIndex, newestAvailable)
+        
+        var raw = [Sample](count: scratchCount, repeatedValue: 0)
+        var scratch = [Float](count: scratchCount, repeatedValue: 0)
+        if ( copyFirst <= copyLast ) {
+            raw.withUnsafeMutableBufferPointer({ (inout buffer:UnsafeMutableBufferPointer<Sample>) in
+                history.copySamples(UInt(copyFirst), count: copyLast - copyFirst + 1, destination: buffer.baseAddress + (copyFirst - firstIndex))
+            })
+            for i in 0..<scratchCount {
+                let source = Swift.max(copyFirst, Swift.min(copyLast, firstIndex + i)) - firstIndex
+                scratch[i] = Float(raw[source])
+            }
+        } else {
+            // the whole view is off one end.
+            var end:Sample = 0
+            history.copySamples(UInt((firstIndex > newestAvailable) ? newestAvailable : oldestAvailable), count: 1, destination: &end)
+            scratch = [Float](count: scratchCount, repeatedValue: Float(end))
+        }
+        
+        scratch.withUnsafeBufferPointer({ samples in
+            for c in 0..<count {
+                let position = newestPosition - step * Double(c)
+                let whole = floor(position)
+                let phase = Int((position - whole) * Double(phaseCount) + 0.5)
+                let row = table + phase * 2 * halfWidth
+                let window = samples.baseAddress + (Int(whole) - halfWidth + 1 - firstIndex)
+                var sum:Float = 0
+                for t in 0..<(2 * halfWidth) {
+                    sum += row[t] * window[t]
+                }
+                rval[c] = sum
+            }
+        })
+        return rval
+    }
+}
@@ -0,0 +1,161 @@
+//
+//  SpanRasterizer.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/14/16.
+//
+//
+
+import Cocoa
+
+/*
+ Draws a channel's minmax columns straight into pixels, instead of building a 2*width point CGPath for CoreGraphics to
+ tessellate and fill.
+ 
+ -the row for every possible sample value (CONFIG_SAMPLE_MAX_VALUE+1 of them) goes in a lookup table, with the channel's
+  offset and scaling already in it.  Sample.asCoordinate is affine, so the table is one multiply-add per entry, and it
+  only gets rebuilt when the view or the channel's display properties change (see ScopeViewMath.generation).
+ -each column is then two table lookups and one run of pixels filled with the trace color.  like the phosphor, the pixels
+  are stored column-major, so the run is contiguous and the loop is memory-bound.
+ -the spans reach over to meet the previous column, so steep edges stay joined up the way the stroked path had them.
+  the insides of the spans get the half-alpha fill the path had, the ends the full color.
+ -column-major means the buffer is an image on its side.  blit() rotates it back with the CTM, in one CGContextDrawImage.
+ -width and height are backing pixels, not points: scale is the window's backingScaleFactor, and the row table
+  multiplies Sample.asCoordinate (which is in points) by it.
+*/
+
+final class SpanRasterizer {
+    
+    private(set) var width:Int
+    private(set) var height:Int
+    let scale:CGFloat
+    
+    // premultiplied RGBA, one UInt32 a pixel, column-major:  column x is pixels[x*height ..< (x+1)*height], row 0 at the bottom.
+    // the bytes go r, g, b, a in memory, which is what a little-endian UInt32 built by packPixel puts there.
+    private var pixels:UnsafeMutablePointer<UInt32>
+    
+    // row of every sample value, or -1 / height when it's off the bottom / top.
+    private var rows:UnsafeMutablePointer<Int32>
+    private let rowCount:Int = CONFIG_SAMPLE_MAX_VALUE + 1
+    private var rowsKey:[Double] = []
+    
+    init( width:Int, height:Int, scale:CGFloat = 1 ) {
+        self.width = width
+        self.height = height
+        self.scale = scale
+        pixels = UnsafeMutablePointer<UInt32>.alloc(width * height)
+        rows = UnsafeMutablePointer<Int32>.alloc(rowCount)
+    }
+    
+    deinit {
+        pixels.dealloc(width * height)
+        rows.dealloc(rowCount)
+    }
+    
+    //
+    // THE LOOKUP TABLE
+    //
+    
+    // the channel's sample display transform has to be set while this runs.  does nothing if key hasn't changed.
+    func updateRows( key:[Double] ) {
+        if ( key == rowsKey ) {
+            return
+        }
+        rowsKey = key
+        let origin = Double(Sample(0).asCoordinate() * scale)
+        let slope = Double(Sample(1).asCoordinate() * scale) - origin
+        let top = Double(height)
+        for s in 0..<rowCount {
+            let y = floor(origin + slope * Double(s))
+            rows[s] = Int32((y < 0) ? -1 : ((y > top) ? top : y))
+        }
+    }
+    
+    private func rowOfSample( sample:Sample ) -> Int {
+        return Int(rows[(sample < 0) ? 0 : ((sample >= rowCount) ? rowCount - 1 : sample)])
+    }
+    
+    //
+    // RASTERIZING
+    //
+    
+    private class func packPixel( red:CGFloat, green:CGFloat, blue:CGFloat, alpha:CGFloat ) -> UInt32 {
+        let r = UInt32(red * alpha * 255)
+        let g = UInt32(green * alpha * 255)
+        let b = UInt32(blue * alpha * 255)
+        let a = UInt32(alpha * 255)
+        return r | (g << 8) | (b << 16) | (a << 24)
+    }
+    
+    func clear() {
+        memset(pixels, 0, width * height * sizeof(UInt32))
+    }
+    
+    // columns newest first, the newest at the right edge, like ScopeImageView lays them out.
+    func fillColumns( columns:[(min:Sample, max:Sample)], color:NSColor ) {
+        let rgbColor = color.colorUsingColorSpaceName(NSCalibratedRGBColorSpace) ?? NSColor.whiteColor()
+        let edge = SpanRasterizer.packPixel(rgbColor.redComponent, green: rgbColor.greenComponent, blue: rgbColor.blueComponent, alpha: 1.0)
+        let fill = SpanRasterizer.packPixel(rgbColor.redComponent, green: rgbColor.greenComponent, blue: rgbColor.blueComponent, alpha: 0.5)
+        
+        var x = width - 1
+        var previous:(low:Int, high:Int)? = nil
+        for column in columns {
+            if ( x < 0 ) {
+                break
+            }
+            // an empty column (getMinMax with nothing there) has min > max.  leave a gap.
+            if ( column.min > column.max ) {
+                previous = nil
+                x -= 1
+                continue
+            }
+            let low = rowOfSample(column.min)
+            let high = rowOfSample(column.max)
+            var spanLow = low
+            var spanHigh = high
+            if let p = previous {
+                spanLow = Swift.min(spanLow, p.high)
+                spanHigh = Swift.max(spanHigh, p.low)
+            }
+            previous = (low: low, high: high)
+            
+            // completely off the top or bottom?  nothing to see.
+            if ( spanHigh < 0 || spanLow >= height ) {
+                x -= 1
+                continue
+            }
+            spanLow = Swift.max(spanLow, 0)
+            spanHigh = Swift.min(spanHigh, height - 1)
+            
+            let columnPixels = pixels + (x * height)
+            for y in spanLow...spanHigh {
+                columnPixels[y] = fill
+            }
+            columnPixels[spanLow] = edge
+            columnPixels[spanHigh] = edge
+            x -= 1
+        }
+    }
+    
+    //
+    // BLITTING
+    //
+    
+    // draws the pixels over rect (the view's bounds, in points), in the current graphics context.
+    func blit( rect:CGRect ) {
+        guard let context = NSGraphicsContext.currentContext()?.CGContext else {
+            return
+        }
+        let bitmap = CGBitmapContextCreate(pixels, height, width, 8, height * 4, CGColorSpaceCreateDeviceRGB(), CGImageAlphaInfo.PremultipliedLast.rawValue)
+        guard let image = CGBitmapContextCreateImage(bitmap) else {
+            return
+        }
+        // the image is height wide and width tall, column x of the view as its row x from the top.  turn it so image
+        // (u, v) lands on view (rect.width - v, u), which puts row x at column x and pixel y at row y.
+        CGContextSaveGState(context)
+        CGContextConcatCTM(context, CGAffineTransform(a: 0, b: 1, c: -1, d: 0, tx: rect.origin.x + rect.width, ty: rect.origin.y))
+        CGContextSetInterpolationQuality(context, .None)
+        CGContextDrawImage(context, CGRect(x: 0, y: 0, width: rect.height, height: rect.width), image)
+        CGContextRestoreGState(context)
+    }
+}
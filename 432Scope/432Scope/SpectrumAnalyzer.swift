@@ -0,0 +1,178 @@
+//
+//  SpectrumAnalyzer.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/7/16.
+//
+//
+
+import Foundation
+
+/*
+ Continuous, windowed, overlapping FFTs of a channel, as a reader stage on its sample buffer.
+ 
+ -samples pile up in a frame-sized history.  every hop (size * (1 - overlap)) samples, the newest frame gets windowed and FFT'd.
+ -the power spectrum gets folded into the result according to the mode (live, exponential average, or peak hold).
+ -the UI grabs a copy of the result in dBV with getSpectrum, whenever it feels like drawing.
+ 
+ All of that happens on the analyzer's own queue.  Settings are fixed per analyzer; to change them, install a new one.
+*/
+
+class SpectrumAnalyzer: SampleBufferReader {
+    
+    enum Mode {
+        case Live
+        case Average
+        case PeakHold
+        
+        static let allValues:[Mode] = [.Live, .Average, .PeakHold]
+        
+        var title:String {
+            get {
+                switch (self) {
+                case .Live: return "Live"
+                case .Average: return "Average"
+                case .PeakHold: return "Peak Hold"
+                }
+            }
+        }
+    }
+    
+    struct Settings {
+        var size:Int = 4096
+        var window:WindowFunction = .Hann
+        var mode:Mode = .Live
+        var overlap:Double = 0.5
+    }
+    
+    let settings:Settings
+    let binCount:Int
+    let binWidth:Frequency
+    
+    private let fft:FFT
+    private let hop:Int
+    private let window:[Float]
+    
+    // the newest size samples, oldest first.  historyCount of them are valid.
+    private var history:UnsafeMutablePointer<Float>
+    private var historyCount:Int = 0
+    
+    // scratch, and the accumulated linear power spectrum
+    private var windowed:UnsafeMutablePointer<Float>
+    private var framePower:UnsafeMutablePointer<Float>
+    private var accumulatedPower:UnsafeMutablePointer<Float>
+    private(set) var framesComputed:Int = 0
+    
+    // converts |X[k]|^2 to peak volts^2 for a sine sitting on bin k:  (2 / (size * coherent gain))^2
+    private let powerScale:Float
+    
+    init( sampleBuffer:SampleBuffer, settings:Settings ) {
+        self.settings = settings
+        fft = FFT(size: settings.size)
+        binCount = settings.size / 2 + 1
+        binWidth = Frequency(CONFIG_SAMPLERATE) / Frequency(settings.size)
+        hop = max(1, Int(Double(settings.size) * (1.0 - settings.overlap)))
+        window = settings.window.coefficients(settings.size)
+        
+        let coherentGain = window.reduce(0, combine: +) / Float(settings.size)
+        let amplitudeScale = 2.0 / (Float(settings.size) * coherentGain)
+        powerScale = amplitudeScale * amplitudeScale
+        
+        history = UnsafeMutablePointer<Float>.alloc(settings.size)
+        windowed = UnsafeMutablePointer<Float>.alloc(settings.size)
+        framePower = UnsafeMutablePointer<Float>.alloc(binCount)
+        accumulatedPower = UnsafeMutablePointer<Float>.alloc(binCount)
+        for k in 0..<binCount {
+            accumulatedPower[k] = 0
+        }
+        
+        super.init(sampleBuffer: sampleBuffer, queueLabel: "spectrumAnalyzerQueue")
+    }
+    
+    deinit {
+        history.dealloc(settings.size)
+        windowed.dealloc(settings.size)
+        framePower.dealloc(binCount)
+        accumulatedPower.dealloc(binCount)
+    }
+    
+    //
+    // PROCESSING - on the analyzer queue.
+    //
+    
+    override func processBlock( block:UnsafeBufferPointer<Sample>, firstSampleIndex:UInt ) {
+        let size = settings.size
+        let voltsPerSample = Float(CONFIG_AFE_VOLTAGE_RANGE.span / Voltage(CONFIG_SAMPLE_MAX_VALUE))
+        let voltsAtZero = Float(CONFIG_AFE_VOLTAGE_RANGE.min)
+        
+        var blockOffset = 0
+        while ( blockOffset < block.count ) {
+            let count = min(block.count - blockOffset, size - historyCount)
+            for i in 0..<count {
+                history[historyCount + i] = Float(block[blockOffset + i]) * voltsPerSample + voltsAtZero
+            }
+            historyCount += count
+            blockOffset += count
+            
+            // a full frame?  crunch it and slide the history along by a hop, so the next one comes a hop later.
+            if ( historyCount == size ) {
+                computeFrame()
+                memmove(history, history + hop, (size - hop) * sizeof(Float))
+                historyCount = size - hop
+            }
+        }
+    }
+    
+    // lost samples make a frame that spans the gap meaningless.  start the history over.
+    override func readerDidSkipAhead( newCursor:UInt ) {
+        historyCount = 0
+    }
+    
+    private func computeFrame() {
+        for i in 0..<settings.size {
+            windowed[i] = history[i] * window[i]
+        }
+        fft.powerSpectrum(windowed, output: framePower)
+        
+        switch (settings.mode) {
+        case .Live:
+            for k in 0..<binCount {
+                accumulatedPower[k] = framePower[k] * powerScale
+            }
+            break
+        case .Average:
+            // exponential average.  ramps in over the first few frames so it doesn't start out at zero.
+            let weight = 1.0 / Float(min(framesComputed + 1, CONFIG_SPECTRUM_AVERAGING_DEPTH))
+            for k in 0..<binCount {
+                accumulatedPower[k] += weight * (framePower[k] * powerScale - accumulatedPower[k])
+            }
+            break
+        case .PeakHold:
+            for k in 0..<binCount {
+                accumulatedPower[k] = max(accumulatedPower[k], framePower[k] * powerScale)
+            }
+            break
+        }
+        framesComputed += 1
+    }
+    
+    //
+    // RESULTS - from any thread.
+    //
+    
+    // the spectrum in dBV (peak), DC through Nyquist.  empty until the first frame is done.
+    func getSpectrum() -> [Float] {
+        var rval:[Float] = []
+        syncWithReader({
+            guard self.framesComputed > 0 else {
+                return
+            }
+            rval.reserveCapacity(self.binCount)
+            for k in 0..<self.binCount {
+                // floor it well below anything the ADC can resolve, so log10 doesn't blow up.
+                rval.append(10 * log10(max(self.accumulatedPower[k], 1e-14)))
+            }
+        })
+        return rval
+    }
+}
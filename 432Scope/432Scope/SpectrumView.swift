@@ -0,0 +1,129 @@
+//
+//  SpectrumView.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/7/16.
+//
+//
+
+import Cocoa
+
+// Draws each channel's SpectrumAnalyzer result.  Linear frequency across, dBV up.
+
+class SpectrumView: NSView {
+    
+    override var opaque:Bool {
+        return true
+    }
+    
+    var channels:[Channel] = []
+    
+    // the dB range shown, top to bottom
+    var dbRange:(min:Float, max:Float) = CONFIG_DISPLAY_SPECTRUM_DB_RANGE
+    
+    let labelAttributes:[String:AnyObject] = [ NSForegroundColorAttributeName: NSColor(calibratedWhite:0.6, alpha:1.0),NSFontAttributeName: NSFont(name:"Menlo", size:10.0)! ]
+    
+    private func yCoordinate( db:Float ) -> CGFloat {
+        let clamped = max(dbRange.min, min(dbRange.max, db))
+        return CGFloat((clamped - dbRange.min) / (dbRange.max - dbRange.min)) * frame.height
+    }
+    
+    //
+    // GRID
+    //
+    
+    func drawGrid( ) {
+        let context = NSGraphicsContext.currentContext()?.CGContext
+        CONFIG_DISPLAY_SCOPEVIEW_GRIDLINE_COLOR.setStroke()
+        
+        // horizontal lines every 20 dB
+        var db = ceil(dbRange.min / 20) * 20
+        while ( db <= dbRange.max ) {
+            let y = yCoordinate(db)
+            let path = CGPathCreateMutable()
+            CGPathMoveToPoint(path, nil, 0, y)
+            CGPathAddLineToPoint(path, nil, frame.width, y)
+            CGContextAddPath(context, path)
+            CGContextStrokePath(context)
+            let label = String(format:"%.0f dBV", db)
+            label.drawAtPoint(NSPoint(x: 2, y: y), withAttributes: labelAttributes)
+            db += 20
+        }
+        
+        // vertical lines every 10 kHz, up to nyquist
+        let nyquist = Frequency(CONFIG_SAMPLERATE) / 2
+        var frequency:Frequency = 10000
+        while ( frequency < nyquist ) {
+            let x = CGFloat(frequency / nyquist) * frame.width
+            let path = CGPathCreateMutable()
+            CGPathMoveToPoint(path, nil, x, 0)
+            CGPathAddLineToPoint(path, nil, x, frame.height)
+            CGContextAddPath(context, path)
+            CGContextStrokePath(context)
+            let label = String(format:"%.0fk", frequency / 1000)
+            let labelSize = label.sizeWithAttributes(labelAttributes)
+            label.drawAtPoint(NSPoint(x: x - labelSize.width / 2, y: frame.height - labelSize.height), withAttributes: labelAttributes)
+            frequency += 10000
+        }
+    }
+    
+    //
+    // TRACES
+    //
+    
+    func drawSpectrum( ch:Channel ) {
+        guard let analyzer = ch.spectrumAnalyzer else {
+            return
+        }
+        let spectrum = analyzer.getSpectrum()
+        guard spectrum.count > 1 else {
+            return
+        }
+        
+        // one point per pixel column.  when there are more bins than columns, take the loudest so narrow peaks don't vanish.
+        let columnCount = Int(frame.width)
+        let binsPerColumn = Double(spectrum.count) / Double(columnCount)
+        let path = CGPathCreateMutable()
+        for x in 0..<columnCount {
+            let firstBin = Int(floor(Double(x) * binsPerColumn))
+            let lastBin = max(firstBin, min(spectrum.count - 1, Int(floor(Double(x + 1) * binsPerColumn)) - 1))
+            var loudest = spectrum[firstBin]
+            for k in firstBin...lastBin {
+                loudest = max(loudest, spectrum[k])
+            }
+            if ( x == 0 ) {
+                CGPathMoveToPoint(path, nil, CGFloat(x), yCoordinate(loudest))
+            } else {
+                CGPathAddLineToPoint(path, nil, CGFloat(x), yCoordinate(loudest))
+            }
+        }
+        
+        ch.displayProperties.traceColor.setStroke()
+        let context = NSGraphicsContext.currentContext()?.CGContext
+        CGContextAddPath(context, path)
+        CGContextStrokePath(context)
+    }
+    
+    //
+    // DRAWING MAIN
+    //
+    
+    override func drawRect(dirtyRect: NSRect) {
+        super.drawRect(dirtyRect)
+        let drawStart = Instrumentation.now()
+        defer {
+            Instrumentation.drawRect.recordElapsed(since: drawStart)
+        }
+        
+        CONFIG_DISPLAY_SCOPEVIEW_BACKGROUND_COLOR.setFill()
+        NSRectFill(NSRect(x: 0, y: 0, width: frame.width, height: frame.height))
+        
+        drawGrid()
+        
+        for ch in channels {
+            if ( ch.displayProperties.visible ) {
+                drawSpectrum(ch)
+            }
+        }
+    }
+}
@@ -0,0 +1,103 @@
+//
+//  StatsPanel.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/12/16.
+//
+//
+
+import Cocoa
+
+/*
+ Window > Pipeline Stats.  A floating panel with the Instrumentation summary, refreshed twice a second while it's up.
+ Reset zeroes everything, so you can watch one thing (a zoom, a trigger change) in isolation.  Copy JSON puts the full
+ snapshot, histograms and all, on the pasteboard.
+ 
+ Built in code rather than in the storyboard, since it's a debugging tool and has no business in the main window's layout.
+*/
+
+class StatsPanelController: NSWindowController, NSWindowDelegate {
+    
+    private let textView:NSTextView
+    private var refreshTimer:NSTimer? = nil
+    
+    init() {
+        let panel = NSPanel(contentRect: NSRect(x: 0, y: 0, width: 760, height: 220),
+                            styleMask: NSTitledWindowMask | NSClosableWindowMask | NSResizableWindowMask | NSUtilityWindowMask,
+                            backing: .Buffered, defer: true)
+        panel.title = "Pipeline Stats"
+        panel.floatingPanel = true
+        panel.hidesOnDeactivate = false
+        
+        let buttonHeight:CGFloat = 32
+        let content = panel.contentView!
+        let scrollView = NSScrollView(frame: NSRect(x: 0, y: buttonHeight, width: content.bounds.width, height: content.bounds.height - buttonHeight))
+        scrollView.autoresizingMask = [.ViewWidthSizable, .ViewHeightSizable]
+        scrollView.hasVerticalScroller = true
+        let text = NSTextView(frame: scrollView.bounds)
+        text.editable = false
+        text.font = NSFont(name: "Menlo", size: 10.0)
+        text.autoresizingMask = [.ViewWidthSizable]
+        scrollView.documentView = text
+        content.addSubview(scrollView)
+        textView = text
+        
+        super.init(window: panel)
+        panel.delegate = self
+        
+        let resetButton = NSButton(frame: NSRect(x: 8, y: 4, width: 80, height: 24))
+        resetButton.title = "Reset"
+        resetButton.bezelStyle = .RoundedBezelStyle
+        resetButton.target = self
+        resetButton.action = #selector(StatsPanelController.reset(_:))
+        content.addSubview(resetButton)
+        
+        let copyButton = NSButton(frame: NSRect(x: 96, y: 4, width: 100, height: 24))
+        copyButton.title = "Copy JSON"
+        copyButton.bezelStyle = .RoundedBezelStyle
+        copyButton.target = self
+        copyButton.action = #selector(StatsPanelController.copyJSON(_:))
+        content.addSubview(copyButton)
+        
+        panel.center()
+    }
+    
+    required init?(coder: NSCoder) {
+        fatalError("StatsPanelController is built in code.")
+    }
+    
+    override func showWindow(sender: AnyObject?) {
+        super.showWindow(sender)
+        refresh()
+        if ( refreshTimer == nil ) {
+            refreshTimer = NSTimer.scheduledTimerWithTimeInterval(0.5, target: self, selector: #selector(StatsPanelController.refreshTimerFired(_:)), userInfo: nil, repeats: true)
+        }
+    }
+    
+    func windowWillClose(notification: NSNotification) {
+        refreshTimer?.invalidate()
+        refreshTimer = nil
+    }
+    
+    func refreshTimerFired(timer: NSTimer) {
+        refresh()
+    }
+    
+    private func refresh() {
+        textView.string = Instrumentation.summary(Instrumentation.snapshot())
+    }
+    
+    @IBAction func reset(sender: AnyObject) {
+        Instrumentation.reset()
+        refresh()
+    }
+    
+    @IBAction func copyJSON(sender: AnyObject) {
+        guard let data = Instrumentation.jsonData(Instrumentation.snapshot()), json = String(data: data, encoding: NSUTF8StringEncoding) else {
+            return
+        }
+        let pasteboard = NSPasteboard.generalPasteboard()
+        pasteboard.clearContents()
+        pasteboard.setString(json, forType: NSPasteboardTypeString)
+    }
+}
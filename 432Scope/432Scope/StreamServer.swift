@@ -0,0 +1,561 @@
+//
+//  StreamServer.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/13/16.
+//
+//
+
+import Foundation
+#if os(Linux)
+import Glibc
+#else
+import Darwin
+#endif
+
+/*
+ Fans live samples out to other processes (a logger, a plotter, a script) over a local Unix-domain socket.
+ 
+ BIG PICTURE:
+ 
+ -each channel gets a StreamPublisher, which is just another SampleBufferReader.  it turns every block into a samples frame,
+  and its channel's trigger events into trigger frames (TriggerStage.setEventTap), and hands them to the server.
+ -the StreamServer owns the listening socket and the subscribers, all on one serial queue.  every frame is built once and the
+  same NSData goes in every subscriber's queue.  once a second or so it sends a telemetry frame per channel.
+ -each subscriber has its own queue of frames and its own cursor into it, drained by a dispatch write source with
+  nonblocking sends.  a subscriber that can't keep up just fills its queue: past CONFIG_STREAM_SUBSCRIBER_QUEUE_BYTES its
+  frames get dropped and counted, and a drops frame goes ahead of the next one that fits.  nothing upstream ever waits on a socket.
+ -connect, and you get a hello frame and a channel frame per channel, then everything from that moment on.  anything a
+  subscriber sends is read and ignored, for now; it's how we notice it hung up.
+ -with nobody connected, the publishers don't build frames at all.
+ -the app only serves if CONFIG_STREAM_SERVER_ENABLED says so.  a socket file already at the path only gets replaced if
+  it's a socket nobody's answering on.
+ 
+ FRAMES (everything little-endian).  a 24-byte header:
+    0   UInt32  magic "432S"
+    4   UInt8   frame type (see FrameType)
+    5   UInt8   channel number (255 for frames that aren't about one channel)
+    6   UInt16  header size (24)
+    8   UInt32  payload size in bytes
+    12  UInt32  reserved, zero
+    16  UInt64  sample index: of the first sample, of the trigger event, or the channel's committed count for telemetry
+ then the payload:
+    Hello       UInt16 protocol version, UInt16 channel count, UInt32 sample rate in Hz,
+                Float64 volts per sample, Float64 volts at sample 0, so samples convert like Sample.asVoltage
+    Channel     the channel's name, UTF-8
+    Samples     Int16 x count, oldest first.  a gap (the publisher or this subscriber fell behind) shows up as a jump in the index.
+    Trigger     Int32 lowest and Int32 highest sample in the period before the event, Int64 samples since the last event (-1 if unknown)
+    Telemetry   Float64 mean, rms, min, max (volts), frequency (Hz), duty cycle (0...1), the last two NaN if there wasn't one;
+                UInt64 samples the publisher skipped, since it started
+    Drops       UInt64 frames and UInt64 bytes this subscriber lost since the last drops frame
+*/
+
+class StreamServer {
+    
+    static let protocolVersion:UInt16 = 1
+    static let headerSize:Int = 24
+    static let frameMagic:UInt32 = 0x53323334 // "432S"
+    static let noChannel:UInt8 = 255
+    
+    enum FrameType: UInt8 {
+        case Hello = 1
+        case Channel = 2
+        case Samples = 3
+        case Trigger = 4
+        case Telemetry = 5
+        case Drops = 6
+    }
+    
+    let socketPath:String
+    private let gcdServerQueue = dispatch_queue_create("streamServerQueue", DISPATCH_QUEUE_SERIAL)
+    private var listeningSocket:Int32 = -1
+    private var gcdAcceptSource:dispatch_source_t? = nil
+    private var gcdTelemetryTimer:dispatch_source_t? = nil
+    
+    // only touched on the server queue.
+    private var subscribers:[StreamSubscriber] = [] {
+        didSet {
+            hasSubscribers = !subscribers.isEmpty
+        }
+    }
+    private var publishers:[StreamPublisher] = []
+    
+    // written on the server queue, read by the publishers on theirs without a lock.  a stale answer costs one frame
+    // built for nobody, or one missed by a subscriber that's only just connected.
+    private(set) var hasSubscribers:Bool = false
+    
+    init( socketPath:String ) throws {
+        self.socketPath = socketPath
+        
+        // a subscriber hanging up mid-send mustn't take the whole process with it.
+        signal(SIGPIPE, SIG_IGN)
+        
+        #if os(Linux)
+        listeningSocket = socket(AF_UNIX, Int32(SOCK_STREAM.rawValue), 0)
+        #else
+        listeningSocket = socket(AF_UNIX, SOCK_STREAM, 0)
+        #endif
+        if ( listeningSocket < 0 ) {
+            throw Error.ChannelFatal("StreamServer: couldn't make a socket.")
+        }
+        
+        var address = sockaddr_un()
+        address.sun_family = sa_family_t(AF_UNIX)
+        #if !os(Linux)
+        address.sun_len = UInt8(sizeof(sockaddr_un))
+        #endif
+        let pathBytes = Array(socketPath.utf8)
+        guard pathBytes.count < sizeofValue(address.sun_path) else {
+            closeDescriptor(listeningSocket)
+            throw Error.ChannelFatal("StreamServer: \(socketPath) is too long for a socket path.")
+        }
+        withUnsafeMutablePointer(&address.sun_path, { tuple in
+            let path = UnsafeMutablePointer<UInt8>(tuple)
+            for i in 0..<pathBytes.count {
+                path[i] = pathBytes[i]
+            }
+            path[pathBytes.count] = 0
+        })
+        
+        // a socket file left over from last time would make the bind fail.  but only take it away if it's a socket and
+        // nobody's answering on it: anything else there isn't ours, and a live one is another instance's.
+        var info = stat()
+        if ( lstat(socketPath, &info) == 0 ) {
+            if ( (Int(info.st_mode) & Int(S_IFMT)) != Int(S_IFSOCK) ) {
+                closeDescriptor(listeningSocket)
+                throw Error.ChannelFatal("StreamServer: \(socketPath) is already there and isn't a socket.  leaving it alone.")
+            }
+            if ( StreamServer.isAnswering(address) ) {
+                closeDescriptor(listeningSocket)
+                throw Error.ChannelFatal("StreamServer: something's already serving on \(socketPath).")
+            }
+            unlink(socketPath)
+        }
+        let bound = withUnsafePointer(&address, {
+            bind(listeningSocket, UnsafePointer<sockaddr>($0), socklen_t(sizeof(sockaddr_un)))
+        })
+        if ( bound != 0 || listen(listeningSocket, 8) != 0 ) {
+            closeDescriptor(listeningSocket)
+            throw Error.ChannelFatal("StreamServer: couldn't listen on \(socketPath), errno \(errno).")
+        }
+        fcntl(listeningSocket, F_SETFL, fcntl(listeningSocket, F_GETFL) | O_NONBLOCK)
+        
+        let acceptSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, UInt(listeningSocket), 0, gcdServerQueue)
+        dispatch_source_set_event_handler(acceptSource, {
+            self.acceptSubscribers()
+        })
+        let fd = listeningSocket
+        dispatch_source_set_cancel_handler(acceptSource, {
+            closeDescriptor(fd)
+        })
+        dispatch_resume(acceptSource)
+        gcdAcceptSource = acceptSource
+        
+        let timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, gcdServerQueue)
+        let nanoseconds = UInt64(CONFIG_STREAM_TELEMETRY_INTERVAL * Double(NSEC_PER_SEC))
+        dispatch_source_set_timer(timer, dispatch_time(DISPATCH_TIME_NOW, Int64(nanoseconds)), nanoseconds, nanoseconds / 10)
+        dispatch_source_set_event_handler(timer, {
+            self.sendTelemetry()
+        })
+        dispatch_resume(timer)
+        gcdTelemetryTimer = timer
+        
+        print("----StreamServer: listening on \(socketPath)")
+    }
+    
+    // a connect that works means the socket has a live owner.
+    private class func isAnswering( address:sockaddr_un ) -> Bool {
+        #if os(Linux)
+        let probe = socket(AF_UNIX, Int32(SOCK_STREAM.rawValue), 0)
+        #else
+        let probe = socket(AF_UNIX, SOCK_STREAM, 0)
+        #endif
+        if ( probe < 0 ) {
+            return false
+        }
+        var probeAddress = address
+        let connected = withUnsafePointer(&probeAddress, {
+            connect(probe, UnsafePointer<sockaddr>($0), socklen_t(sizeof(sockaddr_un)))
+        })
+        closeDescriptor(probe)
+        return connected == 0
+    }
+    
+    //
+    // PUBLISHERS
+    //
+    
+    // newly added channels get announced to everybody already connected.
+    func addPublisher( publisher:StreamPublisher ) {
+        dispatch_async( gcdServerQueue, {
+            self.publishers.append(publisher)
+            self.broadcast(self.channelFrame(publisher))
+        })
+    }
+    
+    func removePublisher( publisher:StreamPublisher ) {
+        dispatch_async( gcdServerQueue, {
+            self.publishers = self.publishers.filter({ $0 !== publisher })
+        })
+    }
+    
+    // publishers call this from their own queues.
+    func publish( frame:NSData ) {
+        dispatch_async( gcdServerQueue, {
+            self.broadcast(frame)
+        })
+    }
+    
+    private func broadcast( frame:NSData ) {
+        for subscriber in subscribers {
+            subscriber.enqueue(frame)
+        }
+    }
+    
+    private func sendTelemetry() {
+        if ( subscribers.isEmpty ) {
+            return
+        }
+        for publisher in publishers {
+            if let frame = publisher.telemetryFrame() {
+                broadcast(frame)
+            }
+        }
+    }
+    
+    //
+    // SUBSCRIBERS
+    //
+    
+    var subscriberCount:Int {
+        var rval = 0
+        dispatch_sync( gcdServerQueue, {
+            rval = self.subscribers.count
+        })
+        return rval
+    }
+    
+    private func acceptSubscribers() {
+        while ( true ) {
+            let fd = accept(listeningSocket, nil, nil)
+            if ( fd < 0 ) {
+                return
+            }
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK)
+            let subscriber = StreamSubscriber(fd: fd, queue: gcdServerQueue, disconnected: { gone in
+                self.subscribers = self.subscribers.filter({ $0 !== gone })
+                print("----StreamServer: subscriber \(gone.fd) went away, \(gone.framesDropped) frames dropped in all")
+            })
+            subscribers.append(subscriber)
+            subscriber.enqueue(helloFrame())
+            for publisher in publishers {
+                subscriber.enqueue(channelFrame(publisher))
+            }
+            print("----StreamServer: subscriber \(fd) connected, \(subscribers.count) now")
+        }
+    }
+    
+    private func helloFrame() -> NSData {
+        let frame = StreamServer.makeFrame(.Hello, channel: StreamServer.noChannel, sampleIndex: 0, payloadSize: 24)
+        let payload = StreamServer.payloadOf(frame)
+        StreamServer.store(StreamServer.protocolVersion, at: 0, into: payload)
+        StreamServer.store(UInt16(publishers.count), at: 2, into: payload)
+        StreamServer.store(UInt32(CONFIG_SAMPLERATE), at: 4, into: payload)
+        StreamServer.store(Float64(CONFIG_VOLTS_PER_SAMPLE), at: 8, into: payload)
+        StreamServer.store(Float64(CONFIG_AFE_VOLTAGE_RANGE.min), at: 16, into: payload)
+        return frame
+    }
+    
+    private func channelFrame( publisher:StreamPublisher ) -> NSData {
+        let nameBytes = Array(publisher.channelName.utf8)
+        let frame = StreamServer.makeFrame(.Channel, channel: publisher.channelByte, sampleIndex: 0, payloadSize: nameBytes.count)
+        let payload = StreamServer.payloadOf(frame)
+        for i in 0..<nameBytes.count {
+            payload[i] = nameBytes[i]
+        }
+        return frame
+    }
+    
+    //
+    // STOPPING
+    //
+    
+    // hangs up on everybody and takes the socket file away.
+    func close() {
+        dispatch_sync( gcdServerQueue, {
+            if let source = self.gcdAcceptSource {
+                dispatch_source_cancel(source)
+                self.gcdAcceptSource = nil
+            }
+            if let timer = self.gcdTelemetryTimer {
+                dispatch_source_cancel(timer)
+                self.gcdTelemetryTimer = nil
+            }
+            for subscriber in self.subscribers {
+                subscriber.disconnect()
+            }
+            self.subscribers = []
+            unlink(self.socketPath)
+        })
+    }
+    
+    //
+    // FRAME BUILDING - for anybody making frames: a zeroed frame with the header filled in, and somewhere to put the payload.
+    //
+    
+    class func makeFrame( type:FrameType, channel:UInt8, sampleIndex:UInt, payloadSize:Int ) -> NSMutableData {
+        let frame = NSMutableData(length: headerSize + payloadSize)!
+        let header = UnsafeMutablePointer<UInt8>(frame.mutableBytes)
+        store(frameMagic, at: 0, into: header)
+        store(type.rawValue, at: 4, into: header)
+        store(channel, at: 5, into: header)
+        store(UInt16(headerSize), at: 6, into: header)
+        store(UInt32(payloadSize), at: 8, into: header)
+        store(UInt64(sampleIndex), at: 16, into: header)
+        return frame
+    }
+    
+    class func payloadOf( frame:NSMutableData ) -> UnsafeMutablePointer<UInt8> {
+        return UnsafeMutablePointer<UInt8>(frame.mutableBytes) + headerSize
+    }
+    
+    class func store<T>( value:T, at offset:Int, into buffer:UnsafeMutablePointer<UInt8> ) {
+        UnsafeMutablePointer<T>(buffer + offset).memory = value
+    }
+}
+
+// StreamServer has a close() of its own.
+private func closeDescriptor( fd:Int32 ) {
+    close(fd)
+}
+
+//
+// ONE CONNECTED PROCESS - lives entirely on the server queue.
+//
+
+private class StreamSubscriber {
+    
+    let fd:Int32
+    private let gcdReadSource:dispatch_source_t
+    private let gcdWriteSource:dispatch_source_t
+    private var isWriting:Bool = false // whether the write source is resumed
+    private var isConnected:Bool = true
+    private let disconnected:(StreamSubscriber) -> ()
+    
+    // the frames waiting to go, and how far into the first one we've sent.
+    private var frames:[NSData] = []
+    private var headIndex:Int = 0
+    private var headOffset:Int = 0
+    private var queuedBytes:Int = 0
+    
+    // what's been lost since the last drops frame, and in all.
+    private var pendingDroppedFrames:UInt64 = 0
+    private var pendingDroppedBytes:UInt64 = 0
+    private(set) var framesDropped:UInt64 = 0
+    
+    #if os(Linux)
+    private static let sendFlags = Int32(MSG_NOSIGNAL)
+    #else
+    private static let sendFlags:Int32 = 0
+    #endif
+    
+    init( fd:Int32, queue:dispatch_queue_t, disconnected:(StreamSubscriber) -> () ) {
+        self.fd = fd
+        self.disconnected = disconnected
+        gcdReadSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, UInt(fd), 0, queue)
+        gcdWriteSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_WRITE, UInt(fd), 0, queue)
+        
+        #if !os(Linux)
+        var on:Int32 = 1
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, socklen_t(sizeof(Int32)))
+        #endif
+        
+        // both sources share the descriptor, so it gets closed once they've both let go.
+        let group = dispatch_group_create()
+        dispatch_group_enter(group)
+        dispatch_group_enter(group)
+        dispatch_group_notify(group, queue, {
+            closeDescriptor(fd)
+        })
+        dispatch_source_set_cancel_handler(gcdReadSource, {
+            dispatch_group_leave(group)
+        })
+        dispatch_source_set_cancel_handler(gcdWriteSource, {
+            dispatch_group_leave(group)
+        })
+        
+        dispatch_source_set_event_handler(gcdReadSource, {
+            self.readAndIgnore()
+        })
+        dispatch_source_set_event_handler(gcdWriteSource, {
+            self.drain()
+        })
+        dispatch_resume(gcdReadSource)
+        // the write source stays suspended until there's something to write.
+    }
+    
+    func enqueue( frame:NSData ) {
+        guard isConnected else {
+            return
+        }
+        
+        // too far behind?  this one's lost.  the drops frame is small enough to always get in.
+        if ( queuedBytes + frame.length > CONFIG_STREAM_SUBSCRIBER_QUEUE_BYTES ) {
+            pendingDroppedFrames += 1
+            pendingDroppedBytes += UInt64(frame.length)
+            framesDropped += 1
+            return
+        }
+        if ( pendingDroppedFrames > 0 ) {
+            let drops = StreamServer.makeFrame(.Drops, channel: StreamServer.noChannel, sampleIndex: 0, payloadSize: 16)
+            let payload = StreamServer.payloadOf(drops)
+            StreamServer.store(pendingDroppedFrames, at: 0, into: payload)
+            StreamServer.store(pendingDroppedBytes, at: 8, into: payload)
+            pendingDroppedFrames = 0
+            pendingDroppedBytes = 0
+            append(drops)
+        }
+        append(frame)
+        
+        if ( !isWriting ) {
+            isWriting = true
+            dispatch_resume(gcdWriteSource)
+        }
+    }
+    
+    private func append( frame:NSData ) {
+        frames.append(frame)
+        queuedBytes += frame.length
+    }
+    
+    // send as much as the socket takes without blocking.
+    private func drain() {
+        while ( headIndex < frames.count ) {
+            let head = frames[headIndex]
+            let sent = send(fd, UnsafePointer<UInt8>(head.bytes) + headOffset, head.length - headOffset, StreamSubscriber.sendFlags)
+            if ( sent < 0 ) {
+                if ( errno == EAGAIN || errno == EINTR ) {
+                    // keep the sent frames from piling up at the front while a slow subscriber never quite catches up.
+                    if ( headIndex > 64 && headIndex * 2 > frames.count ) {
+                        frames.removeFirst(headIndex)
+                        headIndex = 0
+                    }
+                    return // the write source will call again when there's room.
+                }
+                disconnect()
+                return
+            }
+            headOffset += sent
+            queuedBytes -= sent
+            if ( headOffset == head.length ) {
+                headIndex += 1
+                headOffset = 0
+            }
+        }
+        
+        // all caught up.
+        frames.removeAll(keepCapacity: true)
+        headIndex = 0
+        if ( isWriting ) {
+            isWriting = false
+            dispatch_suspend(gcdWriteSource)
+        }
+    }
+    
+    private func readAndIgnore() {
+        var scratch = [UInt8](count: 256, repeatedValue: 0)
+        let count = read(fd, &scratch, scratch.count)
+        if ( count == 0 || (count < 0 && errno != EAGAIN && errno != EINTR) ) {
+            disconnect()
+        }
+    }
+    
+    func disconnect() {
+        guard isConnected else {
+            return
+        }
+        isConnected = false
+        frames = []
+        queuedBytes = 0
+        
+        // a suspended source can't be cancelled properly, so let it run first.
+        if ( !isWriting ) {
+            isWriting = true
+            dispatch_resume(gcdWriteSource)
+        }
+        dispatch_source_cancel(gcdWriteSource)
+        dispatch_source_cancel(gcdReadSource)
+        disconnected(self)
+    }
+}
+
+//
+// THE PER-CHANNEL STAGE
+//
+
+class StreamPublisher: SampleBufferReader {
+    
+    let server:StreamServer
+    let channelNumber:Int
+    let channelName:String
+    private let measurementEngine:MeasurementEngine?
+    
+    var channelByte:UInt8 {
+        return UInt8(truncatingBitPattern: channelNumber)
+    }
+    
+    init( server:StreamServer, sampleBuffer:SampleBuffer, channelNumber:Int, channelName:String, measurementEngine:MeasurementEngine? ) {
+        self.server = server
+        self.channelNumber = channelNumber
+        self.channelName = channelName
+        self.measurementEngine = measurementEngine
+        super.init(sampleBuffer: sampleBuffer, queueLabel: "streamPublisherQueue")
+    }
+    
+    // nobody listening, nothing to build.
+    override func processBlock( block:UnsafeBufferPointer<Sample>, firstSampleIndex:UInt ) {
+        if ( !server.hasSubscribers ) {
+            return
+        }
+        let frame = StreamServer.makeFrame(.Samples, channel: channelByte, sampleIndex: firstSampleIndex, payloadSize: block.count * sizeof(Int16))
+        let payload = UnsafeMutablePointer<Int16>(StreamServer.payloadOf(frame))
+        for i in 0..<block.count {
+            payload[i] = Int16(truncatingBitPattern: block[i])
+        }
+        server.publish(frame)
+    }
+    
+    // the channel's TriggerStage calls this on its own queue, for every event.
+    func publishTriggerEvent( event:TriggerEvent ) {
+        if ( !server.hasSubscribers ) {
+            return
+        }
+        let frame = StreamServer.makeFrame(.Trigger, channel: channelByte, sampleIndex: event.timestamp, payloadSize: 16)
+        let payload = StreamServer.payloadOf(frame)
+        StreamServer.store(Int32(truncatingBitPattern: event.periodLowestSample), at: 0, into: payload)
+        StreamServer.store(Int32(truncatingBitPattern: event.periodHighestSample), at: 4, into: payload)
+        StreamServer.store(Int64(event.samplesSinceLastEvent ?? -1), at: 8, into: payload)
+        server.publish(frame)
+    }
+    
+    // the server calls this on its queue.  nil when there's nothing to measure with.
+    func telemetryFrame() -> NSData? {
+        guard let engine = measurementEngine, measurements = engine.getMeasurements() else {
+            return nil
+        }
+        var skipped:UInt = 0
+        syncWithReader({
+            skipped = self.droppedSampleCount
+        })
+        let frame = StreamServer.makeFrame(.Telemetry, channel: channelByte, sampleIndex: sampleBuffer.committedSampleCount, payloadSize: 56)
+        let payload = StreamServer.payloadOf(frame)
+        StreamServer.store(Float64(measurements.mean), at: 0, into: payload)
+        StreamServer.store(Float64(measurements.rms), at: 8, into: payload)
+        StreamServer.store(Float64(measurements.min), at: 16, into: payload)
+        StreamServer.store(Float64(measurements.max), at: 24, into: payload)
+        StreamServer.store(Float64(measurements.frequency ?? Frequency.NaN), at: 32, into: payload)
+        StreamServer.store(measurements.dutyCycle ?? Double.NaN, at: 40, into: payload)
+        StreamServer.store(UInt64(skipped), at: 48, into: payload)
+        return frame
+    }
+}
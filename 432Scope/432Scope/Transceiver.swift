@@ -7,6 +7,11 @@
 //
 
 import Foundation
+#if os(Linux)
+import Glibc
+#else
+import Darwin
+#endif
 
 /*
  This is the first layer above the /dev/tty.* file.
@@ -36,6 +41,7 @@ class Transceiver: NSObject, NSStreamDelegate {
 
     // Basic stuff: the decoder we send packets to, the file handle, the buffer...
     var decoder:Decoder? = nil
+    private(set) var deviceFilePath:String = ""
     private var fileHandle:NSFileHandle? = nil
     private var buffer:NSMutableData? = nil
     
@@ -90,6 +96,8 @@ class Transceiver: NSObject, NSStreamDelegate {
             throw Error.ChannelFatal("No decoder object attached." )
         }
         
+        deviceFilePath = aPath
+        
         // get a posix style file descriptor ...
         fileDescriptor = c_get_posix_file_descriptor( aPath )
         if ( fileDescriptor == -1 ) {
@@ -112,16 +120,17 @@ class Transceiver: NSObject, NSStreamDelegate {
         var newTermios = termios()
         cfmakeraw( &newTermios )
         newTermios.c_cflag =  tcflag_t( CS8 | CREAD | CLOCAL )
-        newTermios.c_cc.16 = posixReadLength // VMIN
-        newTermios.c_cc.17 = 0 // VTIME
         newTermios.c_ispeed = 300 // gonna override this anyway with IOCTL
         newTermios.c_ospeed = 300
         if ( tcsetattr( fileDescriptor!, TCSANOW, &newTermios ) == -1 ) {
             throw Error.ChannelFatal("tcsetattr() error \(errno): \(strerror(errno))")
         }
+        if ( c_set_read_minimum( fileDescriptor!, posixReadLength, 0 ) == -1 ) {
+            throw Error.ChannelFatal("couldn't set VMIN / VTIME, error \(errno): \(strerror(errno))")
+        }
         
-        // attempting the crazy ioctl call ...
-        if ( c_ioctl_set_crazy_baud_rate( fileDescriptor! ) == -1 ) {
+        // the real baud rate, through the non-trad ioctl.
+        if ( c_set_custom_baud_rate( fileDescriptor!, UInt32(CONFIG_BAUDRATE) ) == -1 ) {
             throw Error.ChannelFatal("ioctl() error while setting baud rate\(errno)")
         }
         
@@ -154,10 +163,12 @@ class Transceiver: NSObject, NSStreamDelegate {
             
             // 1-2) Get the incoming, append it to the buffer.
             // (this means create the buffer if it's not there yet.)
+            let incoming = self.fileHandle!.availableData
+            Instrumentation.serialReadBytes.record(UInt64(incoming.length))
             if ( self.buffer == nil ) {
-                self.buffer = NSMutableData(data: self.fileHandle!.availableData)
+                self.buffer = NSMutableData(data: incoming)
             } else {
-                self.buffer!.appendData(self.fileHandle!.availableData)
+                self.buffer!.appendData(incoming)
             }
             
             // 3) The Packetizer!
@@ -182,6 +193,7 @@ class Transceiver: NSObject, NSStreamDelegate {
             }
             
             // 4) diagnostics ...
+            Instrumentation.packetizerBacklogBytes.record(UInt64(self.buffer!.length))
 //            print( "Read: \(dispatch_source_get_data(self.gcdDispatchSource!))\t\t\tShipped: \(shippedSize)\t\tIn Buffer: \(self.buffer!.length)")
             
             // END POSIX READ HANDLER
@@ -261,4 +273,25 @@ class Transceiver: NSObject, NSStreamDelegate {
     }
 }
 
+//
+// As a SampleSource, the transceiver starts and stops the 432 with its one-byte commands.
+//
 
+extension Transceiver: SampleSource {
+    
+    var sourceName:String {
+        return deviceFilePath
+    }
+    
+    func startStreaming( ) throws {
+        try send("Start")
+    }
+    
+    func stopStreaming( ) throws {
+        try send("Stop")
+    }
+    
+    func close( ) throws {
+        try closeTerminal()
+    }
+}
@@ -17,6 +17,12 @@ import Foundation
 // - override processSample.
 //      - if processSample gets an edge event, call super.eventHappened.
 //      - if no event, call super.eventDidNotHappen.
+//
+// Or, for a block-oriented trigger (see HysteresisTrigger.swift):
+//
+// - override processBlock instead, and bracket each block with blockWillBegin / blockDidFinish.
+//      - call blockEventHappened with the event's offset in the block.
+//      - fold the block's samples into the period min/max with mergePeriodMinMax.
 
 //
 // BASE CLASS
@@ -40,6 +46,11 @@ class Trigger {
     private(set) var eventTimestamps:[UInt] = []
     private var capacity:Int = 0 // this is really the age of the oldest timestamp we need to preserve.
     
+    // a TriggerStage sets the clock to the sample index of the next sample it'll hand over, so timestamps line up with the sample buffer.
+    func startTimestampsAt( timestamp:UInt ) {
+        currentTimestamp = timestamp
+    }
+    
     private var lastEventTimestamp:UInt? {
         get {
             let eventCount = eventTimestamps.count
@@ -53,12 +64,17 @@ class Trigger {
     private func recordTimestamp(timestamp:UInt) {
         eventTimestamps.append(timestamp)
         
-        // while we're at it, cull any really old ones.
-        for _ in 0..<eventTimestamps.count {
-            let age = currentTimestamp &- eventTimestamps[0]
-            if (age >= UInt(capacity)) {
-                eventTimestamps.removeAtIndex(0)
+        // while we're at it, cull any really old ones.  they're in order, so count them from the front and take them all out in one go.
+        var expiredCount:Int = 0
+        while ( expiredCount < eventTimestamps.count ) {
+            let age = currentTimestamp &- eventTimestamps[expiredCount]
+            if (age < UInt(capacity)) {
+                break
             }
+            expiredCount += 1
+        }
+        if ( expiredCount > 0 ) {
+            eventTimestamps.removeRange(0..<expiredCount)
         }
     }
     
@@ -84,6 +100,16 @@ class Trigger {
         return (min:periodMin, max:periodMax)
     }
     
+    // block-oriented derived classes reduce a whole stretch of samples themselves and fold the result in here.
+    func mergePeriodMinMax(min:Sample, max:Sample) {
+        if (min < periodMin) {
+            periodMin = min
+        }
+        if (max > periodMax) {
+            periodMax = max
+        }
+    }
+    
     //
     // WHAT HAPPENS WHEN AN EVENT IS DETECTED
     //
@@ -97,25 +123,30 @@ class Trigger {
         // figure the latency-compensated timestamp
         let theRealTimestamp:UInt = currentTimestamp &- triggerLatency
         
+        // notify and record
+        publishEvent(theRealTimestamp, periodMinMax: periodMinMax)
+
+        // tick the timestamp
+        currentTimestamp = currentTimestamp &+ 1
+    }
+    
+    private func publishEvent(timestamp:UInt, periodMinMax:(min:Sample, max:Sample)) {
         // figure out the sample period, if there is one
         var samplesSinceLastEvent:Int? = nil
         if let lastTimestamp = lastEventTimestamp {
-            samplesSinceLastEvent = Int(theRealTimestamp &- lastTimestamp)
+            samplesSinceLastEvent = Int(timestamp &- lastTimestamp)
         }
         
         // notify
         notifications.triggerEventDetected( TriggerEvent(
-                timestamp: theRealTimestamp,
+                timestamp: timestamp,
                 periodLowestSample: periodMinMax.min,
                 periodHighestSample: periodMinMax.max,
                 samplesSinceLastEvent: samplesSinceLastEvent
             ))
         
         // record
-        recordTimestamp(theRealTimestamp)
-
-        // tick the timestamp
-        currentTimestamp = currentTimestamp &+ 1
+        recordTimestamp(timestamp)
     }
 
     // derived classes should call this when they have gotten a new sample and determined it was NOT a trigger event.
@@ -125,6 +156,34 @@ class Trigger {
         currentTimestamp = currentTimestamp &+ 1
     }
     
+    //
+    // BLOCK-ORIENTED EVENTS
+    //
+    
+    // the timestamp of the first sample in the block being processed.
+    private(set) var blockStartTimestamp:UInt = 0
+    
+    func blockWillBegin( ) {
+        blockStartTimestamp = currentTimestamp
+    }
+    
+    func blockDidFinish( sampleCount:Int ) {
+        currentTimestamp = blockStartTimestamp &+ UInt(sampleCount)
+    }
+    
+    // derived classes call this for each event they find.  offset is where the event sample sits in the current block.  returns the min/max of the period the event just closed.
+    func blockEventHappened( offset:Int ) -> (min:Sample, max:Sample) {
+        let periodMinMax = (min:periodMin, max:periodMax)
+        resetMinMax()
+        
+        // the timestamp ticks along to the event, just like it would have one sample at a time.
+        let theRealTimestamp:UInt = blockStartTimestamp &+ UInt(offset)
+        currentTimestamp = theRealTimestamp &+ 1
+        
+        publishEvent(theRealTimestamp, periodMinMax: periodMinMax)
+        return periodMinMax
+    }
+    
     //
     // INIT AND BASE CLASS FUNCTIONS TO OVERRIDE
     //
@@ -138,6 +197,13 @@ class Trigger {
         // this should be overridden
         print("---trigger.processSample SHOULD NOT BE GETTING CALLED.")
     }
+    
+    // TriggerStage hands over whole blocks of committed samples.  per-sample triggers just get them one at a time; block-oriented ones override this.
+    func processBlock( block:UnsafeBufferPointer<Sample> ) {
+        for sample in block {
+            processSample(sample)
+        }
+    }
 }
 
 struct TriggerEvent {
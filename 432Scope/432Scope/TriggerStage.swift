@@ -0,0 +1,94 @@
+//
+//  TriggerStage.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/2/16.
+//
+//
+
+import Foundation
+
+/*
+ Runs a Trigger as its own pipeline stage, off the sample buffer's write path.
+ 
+ -the trigger sees the committed samples in order on the stage's queue.  its timestamps are sample indices in the buffer (see SampleBuffer.committedSampleCount).
+ -events go out to whoever the trigger was created with (normally the Channel) asynchronously on the main queue, one per block, newest event wins.
+ -anybody wanting the event list from another thread should use getEventTimestamps.
+ -anybody wanting every single event as it happens (the stream server, say) can set an event tap, which gets called on the stage's queue.
+*/
+
+class TriggerStage: SampleBufferReader, TriggerNotifications {
+    
+    let trigger:Trigger
+    private let downstream:TriggerNotifications
+    private var newestEventInBlock:TriggerEvent? = nil
+    private var eventCount:Int = 0 // every event, not just the ones that make it downstream
+    private var eventTap:((TriggerEvent) -> ())? = nil
+    
+    init( trigger:Trigger, sampleBuffer:SampleBuffer ) {
+        self.trigger = trigger
+        downstream = trigger.notifications
+        super.init(sampleBuffer: sampleBuffer, queueLabel: "triggerStageQueue")
+        
+        // we sit between the trigger and its listener, and line its clock up with the buffer's.
+        trigger.notifications = self
+        trigger.startTimestampsAt(readCursor)
+    }
+    
+    // take this stage out of the loop.  call after removing it from the sample buffer.
+    func detach() {
+        dispatch_async( gcdReaderQueue, {
+            self.trigger.notifications = self.downstream
+        })
+    }
+    
+    override func processBlock( block:UnsafeBufferPointer<Sample>, firstSampleIndex:UInt ) {
+        let triggerStart = Instrumentation.now()
+        trigger.processBlock(block)
+        Instrumentation.trigger.recordElapsed(since: triggerStart)
+        
+        if let event = newestEventInBlock {
+            newestEventInBlock = nil
+            let listener = downstream
+            dispatch_async( dispatch_get_main_queue(), {
+                listener.triggerEventDetected(event)
+            })
+        }
+    }
+    
+    override func readerDidSkipAhead( newCursor:UInt ) {
+        trigger.startTimestampsAt(newCursor)
+    }
+    
+    // the trigger calls this on our queue.
+    func triggerEventDetected( event:TriggerEvent ) {
+        newestEventInBlock = event
+        eventCount += 1
+        eventTap?(event)
+    }
+    
+    // tap gets every event, on this stage's queue, from the next block on.  nil takes it out.  keep it quick.
+    func setEventTap( tap:((TriggerEvent) -> ())? ) {
+        dispatch_async( gcdReaderQueue, {
+            self.eventTap = tap
+        })
+    }
+    
+    // how many events the trigger has found since the stage went in.
+    func getEventCount() -> Int {
+        var rval = 0
+        syncWithReader({
+            rval = self.eventCount
+        })
+        return rval
+    }
+    
+    // a consistent copy of the trigger's event list, in sample indices.
+    func getEventTimestamps() -> [UInt] {
+        var rval:[UInt] = []
+        syncWithReader({
+            rval = self.trigger.eventTimestamps
+        })
+        return rval
+    }
+}
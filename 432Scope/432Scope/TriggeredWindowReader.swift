@@ -0,0 +1,126 @@
+//
+//  TriggeredWindowReader.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/14/16.
+//
+//
+
+import Foundation
+#if os(Linux)
+import Glibc
+#else
+import Darwin
+#endif
+
+/*
+ A reader stage that gets a window of samples around every trigger event: segmented capture (SegmentCapture.swift) and
+ waveform averaging (WaveformAverager.swift).
+ 
+ -the trigger stage hands every event to receiveTriggerEvent (its event tap; see Channel.updateEventTap), which just
+  notes the event in a fixed ring of pending events.  no allocation, no dispatch, one mutex.
+ -being a reader stage, this knows when samples are committed.  once an event's post-trigger samples are in, its window
+  gets handed to processWindow, on the stage's queue, while the window is still in the ring.
+ -windows that already fell off the back of the ring (the stage fell behind), and events that came too fast for the
+  pending ring, are counted as missed.
+ 
+ To make a new one, derive from TriggeredWindowReader and override processWindow.
+*/
+
+class TriggeredWindowReader: SampleBufferReader {
+    
+    static let pendingCapacity:Int = 4096
+    
+    let preTriggerSamples:Int
+    let postTriggerSamples:Int
+    
+    var windowLength:Int {
+        return preTriggerSamples + postTriggerSamples
+    }
+    
+    // since the stage started.  only touched on the stage's queue.
+    private(set) var missedCount:Int = 0
+    
+    // events waiting on their post-trigger samples.  filled from the trigger stage's queue, so it has its own lock.
+    // on the heap, so the mutex never moves.
+    private let pendingLock = UnsafeMutablePointer<pthread_mutex_t>.alloc(1)
+    private let pending:UnsafeMutablePointer<TriggerEvent>
+    private var pendingFirst:Int = 0
+    private var pendingCount:Int = 0
+    private var pendingOverflowCount:Int = 0
+    
+    init( sampleBuffer:SampleBuffer, preTriggerSamples:Int, postTriggerSamples:Int, queueLabel:String ) {
+        self.preTriggerSamples = max(0, preTriggerSamples)
+        self.postTriggerSamples = max(1, postTriggerSamples)
+        pending = UnsafeMutablePointer<TriggerEvent>.alloc(TriggeredWindowReader.pendingCapacity)
+        pending.initializeFrom([TriggerEvent](count: TriggeredWindowReader.pendingCapacity, repeatedValue: TriggerEvent()))
+        pthread_mutex_init(pendingLock, nil)
+        super.init(sampleBuffer: sampleBuffer, queueLabel: queueLabel)
+    }
+    
+    deinit {
+        pending.destroy(TriggeredWindowReader.pendingCapacity)
+        pending.dealloc(TriggeredWindowReader.pendingCapacity)
+        pthread_mutex_destroy(pendingLock)
+        pendingLock.dealloc(1)
+    }
+    
+    //
+    // EVENTS
+    //
+    
+    // the trigger stage's event tap.  runs on the trigger stage's queue.
+    func receiveTriggerEvent( event:TriggerEvent ) {
+        pthread_mutex_lock(pendingLock)
+        if ( pendingCount < TriggeredWindowReader.pendingCapacity ) {
+            pending[(pendingFirst + pendingCount) % TriggeredWindowReader.pendingCapacity] = event
+            pendingCount += 1
+        } else {
+            pendingOverflowCount += 1
+        }
+        pthread_mutex_unlock(pendingLock)
+    }
+    
+    override func processBlock( block:UnsafeBufferPointer<Sample>, firstSampleIndex:UInt ) {
+        let committedEnd = firstSampleIndex &+ UInt(block.count)
+        let committed = sampleBuffer.committedSampleCount
+        let oldestAvailable = committed &- min(committed, UInt(sampleBuffer.capacity))
+        
+        // events come in time order, so stop at the first one that's still waiting on samples.
+        while ( true ) {
+            pthread_mutex_lock(pendingLock)
+            missedCount += pendingOverflowCount
+            pendingOverflowCount = 0
+            var next:TriggerEvent? = nil
+            if ( pendingCount > 0 ) {
+                let event = pending[pendingFirst]
+                if ( event.timestamp &+ UInt(postTriggerSamples) <= committedEnd ) {
+                    next = event
+                    pendingFirst = (pendingFirst + 1) % TriggeredWindowReader.pendingCapacity
+                    pendingCount -= 1
+                }
+            }
+            pthread_mutex_unlock(pendingLock)
+            
+            guard let event = next else {
+                break
+            }
+            if ( event.timestamp < UInt(preTriggerSamples) || event.timestamp &- UInt(preTriggerSamples) < oldestAvailable ) {
+                missedCount += 1
+                continue
+            }
+            processWindow(event, windowStart: event.timestamp &- UInt(preTriggerSamples))
+        }
+    }
+    
+    //
+    // OVERRIDE THIS
+    //
+    
+    // gets called on the stage's queue for every event that made it.  the window is the windowLength samples from
+    // windowStart on; they're all committed and still in the ring, so copySamples them out of sampleBuffer.
+    func processWindow( event:TriggerEvent, windowStart:UInt ) {
+        // this should be overridden
+        print("---TriggeredWindowReader.processWindow SHOULD NOT BE GETTING CALLED.")
+    }
+}
@@ -10,21 +10,32 @@ import Foundation
 
 /*
  This file is organized top-down.
+    -Errors.
     -Basic types, range types.
-    -Basic type extensions (mostly for translating)
+    -Basic type extensions (mostly for translating.  the ones that translate to and from the screen are in DisplayTypes.swift, with the UI.)
     -Range type protocol and base class
     -Range type extensions
     -Low-level math
  */
 
+//
+// ERRORS
+//
+
+enum Error:ErrorType {
+    case AppFatal(String)
+    case ChannelFatal(String)
+}
+
 //
 // DATA TYPES
 //
 
 typealias Sample = Int
+typealias StoredSample = UInt16 // what the sample rings keep.  the wire format's 16 bits, which every 14-bit code fits in.  widened to Sample on the way out.
 typealias Voltage = Double
 typealias SampleIndex = Int
-typealias Time = CGFloat
+typealias Time = CGFloat // Foundation has CGFloat everywhere, Linux included, so this doesn't drag in any UI.
 typealias Frequency = Float // this HAS to be different from Double because swift won't let me extend two typealiases separately.  This is really annoying.  The next thing to try is the FloatLiteralConvertible trick.
 
 typealias VoltageRange = FloatingRangeType<Voltage>
@@ -41,24 +52,7 @@ typealias SampleIndexRange = (newest:Int, oldest:Int)
 extension Sample: RangeableType {
     
     func asVoltage( ) -> Voltage {
-        return CONFIG_AFE_VOLTAGE_RANGE.min + (Voltage(self)*ScopeViewMath.sampleToVoltageScaleFactor)
-    }
-    
-    func asCoordinate( ) -> CGFloat {
-        if (ScopeViewMath.sampleDisplayTransform == nil) {
-            return ScopeViewMath.sampleToCoordinateScaleFactor * CGFloat(self - ScopeViewMath.svRange.min)
-        }
-        var floatSelf = CGFloat(self)
-        // the scale-about-zero...
-        floatSelf -= ScopeViewMath.sampleDisplayTransform!.zeroVolts
-        floatSelf *= ScopeViewMath.sampleDisplayTransform!.scaling
-        floatSelf += ScopeViewMath.sampleDisplayTransform!.zeroVolts
-        // the display offset
-        floatSelf += ScopeViewMath.sampleDisplayTransform!.offset
-        // the normal transform ...
-        floatSelf -= CGFloat(ScopeViewMath.svRange.min)
-        floatSelf *= ScopeViewMath.sampleToCoordinateScaleFactor
-        return floatSelf
+        return CONFIG_AFE_VOLTAGE_RANGE.min + (Voltage(self)*CONFIG_VOLTS_PER_SAMPLE)
     }
 }
 
@@ -78,25 +72,14 @@ extension Voltage: RangeableType {
         return String(format:"%.3f", self) + " V"
     }
     
-    func asCoordinate( ) -> CGFloat {
-        var yVal = self - ScopeViewMath.vvRange.min
-        yVal *= ScopeViewMath.voltageScaleFactor
-        return CGFloat(yVal)
-    }
-    
     func asSample( ) -> Sample {
-        return Sample( (self - CONFIG_AFE_VOLTAGE_RANGE.min) * ScopeViewMath.voltageToSampleScaleFactor)
+        return Sample( (self - CONFIG_AFE_VOLTAGE_RANGE.min) * CONFIG_SAMPLES_PER_VOLT)
     }
     
     // if a sample moves by (self) volts, how far does its (Sample) value move?
     func asSampleDiff( ) -> Sample {
         return (self.asSample() - Voltage(0.0).asSample())
     }
-    
-    // if something moves by (self) volts, how many pixels does it move by?  ask this function.
-    func asGraphicsDiff( ) -> CGFloat {
-        return CGFloat(self * ScopeViewMath.voltageScaleFactor)
-    }
 }
 
 extension SampleIndex {
@@ -121,19 +104,9 @@ extension Time: RangeableType, IsTime {
         return String(format:"%.3f", self) + " S"
     }
     
-    func asCoordinate( ) -> CGFloat {
-        var xVal = self - ScopeViewMath.tvRange.newest
-        xVal *= ScopeViewMath.timeScaleFactor
-        return CGFloat(ScopeViewMath.imageSize.width - xVal);
-    }
-    
     func asSampleIndex( ) -> SampleIndex {
         return SampleIndex(floor(self*Time(CONFIG_SAMPLERATE)))
     }
-    
-    func asGraphicsDiff( ) -> CGFloat {
-        return CGFloat(self * ScopeViewMath.timeScaleFactor)
-    }
 }
 
 extension Frequency: RangeableType {
@@ -142,28 +115,6 @@ extension Frequency: RangeableType {
     }
 }
 
-extension CGFloat {
-    
-    // if self is a ScopeImageView coordinate, these translate it to Time (x) or Voltage (y).
-    func asTime( ) -> Time {
-        return (Time(ScopeViewMath.imageSize.width-self)*ScopeViewMath.inverseTimeScaleFactor)+ScopeViewMath.tvRange.newest
-    }
-    
-    func asVoltage( ) -> Voltage {
-        return (Voltage(self)*ScopeViewMath.inverseVoltageScaleFactor)+ScopeViewMath.vvRange.min
-    }
-    
-    // diff translates.  if self is a distance along x or y axes of ScopeImageView, these return the corresponding difference in time or voltage.
-    func asTimeDiff( ) -> Time {
-        return ScopeViewMath.inverseTimeScaleFactor * Time(self)
-    }
-    
-    func asVoltageDiff( ) -> Voltage {
-        return ScopeViewMath.inverseVoltageScaleFactor * Voltage(self)
-    }
-}
-
-
 /*
  This is the operator protocol + boundable range generic struct.  All the *Range types are derived from this.
  */
@@ -0,0 +1,223 @@
+//
+//  WaveformAverager.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/14/16.
+//
+//
+
+import Foundation
+
+/*
+ Trigger-aligned averaging: the window around every trigger event, lined up on the trigger and averaged, so everything
+ that isn't locked to the trigger (noise, mostly) averages away.
+ 
+ -it's a TriggeredWindowReader (TriggeredWindowReader.swift), so every event whose window made it comes through
+  processWindow on the stage's own queue, with the window still in the ring.
+ -event timestamps are whole samples, and the trigger's latency compensation is too, so lining windows up on them
+  smears every edge over a sample or so.  instead each window gets lined up on where it really crosses the middle of
+  the event's period (between its lowest and highest sample), found within alignmentRadius samples of the timestamp
+  and interpolated between the two samples either side.  the window is then resampled, linearly, at that crossing
+  plus whole samples.  that's why the stage reads alignmentRadius+2 extra samples on both ends.
+ -two ways to average:
+   .Sweeps(n)       the plain mean of the last n windows.  a running sum, plus the last n windows in a ring so the
+                    oldest can come back out of the sum.  nothing changes after the first n.
+   .Exponential(n)  each new window counts 1/n (1/sweeps until there are n of them, so it starts out a plain mean).
+                    no ring, and it never stops following the signal.
+ -a sweep costs the same whatever n is: copy the window out, resample it into aligned, then one pass that either swaps
+  the oldest window in the ring for the new one in the running sum, or nudges the exponential average toward it.  the
+  average is kept up to date every sweep, so getAverage never has to divide anything.  all the arrays are made when
+  the stage is, so nothing gets allocated per sweep.
+ -reading happens from any thread through getAverage, which copies the average out between sweeps.
+ 
+ AveragedChannel (AveragedChannel.swift) shows the average as a channel of its own.
+*/
+
+enum AveragingMode {
+    case Sweeps(Int)
+    case Exponential(Int)
+    
+    var count:Int {
+        switch (self) {
+        case .Sweeps(let n):
+            return Swift.max(1, n)
+        case .Exponential(let n):
+            return Swift.max(1, n)
+        }
+    }
+    
+    var description:String {
+        switch (self) {
+        case .Sweeps(let n):
+            return "\(n) sweeps"
+        case .Exponential(let n):
+            return "exp \(n)"
+        }
+    }
+}
+
+// the average, in samples (fractional ones), windowLength of them, oldest first.  windowStart is where the newest
+// sweep's window started in the sample buffer, so the trigger lands on values[preTriggerSamples].
+struct AveragedWaveform {
+    let windowStart:UInt
+    let sweepCount:Int
+    let generation:UInt
+    let values:[Double]
+}
+
+class WaveformAverager: TriggeredWindowReader {
+    
+    let mode:AveragingMode
+    let alignmentRadius:Int
+    
+    // what the average covers, around the trigger.  the stage's own window is alignmentRadius+2 wider on both ends.
+    let averagedPreTriggerSamples:Int
+    let averagedLength:Int
+    
+    // the window as it came out of the ring, then in doubles, then lined up on the crossing.
+    private let raw:UnsafeMutablePointer<Sample>
+    private let window:UnsafeMutablePointer<Double>
+    private let aligned:UnsafeMutablePointer<Double>
+    
+    // .Sweeps: the running sum, and the last n aligned windows (slot n is history[n*averagedLength ..< (n+1)*averagedLength]).
+    // .Exponential: average is all there is.
+    private let sum:UnsafeMutablePointer<Double>
+    private let history:UnsafeMutablePointer<Double>
+    private let historyCapacity:Int
+    private let average:UnsafeMutablePointer<Double>
+    
+    // only touched on the stage's queue
+    private var sweepCount:Int = 0
+    private var newestWindowStart:UInt = 0
+    private var generation:UInt = 0
+    
+    init( sampleBuffer:SampleBuffer, preTriggerSamples:Int, postTriggerSamples:Int, mode:AveragingMode, alignmentRadius:Int ) {
+        let pre = Swift.max(0, preTriggerSamples)
+        let length = pre + Swift.max(1, postTriggerSamples)
+        let m = Swift.max(0, alignmentRadius) + 2
+        self.mode = mode
+        self.alignmentRadius = Swift.max(0, alignmentRadius)
+        averagedPreTriggerSamples = pre
+        averagedLength = length
+        
+        raw = UnsafeMutablePointer<Sample>.alloc(length + 2 * m)
+        window = UnsafeMutablePointer<Double>.alloc(length + 2 * m)
+        aligned = UnsafeMutablePointer<Double>.alloc(length)
+        sum = UnsafeMutablePointer<Double>.alloc(length)
+        if case .Sweeps(_) = mode {
+            historyCapacity = mode.count
+        } else {
+            historyCapacity = 0
+        }
+        history = UnsafeMutablePointer<Double>.alloc(Swift.max(1, historyCapacity * length))
+        average = UnsafeMutablePointer<Double>.alloc(length)
+        for i in 0..<length {
+            sum[i] = 0
+            average[i] = 0
+        }
+        super.init(sampleBuffer: sampleBuffer, preTriggerSamples: pre + m, postTriggerSamples: length - pre + m, queueLabel: "waveformAveragerQueue")
+    }
+    
+    deinit {
+        raw.dealloc(windowLength)
+        window.dealloc(windowLength)
+        aligned.dealloc(averagedLength)
+        sum.dealloc(averagedLength)
+        history.dealloc(Swift.max(1, historyCapacity * averagedLength))
+        average.dealloc(averagedLength)
+    }
+    
+    //
+    // AVERAGING
+    //
+    
+    override func processWindow( event:TriggerEvent, windowStart:UInt ) {
+        sampleBuffer.copySamples(windowStart, count: windowLength, destination: raw)
+        for i in 0..<windowLength {
+            window[i] = Double(raw[i])
+        }
+        
+        // line it up, and resample it at the crossing plus whole samples.
+        let crossing = findCrossing(event)
+        let first = crossing - Double(averagedPreTriggerSamples)
+        let whole = floor(first)
+        let fraction = first - whole
+        let from = window + Int(whole)
+        for k in 0..<averagedLength {
+            aligned[k] = from[k] + fraction * (from[k+1] - from[k])
+        }
+        
+        sweepCount += 1
+        switch (mode) {
+        case .Sweeps(_):
+            let slot = history + ((sweepCount - 1) % historyCapacity) * averagedLength
+            if ( sweepCount > historyCapacity ) {
+                for k in 0..<averagedLength {
+                    sum[k] -= slot[k]
+                }
+            }
+            let scale = 1.0 / Double(Swift.min(sweepCount, historyCapacity))
+            for k in 0..<averagedLength {
+                slot[k] = aligned[k]
+                sum[k] += aligned[k]
+                average[k] = sum[k] * scale
+            }
+            break
+        case .Exponential(_):
+            let alpha = 1.0 / Double(Swift.min(sweepCount, mode.count))
+            for k in 0..<averagedLength {
+                average[k] += alpha * (aligned[k] - average[k])
+            }
+            break
+        }
+        newestWindowStart = event.timestamp &- UInt(averagedPreTriggerSamples)
+        generation = generation &+ 1
+    }
+    
+    // where the window crosses the middle of the event's period, in window samples, nearest the timestamp first.  the
+    // timestamp itself if it doesn't cross there (a flat period, or a trigger level way off the middle).
+    private func findCrossing( event:TriggerEvent ) -> Double {
+        let center = preTriggerSamples
+        if ( event.periodHighestSample <= event.periodLowestSample ) {
+            return Double(center)
+        }
+        let level = 0.5 * (Double(event.periodLowestSample) + Double(event.periodHighestSample))
+        let rising = window[center + alignmentRadius] >= window[center - alignmentRadius]
+        
+        for distance in 0...alignmentRadius {
+            for i in [center + distance, center - distance - 1] {
+                let a = window[i]
+                let b = window[i + 1]
+                if ( rising ? (a < level && b >= level) : (a > level && b <= level) ) {
+                    return Double(i) + (level - a) / (b - a)
+                }
+            }
+        }
+        return Double(center)
+    }
+    
+    //
+    // READING - from any thread
+    //
+    
+    func getAverage() -> AveragedWaveform? {
+        var rval:AveragedWaveform? = nil
+        syncWithReader({
+            if ( self.sweepCount == 0 ) {
+                return
+            }
+            let values = Array(UnsafeBufferPointer<Double>(start: self.average, count: self.averagedLength))
+            rval = AveragedWaveform(windowStart: self.newestWindowStart, sweepCount: self.sweepCount, generation: self.generation, values: values)
+        })
+        return rval
+    }
+    
+    // how many windows it's seen, and how many it missed, since it started.
+    func getStatus() -> (sweeps:Int, missed:Int) {
+        var rval = (sweeps: 0, missed: 0)
+        syncWithReader({
+            rval = (sweeps: self.sweepCount, missed: self.missedCount)
+        })
+        return rval
+    }
+}
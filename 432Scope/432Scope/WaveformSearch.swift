@@ -0,0 +1,568 @@
+//
+//  WaveformSearch.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/14/16.
+//
+//
+
+import Foundation
+
+/*
+ Searching a channel's whole history for things worth looking at: edges, pulses narrower or wider than something, runts,
+ excursions out of a window, and whatever its protocol decoder turned up.  the hits are sample indices, oldest first, and
+ the search panel (WaveformSearchPanel.swift) hands them to the scope view to jump to.
+ 
+ -the history gets cut into parts on summary chunk boundaries, and the parts get scanned at the same time with
+  dispatch_apply.  each part has its own scanner, and owns the hits that start inside it.  if one is still open when
+  the part ends, its scanner keeps going into the next part until it closes (it just doesn't start any new ones).
+ -a scanner needs to know what state the signal was in when its part starts.  it looks back from the start for the
+  newest sample that settles that on its own (one outside the hysteresis band, say), and runs forward from there
+  without keeping anything.  so every part finds exactly what one scan from the oldest sample would have.
+ -the min/max summary (MinMaxSummary.swift) is what makes it quick.  before looking at a chunk, the scanner gets its min
+  and max, and if nothing in that range could change its state (a low signal that never gets above the band, a runt
+  search in a chunk that never leaves the zone it's in), the whole chunk is skipped.  chunks the summary doesn't have
+  get scanned.
+ -levels get hysteresis: crossing up means going above level+hysteresis/2, crossing down going below level-hysteresis/2,
+  so noise sitting on a level isn't a thousand edges.  runt and window searches do the same at both of their levels.
+ -the writer keeps writing while we search.  the oldest CONFIG_SEARCH_OLDEST_MARGIN of the ring is left alone, since
+  that's what the writer overwrites next, and the newest end is wherever it was when the search started.  nothing from
+  before the last clear gets searched either.
+ -decoded matches don't scan anything: they're the protocol decoder's items whose text has the search text in it.
+*/
+
+enum SearchCriterion {
+    case Edge(level:Voltage, rising:Bool)
+    case Pulse(level:Voltage, positive:Bool, narrowerThan:Time?, widerThan:Time?)
+    case Runt(low:Voltage, high:Voltage, positive:Bool)
+    case OutsideWindow(low:Voltage, high:Voltage)
+    case Decoded(text:String)
+    
+    var description:String {
+        switch (self) {
+        case .Edge(let level, let rising):
+            return (rising ? "rising" : "falling") + " edges through " + level.asString()
+        case .Pulse(let level, let positive, let narrowerThan, let widerThan):
+            var rval = (positive ? "positive" : "negative") + " pulses at " + level.asString()
+            if let narrower = narrowerThan {
+                rval += ", narrower than " + narrower.asString()
+            }
+            if let wider = widerThan {
+                rval += ", wider than " + wider.asString()
+            }
+            return rval
+        case .Runt(let low, let high, let positive):
+            return (positive ? "positive" : "negative") + " runts between " + low.asString() + " and " + high.asString()
+        case .OutsideWindow(let low, let high):
+            return "outside " + low.asString() + " to " + high.asString()
+        case .Decoded(let text):
+            return "decoded \"" + text + "\""
+        }
+    }
+}
+
+struct SearchHit {
+    let firstSampleIndex:UInt
+    let lastSampleIndex:UInt
+    let text:String
+}
+
+struct SearchResult {
+    let hits:[SearchHit]
+    // there were more than maximumHits.  hits has the oldest ones.
+    let truncated:Bool
+    // how many samples got looked at one by one, and how many the summary let us skip.
+    let scannedSampleCount:Int
+    let skippedSampleCount:Int
+    // the newest sample there was when the search started, so hits can be shown as ages.
+    let newestSampleIndex:UInt
+}
+
+final class WaveformSearch {
+    
+    class func search( sampleBuffer:SampleBuffer, summary:MinMaxSummary?, decoder:ProtocolDecoderStage?, criterion:SearchCriterion, hysteresis:Voltage, maximumHits:Int ) -> SearchResult {
+        let committed = sampleBuffer.committedSampleCount
+        let available = min(committed, UInt(sampleBuffer.capacity))
+        let oldest = max(sampleBuffer.validFromSampleIndex, committed - available + min(available, UInt(CONFIG_SEARCH_OLDEST_MARGIN.asSampleIndex())))
+        let newest = committed &- 1
+        
+        if case .Decoded(let text) = criterion {
+            return searchDecoded(decoder, text: text, oldest: oldest, newest: newest, maximumHits: maximumHits)
+        }
+        guard oldest < committed else {
+            return SearchResult(hits: [], truncated: false, scannedSampleCount: 0, skippedSampleCount: 0, newestSampleIndex: newest)
+        }
+        
+        // parts, on chunk boundaries.  a few per core, since some parts skip most of their chunks and some don't.
+        let chunkSize = UInt(summary?.chunkSize ?? CONFIG_SEARCH_SUMMARY_CHUNK)
+        let firstChunk = oldest / chunkSize
+        let endChunk = (committed + chunkSize - 1) / chunkSize
+        let chunks = SummaryChunks(summary: summary, chunkSize: chunkSize, firstChunk: firstChunk, endChunk: endChunk)
+        let partCount = Int(min(endChunk - firstChunk, UInt(max(1, NSProcessInfo.processInfo().activeProcessorCount * 4))))
+        let chunksPerPart = (endChunk - firstChunk + UInt(partCount) - 1) / UInt(partCount)
+        
+        let scanners = (0..<partCount).map({ _ in makeScanner(criterion, hysteresis: hysteresis, maximumHits: maximumHits) })
+        dispatch_apply(partCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), { part in
+            let scanner = scanners[part]
+            let start = max(oldest, (firstChunk + UInt(part) * chunksPerPart) * chunkSize)
+            let end = min(committed, (firstChunk + UInt(part + 1) * chunksPerPart) * chunkSize)
+            if ( start >= end ) {
+                return
+            }
+            let reader = SearchReader(sampleBuffer: sampleBuffer, chunks: chunks, oldest: oldest, end: committed)
+            reader.prime(scanner, start: start)
+            scanner.opening = true
+            reader.run(scanner, from: start, to: end)
+            scanner.opening = false
+            reader.finish(scanner, from: end)
+            scanner.scannedSampleCount = reader.scannedSampleCount
+            scanner.skippedSampleCount = reader.skippedSampleCount
+        })
+        
+        var hits:[SearchHit] = []
+        var scanned = 0
+        var skipped = 0
+        var truncated = false
+        for scanner in scanners {
+            scanned += scanner.scannedSampleCount
+            skipped += scanner.skippedSampleCount
+            truncated = truncated || scanner.truncated
+            hits.appendContentsOf(scanner.hits)
+        }
+        if ( hits.count > maximumHits ) {
+            hits.removeRange(maximumHits..<hits.count)
+            truncated = true
+        }
+        return SearchResult(hits: hits, truncated: truncated, scannedSampleCount: scanned, skippedSampleCount: skipped, newestSampleIndex: newest)
+    }
+    
+    private class func searchDecoded( decoder:ProtocolDecoderStage?, text:String, oldest:UInt, newest:UInt, maximumHits:Int ) -> SearchResult {
+        var hits:[SearchHit] = []
+        var truncated = false
+        if let items = decoder?.getAllItems() {
+            let wanted = text.lowercaseString
+            for item in items where item.firstSampleIndex >= oldest && item.lastSampleIndex <= newest {
+                if ( wanted.isEmpty || item.text.lowercaseString.containsString(wanted) ) {
+                    if ( hits.count == maximumHits ) {
+                        truncated = true
+                        break
+                    }
+                    hits.append(SearchHit(firstSampleIndex: item.firstSampleIndex, lastSampleIndex: item.lastSampleIndex, text: item.text))
+                }
+            }
+        }
+        return SearchResult(hits: hits, truncated: truncated, scannedSampleCount: 0, skippedSampleCount: 0, newestSampleIndex: newest)
+    }
+    
+    private class func makeScanner( criterion:SearchCriterion, hysteresis:Voltage, maximumHits:Int ) -> SearchScanner {
+        let halfBand = 0.5 * max(0, hysteresis)
+        switch (criterion) {
+        case .Edge(let level, let rising):
+            return LevelScanner(low: (level - halfBand).asSample(), high: (level + halfBand).asSample(), rising: rising, pulses: false, narrowerThan: nil, widerThan: nil, maximumHits: maximumHits)
+        case .Pulse(let level, let positive, let narrowerThan, let widerThan):
+            return LevelScanner(low: (level - halfBand).asSample(), high: (level + halfBand).asSample(), rising: positive, pulses: true, narrowerThan: narrowerThan?.asSampleIndex(), widerThan: widerThan?.asSampleIndex(), maximumHits: maximumHits)
+        case .Runt(let low, let high, let positive):
+            return ZoneScanner(low: min(low, high), high: max(low, high), halfBand: halfBand, runts: true, positive: positive, maximumHits: maximumHits)
+        case .OutsideWindow(let low, let high):
+            return ZoneScanner(low: min(low, high), high: max(low, high), halfBand: halfBand, runts: false, positive: true, maximumHits: maximumHits)
+        case .Decoded(_):
+            return SearchScanner(maximumHits: maximumHits)
+        }
+    }
+}
+
+//
+// THE SUMMARY - one snapshot for every part, taken before they start.
+//
+
+private final class SummaryChunks {
+    let chunkSize:UInt
+    let validFirst:UInt
+    let validEnd:UInt
+    let minimums:[Sample]
+    let maximums:[Sample]
+    
+    init( summary:MinMaxSummary?, chunkSize:UInt, firstChunk:UInt, endChunk:UInt ) {
+        self.chunkSize = chunkSize
+        if let snapshot = summary?.snapshot(firstChunk, endChunk: endChunk) {
+            validFirst = snapshot.validFirst
+            validEnd = snapshot.validEnd
+            minimums = snapshot.minimums
+            maximums = snapshot.maximums
+        } else {
+            validFirst = 0
+            validEnd = 0
+            minimums = []
+            maximums = []
+        }
+    }
+    
+    func get( chunk:UInt ) -> (min:Sample, max:Sample)? {
+        if ( chunk < validFirst || chunk >= validEnd ) {
+            return nil
+        }
+        let i = Int(chunk - validFirst)
+        return (min: minimums[i], max: maximums[i])
+    }
+}
+
+//
+// READING - walks a scanner over the samples a chunk at a time, skipping the chunks it can.  one per part.
+//
+
+private final class SearchReader {
+    let sampleBuffer:SampleBuffer
+    let chunks:SummaryChunks
+    let oldest:UInt
+    let end:UInt
+    private var block:[Sample]
+    
+    var scannedSampleCount = 0
+    var skippedSampleCount = 0
+    
+    init( sampleBuffer:SampleBuffer, chunks:SummaryChunks, oldest:UInt, end:UInt ) {
+        self.sampleBuffer = sampleBuffer
+        self.chunks = chunks
+        self.oldest = oldest
+        self.end = end
+        block = [Sample](count: Int(chunks.chunkSize), repeatedValue: 0)
+    }
+    
+    // sets the scanner up for a part starting at start: finds the newest sample before it that settles the scanner's
+    // state, and runs forward from there.  nothing settles it (the start of the history, or a signal that's sat in a
+    // hysteresis band ever since)?  then it starts out not knowing, same as a scan from the oldest sample would.
+    func prime( scanner:SearchScanner, start:UInt ) {
+        var index = start
+        while ( index > oldest ) {
+            let chunk = (index - 1) / chunks.chunkSize
+            let chunkStart = max(oldest, chunk * chunks.chunkSize)
+            if let summary = chunks.get(chunk) where !scanner.mightSettle(summary.min, maximum: summary.max) {
+                index = chunkStart
+                continue
+            }
+            let count = Int(index - chunkStart)
+            sampleBuffer.copySamples(chunkStart, count: count, destination: &block)
+            for j in (0..<count).reverse() {
+                if ( scanner.settle(block[j]) ) {
+                    run(scanner, from: chunkStart + UInt(j) + 1, to: start)
+                    return
+                }
+            }
+            index = chunkStart
+        }
+    }
+    
+    func run( scanner:SearchScanner, from:UInt, to:UInt ) {
+        var index = from
+        while ( index < to ) {
+            let chunk = index / chunks.chunkSize
+            let pieceEnd = min(to, (chunk + 1) * chunks.chunkSize)
+            step(scanner, chunk: chunk, from: index, to: pieceEnd)
+            index = pieceEnd
+        }
+    }
+    
+    // past the end of the part, until whatever's open closes.
+    func finish( scanner:SearchScanner, from:UInt ) {
+        var index = from
+        while ( index < end && scanner.isOpen ) {
+            let chunk = index / chunks.chunkSize
+            let pieceEnd = min(end, (chunk + 1) * chunks.chunkSize)
+            step(scanner, chunk: chunk, from: index, to: pieceEnd)
+            index = pieceEnd
+        }
+    }
+    
+    private func step( scanner:SearchScanner, chunk:UInt, from:UInt, to:UInt ) {
+        let count = Int(to - from)
+        if let summary = chunks.get(chunk) where scanner.skip(summary.min, maximum: summary.max) {
+            skippedSampleCount += count
+            return
+        }
+        sampleBuffer.copySamples(from, count: count, destination: &block)
+        block.withUnsafeBufferPointer({ samples in
+            scanner.scan(samples.baseAddress, count: count, firstSampleIndex: from)
+        })
+        scannedSampleCount += count
+    }
+}
+
+//
+// SCANNERS - the state machines.  scan is the only thing that runs per sample; everything else runs per chunk, or per hit.
+//
+
+private class SearchScanner {
+    let maximumHits:Int
+    private(set) var hits:[SearchHit] = []
+    private(set) var truncated = false
+    
+    // hits only start while this is set (inside our own part).  they can finish any time.
+    var opening = false
+    
+    var scannedSampleCount = 0
+    var skippedSampleCount = 0
+    
+    init( maximumHits:Int ) {
+        self.maximumHits = maximumHits
+    }
+    
+    // a hit started in our part and hasn't finished yet.
+    var isOpen:Bool {
+        return false
+    }
+    
+    // could a chunk with this min and max hold a sample that settles the state on its own?
+    func mightSettle( minimum:Sample, maximum:Sample ) -> Bool {
+        return false
+    }
+    
+    // if this sample settles the state on its own, take that state and say so.
+    func settle( sample:Sample ) -> Bool {
+        return false
+    }
+    
+    // if nothing in a chunk with this min and max could change anything but the state, take the state the chunk
+    // leaves us in and say so.
+    func skip( minimum:Sample, maximum:Sample ) -> Bool {
+        return true
+    }
+    
+    func scan( samples:UnsafePointer<Sample>, count:Int, firstSampleIndex:UInt ) {
+    }
+    
+    func addHit( firstSampleIndex:UInt, lastSampleIndex:UInt, text:String ) {
+        if ( hits.count == maximumHits ) {
+            truncated = true
+            return
+        }
+        hits.append(SearchHit(firstSampleIndex: firstSampleIndex, lastSampleIndex: lastSampleIndex, text: text))
+    }
+}
+
+// edges and pulses: one level, with a hysteresis band around it.
+private final class LevelScanner: SearchScanner {
+    let low:Sample
+    let high:Sample
+    let rising:Bool // the edge we want, or the leading edge of the pulses we want
+    let pulses:Bool
+    let narrowerThan:SampleIndex?
+    let widerThan:SampleIndex?
+    
+    // -1 low, 1 high, 0 don't know yet
+    private var state = 0
+    private var pulseStart:UInt? = nil
+    
+    init( low:Sample, high:Sample, rising:Bool, pulses:Bool, narrowerThan:SampleIndex?, widerThan:SampleIndex?, maximumHits:Int ) {
+        self.low = low
+        self.high = high
+        self.rising = rising
+        self.pulses = pulses
+        self.narrowerThan = narrowerThan
+        self.widerThan = widerThan
+        super.init(maximumHits: maximumHits)
+    }
+    
+    override var isOpen:Bool {
+        return pulseStart != nil
+    }
+    
+    override func mightSettle( minimum:Sample, maximum:Sample ) -> Bool {
+        return minimum < low || maximum > high
+    }
+    
+    override func settle( sample:Sample ) -> Bool {
+        if ( sample > high ) {
+            state = 1
+            return true
+        }
+        if ( sample < low ) {
+            state = -1
+            return true
+        }
+        return false
+    }
+    
+    override func skip( minimum:Sample, maximum:Sample ) -> Bool {
+        if ( maximum <= high ) {
+            // nothing goes high.  if we're high and something goes low, that's an edge.
+            if ( minimum >= low ) {
+                return true
+            }
+            if ( state == 1 ) {
+                return false
+            }
+            state = -1
+            return true
+        }
+        if ( minimum >= low ) {
+            if ( state == -1 ) {
+                return false
+            }
+            state = 1
+            return true
+        }
+        return false
+    }
+    
+    override func scan( samples:UnsafePointer<Sample>, count:Int, firstSampleIndex:UInt ) {
+        for i in 0..<count {
+            let sample = samples[i]
+            if ( state != 1 && sample > high ) {
+                if ( state == -1 ) {
+                    edge(true, at: firstSampleIndex + UInt(i))
+                }
+                state = 1
+            } else if ( state != -1 && sample < low ) {
+                if ( state == 1 ) {
+                    edge(false, at: firstSampleIndex + UInt(i))
+                }
+                state = -1
+            }
+        }
+    }
+    
+    private func edge( up:Bool, at index:UInt ) {
+        if ( !pulses ) {
+            if ( up == rising && opening ) {
+                addHit(index, lastSampleIndex: index, text: up ? "rising edge" : "falling edge")
+            }
+            return
+        }
+        if ( up == rising ) {
+            pulseStart = opening ? index : nil
+            return
+        }
+        if let start = pulseStart {
+            let width = Int(index - start)
+            if ( (narrowerThan == nil || width < narrowerThan!) && (widerThan == nil || width > widerThan!) ) {
+                addHit(start, lastSampleIndex: index - 1, text: (rising ? "positive" : "negative") + " pulse, " + width.asTime().asString())
+            }
+        }
+        pulseStart = nil
+    }
+}
+
+// runts and windows: two levels, each with a hysteresis band, making three zones.  0 is below low, 1 between, 2 above high.
+private final class ZoneScanner: SearchScanner {
+    let lowDown:Sample
+    let lowUp:Sample
+    let highDown:Sample
+    let highUp:Sample
+    let runts:Bool
+    let positive:Bool
+    
+    // -1 don't know yet
+    private var zone = -1
+    // runts: where the one we're in started, and the zone it came from.  windows: where the excursion started, and
+    // which ways it's gone.
+    private var openStart:UInt? = nil
+    private var openFrom = 0
+    private var wentBelow = false
+    private var wentAbove = false
+    
+    init( low:Voltage, high:Voltage, halfBand:Voltage, runts:Bool, positive:Bool, maximumHits:Int ) {
+        lowDown = (low - halfBand).asSample()
+        lowUp = (low + halfBand).asSample()
+        highDown = (high - halfBand).asSample()
+        highUp = (high + halfBand).asSample()
+        self.runts = runts
+        self.positive = positive
+        super.init(maximumHits: maximumHits)
+    }
+    
+    override var isOpen:Bool {
+        return openStart != nil
+    }
+    
+    // below the bottom band, above the top one, or between the two.
+    override func mightSettle( minimum:Sample, maximum:Sample ) -> Bool {
+        return !((minimum >= lowDown && maximum <= lowUp) || (minimum >= highDown && maximum <= highUp))
+    }
+    
+    override func settle( sample:Sample ) -> Bool {
+        if ( sample < lowDown ) {
+            zone = 0
+            return true
+        }
+        if ( sample > highUp ) {
+            zone = 2
+            return true
+        }
+        if ( sample > lowUp && sample < highDown ) {
+            zone = 1
+            return true
+        }
+        return false
+    }
+    
+    override func skip( minimum:Sample, maximum:Sample ) -> Bool {
+        switch (zone) {
+        case 0:
+            return maximum <= lowUp
+        case 1:
+            return minimum >= lowDown && maximum <= highUp
+        case 2:
+            return minimum >= highDown
+        default:
+            return false
+        }
+    }
+    
+    override func scan( samples:UnsafePointer<Sample>, count:Int, firstSampleIndex:UInt ) {
+        var i = 0
+        // not knowing yet is only ever at the start of the history.  the first sample says where we are, no hysteresis.
+        if ( zone == -1 && count > 0 ) {
+            zone = samples[0] < lowDown ? 0 : (samples[0] > highUp ? 2 : 1)
+            i = 1
+        }
+        while ( i < count ) {
+            let sample = samples[i]
+            var next = zone
+            switch (zone) {
+            case 0:
+                next = sample > highUp ? 2 : (sample > lowUp ? 1 : 0)
+            case 1:
+                next = sample > highUp ? 2 : (sample < lowDown ? 0 : 1)
+            default:
+                next = sample < lowDown ? 0 : (sample < highDown ? 1 : 2)
+            }
+            if ( next != zone ) {
+                enter(next, at: firstSampleIndex + UInt(i))
+            }
+            i += 1
+        }
+    }
+    
+    private func enter( next:Int, at index:UInt ) {
+        let from = zone
+        zone = next
+        if ( runts ) {
+            if ( next == 1 ) {
+                if ( opening && from == (positive ? 0 : 2) ) {
+                    openStart = index
+                    openFrom = from
+                }
+                return
+            }
+            if let start = openStart where next == openFrom {
+                addHit(start, lastSampleIndex: index - 1, text: (positive ? "positive" : "negative") + " runt, " + Int(index - start).asTime().asString())
+            }
+            openStart = nil
+            return
+        }
+        
+        if ( from == 1 ) {
+            if ( opening ) {
+                openStart = index
+                wentBelow = false
+                wentAbove = false
+            }
+        } else if let start = openStart where next == 1 {
+            let which = (wentBelow && wentAbove) ? "below and above" : (wentBelow ? "below" : "above")
+            addHit(start, lastSampleIndex: index - 1, text: which + " window, " + Int(index - start).asTime().asString())
+            openStart = nil
+        }
+        wentBelow = wentBelow || next == 0
+        wentAbove = wentAbove || next == 2
+    }
+}
@@ -0,0 +1,257 @@
+//
+//  WaveformSearchPanel.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/14/16.
+//
+//
+
+import Cocoa
+
+/*
+ Window > Waveform Search.  Searches a channel's whole history (WaveformSearch.swift) and lists the hits, oldest first.
+ picking one (click it, or Previous / Next) stops the scope and puts the hit in the middle of the view.
+ 
+ -level / low is the level for edges and pulses, and the bottom of the window for runts and windows.  high is the top.
+  narrower than and wider than are pulse widths in seconds, either or both, or neither for every pulse.  text is what a
+  decoded search looks for in the channel's protocol decoder items.
+ -the search runs off the main thread, and the time it took shows up in the status line with how much of the history
+  actually got looked at.
+ -times are how long before the newest sample the hit was, as of the search.
+ 
+ Built in code, like the protocol decoder panel.
+*/
+
+class WaveformSearchPanelController: NSWindowController, NSWindowDelegate, NSTableViewDataSource, NSTableViewDelegate {
+    
+    private let channels:[Channel]
+    private let show:(Channel, SearchHit) -> ()
+    private let channelPopup:NSPopUpButton
+    private let criterionPopup:NSPopUpButton
+    private let lowField:NSTextField
+    private let highField:NSTextField
+    private let narrowerField:NSTextField
+    private let widerField:NSTextField
+    private let textField:NSTextField
+    private let tableView:NSTableView
+    private let statusLabel:NSTextField
+    private var searchButton:NSButton? = nil
+    
+    // the last search's hits, and the channel they're from.
+    private var result:SearchResult? = nil
+    private var resultChannel:Channel? = nil
+    
+    init( channels:[Channel], show:(Channel, SearchHit) -> () ) {
+        self.channels = channels
+        self.show = show
+        let panel = NSPanel(contentRect: NSRect(x: 0, y: 0, width: 760, height: 420),
+                            styleMask: NSTitledWindowMask | NSClosableWindowMask | NSResizableWindowMask | NSUtilityWindowMask,
+                            backing: .Buffered, defer: true)
+        panel.title = "Waveform Search"
+        panel.floatingPanel = true
+        panel.hidesOnDeactivate = false
+        
+        let rowHeight:CGFloat = 30
+        let content = panel.contentView!
+        let top = content.bounds.height
+        
+        // first row: where to look, and for what
+        channelPopup = NSPopUpButton(frame: NSRect(x: 8, y: top - rowHeight + 2, width: 200, height: 24), pullsDown: false)
+        channelPopup.addItemsWithTitles(channels.map({ $0.name }))
+        criterionPopup = NSPopUpButton(frame: NSRect(x: 212, y: top - rowHeight + 2, width: 160, height: 24), pullsDown: false)
+        criterionPopup.addItemsWithTitles(["Rising edge", "Falling edge", "Positive pulse", "Negative pulse", "Positive runt", "Negative runt", "Outside window", "Decoded text"])
+        
+        // second row: the numbers
+        lowField = NSTextField(frame: NSRect(x: 8, y: top - 2 * rowHeight + 4, width: 90, height: 22))
+        lowField.stringValue = "\(CONFIG_PROTOCOL_DEFAULT_THRESHOLD)"
+        lowField.placeholderString = "level / low (V)"
+        lowField.toolTip = "level for edges and pulses, bottom of the window for runts and windows, volts"
+        highField = NSTextField(frame: NSRect(x: 102, y: top - 2 * rowHeight + 4, width: 90, height: 22))
+        highField.placeholderString = "high (V)"
+        highField.toolTip = "top of the window for runts and windows, volts"
+        narrowerField = NSTextField(frame: NSRect(x: 196, y: top - 2 * rowHeight + 4, width: 110, height: 22))
+        narrowerField.placeholderString = "narrower than (s)"
+        narrowerField.toolTip = "pulses narrower than this many seconds"
+        widerField = NSTextField(frame: NSRect(x: 310, y: top - 2 * rowHeight + 4, width: 110, height: 22))
+        widerField.placeholderString = "wider than (s)"
+        widerField.toolTip = "pulses wider than this many seconds"
+        textField = NSTextField(frame: NSRect(x: 424, y: top - 2 * rowHeight + 4, width: content.bounds.width - 432, height: 22))
+        textField.placeholderString = "decoded text"
+        textField.autoresizingMask = [.ViewWidthSizable]
+        
+        for view in [channelPopup, criterionPopup, lowField, highField, narrowerField, widerField, textField] as [NSView] {
+            view.autoresizingMask.insert(.ViewMinYMargin)
+            content.addSubview(view)
+        }
+        
+        // the hits
+        tableView = NSTableView(frame: NSRect(x: 0, y: 0, width: content.bounds.width, height: 100))
+        let columns:[(identifier:String, title:String, width:CGFloat)] = [("number", "#", 60), ("time", "time (s)", 120), ("width", "width", 100), ("text", "found", 440)]
+        for c in columns {
+            let column = NSTableColumn(identifier: c.identifier)
+            column.title = c.title
+            column.width = c.width
+            tableView.addTableColumn(column)
+        }
+        tableView.usesAlternatingRowBackgroundColors = true
+        let scrollView = NSScrollView(frame: NSRect(x: 0, y: rowHeight, width: content.bounds.width, height: top - 3 * rowHeight - 4))
+        scrollView.documentView = tableView
+        scrollView.hasVerticalScroller = true
+        scrollView.autoresizingMask = [.ViewWidthSizable, .ViewHeightSizable]
+        content.addSubview(scrollView)
+        
+        statusLabel = NSTextField(frame: NSRect(x: 260, y: 8, width: content.bounds.width - 268, height: 18))
+        statusLabel.editable = false
+        statusLabel.bordered = false
+        statusLabel.drawsBackground = false
+        statusLabel.font = NSFont(name: "Menlo", size: 10.0)
+        statusLabel.autoresizingMask = [.ViewWidthSizable]
+        content.addSubview(statusLabel)
+        
+        super.init(window: panel)
+        panel.delegate = self
+        tableView.setDataSource(self)
+        tableView.setDelegate(self)
+        
+        let buttons:[(title:String, width:CGFloat, action:Selector)] = [
+            ("Search", 80, #selector(WaveformSearchPanelController.startSearch(_:))),
+            ("Previous", 80, #selector(WaveformSearchPanelController.previousHit(_:))),
+            ("Next", 80, #selector(WaveformSearchPanelController.nextHit(_:))),
+        ]
+        var x:CGFloat = 8
+        for b in buttons {
+            let button = NSButton(frame: NSRect(x: x, y: 2, width: b.width, height: 24))
+            button.title = b.title
+            button.bezelStyle = .RoundedBezelStyle
+            button.target = self
+            button.action = b.action
+            content.addSubview(button)
+            if ( searchButton == nil ) {
+                searchButton = button
+            }
+            x += b.width + 4
+        }
+        
+        panel.center()
+    }
+    
+    required init?(coder: NSCoder) {
+        fatalError("WaveformSearchPanelController is built in code.")
+    }
+    
+    private var channel:Channel? {
+        let index = channelPopup.indexOfSelectedItem
+        return (index >= 0 && index < channels.count) ? channels[index] : nil
+    }
+    
+    // nil if it's empty or isn't a number.
+    private class func optionalTime( field:NSTextField ) -> Time? {
+        guard let value = Double(field.stringValue.stringByTrimmingCharactersInSet(NSCharacterSet.whitespaceCharacterSet())) else {
+            return nil
+        }
+        return Time(value)
+    }
+    
+    private func criterion() -> SearchCriterion {
+        let low = Voltage(lowField.doubleValue)
+        let high = Voltage(highField.doubleValue)
+        let narrower = WaveformSearchPanelController.optionalTime(narrowerField)
+        let wider = WaveformSearchPanelController.optionalTime(widerField)
+        switch (criterionPopup.indexOfSelectedItem) {
+        case 0:
+            return .Edge(level: low, rising: true)
+        case 1:
+            return .Edge(level: low, rising: false)
+        case 2:
+            return .Pulse(level: low, positive: true, narrowerThan: narrower, widerThan: wider)
+        case 3:
+            return .Pulse(level: low, positive: false, narrowerThan: narrower, widerThan: wider)
+        case 4:
+            return .Runt(low: low, high: high, positive: true)
+        case 5:
+            return .Runt(low: low, high: high, positive: false)
+        case 6:
+            return .OutsideWindow(low: low, high: high)
+        default:
+            return .Decoded(text: textField.stringValue)
+        }
+    }
+    
+    //
+    // THE TABLE
+    //
+    
+    func numberOfRowsInTableView(tableView: NSTableView) -> Int {
+        return result?.hits.count ?? 0
+    }
+    
+    func tableView(tableView: NSTableView, objectValueForTableColumn tableColumn: NSTableColumn?, row: Int) -> AnyObject? {
+        guard let hits = result?.hits, newest = result?.newestSampleIndex, identifier = tableColumn?.identifier where row >= 0 && row < hits.count else {
+            return nil
+        }
+        let hit = hits[row]
+        switch (identifier) {
+        case "number":
+            return "\(row + 1)"
+        case "time":
+            return String(format: "-%.6f", Double(Int(newest) - Int(hit.firstSampleIndex)) * Double(CONFIG_SAMPLEPERIOD))
+        case "width":
+            return Int(hit.lastSampleIndex - hit.firstSampleIndex + 1).asTime().asString()
+        default:
+            return hit.text
+        }
+    }
+    
+    func tableViewSelectionDidChange(notification: NSNotification) {
+        let row = tableView.selectedRow
+        guard let hits = result?.hits, ch = resultChannel where row >= 0 && row < hits.count else {
+            return
+        }
+        show(ch, hits[row])
+    }
+    
+    private func selectRow( row:Int ) {
+        let count = result?.hits.count ?? 0
+        if ( count == 0 ) {
+            return
+        }
+        let clamped = max(0, min(count - 1, row))
+        tableView.selectRowIndexes(NSIndexSet(index: clamped), byExtendingSelection: false)
+        tableView.scrollRowToVisible(clamped)
+    }
+    
+    //
+    // ACTIONS
+    //
+    
+    @IBAction func startSearch(sender: AnyObject) {
+        guard let ch = channel else {
+            return
+        }
+        let what = criterion()
+        searchButton?.enabled = false
+        statusLabel.stringValue = "searching for " + what.description + " ..."
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), {
+            let started = CFAbsoluteTimeGetCurrent()
+            let found = ch.search(what, maximumHits: CONFIG_SEARCH_MAX_HITS)
+            let milliseconds = (CFAbsoluteTimeGetCurrent() - started) * 1000
+            dispatch_async(dispatch_get_main_queue(), {
+                self.result = found
+                self.resultChannel = ch
+                self.tableView.reloadData()
+                self.searchButton?.enabled = true
+                let total = found.scannedSampleCount + found.skippedSampleCount
+                self.statusLabel.stringValue = "\(found.hits.count)" + (found.truncated ? "+" : "") + " hits in " + String(format: "%.1f", milliseconds) + " ms, looked at \(found.scannedSampleCount) of \(total) samples"
+            })
+        })
+    }
+    
+    @IBAction func previousHit(sender: AnyObject) {
+        let row = tableView.selectedRow
+        selectRow(row < 0 ? (result?.hits.count ?? 0) - 1 : row - 1)
+    }
+    
+    @IBAction func nextHit(sender: AnyObject) {
+        selectRow(tableView.selectedRow + 1)
+    }
+}
@@ -7,41 +7,113 @@
 //
 
 import Foundation
-import Cocoa
+
+/*
+ The acquisition and signal processing settings.  Nothing in here (or in anything that only needs this) touches Cocoa, so it
+ all goes into the headless command-line build too.  The display settings are in displayconfig.swift, with the UI.
+*/
 
 //
-// DISPLAY
+// SIGNAL PROCESSING
 //
 
-// The trace display (ScopeViewController) frame rate!
-let CONFIG_DISPLAY_REFRESH_RATE:Double = 20
+// spectrum analyzer: the FFT sizes on offer, and how many frames Average mode averages.
+let CONFIG_SPECTRUM_SIZES:[Int] = [1024, 2048, 4096, 8192, 16384, 32768, 65536]
+let CONFIG_SPECTRUM_AVERAGING_DEPTH:Int = 16
 
-// Scope View grid colors
-let CONFIG_DISPLAY_SCOPEVIEW_BACKGROUND_COLOR = NSColor(calibratedWhite: 0.0, alpha: 1.0)
-let CONFIG_DISPLAY_SCOPEVIEW_GRIDLINE_COLOR = NSColor(calibratedWhite: 0.2, alpha: 1.0)
-let CONFIG_DISPLAY_SCOPEVIEW_GROUNDLINE_COLOR = NSColor(calibratedWhite: 1.0, alpha: 1.0)
+// measurement engine: how much signal each published measurement covers, and how big a swing has to be before it counts as having edges.
+let CONFIG_MEASUREMENT_WINDOW_LENGTH:Time = 0.1
+let CONFIG_MEASUREMENT_MINIMUM_SWING:Voltage = 0.05
 
-// scope view scrolling limits
-let CONFIG_DISPLAY_TIME_LIMITS = TimeRange(newest:0, oldest:10)
-let CONFIG_DISPLAY_VOLTAGE_LIMITS = VoltageRange(min:-20, max:20)
+// decimation: every channel keeps a second, low-passed copy at 1/CONFIG_DECIMATION_FACTOR the rate (1 for no copy; see
+// Decimator.swift), with this many filter taps per output.  views use it once each column covers this many decimated
+// samples, and measurements once they're longer than CONFIG_DECIMATED_MEASUREMENT_LENGTH.
+let CONFIG_DECIMATION_FACTOR:Int = 10
+let CONFIG_DECIMATION_TAPS_PER_PHASE:Int = 8
+let CONFIG_DECIMATION_CUTOFF:Double = 0.8 // fraction of the decimated Nyquist rate
+let CONFIG_DECIMATED_MINIMUM_SAMPLES_PER_COLUMN:Double = 4
+let CONFIG_DECIMATED_MEASUREMENT_LENGTH:Time = 1.0
 
-// scope view zooming limits
-let CONFIG_DISPLAY_TIME_SPAN_LIMITS:(min:Time, max:Time) = (0.001, CONFIG_DISPLAY_TIME_LIMITS.span)
-let CONFIG_DISPLAY_VOLTAGE_SPAN_LIMITS:(min:Voltage, max:Voltage) = (0.1, CONFIG_DISPLAY_VOLTAGE_LIMITS.span)
+//
+// SEGMENTED CAPTURE - a window around every trigger event, copied out of the ring.  see SegmentCapture.swift.
+//
 
-// grid line spacing constant.  This is essentially the minimum space between gridlines.
-let CONFIG_DISPLAY_TIME_GRID_CONSTANT:CGFloat = 80
-let CONFIG_DISPLAY_VOLTAGE_GRID_CONSTANT:CGFloat = 50
+// how much of each window comes before and after the trigger, and how many windows the pool holds before it starts
+// reusing the oldest.  (8 bytes a sample, so the defaults are 4096 x 1000 samples, about 33MB per capturing channel.)
+let CONFIG_SEGMENT_PRE_TRIGGER:Time = 0.002
+let CONFIG_SEGMENT_POST_TRIGGER:Time = 0.008
+let CONFIG_SEGMENT_COUNT:Int = 4096
 
-// channel view reading rate in FPS, and depth of the filter on those readings
-let CONFIG_DISPLAY_CHANNELVIEW_REFRESH_RATE:Double = 10
-let CONFIG_DISPLAY_CHANNELVIEW_FILTER_DEPTH:Int = 16
+//
+// AVERAGING - trigger-aligned windows averaged into a channel of their own.  see WaveformAverager.swift.
+//
+
+// how much of the window comes before and after the trigger, how many sweeps an average covers unless somebody says
+// otherwise, and how far (in samples) from an event's timestamp to look for its real crossing.
+let CONFIG_AVERAGING_PRE_TRIGGER:Time = 0.005
+let CONFIG_AVERAGING_POST_TRIGGER:Time = 0.005
+let CONFIG_AVERAGING_DEFAULT_COUNT:Int = 64
+let CONFIG_AVERAGING_ALIGNMENT_RADIUS:Int = 3
+
+//
+// PROTOCOL DECODING - UART, SPI and I2C off thresholded channels.  see ProtocolDecoder.swift.
+//
+
+// where the logic threshold starts out, and how wide its hysteresis band is.  (3.3V logic.)  and how many decoded items
+// each decoder keeps before it starts dropping the oldest.
+let CONFIG_PROTOCOL_DEFAULT_THRESHOLD:Voltage = 1.65
+let CONFIG_PROTOCOL_DEFAULT_HYSTERESIS:Voltage = 0.2
+let CONFIG_PROTOCOL_ITEM_CAPACITY:Int = 100000
+
+// how far the decoder's own channel can get ahead of one of its other lines (SPI data, I2C SDA...) before that line
+// counts as stopped, and the decoder says so instead of waiting on it quietly.
+let CONFIG_PROTOCOL_STALL_TIME:Time = 1.0
+
+//
+// SEARCH - edges, pulses, runts and such, anywhere in the history.  see WaveformSearch.swift and MinMaxSummary.swift.
+//
+
+// how many samples each summary entry covers, how many hits a search keeps, how much of the oldest end of the ring a
+// search leaves alone (the writer's about to overwrite it), and how wide the hysteresis band around every level is.
+let CONFIG_SEARCH_SUMMARY_CHUNK:Int = 256
+let CONFIG_SEARCH_MAX_HITS:Int = 10000
+let CONFIG_SEARCH_OLDEST_MARGIN:Time = 0.1
+let CONFIG_SEARCH_HYSTERESIS:Voltage = 0.05
+
+//
+// EXPORT - selections, the visible range or whole rings, to binary, WAV or CSV.  see Exporter.swift.
+//
+
+// how many frames go out per write, and how much of a full ring's oldest end an export leaves alone.
+let CONFIG_EXPORT_BLOCK_FRAMES:Int = 65536
+let CONFIG_EXPORT_OLDEST_MARGIN:Time = 0.1
+
+//
+// INSTRUMENTATION - only matters in builds with -DINSTRUMENTATION.  see Instrumentation.swift.
+//
+
+// how often the stage stats get logged (nil for never), and a file to write them to as JSON each time (nil for just the log).
+let CONFIG_INSTRUMENTATION_DUMP_INTERVAL:Double? = 30
+let CONFIG_INSTRUMENTATION_DUMP_FILE:String? = nil
+
+//
+// STREAM SERVER - fans live samples out to other processes over a Unix-domain socket.  see StreamServer.swift.
+//
+
+// whether the app runs a server at all (off unless you want it; the CLI has --serve either way), where its socket goes,
+// how many bytes of frames one subscriber can have waiting before its frames start getting dropped, and how often channel
+// telemetry goes out, in seconds.
+let CONFIG_STREAM_SERVER_ENABLED:Bool = false
+let CONFIG_STREAM_SERVER_SOCKET_PATH:String? = "/tmp/432scope.sock"
+let CONFIG_STREAM_SUBSCRIBER_QUEUE_BYTES:Int = 2097152
+let CONFIG_STREAM_TELEMETRY_INTERVAL:Double = 1.0
 
 //
 // I/O
 //
 
-// The UART baud rate
+// The UART baud rate.  both transceivers set it with c_set_custom_baud_rate (IOSSIOSPEED on the Mac, termios2 on linux),
+// so it can be anything the USB serial driver can do.
 let CONFIG_BAUDRATE:Int = 3000000
 
 // how many Bytes come through the UART per sample (this value is used to compute read lengths)
@@ -53,6 +125,16 @@ let CONFIG_SAMPLERATE:Int = 100000
 // the length of time to store in the sample buffers
 let CONFIG_BUFFER_LENGTH:Int = 10
 
+// deep history: set this to a directory and the sample buffers become memory-mapped files in there, CONFIG_DEEP_HISTORY_LENGTH seconds deep.
+// (2 bytes a sample, so an hour at 100kHz is about 720MB per channel.)  nil keeps them in RAM.
+// the files are one per device and start over every launch, so they're no good for keeping a session.  record for that.
+let CONFIG_DEEP_HISTORY_DIRECTORY:String? = nil
+let CONFIG_DEEP_HISTORY_LENGTH:Int = 3600
+
+// the recorder's chunk size in bytes (keep it a multiple of the page size), and how many chunks per channel can be waiting on the disk before we start dropping them.
+let CONFIG_RECORDER_CHUNK_SIZE:Int = 262144
+let CONFIG_RECORDER_MAX_CHUNKS_IN_FLIGHT:Int = 16
+
 // the range of voltages the analog front end can accept
 let CONFIG_AFE_VOLTAGE_RANGE = VoltageRange(min:-15.0, max:15.0)
 
@@ -67,16 +149,30 @@ let CONFIG_SAMPLE_MAX_VALUE:Sample = 16383 // 2^14-1
 
 let CONFIG_SAMPLEPERIOD:Time = 1.0/Time(CONFIG_SAMPLERATE)
 
+// ADC counts <-> volts
+let CONFIG_VOLTS_PER_SAMPLE:Voltage = (CONFIG_AFE_VOLTAGE_RANGE.span) / Voltage(CONFIG_SAMPLE_MAX_VALUE)
+let CONFIG_SAMPLES_PER_VOLT:Voltage = Voltage(CONFIG_SAMPLE_MAX_VALUE)/(CONFIG_AFE_VOLTAGE_RANGE.span)
+
+// how many seconds the sample buffers really hold
+let CONFIG_ACTIVE_BUFFER_LENGTH:Int = (CONFIG_DEEP_HISTORY_DIRECTORY == nil) ? CONFIG_BUFFER_LENGTH : CONFIG_DEEP_HISTORY_LENGTH
+
 let CONFIG_INCOMING_BYTES_PER_SECOND:Int = CONFIG_SAMPLERATE * CONFIG_INCOMING_SAMPLE_SIZE_IN_BYTES
 
-let CONFIG_INCOMING_BYTES_PER_DISPLAY_FRAME:Double = Double(CONFIG_INCOMING_BYTES_PER_SECOND)/CONFIG_DISPLAY_REFRESH_RATE
+// how many packets per second the decoder cuts the incoming stream into.  this used to be the display frame rate; it isn't tied to drawing anymore.
+let CONFIG_DECODER_PACKET_RATE:Double = 20
+
+let CONFIG_INCOMING_BYTES_PER_PACKET:Double = Double(CONFIG_INCOMING_BYTES_PER_SECOND)/CONFIG_DECODER_PACKET_RATE
 
 // The decoder packet size also in bytes.
-let CONFIG_DECODER_PACKET_SIZE:Int = roundDoubleUpToNearestIncomingSampleBoundary(CONFIG_INCOMING_BYTES_PER_DISPLAY_FRAME)
+let CONFIG_DECODER_PACKET_SIZE:Int = roundDoubleUpToNearestIncomingSampleBoundary(CONFIG_INCOMING_BYTES_PER_PACKET)
 
 // The POSIX termios.vmin minimum read length in bytes.  At high sample rates, most reads will be much bigger than this anyway.
 let CONFIG_POSIX_READ_LENGTH:UInt8 = UInt8(clampToRange(CONFIG_DECODER_PACKET_SIZE, min: 2, max: 254))
 
+// biggest single read() the linux backend does.  the tty layer buffers 64K or so before it starts dropping; one read
+// that can take all of it keeps the reader thread to a few calls per wakeup at full rate.
+let CONFIG_SERIAL_READ_SIZE:Int = 65536
+
 
 func roundDoubleUpToNearestIncomingSampleBoundary(value:Double) -> Int {
     let fractionNum = value / Double(CONFIG_INCOMING_SAMPLE_SIZE_IN_BYTES)
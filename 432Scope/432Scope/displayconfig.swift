@@ -0,0 +1,66 @@
+//
+//  displayconfig.swift
+//  432Scope
+//
+//  Created by Nicholas Cordle on 6/9/16.
+//
+//
+
+import Cocoa
+
+/*
+ The display settings.  These are the only settings that need Cocoa, so they're kept apart from config.swift, which the
+ headless build uses.
+*/
+
+//
+// DISPLAY
+//
+
+// The trace display (ScopeViewController) frame rate cap.  frames go out on vsync (see FrameScheduler), but no faster than this.
+let CONFIG_DISPLAY_REFRESH_RATE:Double = 60
+
+// Scope View grid colors
+let CONFIG_DISPLAY_SCOPEVIEW_BACKGROUND_COLOR = NSColor(calibratedWhite: 0.0, alpha: 1.0)
+let CONFIG_DISPLAY_SCOPEVIEW_GRIDLINE_COLOR = NSColor(calibratedWhite: 0.2, alpha: 1.0)
+let CONFIG_DISPLAY_SCOPEVIEW_GROUNDLINE_COLOR = NSColor(calibratedWhite: 1.0, alpha: 1.0)
+
+// scope view scrolling limits.  you can pan back as far as the sample buffers go.
+let CONFIG_DISPLAY_TIME_LIMITS = TimeRange(newest:0, oldest:Time(CONFIG_ACTIVE_BUFFER_LENGTH))
+let CONFIG_DISPLAY_VOLTAGE_LIMITS = VoltageRange(min:-20, max:20)
+
+// deep zoom: below one sample per column, traces are sin(x)/x interpolated from this many samples either side of each
+// point (see SincInterpolator.swift), with the kernel tabulated at this many fractions of a sample period.  false draws
+// the raw samples, as steps.
+let CONFIG_DISPLAY_SINC_INTERPOLATION:Bool = true
+let CONFIG_DISPLAY_SINC_HALF_WIDTH:Int = 8
+let CONFIG_DISPLAY_SINC_PHASES:Int = 256
+
+// scope view zooming limits
+// (with deep history you can pan back hours, but a frame still only minmaxes up to CONFIG_BUFFER_LENGTH seconds of it.)
+// (with interpolation on, you can zoom in until there are only a couple dozen samples across the view.)
+let CONFIG_DISPLAY_TIME_SPAN_LIMITS:(min:Time, max:Time) = (CONFIG_DISPLAY_SINC_INTERPOLATION ? Time(24) * CONFIG_SAMPLEPERIOD : 0.001, min(CONFIG_DISPLAY_TIME_LIMITS.span, Time(CONFIG_BUFFER_LENGTH)))
+let CONFIG_DISPLAY_VOLTAGE_SPAN_LIMITS:(min:Voltage, max:Voltage) = (0.1, CONFIG_DISPLAY_VOLTAGE_LIMITS.span)
+
+// grid line spacing constant.  This is essentially the minimum space between gridlines.
+let CONFIG_DISPLAY_TIME_GRID_CONSTANT:CGFloat = 80
+let CONFIG_DISPLAY_VOLTAGE_GRID_CONSTANT:CGFloat = 50
+
+// persistence (digital phosphor) mode: how much intensity survives each frame, and the most trigger events to fold in per
+// frame.  any more than that wait for the frames after.
+let CONFIG_DISPLAY_PHOSPHOR_DEFAULT_DECAY:Float = 0.9
+let CONFIG_DISPLAY_PHOSPHOR_MAX_EVENTS_PER_FRAME:Int = 2000
+
+// protocol decoder annotations: the most to draw per channel per frame, and how tall each channel's row of them is.
+let CONFIG_DISPLAY_PROTOCOL_MAX_ANNOTATIONS:Int = 400
+let CONFIG_DISPLAY_PROTOCOL_ROW_HEIGHT:CGFloat = 16
+
+// spectrum analyzer: the width of its view when it's showing, and the dBV range it shows.
+let CONFIG_DISPLAY_SPECTRUM_WIDTH:CGFloat = 320
+let CONFIG_DISPLAY_SPECTRUM_DB_RANGE:(min:Float, max:Float) = (-120, 20)
+
+// channel view reading rate in FPS.  this is just how often the labels get redrawn; the measurements themselves cover every sample.
+let CONFIG_DISPLAY_CHANNELVIEW_REFRESH_RATE:Double = 10
+
+// math channels: how many minmax columns each one remembers.  a few screens' worth; past that the oldest go first.
+let CONFIG_MATH_COLUMN_CACHE_SIZE:Int = 8192
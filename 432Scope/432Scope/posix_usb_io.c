@@ -11,8 +11,23 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <errno.h>
 #include <sys/ioctl.h>
+#ifdef __APPLE__
 #include <IOKit/serial/ioss.h> // for the non-trad baud rates
+#endif
+#ifndef __linux__
+#include <termios.h>
+#endif
+#ifdef __linux__
+// termios2 lives in the kernel headers, and they can't share a file with <termios.h>.  this file doesn't need it.
+#include <asm/termbits.h>
+#include <linux/serial.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
 
 // AAAAH this is nasty but whatever.
 int c_get_posix_file_descriptor( const char* filename ) {
@@ -24,7 +39,207 @@ int c_close_posix_file_descriptor( int fd ) {
     return close( fd );
 }
 
-int c_ioctl_set_crazy_baud_rate( int fd ) {
-    speed_t nonstandard_baud_rate = 3000000;
+int c_set_read_minimum( int fd, unsigned char vmin, unsigned char vtime ) {
+#ifdef __linux__
+    // the kernel's termios, which is what tcsetattr hands over anyway.
+    struct termios tio;
+    if ( ioctl( fd, TCGETS, &tio ) == -1 ) {
+        return -1;
+    }
+    tio.c_cc[VMIN] = vmin;
+    tio.c_cc[VTIME] = vtime;
+    return ioctl( fd, TCSETS, &tio );
+#else
+    struct termios tio;
+    if ( tcgetattr( fd, &tio ) == -1 ) {
+        return -1;
+    }
+    tio.c_cc[VMIN] = vmin;
+    tio.c_cc[VTIME] = vtime;
+    return tcsetattr( fd, TCSANOW, &tio );
+#endif
+}
+
+int c_set_custom_baud_rate( int fd, unsigned int baud_rate ) {
+#if defined(__APPLE__)
+    speed_t nonstandard_baud_rate = baud_rate;
     return ioctl( fd, IOSSIOSPEED, &nonstandard_baud_rate );
-}
\ No newline at end of file
+#elif defined(__linux__)
+    // BOTHER means "the speed is the number in c_ispeed / c_ospeed", not one of the Bxxx table entries.
+    // everything else in the settings stays however tcsetattr left it.
+    struct termios2 tio;
+    if ( ioctl( fd, TCGETS2, &tio ) == -1 ) {
+        return -1;
+    }
+    tio.c_cflag &= ~CBAUD;
+    tio.c_cflag |= BOTHER;
+    tio.c_ispeed = baud_rate;
+    tio.c_ospeed = baud_rate;
+    return ioctl( fd, TCSETS2, &tio );
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+int c_set_low_latency( int fd ) {
+#ifdef __linux__
+    // plenty of USB serial drivers don't do TIOCSSERIAL at all.  that's the caller's call.
+    struct serial_struct serial;
+    if ( ioctl( fd, TIOCGSERIAL, &serial ) == -1 ) {
+        return -1;
+    }
+    serial.flags |= ASYNC_LOW_LATENCY;
+    return ioctl( fd, TIOCSSERIAL, &serial );
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+//
+// THE EPOLL READER
+//
+
+#ifdef __linux__
+
+struct c_serial_reader {
+    int fd;
+    int epoll_fd;
+    int wake_fd;     // an eventfd.  writing to it is how stop gets the thread out of epoll_wait
+    long read_size;
+    unsigned char* bytes;
+    c_serial_read_callback callback;
+    c_serial_reader_exit_callback exit_callback;
+    void* context;
+    pthread_t thread;
+};
+
+// the thread giving up on its own.  the caller finds out, since nothing's coming in any more.
+static void* c_serial_reader_exit( c_serial_reader* reader, int error ) {
+    reader->exit_callback( reader->context, error );
+    return NULL;
+}
+
+static void* c_serial_reader_thread( void* argument ) {
+    c_serial_reader* reader = (c_serial_reader*)argument;
+    struct epoll_event events[2];
+    int read_error = 0;
+    for (;;) {
+        int ready = epoll_wait( reader->epoll_fd, events, 2, -1 );
+        if ( ready == -1 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            return c_serial_reader_exit( reader, errno );
+        }
+        for ( int i = 0; i < ready; i++ ) {
+            if ( events[i].data.fd == reader->wake_fd ) {
+                return NULL;
+            }
+        }
+        // drain it.  each read takes as much as the tty has, up to read_size, so at full rate it's a few big reads
+        // per wakeup rather than lots of small ones.
+        for (;;) {
+            ssize_t count = read( reader->fd, reader->bytes, reader->read_size );
+            if ( count > 0 ) {
+                reader->callback( reader->context, reader->bytes, (long)count );
+                continue;
+            }
+            if ( count == -1 && errno == EINTR ) {
+                continue;
+            }
+            // EAGAIN is the usual way out.  anything else (the device went away) shows up as a hangup next time round,
+            // and the read's errno is the better thing to report then.
+            if ( count == -1 && errno != EAGAIN && errno != EWOULDBLOCK ) {
+                read_error = errno;
+            }
+            break;
+        }
+        for ( int i = 0; i < ready; i++ ) {
+            if ( events[i].data.fd == reader->fd && (events[i].events & (EPOLLHUP | EPOLLERR)) ) {
+                return c_serial_reader_exit( reader, (read_error != 0) ? read_error : EIO );
+            }
+        }
+    }
+}
+
+c_serial_reader* c_serial_reader_start( int fd, long read_size, c_serial_read_callback callback, c_serial_reader_exit_callback exit_callback, void* context ) {
+    c_serial_reader* reader = calloc( 1, sizeof(c_serial_reader) );
+    if ( reader == NULL ) {
+        return NULL;
+    }
+    reader->fd = fd;
+    reader->read_size = read_size;
+    reader->callback = callback;
+    reader->exit_callback = exit_callback;
+    reader->context = context;
+    reader->epoll_fd = -1;
+    reader->wake_fd = -1;
+    reader->bytes = malloc( read_size );
+    if ( reader->bytes == NULL ) {
+        goto fail;
+    }
+    reader->epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+    reader->wake_fd = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+    if ( reader->epoll_fd == -1 || reader->wake_fd == -1 ) {
+        goto fail;
+    }
+    struct epoll_event event = { 0 };
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if ( epoll_ctl( reader->epoll_fd, EPOLL_CTL_ADD, fd, &event ) == -1 ) {
+        goto fail;
+    }
+    event.data.fd = reader->wake_fd;
+    if ( epoll_ctl( reader->epoll_fd, EPOLL_CTL_ADD, reader->wake_fd, &event ) == -1 ) {
+        goto fail;
+    }
+    int failure = pthread_create( &reader->thread, NULL, c_serial_reader_thread, reader );
+    if ( failure != 0 ) {
+        errno = failure;
+        goto fail;
+    }
+    return reader;
+    
+fail:
+    {
+        int saved_errno = errno;
+        if ( reader->epoll_fd != -1 ) {
+            close( reader->epoll_fd );
+        }
+        if ( reader->wake_fd != -1 ) {
+            close( reader->wake_fd );
+        }
+        free( reader->bytes );
+        free( reader );
+        errno = saved_errno;
+    }
+    return NULL;
+}
+
+void c_serial_reader_stop( c_serial_reader* reader ) {
+    if ( reader == NULL ) {
+        return;
+    }
+    uint64_t one = 1;
+    while ( write( reader->wake_fd, &one, sizeof(one) ) == -1 && errno == EINTR ) {
+    }
+    pthread_join( reader->thread, NULL );
+    close( reader->epoll_fd );
+    close( reader->wake_fd );
+    free( reader->bytes );
+    free( reader );
+}
+
+#else
+
+c_serial_reader* c_serial_reader_start( int fd, long read_size, c_serial_read_callback callback, c_serial_reader_exit_callback exit_callback, void* context ) {
+    errno = ENOTSUP;
+    return NULL;
+}
+
+void c_serial_reader_stop( c_serial_reader* reader ) {
+}
+
+#endif
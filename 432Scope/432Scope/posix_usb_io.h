@@ -12,6 +12,8 @@
 #include <stdio.h>
 #include <sys/param.h>
 
+// the IOKit stuff is only for finding devices (USBDevice), which is the app's job.  the serial I/O below is plain POSIX.
+#ifdef __APPLE__
 #include <CoreFoundation/CoreFoundation.h>
 #include <IOKit/usb/IOUSBLib.h>
 #include <IOKit/IOKitLib.h>
@@ -21,10 +23,23 @@
 
 #include <IOKit/serial/IOSerialKeys.h>
 #include <CoreFoundation/CFDictionary.h>
+#endif
 
 // swift apparently can't do these yet, so we have to do them here in C.
 int c_get_posix_file_descriptor( const char* filename );
 int c_close_posix_file_descriptor( int fd );
-int c_ioctl_set_crazy_baud_rate( int fd );
+int c_set_read_minimum( int fd, unsigned char vmin, unsigned char vtime ); // VMIN and VTIME.  where they sit in c_cc isn't the same everywhere
+int c_set_custom_baud_rate( int fd, unsigned int baud_rate ); // any rate the driver can do: IOSSIOSPEED on macOS, termios2 BOTHER on linux.  -1 with errno = ENOTSUP elsewhere
+int c_set_low_latency( int fd ); // ASYNC_LOW_LATENCY on linux, so the driver pushes bytes up right away.  ENOTSUP elsewhere
+
+// linux only: a thread that epolls the descriptor and does big read()s, calling back with whatever each one got.
+// the callbacks run on that thread.  the descriptor should be O_NONBLOCK.  NULL with errno = ENOTSUP elsewhere.
+// if the thread stops by itself (the device hung up or errored, or epoll_wait failed), exit_callback gets the errno,
+// once, as the thread's last act.  stopping it with c_serial_reader_stop doesn't call it.
+typedef void (*c_serial_read_callback)( void* context, const unsigned char* bytes, long count );
+typedef void (*c_serial_reader_exit_callback)( void* context, int error );
+typedef struct c_serial_reader c_serial_reader;
+c_serial_reader* c_serial_reader_start( int fd, long read_size, c_serial_read_callback callback, c_serial_reader_exit_callback exit_callback, void* context );
+void c_serial_reader_stop( c_serial_reader* reader ); // waits for the thread, so no callbacks after this returns
  
 #endif /* posix_usb_io_h */
@@ -0,0 +1,262 @@
+//
+//  BenchmarkSupport.swift
+//  432ScopeTests
+//
+//  Created by Nicholas Cordle on 6/11/16.
+//
+//
+
+import Foundation
+import XCTest
+@testable import _32Scope
+
+/*
+ The plumbing for PipelineBenchmarks.
+ 
+ -SyntheticSignal makes repeatable sample streams (sine, square, noise, ramp) straight into a pointer, or as wire-format packets for the Decoder.
+ -Benchmark.run times a closure: a couple of warmup runs, then a bunch of timed ones.  the median is what counts, so one
+  unlucky run (page faults, another process) doesn't make a regression out of nothing.
+ -BenchmarkResults collects everything into one JSON file, and checks each result against a baseline file as it goes.
+ 
+ ENVIRONMENT (set these in the test scheme, or on the xcodebuild command line):
+ -BENCHMARK_OUTPUT      where the results go.  default: 432scope-benchmarks.json in the temporary directory.
+ -BENCHMARK_BASELINE    a results file from an earlier run.  any benchmark more than the tolerance slower than it fails.
+                        to take a new baseline, copy an output file over the old one.
+ -BENCHMARK_TOLERANCE   how much slower is too slow, as a fraction.  default 0.15.
+ 
+ Timings from an unoptimized build aren't comparable with optimized ones, so the file records which it was, and the
+ comparison is skipped (with a note) if the baseline's different.
+*/
+
+//
+// SYNTHETIC SIGNALS
+//
+
+struct SyntheticSignal {
+    
+    enum Shape {
+        case Sine(period:Double)    // periods in samples
+        case Square(period:Int)
+        case Noise(seed:UInt32)
+        case Ramp(period:Int)
+    }
+    
+    let shape:Shape
+    var amplitude:Voltage = 10.0 // peak, around 0V
+    private var position:Int = 0
+    private var noiseState:UInt32 = 1
+    
+    init( shape:Shape, amplitude:Voltage = 10.0 ) {
+        self.shape = shape
+        self.amplitude = amplitude
+        if case .Noise(let seed) = shape {
+            noiseState = max(seed, 1)
+        }
+    }
+    
+    // the next count samples of the signal.  picks up where the last call left off.
+    mutating func fill( destination:UnsafeMutablePointer<Sample>, count:Int ) {
+        let middle = Voltage(0.0).asSample()
+        let swing = Double(amplitude.asSampleDiff())
+        for i in 0..<count {
+            let n = position + i
+            var value:Double
+            switch (shape) {
+            case .Sine(let period):
+                value = sin(2.0 * M_PI * Double(n) / period)
+            case .Square(let period):
+                value = (n % period) < period / 2 ? 1.0 : -1.0
+            case .Noise:
+                // xorshift, so every run gets the same "noise".
+                noiseState ^= noiseState << 13
+                noiseState ^= noiseState >> 17
+                noiseState ^= noiseState << 5
+                value = Double(noiseState) / Double(UInt32.max) * 2.0 - 1.0
+            case .Ramp(let period):
+                value = Double(n % period) / Double(period) * 2.0 - 1.0
+            }
+            destination[i] = Swift.max(0, Swift.min(CONFIG_SAMPLE_MAX_VALUE, middle + Int(value * swing)))
+        }
+        position += count
+    }
+    
+    // packets just like the Transceiver hands the Decoder: 16 bits a sample, CONFIG_DECODER_PACKET_SIZE bytes.
+    mutating func packets( count:Int ) -> [NSData] {
+        let samplesPerPacket = CONFIG_DECODER_PACKET_SIZE / CONFIG_INCOMING_SAMPLE_SIZE_IN_BYTES
+        let block = UnsafeMutablePointer<Sample>.alloc(samplesPerPacket)
+        let raw = UnsafeMutablePointer<UInt16>.alloc(samplesPerPacket)
+        var rval:[NSData] = []
+        for _ in 0..<count {
+            fill(block, count: samplesPerPacket)
+            for i in 0..<samplesPerPacket {
+                raw[i] = UInt16(truncatingBitPattern: block[i])
+            }
+            rval.append(NSData(bytes: raw, length: samplesPerPacket * sizeof(UInt16)))
+        }
+        block.dealloc(samplesPerPacket)
+        raw.dealloc(samplesPerPacket)
+        return rval
+    }
+}
+
+// somewhere for trigger events to go.
+class CountingTriggerListener: TriggerNotifications {
+    var eventCount:Int = 0
+    func triggerEventDetected( event:TriggerEvent ) {
+        eventCount += 1
+    }
+}
+
+//
+// TIMING
+//
+
+struct BenchmarkResult {
+    let name:String
+    let unit:String             // what one unit of work is: "sample", "column", "event" ...
+    let unitsPerIteration:Int
+    let iterations:Int
+    let medianSeconds:Double
+    let minSeconds:Double
+    
+    var nanosecondsPerUnit:Double {
+        return medianSeconds * 1e9 / Double(unitsPerIteration)
+    }
+    
+    var unitsPerSecond:Double {
+        return Double(unitsPerIteration) / medianSeconds
+    }
+    
+    var asDictionary:[String:AnyObject] {
+        return [
+            "unit": unit,
+            "unitsPerIteration": unitsPerIteration,
+            "iterations": iterations,
+            "medianSeconds": medianSeconds,
+            "minSeconds": minSeconds,
+            "nanosecondsPerUnit": nanosecondsPerUnit,
+            "unitsPerSecond": unitsPerSecond,
+        ]
+    }
+}
+
+class Benchmark {
+    
+    private static var timebase:mach_timebase_info_data_t = {
+        var info = mach_timebase_info_data_t()
+        mach_timebase_info(&info)
+        return info
+    }()
+    
+    class func now() -> Double {
+        return Double(mach_absolute_time()) * Double(timebase.numer) / Double(timebase.denom) / 1e9
+    }
+    
+    // setup runs before every iteration, untimed.  body is what gets timed.
+    class func run( name:String, unit:String, unitsPerIteration:Int, iterations:Int = 10, warmup:Int = 2, setup:(() -> ())? = nil, body:() -> () ) -> BenchmarkResult {
+        for _ in 0..<warmup {
+            setup?()
+            body()
+        }
+        var times:[Double] = []
+        for _ in 0..<iterations {
+            setup?()
+            let start = now()
+            body()
+            times.append(now() - start)
+        }
+        times.sortInPlace()
+        return BenchmarkResult(name: name, unit: unit, unitsPerIteration: unitsPerIteration, iterations: iterations,
+                               medianSeconds: times[times.count / 2], minSeconds: times[0])
+    }
+}
+
+//
+// RESULTS AND BASELINES
+//
+
+class BenchmarkResults {
+    
+    static let shared = BenchmarkResults()
+    static let formatVersion = 1
+    
+    private(set) var results:[BenchmarkResult] = []
+    private var baseline:[String:AnyObject]? = nil
+    private var baselineIsComparable:Bool = false
+    let tolerance:Double
+    
+    let isOptimized:Bool = !_isDebugAssertConfiguration()
+    
+    private var environment:[String:String] {
+        return NSProcessInfo.processInfo().environment
+    }
+    
+    var outputURL:NSURL {
+        if let path = environment["BENCHMARK_OUTPUT"] {
+            return NSURL(fileURLWithPath: path)
+        }
+        return NSURL(fileURLWithPath: NSTemporaryDirectory()).URLByAppendingPathComponent("432scope-benchmarks.json")
+    }
+    
+    init() {
+        tolerance = Double(NSProcessInfo.processInfo().environment["BENCHMARK_TOLERANCE"] ?? "") ?? 0.15
+        
+        guard let path = NSProcessInfo.processInfo().environment["BENCHMARK_BASELINE"] else {
+            return
+        }
+        guard let data = NSData(contentsOfFile: path),
+            let json = try? NSJSONSerialization.JSONObjectWithData(data, options: []),
+            let file = json as? [String:AnyObject],
+            let baselineResults = file["results"] as? [String:AnyObject] else {
+            print("----BenchmarkResults: couldn't read a baseline from \(path).  not comparing.")
+            return
+        }
+        baseline = baselineResults
+        baselineIsComparable = (file["optimized"] as? Bool) == isOptimized
+        if ( !baselineIsComparable ) {
+            print("----BenchmarkResults: the baseline in \(path) is from a build with different optimization.  not comparing.")
+        }
+    }
+    
+    // keeps the result, and fails the test if it's regressed past the tolerance.
+    func record( result:BenchmarkResult, testCase:XCTestCase ) {
+        results.append(result)
+        print(String(format: "----benchmark %@: %.2f ns/%@ (%.3g %@/s)", result.name, result.nanosecondsPerUnit, result.unit, result.unitsPerSecond, result.unit))
+        
+        guard baselineIsComparable,
+            let entry = baseline?[result.name] as? [String:AnyObject],
+            let baselineNanoseconds = entry["nanosecondsPerUnit"] as? Double else {
+            return
+        }
+        let ratio = result.nanosecondsPerUnit / baselineNanoseconds
+        if ( ratio > 1.0 + tolerance ) {
+            testCase.recordFailureWithDescription(String(format: "%@ regressed: %.2f ns/%@, baseline %.2f (%.0f%% slower, tolerance %.0f%%)",
+                result.name, result.nanosecondsPerUnit, result.unit, baselineNanoseconds, (ratio - 1.0) * 100, tolerance * 100),
+                inFile: #file, atLine: #line, expected: true)
+        }
+    }
+    
+    // one file for the whole run.  written after every class of benchmarks finishes, so a crash partway still leaves something.
+    func write() {
+        var resultDictionary:[String:AnyObject] = [:]
+        for result in results {
+            resultDictionary[result.name] = result.asDictionary
+        }
+        let file:[String:AnyObject] = [
+            "format": BenchmarkResults.formatVersion,
+            "date": NSDate().description,
+            "host": NSProcessInfo.processInfo().hostName,
+            "optimized": isOptimized,
+            "sampleRate": CONFIG_SAMPLERATE,
+            "decoderPacketSize": CONFIG_DECODER_PACKET_SIZE,
+            "results": resultDictionary,
+        ]
+        do {
+            let data = try NSJSONSerialization.dataWithJSONObject(file, options: .PrettyPrinted)
+            try data.writeToURL(outputURL, options: .DataWritingAtomic)
+            print("----BenchmarkResults: \(results.count) results written to \(outputURL.path!)")
+        } catch let msg {
+            print("----BenchmarkResults: couldn't write \(outputURL.path!): \(msg)")
+        }
+    }
+}
@@ -0,0 +1,68 @@
+//
+//  DecimatorTests.swift
+//  432ScopeTests
+//
+//  Created by Nicholas Cordle on 6/14/16.
+//
+//
+
+import XCTest
+@testable import _32Scope
+
+/*
+ The decimator's FIR filter rings past a step.  a rail-to-rail step would ring past the rails, so its outputs have to
+ be saturated to the ADC's range, through the filter and through the whole stage into the decimated buffer.
+*/
+
+class DecimatorTests: XCTestCase {
+    
+    let top = CONFIG_SAMPLE_MAX_VALUE
+    
+    // rail to rail and back, halfPeriod samples at each.
+    private func steps( count:Int, halfPeriod:Int ) -> [Sample] {
+        return (0..<count).map({ ($0 / halfPeriod) % 2 == 0 ? 0 : self.top })
+    }
+    
+    func testFilterOutputStaysInRange() {
+        let blockSize = 4000
+        let filter = FIRFilter(factor: CONFIG_DECIMATION_FACTOR, tapsPerPhase: CONFIG_DECIMATION_TAPS_PER_PHASE, cutoff: CONFIG_DECIMATION_CUTOFF, maxBlockSize: blockSize)
+        let output = UnsafeMutablePointer<Sample>.alloc(blockSize / filter.factor + 1)
+        defer {
+            output.dealloc(blockSize / filter.factor + 1)
+        }
+        var outputs:[Sample] = []
+        let input = steps(blockSize * 3, halfPeriod: 500)
+        for b in 0..<3 {
+            input.withUnsafeBufferPointer({ samples in
+                let count = filter.process(UnsafeBufferPointer<Sample>(start: samples.baseAddress + b * blockSize, count: blockSize), output: output)
+                outputs += UnsafeBufferPointer<Sample>(start: output, count: count)
+            })
+        }
+        XCTAssertFalse(outputs.isEmpty)
+        XCTAssertTrue(outputs.filter({ $0 < 0 || $0 > self.top }).isEmpty)
+        // it settles on both rails between steps, so they both turn up.
+        XCTAssertEqual(outputs.minElement(), 0)
+        XCTAssertEqual(outputs.maxElement(), top)
+    }
+    
+    func testDecimatedBufferStaysInRange() {
+        let buffer = SampleBuffer(capacity: 100000, clearValue: 0)
+        let decimator = Decimator(sampleBuffer: buffer, factor: CONFIG_DECIMATION_FACTOR, tapsPerPhase: CONFIG_DECIMATION_TAPS_PER_PHASE, cutoff: CONFIG_DECIMATION_CUTOFF)
+        buffer.addReader(decimator)
+        let input = steps(20000, halfPeriod: 700)
+        input.withUnsafeBufferPointer({ buffer.storeNewSamples($0) })
+        
+        // wait for the stage to get through everything.
+        decimator.syncWithReader({})
+        buffer.removeReader(decimator)
+        
+        let decimated = decimator.decimatedBuffer
+        let count = Int(decimated.committedSampleCount)
+        XCTAssertEqual(count, input.count / decimator.factor)
+        var outputs = [Sample](count: count, repeatedValue: -1)
+        decimated.copySamples(0, count: count, destination: &outputs)
+        XCTAssertTrue(outputs.filter({ $0 < 0 || $0 > self.top }).isEmpty)
+        XCTAssertEqual(outputs.minElement(), 0)
+        XCTAssertEqual(outputs.maxElement(), top)
+    }
+}
@@ -0,0 +1,68 @@
+//
+//  MathExpressionTests.swift
+//  432ScopeTests
+//
+//  Created by Nicholas Cordle on 6/14/16.
+//
+//
+
+import XCTest
+@testable import _32Scope
+
+/*
+ MathExpression.parse on the constants: plain, with exponents, and with signed exponents, which is where the number
+ scanner has to tell the exponent's sign from a minus sign between two terms.
+*/
+
+class MathExpressionTests: XCTestCase {
+    
+    // channels with nothing behind them.  parsing only cares how many there are.
+    let inputs = [Channel(), Channel()]
+    
+    // the gain and offset of a constant*A + constant expression.
+    private func scaling( text:String ) -> (gain:Double, offset:Voltage)? {
+        guard let expression = try? MathExpression.parse(text, inputs: inputs) else {
+            return nil
+        }
+        switch (expression) {
+        case .Scaled(.Scaled(.Input(_), let gain, _), let outerGain, let offset):
+            return (gain: gain * outerGain, offset: offset)
+        case .Scaled(.Input(_), let gain, let offset):
+            return (gain: gain, offset: offset)
+        default:
+            return nil
+        }
+    }
+    
+    func testPlainNumbers() {
+        XCTAssertEqual(scaling("2*A")?.gain, 2)
+        XCTAssertEqual(scaling("0.5*A")?.gain, 0.5)
+        XCTAssertEqual(scaling("1e3*A")?.gain, 1000)
+        XCTAssertEqual(scaling("A + 0.25")?.offset, 0.25)
+    }
+    
+    func testSignedExponents() {
+        XCTAssertEqual(scaling("1e-3*A")?.gain, 1e-3)
+        XCTAssertEqual(scaling("2.5E+6*A")?.gain, 2.5e6)
+        XCTAssertEqual(scaling("A*4E-2")?.gain, 4e-2)
+        XCTAssertEqual(scaling("A + 1.5e+1")?.offset, 15)
+        // the exponent's minus, then a real one.
+        XCTAssertEqual(scaling("A - 2e-1")?.offset, -0.2)
+        XCTAssertEqual(scaling("1e+2*A - 5")?.gain, 100)
+        XCTAssertEqual(scaling("1e+2*A - 5")?.offset, -5)
+    }
+    
+    func testSignOnlyAfterTheExponent() {
+        // a minus after the digits is a subtraction, not part of the number.
+        guard let expression = try? MathExpression.parse("3-A", inputs: inputs), case .Scaled(.Input(_), let gain, let offset) = expression else {
+            XCTFail("3-A didn't parse as -A + 3")
+            return
+        }
+        XCTAssertEqual(gain, -1)
+        XCTAssertEqual(offset, 3)
+        
+        // an exponent with nothing after it still isn't a number.
+        XCTAssertNil(try? MathExpression.parse("1e-*A", inputs: inputs))
+        XCTAssertNil(try? MathExpression.parse("2e+", inputs: inputs))
+    }
+}
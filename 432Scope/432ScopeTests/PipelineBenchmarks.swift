@@ -0,0 +1,211 @@
+//
+//  PipelineBenchmarks.swift
+//  432ScopeTests
+//
+//  Created by Nicholas Cordle on 6/11/16.
+//
+//
+
+import XCTest
+@testable import _32Scope
+
+/*
+ How fast the acquisition and drawing paths go, on synthetic signals.  See BenchmarkSupport.swift for the results file and baselines.
+ 
+ -ingestion: the Decoder, and the sample buffer's one-at-a-time and block writes.
+ -drawing: the minmax reductions the scope view runs every frame, at a few zoom levels and view widths.
+ -triggers: per-sample cost on an ordinary signal, and the timestamp bookkeeping when events come thick and fast.
+ 
+ Everything here runs on buffers with no readers attached, so it's the cost of the code itself, not of waking up queues.
+ Run these from a Release build (edit the scheme's test action) for numbers that mean anything.
+*/
+
+class PipelineBenchmarks: XCTestCase {
+    
+    let bufferCapacity = CONFIG_SAMPLERATE * CONFIG_BUFFER_LENGTH
+    
+    override class func tearDown() {
+        BenchmarkResults.shared.write()
+        super.tearDown()
+    }
+    
+    private func record( result:BenchmarkResult ) {
+        BenchmarkResults.shared.record(result, testCase: self)
+    }
+    
+    // a buffer that's been filled all the way around once, so reads see real data everywhere.
+    private func filledBuffer( signal:SyntheticSignal.Shape ) -> SampleBuffer {
+        let buffer = SampleBuffer(capacity: bufferCapacity, clearValue: Voltage(0.0).asSample())
+        var generator = SyntheticSignal(shape: signal)
+        let blockSize = 8192
+        let block = UnsafeMutablePointer<Sample>.alloc(blockSize)
+        var written = 0
+        while ( written < bufferCapacity ) {
+            let count = min(blockSize, bufferCapacity - written)
+            generator.fill(block, count: count)
+            buffer.storeNewSamples(UnsafeBufferPointer<Sample>(start: block, count: count))
+            written += count
+        }
+        block.dealloc(blockSize)
+        return buffer
+    }
+    
+    //
+    // INGESTION
+    //
+    
+    func testDecoderThroughput() {
+        let buffer = SampleBuffer(capacity: bufferCapacity, clearValue: Voltage(0.0).asSample())
+        let decoder = Decoder(sampleBuffer: buffer)
+        var generator = SyntheticSignal(shape: .Noise(seed: 432))
+        let packets = generator.packets(200)
+        let samplesPerPacket = CONFIG_DECODER_PACKET_SIZE / CONFIG_INCOMING_SAMPLE_SIZE_IN_BYTES
+        
+        record(Benchmark.run("decoder.newPacketArrived", unit: "sample", unitsPerIteration: packets.count * samplesPerPacket, body: {
+            for packet in packets {
+                decoder.newPacketArrived(packet)
+            }
+        }))
+        XCTAssertEqual(buffer.committedSampleCount, UInt(12 * packets.count * samplesPerPacket))
+    }
+    
+    func testSampleBufferSingleSampleWrites() {
+        let buffer = SampleBuffer(capacity: bufferCapacity, clearValue: Voltage(0.0).asSample())
+        let count = 100000
+        let samples = UnsafeMutablePointer<Sample>.alloc(count)
+        var generator = SyntheticSignal(shape: .Sine(period: 100))
+        generator.fill(samples, count: count)
+        
+        record(Benchmark.run("sampleBuffer.storeNewSample", unit: "sample", unitsPerIteration: count, body: {
+            for i in 0..<count {
+                buffer.storeNewSample(samples[i])
+            }
+        }))
+        samples.dealloc(count)
+    }
+    
+    func testSampleBufferBlockWrites() {
+        let buffer = SampleBuffer(capacity: bufferCapacity, clearValue: Voltage(0.0).asSample())
+        let blockSize = CONFIG_DECODER_PACKET_SIZE / CONFIG_INCOMING_SAMPLE_SIZE_IN_BYTES
+        let blockCount = 200
+        let samples = UnsafeMutablePointer<Sample>.alloc(blockSize * blockCount)
+        var generator = SyntheticSignal(shape: .Sine(period: 100))
+        generator.fill(samples, count: blockSize * blockCount)
+        
+        record(Benchmark.run("sampleBuffer.storeNewSamples", unit: "sample", unitsPerIteration: blockSize * blockCount, body: {
+            for b in 0..<blockCount {
+                buffer.storeNewSamples(UnsafeBufferPointer<Sample>(start: samples + b * blockSize, count: blockSize))
+            }
+        }))
+        samples.dealloc(blockSize * blockCount)
+    }
+    
+    //
+    // DRAWING REDUCTIONS
+    //
+    
+    // visible spans from very zoomed in (less than a sample a column at the wide widths) to the whole buffer.
+    let zoomSpans:[Time] = [0.002, 0.05, 1.0, Time(CONFIG_BUFFER_LENGTH) - 0.01]
+    let viewWidths:[Int] = [400, 1600]
+    
+    func testSubRangeMinMaxes() {
+        let buffer = filledBuffer(.Noise(seed: 1))
+        for span in zoomSpans {
+            for width in viewWidths {
+                let timeRange = TimeRange(newest: 0, span: span)
+                let name = String(format: "sampleBuffer.getSubRangeMinMaxes.%gs.%dpx", Double(span), width)
+                record(Benchmark.run(name, unit: "column", unitsPerIteration: width, body: {
+                    let minmaxes = buffer.getSubRangeMinMaxes(timeRange, howManySubranges: width)
+                    XCTAssertEqual(minmaxes.count, width)
+                }))
+            }
+        }
+    }
+    
+    func testColumnMinMaxes() {
+        let buffer = filledBuffer(.Noise(seed: 2))
+        let newestSampleIndex = Int(buffer.committedSampleCount) - 1
+        for span in zoomSpans {
+            for width in viewWidths {
+                let samplesPerColumn = Double(span.asSampleIndex()) / Double(width)
+                let name = String(format: "sampleBuffer.getColumnMinMaxes.%gs.%dpx", Double(span), width)
+                record(Benchmark.run(name, unit: "column", unitsPerIteration: width, body: {
+                    let minmaxes = buffer.getColumnMinMaxes(newestSampleIndex, samplesPerColumn: samplesPerColumn, columnCount: width)
+                    XCTAssertEqual(minmaxes.count, width)
+                }))
+            }
+        }
+    }
+    
+    //
+    // TRIGGERS
+    //
+    
+    func testRisingEdgeTriggerPerSample() {
+        let count = 500000
+        let samples = UnsafeMutablePointer<Sample>.alloc(count)
+        var generator = SyntheticSignal(shape: .Sine(period: 1000)) // a 100 Hz sine: the usual case, an event every now and then
+        generator.fill(samples, count: count)
+        let listener = CountingTriggerListener()
+        var trigger:RisingEdgeTrigger! = nil
+        
+        record(Benchmark.run("risingEdgeTrigger.processSample", unit: "sample", unitsPerIteration: count, setup: {
+            trigger = RisingEdgeTrigger(triggerLevel: 0.0, autoLevel: false, filterDepth: 4, notifications: listener)
+        }, body: {
+            for i in 0..<count {
+                trigger.processSample(samples[i])
+            }
+        }))
+        XCTAssertGreaterThan(listener.eventCount, 0)
+        samples.dealloc(count)
+    }
+    
+    func testEdgeTriggerBlocks() {
+        let count = 500000
+        let samples = UnsafeMutablePointer<Sample>.alloc(count)
+        var generator = SyntheticSignal(shape: .Sine(period: 1000))
+        generator.fill(samples, count: count)
+        let listener = CountingTriggerListener()
+        let blockSize = CONFIG_DECODER_PACKET_SIZE / CONFIG_INCOMING_SAMPLE_SIZE_IN_BYTES
+        var trigger:EdgeTrigger! = nil
+        
+        record(Benchmark.run("edgeTrigger.processBlock", unit: "sample", unitsPerIteration: count, setup: {
+            trigger = EdgeTrigger(slope: .Rising, triggerLevel: 0.0, hysteresis: 0.1, autoLevel: false, notifications: listener)
+        }, body: {
+            var offset = 0
+            while ( offset < count ) {
+                let n = min(blockSize, count - offset)
+                trigger.processBlock(UnsafeBufferPointer<Sample>(start: samples + offset, count: n))
+                offset += n
+            }
+        }))
+        XCTAssertGreaterThan(listener.eventCount, 0)
+        samples.dealloc(count)
+    }
+    
+    // a square wave with a 4-sample period: an event every 4 samples, so the timestamp list fills up to a second's worth
+    // (25000) and then culls on every event.  that's the recordTimestamp path at its worst.
+    func testTriggerTimestampsAtHighEventRate() {
+        let count = 400000
+        let period = 4
+        let samples = UnsafeMutablePointer<Sample>.alloc(count)
+        var generator = SyntheticSignal(shape: .Square(period: period))
+        generator.fill(samples, count: count)
+        let listener = CountingTriggerListener()
+        let blockSize = CONFIG_DECODER_PACKET_SIZE / CONFIG_INCOMING_SAMPLE_SIZE_IN_BYTES
+        var trigger:EdgeTrigger! = nil
+        
+        record(Benchmark.run("trigger.recordTimestamp.everyFourSamples", unit: "event", unitsPerIteration: count / period, setup: {
+            trigger = EdgeTrigger(slope: .Rising, triggerLevel: 0.0, hysteresis: 0.1, autoLevel: false, notifications: listener)
+        }, body: {
+            var offset = 0
+            while ( offset < count ) {
+                let n = min(blockSize, count - offset)
+                trigger.processBlock(UnsafeBufferPointer<Sample>(start: samples + offset, count: n))
+                offset += n
+            }
+        }))
+        XCTAssertLessThanOrEqual(trigger.eventTimestamps.count, CONFIG_SAMPLERATE / period + 1)
+        samples.dealloc(count)
+    }
+}
@@ -0,0 +1,256 @@
+//
+//  ProtocolDecoderTests.swift
+//  432ScopeTests
+//
+//  Created by Nicholas Cordle on 6/14/16.
+//
+//
+
+import XCTest
+@testable import _32Scope
+
+/*
+ The bus state machines in ProtocolDecoder.swift, fed levels straight in: known frames, with the bytes, starts, stops
+ and errors they ought to come out as.
+ 
+ -each test also runs the same levels through in small uneven pieces, since the stage hands the machines whatever's
+  committed, and a frame split across two blocks has to come out the same.
+*/
+
+class ProtocolDecoderTests: XCTestCase {
+    
+    //
+    // PLUMBING
+    //
+    
+    // runs lines (all the same length) through machine, chunk samples at a time, and returns what came out.
+    private func decode( machine:SerialStateMachine, lines:[[UInt8]], chunk:Int? = nil ) -> [DecodedItem] {
+        let count = lines[0].count
+        let pointers = lines.map({ line -> UnsafeMutablePointer<UInt8> in
+            let p = UnsafeMutablePointer<UInt8>.alloc(count)
+            p.initializeFrom(line)
+            return p
+        })
+        let step = chunk ?? count
+        var done = 0
+        while ( done < count ) {
+            let n = min(step, count - done)
+            machine.decode(UInt(done), count: n, lines: pointers.map({ UnsafePointer<UInt8>($0 + done) }))
+            done += n
+        }
+        for p in pointers {
+            p.dealloc(count)
+        }
+        let rval = machine.output
+        machine.output.removeAll()
+        return rval
+    }
+    
+    // whole and in pieces, which have to agree.
+    private func decodeBothWays( makeMachine:() -> SerialStateMachine, lines:[[UInt8]] ) -> [DecodedItem] {
+        let whole = decode(makeMachine(), lines: lines)
+        let pieces = decode(makeMachine(), lines: lines, chunk: 7)
+        XCTAssertEqual(whole.map({ $0.text }), pieces.map({ $0.text }))
+        XCTAssertEqual(whole.map({ $0.firstSampleIndex }), pieces.map({ $0.firstSampleIndex }))
+        return whole
+    }
+    
+    private func repeated( level:UInt8, _ count:Int ) -> [UInt8] {
+        return [UInt8](count: count, repeatedValue: level)
+    }
+    
+    //
+    // UART
+    //
+    
+    // idle, then each byte as a start bit, 8 data bits LSB first, maybe a parity bit, one stop bit, then idle again.
+    private func uartLine( bytes:[Int], samplesPerBit:Int, parityBit:((Int) -> UInt8)? = nil, stopLevel:UInt8 = 1 ) -> [UInt8] {
+        var line = repeated(1, 3 * samplesPerBit)
+        for byte in bytes {
+            line += repeated(0, samplesPerBit)
+            for b in 0..<8 {
+                line += repeated(UInt8((byte >> b) & 1), samplesPerBit)
+            }
+            if let parity = parityBit {
+                line += repeated(parity(byte), samplesPerBit)
+            }
+            line += repeated(stopLevel, samplesPerBit)
+            line += repeated(1, 2 * samplesPerBit)
+        }
+        return line
+    }
+    
+    func testUARTBytes() {
+        let items = decodeBothWays({ UARTStateMachine(samplesPerBit: 10, dataBits: 8, parity: .None, stopBits: 1, inverted: false) },
+                                   lines: [uartLine([0x55, 0xA3, 0x00], samplesPerBit: 10)])
+        XCTAssertEqual(items.map({ $0.kind }), [.Data, .Data, .Data])
+        XCTAssertEqual(items.map({ $0.value }), [0x55, 0xA3, 0x00])
+        XCTAssertEqual(items.first?.text, "0x55 'U'")
+        // each frame starts at its start bit's falling edge: 3 bits of idle, then 12 bits a frame.
+        XCTAssertEqual(items.map({ $0.firstSampleIndex }), [30, 150, 270])
+    }
+    
+    func testUARTFramingError() {
+        let items = decodeBothWays({ UARTStateMachine(samplesPerBit: 10, dataBits: 8, parity: .None, stopBits: 1, inverted: false) },
+                                   lines: [uartLine([0x41], samplesPerBit: 10, stopLevel: 0)])
+        XCTAssertEqual(items.count, 1)
+        XCTAssertEqual(items.first?.kind, .Error)
+        XCTAssertEqual(items.first?.value, 0x41)
+        XCTAssertEqual(items.first?.text, "0x41 'A' framing error")
+    }
+    
+    func testUARTParity() {
+        let ones = { (byte:Int) -> Int in (0..<8).reduce(0, combine: { $0 + ((byte >> $1) & 1) }) }
+        let even = { (byte:Int) -> UInt8 in UInt8(ones(byte) % 2) }
+        let wrong = { (byte:Int) -> UInt8 in 1 - even(byte) }
+        let good = decodeBothWays({ UARTStateMachine(samplesPerBit: 10, dataBits: 8, parity: .Even, stopBits: 1, inverted: false) },
+                                  lines: [uartLine([0x07, 0x30], samplesPerBit: 10, parityBit: even)])
+        XCTAssertEqual(good.map({ $0.kind }), [.Data, .Data])
+        XCTAssertEqual(good.map({ $0.value }), [0x07, 0x30])
+        
+        let bad = decodeBothWays({ UARTStateMachine(samplesPerBit: 10, dataBits: 8, parity: .Even, stopBits: 1, inverted: false) },
+                                 lines: [uartLine([0x07], samplesPerBit: 10, parityBit: wrong)])
+        XCTAssertEqual(bad.map({ $0.kind }), [.Error])
+        XCTAssertEqual(bad.first?.text, "0x07 parity error")
+    }
+    
+    func testUARTIgnoresGlitch() {
+        // a low blip shorter than half a bit isn't a start bit.
+        var line = repeated(1, 30)
+        line += repeated(0, 3)
+        line += repeated(1, 30)
+        let items = decodeBothWays({ UARTStateMachine(samplesPerBit: 10, dataBits: 8, parity: .None, stopBits: 1, inverted: false) },
+                                   lines: [line])
+        XCTAssertTrue(items.isEmpty)
+    }
+    
+    //
+    // SPI
+    //
+    
+    // mode 0 (clock idles low, data sampled on the rising edge), MSB first, with select low around words.  select
+    // goes up between words.  bitsInLast cuts the last word short.
+    private func spiLines( words:[Int], bitsInLast:Int = 8 ) -> [[UInt8]] {
+        var clock = repeated(0, 4)
+        var data = repeated(0, 4)
+        var select = repeated(1, 4)
+        for (w, word) in words.enumerate() {
+            let bits = (w == words.count - 1) ? bitsInLast : 8
+            for b in 0..<bits {
+                let level = UInt8((word >> (7 - b)) & 1)
+                clock += repeated(0, 2) + repeated(1, 2)
+                data += repeated(level, 4)
+                select += repeated(0, 4)
+            }
+            clock += repeated(0, 6)
+            data += repeated(0, 6)
+            select += repeated(0, 2) + repeated(1, 4)
+        }
+        return [clock, data, select]
+    }
+    
+    func testSPIWords() {
+        let items = decodeBothWays({ SPIStateMachine(mode: 0, bitsPerWord: 8, lsbFirst: false, hasSelect: true) },
+                                   lines: spiLines([0xA5, 0x3C, 0xFF]))
+        XCTAssertEqual(items.map({ $0.kind }), [.Data, .Data, .Data])
+        XCTAssertEqual(items.map({ $0.value }), [0xA5, 0x3C, 0xFF])
+        XCTAssertEqual(items.map({ $0.text }), ["0xA5", "0x3C", "0xFF"])
+    }
+    
+    func testSPIPartialWord() {
+        let items = decodeBothWays({ SPIStateMachine(mode: 0, bitsPerWord: 8, lsbFirst: false, hasSelect: true) },
+                                   lines: spiLines([0x81, 0xB0], bitsInLast: 5))
+        XCTAssertEqual(items.map({ $0.kind }), [.Data, .Error])
+        XCTAssertEqual(items.first?.value, 0x81)
+        // the top 5 bits of 0xB0, MSB first.
+        XCTAssertEqual(items.last?.value, 0x16)
+        XCTAssertEqual(items.last?.text, "partial word (5 bits)")
+    }
+    
+    //
+    // I2C
+    //
+    
+    // SCL and SDA, built up a condition or a bit at a time.
+    private struct I2CBus {
+        var scl:[UInt8] = [1, 1, 1, 1]
+        var sda:[UInt8] = [1, 1, 1, 1]
+        
+        private mutating func hold( clock:UInt8, data:UInt8, count:Int = 2 ) {
+            scl += [UInt8](count: count, repeatedValue: clock)
+            sda += [UInt8](count: count, repeatedValue: data)
+        }
+        
+        // SDA falls with SCL high.  works as a repeated start too, from anywhere.
+        mutating func start() {
+            hold(0, data: 1)
+            hold(1, data: 1)
+            hold(1, data: 0)
+        }
+        
+        // SDA rises with SCL high.
+        mutating func stop() {
+            hold(0, data: 0)
+            hold(1, data: 0)
+            hold(1, data: 1)
+        }
+        
+        // MSB first, then the ninth bit: ACK is SDA low.
+        mutating func byte( value:Int, ack:Bool ) {
+            for b in 0..<8 {
+                let level = UInt8((value >> (7 - b)) & 1)
+                hold(0, data: level)
+                hold(1, data: level)
+            }
+            hold(0, data: ack ? 0 : 1)
+            hold(1, data: ack ? 0 : 1)
+            hold(0, data: ack ? 0 : 1)
+        }
+        
+        var lines:[[UInt8]] {
+            return [scl, sda]
+        }
+    }
+    
+    func testI2CWrite() {
+        var bus = I2CBus()
+        bus.start()
+        bus.byte(0x50 << 1, ack: true)     // address 0x50, write
+        bus.byte(0x3C, ack: true)
+        bus.byte(0xFF, ack: false)
+        bus.stop()
+        let items = decodeBothWays({ I2CStateMachine() }, lines: bus.lines)
+        XCTAssertEqual(items.map({ $0.kind }), [.Start, .Address, .Data, .Data, .Stop])
+        XCTAssertEqual(items.map({ $0.text }), ["S", "W 0x50", "0x3C", "0xFF NACK", "P"])
+        XCTAssertEqual(items[1].value, 0x50)
+    }
+    
+    func testI2CRepeatedStartRead() {
+        var bus = I2CBus()
+        bus.start()
+        bus.byte(0x1D << 1, ack: true)
+        bus.byte(0x0F, ack: true)
+        bus.start()
+        bus.byte((0x1D << 1) | 1, ack: true)
+        bus.byte(0x2A, ack: false)
+        bus.stop()
+        let items = decodeBothWays({ I2CStateMachine() }, lines: bus.lines)
+        XCTAssertEqual(items.map({ $0.text }), ["S", "W 0x1D", "0x0F", "S", "R 0x1D", "0x2A NACK", "P"])
+    }
+    
+    func testI2CCutShort() {
+        var bus = I2CBus()
+        bus.start()
+        bus.byte(0x50 << 1, ack: true)
+        // four bits of a byte, then a stop in the middle of it.
+        for _ in 0..<4 {
+            bus.hold(0, data: 1)
+            bus.hold(1, data: 1)
+        }
+        bus.stop()
+        let items = decodeBothWays({ I2CStateMachine() }, lines: bus.lines)
+        XCTAssertEqual(items.map({ $0.kind }), [.Start, .Address, .Error, .Stop])
+        // the stop's own SCL rise makes it five.
+        XCTAssertEqual(items[2].text, "cut short (5 bits)")
+    }
+}
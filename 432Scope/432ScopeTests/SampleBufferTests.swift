@@ -0,0 +1,127 @@
+//
+//  SampleBufferTests.swift
+//  432ScopeTests
+//
+//  Created by Nicholas Cordle on 6/14/16.
+//
+//
+
+import XCTest
+@testable import _32Scope
+
+/*
+ The clear watermark in SampleBuffer: clearAllSamples doesn't touch the ring, it just says everything older than now
+ reads as clearValue.  so every read path has to honour it, including when the ring has wrapped (the watermark and
+ the array's end are in different places), and samples committed after a clear have to show up like any others.
+ 
+ -the ring keeps 16 bits a sample, so values outside the ADC's range (a filter's overshoot) have to come back pinned
+  to the rail they went past, not wrapped.
+*/
+
+class SampleBufferTests: XCTestCase {
+    
+    let capacity = 100
+    let clearValue:Sample = 7
+    
+    private func store( buffer:SampleBuffer, _ values:[Sample] ) {
+        values.withUnsafeBufferPointer({ buffer.storeNewSamples($0) })
+    }
+    
+    private func copy( buffer:SampleBuffer, firstSampleIndex:UInt, count:Int ) -> [Sample] {
+        var rval = [Sample](count: count, repeatedValue: -1)
+        buffer.copySamples(firstSampleIndex, count: count, destination: &rval)
+        return rval
+    }
+    
+    // a Time that's age whole samples back, for getSampleAtTime.  the half keeps asSampleIndex's floor off the edge.
+    private func ageAsTime( age:Int ) -> Time {
+        return (Time(age) + 0.5) * CONFIG_SAMPLEPERIOD
+    }
+    
+    func testClearedSamplesReadAsClearValue() {
+        let buffer = SampleBuffer(capacity: capacity, clearValue: 0)
+        store(buffer, (0..<60).map({ 1000 + $0 }))
+        buffer.clearAllSamples(clearValue)
+        
+        XCTAssertEqual(buffer.clearCount, 1)
+        XCTAssertEqual(buffer.validSampleCount, 0)
+        XCTAssertEqual(copy(buffer, firstSampleIndex: 0, count: 60), [Sample](count: 60, repeatedValue: clearValue))
+        XCTAssertEqual(buffer.getMinMax(0, count: 60).min, clearValue)
+        XCTAssertEqual(buffer.getMinMax(0, count: 60).max, clearValue)
+        XCTAssertEqual(buffer.getNewestSample(), clearValue)
+        XCTAssertEqual(buffer.getSampleAtTime(ageAsTime(0)), clearValue)
+        XCTAssertEqual(buffer.getSampleAtTime(ageAsTime(30)), clearValue)
+    }
+    
+    func testClearAcrossWraparound() {
+        let buffer = SampleBuffer(capacity: capacity, clearValue: 0)
+        // 290 in: the ring's been round almost three times, and the next sample goes near the array's end.
+        store(buffer, (0..<290).map({ 1000 + $0 }))
+        buffer.clearAllSamples(clearValue)
+        XCTAssertEqual(buffer.validFromSampleIndex, 290)
+        
+        // 30 new ones, which wrap past the array's start on their way in.
+        let fresh = (0..<30).map({ 3000 + $0 })
+        store(buffer, fresh)
+        XCTAssertEqual(buffer.committedSampleCount, 320)
+        XCTAssertEqual(buffer.validSampleCount, 30)
+        
+        // the whole ring: 70 cleared, then the new ones in order.
+        let expected = [Sample](count: 70, repeatedValue: clearValue) + fresh
+        XCTAssertEqual(copy(buffer, firstSampleIndex: 220, count: capacity), expected)
+        
+        // straddling the watermark, from the old side.
+        XCTAssertEqual(copy(buffer, firstSampleIndex: 285, count: 10), [Sample](count: 5, repeatedValue: clearValue) + Array(fresh[0..<5]))
+        
+        let both = buffer.getMinMax(220, count: capacity)
+        XCTAssertEqual(both.min, clearValue)
+        XCTAssertEqual(both.max, 3029)
+        let newOnly = buffer.getMinMax(290, count: 30)
+        XCTAssertEqual(newOnly.min, 3000)
+        XCTAssertEqual(newOnly.max, 3029)
+        
+        XCTAssertEqual(buffer.getNewestSample(), 3029)
+        XCTAssertEqual(buffer.getSampleAtTime(ageAsTime(0)), 3029)
+        XCTAssertEqual(buffer.getSampleAtTime(ageAsTime(29)), 3000)
+        XCTAssertEqual(buffer.getSampleAtTime(ageAsTime(30)), clearValue)
+        XCTAssertEqual(buffer.getSampleAtTime(ageAsTime(99)), clearValue)
+    }
+    
+    func testCommitsAfterClearAreVisible() {
+        let buffer = SampleBuffer(capacity: capacity, clearValue: 0)
+        store(buffer, (0..<40).map({ 1000 + $0 }))
+        buffer.clearAllSamples(clearValue)
+        
+        buffer.storeNewSample(2000)
+        XCTAssertEqual(buffer.validSampleCount, 1)
+        XCTAssertEqual(buffer.getNewestSample(), 2000)
+        XCTAssertEqual(copy(buffer, firstSampleIndex: 39, count: 2), [clearValue, 2000])
+        
+        // cleared again, with a different value: the last clear's value is the one that counts.
+        buffer.clearAllSamples(9)
+        XCTAssertEqual(buffer.clearCount, 2)
+        XCTAssertEqual(copy(buffer, firstSampleIndex: 39, count: 2), [9, 9])
+        
+        // and enough afterwards to push the whole ring past the watermark: nothing reads as cleared any more.
+        let fresh = (0..<capacity).map({ 4000 + $0 })
+        store(buffer, fresh)
+        XCTAssertEqual(buffer.validSampleCount, capacity)
+        XCTAssertEqual(copy(buffer, firstSampleIndex: buffer.committedSampleCount - UInt(capacity), count: capacity), fresh)
+        XCTAssertEqual(buffer.getMinMax(Int(buffer.committedSampleCount) - capacity, count: capacity).min, 4000)
+    }
+    
+    func testOutOfRangeSamplesArePinnedToTheRails() {
+        let buffer = SampleBuffer(capacity: capacity, clearValue: 0)
+        let top = CONFIG_SAMPLE_MAX_VALUE
+        store(buffer, [-3, -1, -70000, top + 1, 65533, 70000, 0, top, 1234])
+        XCTAssertEqual(copy(buffer, firstSampleIndex: 0, count: 9), [0, 0, 0, top, top, top, 0, top, 1234])
+        
+        buffer.storeNewSample(-5)
+        buffer.storeNewSample(65536 + 12)
+        XCTAssertEqual(copy(buffer, firstSampleIndex: 9, count: 2), [0, top])
+        
+        let extremes = buffer.getMinMax(0, count: 11)
+        XCTAssertEqual(extremes.min, 0)
+        XCTAssertEqual(extremes.max, top)
+    }
+}
@@ -0,0 +1,145 @@
+//
+//  WaveformSearchTests.swift
+//  432ScopeTests
+//
+//  Created by Nicholas Cordle on 6/14/16.
+//
+//
+
+import XCTest
+@testable import _32Scope
+
+/*
+ The min/max summary is only allowed to make WaveformSearch quicker, never to change what it finds.  so every search
+ here runs twice on the same buffer, once with the summary and once without (every chunk scanned), and the hits have
+ to come out identical.  edges also get checked against a plain one-sample-at-a-time loop.
+ 
+ -the signal sits low most of the time, so the summary gets to skip most chunks, with pulses, a runt and a burst of
+  chatter put right across summary chunk boundaries, inside a chunk, filling one, and on a chunk's last sample.
+*/
+
+class WaveformSearchTests: XCTestCase {
+    
+    let chunk = CONFIG_SEARCH_SUMMARY_CHUNK
+    let hysteresis:Voltage = 0.05
+    
+    private var buffer:SampleBuffer! = nil
+    private var summary:MinMaxSummary! = nil
+    private var signal:[Sample] = []
+    
+    override func setUp() {
+        super.setUp()
+        let low = Voltage(-1.0).asSample()
+        let high = Voltage(2.0).asSample()
+        signal = [Sample](count: chunk * 200, repeatedValue: low)
+        
+        // pulses, as [start, end)
+        let pulses = [
+            (5000, 5020),                           // older than CONFIG_SEARCH_OLDEST_MARGIN, so never searched
+            (chunk * 60 - 3, chunk * 60 + 4),       // across a boundary
+            (chunk * 80 + 10, chunk * 80 + 100),    // inside one chunk
+            (chunk * 100 - 1, chunk * 101 + 1),     // a whole chunk and a bit either side
+            (chunk * 120 + chunk - 1, chunk * 121), // a chunk's last sample
+        ]
+        for (start, end) in pulses {
+            for i in start..<end {
+                signal[i] = high
+            }
+        }
+        // a runt, up into the middle zone and back, across a boundary.
+        for i in (chunk * 140 - 5)..<(chunk * 140 + 5) {
+            signal[i] = Voltage(0.3).asSample()
+        }
+        // chatter that never gets near a level.
+        for i in (chunk * 150)..<(chunk * 160) {
+            signal[i] = Voltage(-1.0 + 0.2 * sin(Double(i))).asSample()
+        }
+        // chatter right through the level, across a boundary: an edge every sample.
+        for i in (chunk * 170 - 20)..<(chunk * 170 + 20) {
+            signal[i] = Voltage(i % 2 == 0 ? 0.2 : 0.8).asSample()
+        }
+        
+        buffer = SampleBuffer(capacity: chunk * 256, clearValue: low)
+        summary = MinMaxSummary(sampleBuffer: buffer, chunkSize: chunk)
+        buffer.addReader(summary)
+        // in odd-sized blocks, so the summary's chunks get finished part way through them.
+        var written = 0
+        signal.withUnsafeBufferPointer({ samples in
+            while ( written < samples.count ) {
+                let count = min(1000, samples.count - written)
+                self.buffer.storeNewSamples(UnsafeBufferPointer<Sample>(start: samples.baseAddress + written, count: count))
+                written += count
+            }
+        })
+    }
+    
+    override func tearDown() {
+        buffer.removeReader(summary)
+        summary = nil
+        buffer = nil
+        super.tearDown()
+    }
+    
+    private func searchBothWays( criterion:SearchCriterion ) -> (summarized:SearchResult, scanned:SearchResult) {
+        let summarized = WaveformSearch.search(buffer, summary: summary, decoder: nil, criterion: criterion, hysteresis: hysteresis, maximumHits: CONFIG_SEARCH_MAX_HITS)
+        let scanned = WaveformSearch.search(buffer, summary: nil, decoder: nil, criterion: criterion, hysteresis: hysteresis, maximumHits: CONFIG_SEARCH_MAX_HITS)
+        XCTAssertEqual(summarized.hits.map({ $0.firstSampleIndex }), scanned.hits.map({ $0.firstSampleIndex }), criterion.description)
+        XCTAssertEqual(summarized.hits.map({ $0.lastSampleIndex }), scanned.hits.map({ $0.lastSampleIndex }), criterion.description)
+        XCTAssertEqual(summarized.hits.map({ $0.text }), scanned.hits.map({ $0.text }), criterion.description)
+        XCTAssertEqual(scanned.skippedSampleCount, 0)
+        return (summarized: summarized, scanned: scanned)
+    }
+    
+    // the summary has to have been used, or none of this proves anything.
+    func testSummaryGetsUsed() {
+        // snapshot waits for the summary to finish with what's been written.
+        let snapshot = summary.snapshot(0, endChunk: UInt(signal.count / chunk))
+        XCTAssertEqual(snapshot.validEnd, UInt(signal.count / chunk))
+        let result = searchBothWays(.Edge(level: 0.5, rising: true))
+        XCTAssertGreaterThan(result.summarized.skippedSampleCount, result.summarized.scannedSampleCount)
+    }
+    
+    func testEdgesMatchPlainLoop() {
+        for rising in [true, false] {
+            let result = searchBothWays(.Edge(level: 0.5, rising: rising))
+            
+            // one sample at a time from the oldest searchable sample, same hysteresis.
+            let low = (0.5 - 0.5 * hysteresis).asSample()
+            let high = (0.5 + 0.5 * hysteresis).asSample()
+            var expected:[UInt] = []
+            var state = 0
+            for i in CONFIG_SEARCH_OLDEST_MARGIN.asSampleIndex()..<signal.count {
+                let s = signal[i]
+                if ( state != 1 && s > high ) {
+                    if ( state == -1 && rising ) {
+                        expected.append(UInt(i))
+                    }
+                    state = 1
+                } else if ( state != -1 && s < low ) {
+                    if ( state == 1 && !rising ) {
+                        expected.append(UInt(i))
+                    }
+                    state = -1
+                }
+            }
+            XCTAssertEqual(result.summarized.hits.map({ $0.firstSampleIndex }), expected)
+            XCTAssertGreaterThan(expected.count, 20)
+        }
+    }
+    
+    func testPulses() {
+        let all = searchBothWays(.Pulse(level: 0.5, positive: true, narrowerThan: nil, widerThan: nil))
+        XCTAssertEqual(Array(all.summarized.hits.prefix(4)).map({ $0.firstSampleIndex }),
+                       [UInt(chunk * 60 - 3), UInt(chunk * 80 + 10), UInt(chunk * 100 - 1), UInt(chunk * 120 + chunk - 1)])
+        searchBothWays(.Pulse(level: 0.5, positive: true, narrowerThan: 10 * CONFIG_SAMPLEPERIOD, widerThan: nil))
+        searchBothWays(.Pulse(level: 0.5, positive: false, narrowerThan: nil, widerThan: 100 * CONFIG_SAMPLEPERIOD))
+    }
+    
+    func testRuntsAndWindows() {
+        let runts = searchBothWays(.Runt(low: 0.0, high: 1.0, positive: true))
+        XCTAssertEqual(runts.summarized.hits.first?.firstSampleIndex, UInt(chunk * 140 - 5))
+        searchBothWays(.Runt(low: 0.0, high: 1.0, positive: false))
+        let outside = searchBothWays(.OutsideWindow(low: -1.5, high: 1.5))
+        XCTAssertEqual(outside.summarized.hits.count, 4)
+    }
+}
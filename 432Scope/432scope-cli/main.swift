@@ -0,0 +1,322 @@
+//
+//  main.swift
+//  432scope-cli
+//
+//  Created by Nicholas Cordle on 6/10/16.
+//
+//
+
+import Foundation
+#if os(Linux)
+import Glibc
+#else
+import Darwin
+#endif
+
+/*
+ The scope with no scope view.  Opens a 432 (or a file), streams it through the same signal chain the app uses, and
+ triggers, measures and records without any UI.  For unattended captures, for servers, and for wherever Cocoa isn't.
+ 
+ BIG PICTURE:
+ 
+ -source -> Decoder -> SampleBuffer -> readers, exactly like a Channel.  the readers are whichever of TriggerStage,
+  MeasurementEngine, Recorder and StreamPublisher the options ask for.
+ -once a second, a status line goes to stdout.
+ -it runs until --duration is up, the file runs out, or ^C.  all three shut down the same way, so recordings get closed properly.
+*/
+
+let usage = "usage: 432scope-cli <device or file> [options]\n" +
+    "  <device or file>       a 432's serial device (/dev/...), a .432rec recording, or a raw 16-bit sample dump\n" +
+    "  --trigger <volts|auto> rising-edge trigger at this level, and count the events\n" +
+    "  --filter <depth>       trigger filter depth, as a power of two (default 4)\n" +
+    "  --record <directory>   record to <directory>/432scope-<time>.432rec and .432idx\n" +
+    "  --duration <seconds>   stop after this long\n" +
+    "  --measure              print measurements with the status line\n" +
+    "  --fast                 files only: read as fast as possible instead of in real time\n" +
+    "  --stats <file>         write the pipeline stage stats here as JSON, now and then and at the end (needs -DINSTRUMENTATION)\n" +
+    "  --serve <socket>       stream samples, trigger events and telemetry to other processes on this Unix-domain socket\n"
+
+@noreturn func fail( message:String ) {
+    fputs(message + "\n", stderr)
+    exit(1)
+}
+
+//
+// OPTIONS
+//
+
+struct Options {
+    var path:String? = nil
+    var triggerLevel:Voltage? = nil
+    var triggerAutoLevel:Bool = false
+    var triggerFilterDepth:UInt = 4
+    var recordDirectory:String? = nil
+    var duration:Time? = nil
+    var measure:Bool = false
+    var fast:Bool = false
+    var statsFile:String? = nil
+    var socketPath:String? = nil
+}
+
+func parseOptions( arguments:[String] ) -> Options {
+    var options = Options()
+    var i = 0
+    
+    func value( name:String ) -> String {
+        i += 1
+        if ( i >= arguments.count ) {
+            fail("\(name) needs a value.\n" + usage)
+        }
+        return arguments[i]
+    }
+    
+    while ( i < arguments.count ) {
+        let argument = arguments[i]
+        switch (argument) {
+        case "--trigger":
+            let level = value(argument)
+            if ( level == "auto" ) {
+                options.triggerAutoLevel = true
+                options.triggerLevel = 0
+            } else if let volts = Double(level) {
+                options.triggerLevel = Voltage(volts)
+            } else {
+                fail("--trigger wants volts or \"auto\", not \(level).")
+            }
+        case "--filter":
+            guard let depth = UInt(value(argument)) else {
+                fail("--filter wants a whole number.")
+            }
+            options.triggerFilterDepth = depth
+        case "--record":
+            options.recordDirectory = value(argument)
+        case "--duration":
+            guard let seconds = Double(value(argument)) where seconds > 0 else {
+                fail("--duration wants a positive number of seconds.")
+            }
+            options.duration = Time(seconds)
+        case "--measure":
+            options.measure = true
+        case "--fast":
+            options.fast = true
+        case "--stats":
+            options.statsFile = value(argument)
+        case "--serve":
+            options.socketPath = value(argument)
+        case "-h", "--help":
+            print(usage)
+            exit(0)
+        default:
+            if ( argument.hasPrefix("-") || options.path != nil ) {
+                fail("don't know what to do with \(argument).\n" + usage)
+            }
+            options.path = argument
+        }
+        i += 1
+    }
+    if ( options.path == nil ) {
+        fail(usage)
+    }
+    return options
+}
+
+//
+// THE CAPTURE
+//
+
+class HeadlessCapture: TriggerNotifications {
+    
+    let options:Options
+    let sampleBuffer:SampleBuffer
+    let decoder:Decoder
+    private(set) var source:SampleSource? = nil
+    private(set) var triggerStage:TriggerStage? = nil
+    private(set) var measurementEngine:MeasurementEngine? = nil
+    private(set) var recorder:Recorder? = nil
+    private(set) var streamServer:StreamServer? = nil
+    private(set) var streamPublisher:StreamPublisher? = nil
+    
+    private var statusTimer:dispatch_source_t? = nil
+    private var startTime = NSDate()
+    private var isShuttingDown:Bool = false
+    
+    init( options:Options ) throws {
+        self.options = options
+        sampleBuffer = SampleBuffer(capacity: CONFIG_SAMPLERATE * CONFIG_BUFFER_LENGTH, clearValue: Voltage(0.0).asSample())
+        decoder = Decoder(sampleBuffer: sampleBuffer)
+        
+        // the stream server sends telemetry from the measurement engine, so it wants one too.
+        if ( options.measure || options.socketPath != nil ) {
+            measurementEngine = MeasurementEngine(sampleBuffer: sampleBuffer)
+            sampleBuffer.addReader(measurementEngine!)
+        }
+        if let level = options.triggerLevel {
+            let trigger = RisingEdgeTrigger(triggerLevel: level, autoLevel: options.triggerAutoLevel, filterDepth: options.triggerFilterDepth, notifications: self)
+            triggerStage = TriggerStage(trigger: trigger, sampleBuffer: sampleBuffer)
+            sampleBuffer.addReader(triggerStage!)
+        }
+        
+        // devices are anything under /dev.  everything else is a file.
+        let path = options.path!
+        if ( path.hasPrefix("/dev/") ) {
+            #if os(Linux)
+            let transceiver = try LinuxTransceiver(deviceFilePath: path, decoder: decoder)
+            transceiver.failureHandler = { error in
+                dispatch_async( dispatch_get_main_queue(), {
+                    print("\(error)")
+                    self.shutDown(1)
+                })
+            }
+            source = transceiver
+            #else
+            source = try Transceiver(deviceFilePath: path, decoder: decoder)
+            #endif
+        } else {
+            let fileSource = try FileSampleSource(fileURL: NSURL(fileURLWithPath: path), decoder: decoder, realTime: !options.fast)
+            fileSource.endOfFileHandler = {
+                dispatch_async( dispatch_get_main_queue(), {
+                    print("end of \(path).")
+                    self.shutDown(0)
+                })
+            }
+            source = fileSource
+        }
+        
+        if let directory = options.recordDirectory {
+            let formatter = NSDateFormatter()
+            formatter.dateFormat = "yyyyMMdd-HHmmss"
+            let baseName = "432scope-" + formatter.stringFromDate(NSDate())
+            recorder = try Recorder(sampleBuffer: sampleBuffer, channelNumber: 0, deviceName: path, directory: NSURL(fileURLWithPath: directory), baseName: baseName)
+            sampleBuffer.addReader(recorder!)
+            print("recording to \(recorder!.dataFileURL.path!)")
+        }
+        
+        if let socketPath = options.socketPath {
+            let server = try StreamServer(socketPath: socketPath)
+            let publisher = StreamPublisher(server: server, sampleBuffer: sampleBuffer, channelNumber: 0, channelName: path, measurementEngine: measurementEngine)
+            sampleBuffer.addReader(publisher)
+            server.addPublisher(publisher)
+            triggerStage?.setEventTap(publisher.publishTriggerEvent)
+            streamServer = server
+            streamPublisher = publisher
+            print("serving on \(socketPath)")
+        }
+    }
+    
+    func start( ) throws {
+        source!.flush()
+        try source!.startStreaming()
+        startTime = NSDate()
+        print("streaming from \(source!.sourceName)")
+        
+        statusTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, dispatch_get_main_queue())
+        dispatch_source_set_timer(statusTimer!, dispatch_time(DISPATCH_TIME_NOW, Int64(NSEC_PER_SEC)), NSEC_PER_SEC, NSEC_PER_SEC / 10)
+        dispatch_source_set_event_handler(statusTimer!, {
+            self.printStatus()
+            if let duration = self.options.duration where Time(NSDate().timeIntervalSinceDate(self.startTime)) >= duration {
+                self.shutDown(0)
+            }
+        })
+        dispatch_resume(statusTimer!)
+        
+        if let statsFile = options.statsFile {
+            Instrumentation.startPeriodicDump(CONFIG_INSTRUMENTATION_DUMP_INTERVAL ?? 10, fileURL: NSURL(fileURLWithPath: statsFile))
+        }
+    }
+    
+    // TriggerStage hands these over on the main queue, newest one per block.  the status line counts them all itself.
+    func triggerEventDetected( event:TriggerEvent ) {
+    }
+    
+    private func printStatus( ) {
+        let elapsed = NSDate().timeIntervalSinceDate(startTime)
+        var line = String(format: "%7.1fs  %10lu samples", elapsed, sampleBuffer.committedSampleCount)
+        if let stage = triggerStage {
+            line += "  \(stage.getEventCount()) triggers"
+        }
+        if let server = streamServer {
+            line += "  \(server.subscriberCount) subscribers"
+        }
+        if let measurements = options.measure ? measurementEngine?.getMeasurements() : nil {
+            line += String(format: "  mean %.3fV  rms %.3fV  p-p %.3fV", measurements.mean, measurements.rms, measurements.peakToPeak)
+            if let frequency = measurements.frequency {
+                line += String(format: "  %.1fHz", frequency)
+            }
+            if let duty = measurements.dutyCycle {
+                line += String(format: "  duty %.1f%%", duty * 100)
+            }
+        }
+        print(line)
+    }
+    
+    // main queue.  stop the source, one last status line, close the recording properly, and go.
+    func shutDown( status:Int32 ) {
+        if ( isShuttingDown ) {
+            return
+        }
+        isShuttingDown = true
+        if let timer = statusTimer {
+            dispatch_source_cancel(timer)
+        }
+        // a source that's already failed can't stop, but it still has to close.
+        do {
+            try source?.stopStreaming()
+        } catch let msg {
+            print("couldn't stop the source: \(msg)")
+        }
+        do {
+            try source?.close()
+        } catch let msg {
+            print("couldn't close the source: \(msg)")
+        }
+        
+        printStatus()
+        if let statsFile = options.statsFile {
+            Instrumentation.stopPeriodicDump()
+            let snapshots = Instrumentation.snapshot()
+            print(Instrumentation.summary(snapshots))
+            Instrumentation.jsonData(snapshots)?.writeToFile(statsFile, atomically: true)
+        }
+        if let publisher = streamPublisher {
+            sampleBuffer.removeReader(publisher)
+            streamServer?.close()
+        }
+        if let oldRecorder = recorder {
+            sampleBuffer.removeReader(oldRecorder)
+            oldRecorder.finish()
+            if ( !oldRecorder.waitUntilFinished(10) ) {
+                print("the recording didn't finish writing in time.  it may be short.")
+            }
+        }
+        exit(status)
+    }
+}
+
+//
+// MAIN
+//
+
+let options = parseOptions(Array(Process.arguments.dropFirst()))
+
+let capture:HeadlessCapture
+do {
+    capture = try HeadlessCapture(options: options)
+    try capture.start()
+} catch let msg {
+    fail("couldn't start: \(msg)")
+}
+
+// ^C and friends get a proper shutdown.  the default handlers have to be off for dispatch to see them.
+var signalSources:[dispatch_source_t] = []
+for signalNumber in [SIGINT, SIGTERM] {
+    signal(signalNumber, SIG_IGN)
+    let signalSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_SIGNAL, UInt(signalNumber), 0, dispatch_get_main_queue())
+    dispatch_source_set_event_handler(signalSource, {
+        print("")
+        capture.shutDown(0)
+    })
+    dispatch_resume(signalSource)
+    signalSources.append(signalSource)
+}
+
+dispatch_main()